@@ -0,0 +1,268 @@
+// ConfigCompression.h - 設定フレームの圧縮（LZ4 / zstd、ヘッダーのみ）
+//
+// 目的:
+// 全設定の同期（設定要求への返信）と大きな設定更新を、無線・テザー回線で送る量を減らす。
+// 設定の直列化結果は "[SECTION]KEY=" の繰り返しが多いため、既知のセクション名・キー名を
+// 並べた辞書を両側で共有して圧縮率を上げる。
+//
+// ビルドフラグ（どちらも省略可。省略した方式は使えない）:
+//   -DCONFIG_SYNC_WITH_ZSTD -lzstd   （make WITH_ZSTD=1）
+//   -DCONFIG_SYNC_WITH_LZ4  -llz4    （make WITH_LZ4=1）
+//
+// フレーム上の表現（ヘッダーのオプション）:
+//   要求側:   accept=zstd,lz4         … 受け取れる方式（好みの順）
+//   圧縮済み: enc=<方式> raw=<展開後の長さ> dict=<辞書ID>
+// 長さ・CRCは圧縮後の本体に対するもの。
+
+#ifndef CONFIG_COMPRESSION_H
+#define CONFIG_COMPRESSION_H
+
+#include <string>
+#include <sstream>
+#include <cstdint>
+#include <cstdio>
+
+#include "Crc32c.h"
+
+#ifdef CONFIG_SYNC_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef CONFIG_SYNC_WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace config_compression {
+
+enum Codec {
+    NONE = 0,
+    LZ4 = 1,
+    ZSTD = 2,
+};
+
+inline const char* codec_name(Codec codec) {
+    switch (codec) {
+    case LZ4:
+        return "lz4";
+    case ZSTD:
+        return "zstd";
+    default:
+        return "none";
+    }
+}
+
+/**
+ * @brief このビルドで使えるか
+ */
+inline bool is_supported(Codec codec) {
+    switch (codec) {
+#ifdef CONFIG_SYNC_WITH_ZSTD
+    case ZSTD:
+        return true;
+#endif
+#ifdef CONFIG_SYNC_WITH_LZ4
+    case LZ4:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+inline bool parse_codec(const std::string& name, Codec& codec) {
+    if (name == "zstd") {
+        codec = ZSTD;
+    } else if (name == "lz4") {
+        codec = LZ4;
+    } else if (name == "none") {
+        codec = NONE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief このビルドで使える方式の一覧（"zstd,lz4" など、なければ空）
+ */
+inline std::string supported_codecs() {
+    std::string list;
+    for (Codec codec : {ZSTD, LZ4}) {
+        if (is_supported(codec)) {
+            list += (list.empty() ? "" : ",") + std::string(codec_name(codec));
+        }
+    }
+    return list;
+}
+
+/**
+ * @brief 相手の accept= の一覧から、このビルドで使える最初の方式を選ぶ
+ */
+inline Codec choose_codec(const std::string& accept_list) {
+    std::istringstream names(accept_list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        Codec codec;
+        if (parse_codec(name, codec) && codec != NONE && is_supported(codec)) {
+            return codec;
+        }
+    }
+    return NONE;
+}
+
+/**
+ * @brief 両側で共有する辞書（既知のセクション名・キー名を直列化と同じ形式で並べたもの）
+ *
+ * 内容を変えたら辞書IDが変わり、古い相手とは圧縮なしでやり取りすることになる。
+ * よく出る語ほど末尾（圧縮対象に近い位置）に置く。
+ */
+inline const std::string& dictionary() {
+    static const std::string dict = [] {
+        static const char* const sections[][2] = {
+            {"PWM", "PWM_MIN PWM_NEUTRAL PWM_NORMAL_MAX PWM_BOOST_MAX PWM_FREQUENCY"},
+            {"JOYSTICK", "DEADZONE"},
+            {"LED", "CHANNEL ON_VALUE OFF_VALUE"},
+            {"THRUSTER_CONTROL", "SMOOTHING_FACTOR_HORIZONTAL SMOOTHING_FACTOR_VERTICAL KP_ROLL KP_YAW "
+                                 "YAW_THRESHOLD_DPS YAW_GAIN"},
+            {"NETWORK", "RECV_PORT SEND_PORT CLIENT_HOST CONNECTION_TIMEOUT_SECONDS"},
+            {"APPLICATION", "SENSOR_SEND_INTERVAL LOOP_DELAY_US"},
+            {"CONFIG_SYNC", "WPF_HOST WPF_RECV_PORT CPP_RECV_PORT WORKER_THREADS WORKER_QUEUE_DEPTH EVENT_BACKEND "
+                            "CLIENT_IDLE_TIMEOUT_MS CLIENT_FRAME_TIMEOUT_MS CLIENT_MIN_RECV_RATE "
+                            "MAX_CONNECTIONS_PER_IP MAX_FRAME_SIZE SHM_NAME JOURNAL_COMPACT_RECORDS "
+                            "JOURNAL_KEEP_VERSIONS PUSH_COALESCE_MS PUSH_MAX_RATE PUSH_ON_CHANGE "
+                            "REQUIRE_FRAME_CRC COMPRESS_MIN_BYTES COMPRESSION_LEVEL"},
+            {"GSTREAMER_CAMERA_2", "DEVICE PORT WIDTH HEIGHT FRAMERATE_NUM FRAMERATE_DEN IS_H264_NATIVE_SOURCE "
+                                   "RTP_PAYLOAD_TYPE RTP_CONFIG_INTERVAL X264_BITRATE X264_TUNE X264_SPEED_PRESET"},
+            {"GSTREAMER_CAMERA_1", "DEVICE PORT WIDTH HEIGHT FRAMERATE_NUM FRAMERATE_DEN IS_H264_NATIVE_SOURCE "
+                                   "RTP_PAYLOAD_TYPE RTP_CONFIG_INTERVAL"},
+        };
+        std::string text;
+        for (const auto& section : sections) {
+            std::istringstream keys(section[1]);
+            std::string key;
+            while (keys >> key) {
+                text += "[" + std::string(section[0]) + "]" + key + "=\n";
+            }
+        }
+        return text;
+    }();
+    return dict;
+}
+
+/**
+ * @brief 辞書ID（ヘッダーの dict= に入れる。相手と違えば展開しない）
+ */
+inline uint32_t dictionary_id() {
+    static const uint32_t id = crc32c(dictionary().data(), dictionary().size());
+    return id;
+}
+
+/**
+ * @brief 圧縮する
+ * @param out 圧縮結果（呼び出し側のバッファを再利用する。内容は置き換える）
+ * @param level zstdの圧縮レベル（LZ4では使わない）
+ * @return このビルドで使えない方式、または失敗した場合はfalse
+ */
+inline bool compress(Codec codec, const char* data, size_t length, std::string& out, int level = 3) {
+#ifdef CONFIG_SYNC_WITH_ZSTD
+    if (codec == ZSTD) {
+        // 圧縮コンテキストと辞書を取り込んだ状態はスレッドごとに作って使い回す
+        struct Context {
+            ZSTD_CCtx* cctx = ZSTD_createCCtx();
+            ZSTD_CDict* cdict = nullptr;
+            int level = 0;
+            ~Context() {
+                ZSTD_freeCDict(cdict);
+                ZSTD_freeCCtx(cctx);
+            }
+        };
+        thread_local Context context;
+        if (context.cdict == nullptr || context.level != level) {
+            ZSTD_freeCDict(context.cdict);
+            context.cdict = ZSTD_createCDict(dictionary().data(), dictionary().size(), level);
+            context.level = level;
+        }
+        out.resize(ZSTD_compressBound(length));
+        size_t written = ZSTD_compress_usingCDict(context.cctx, &out[0], out.size(), data, length, context.cdict);
+        if (ZSTD_isError(written)) {
+            return false;
+        }
+        out.resize(written);
+        return true;
+    }
+#endif
+#ifdef CONFIG_SYNC_WITH_LZ4
+    if (codec == LZ4) {
+        if (length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+            return false;
+        }
+        struct Context {
+            LZ4_stream_t* stream = LZ4_createStream();
+            ~Context() { LZ4_freeStream(stream); }
+        };
+        thread_local Context context;
+        LZ4_resetStream_fast(context.stream);
+        LZ4_loadDict(context.stream, dictionary().data(), static_cast<int>(dictionary().size()));
+        out.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(length))));
+        int written = LZ4_compress_fast_continue(context.stream, data, &out[0], static_cast<int>(length),
+                                                 static_cast<int>(out.size()), 1);
+        if (written <= 0) {
+            return false;
+        }
+        out.resize(static_cast<size_t>(written));
+        return true;
+    }
+#endif
+    (void)codec;
+    (void)data;
+    (void)length;
+    (void)out;
+    (void)level;
+    return false;
+}
+
+/**
+ * @brief 展開する
+ * @param raw_length 展開後の長さ（ヘッダーの raw=。これと一致しなければ失敗）
+ * @param out 展開結果（呼び出し側のバッファを再利用する。内容は置き換える）
+ */
+inline bool decompress(Codec codec, const char* data, size_t length, size_t raw_length, std::string& out) {
+#ifdef CONFIG_SYNC_WITH_ZSTD
+    if (codec == ZSTD) {
+        struct Context {
+            ZSTD_DCtx* dctx = ZSTD_createDCtx();
+            ZSTD_DDict* ddict = ZSTD_createDDict(dictionary().data(), dictionary().size());
+            ~Context() {
+                ZSTD_freeDDict(ddict);
+                ZSTD_freeDCtx(dctx);
+            }
+        };
+        thread_local Context context;
+        out.resize(raw_length);
+        size_t written = ZSTD_decompress_usingDDict(context.dctx, raw_length > 0 ? &out[0] : nullptr, raw_length,
+                                                    data, length, context.ddict);
+        return !ZSTD_isError(written) && written == raw_length;
+    }
+#endif
+#ifdef CONFIG_SYNC_WITH_LZ4
+    if (codec == LZ4) {
+        if (raw_length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE) || length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+            return false;
+        }
+        out.resize(raw_length);
+        int written = LZ4_decompress_safe_usingDict(data, raw_length > 0 ? &out[0] : nullptr,
+                                                    static_cast<int>(length), static_cast<int>(raw_length),
+                                                    dictionary().data(), static_cast<int>(dictionary().size()));
+        return written >= 0 && static_cast<size_t>(written) == raw_length;
+    }
+#endif
+    (void)codec;
+    (void)data;
+    (void)length;
+    (void)raw_length;
+    (void)out;
+    return false;
+}
+
+} // namespace config_compression
+
+#endif // CONFIG_COMPRESSION_H
@@ -0,0 +1,327 @@
+// ConfigShm.h - 共有メモリ上の設定スナップショット（ヘッダーのみのリーダー）
+//
+// 目的:
+// ConfigSynchronizerが公開する設定スナップショットを、同じRaspberry Pi上の
+// 別プロセス（スラスター制御、カメラ起動、センサー送信など）から、
+// config.iniの再パースやTCP接続なしに読み出す。
+//
+// 仕組み:
+// - ConfigSynchronizerは設定が変わるたびに、POSIX共有メモリ（既定 /config_sync）へ
+//   型付きの全設定を書き込む。
+// - 書き込みはシーケンスロック（seqlock）で保護する。書き込み中はシーケンス番号が奇数になり、
+//   リーダーは読む前後でシーケンス番号が同じ偶数であることを確認する（違えば読み直す）。
+// - リーダーはロックもシステムコールも使わない（open()時のshm_open/mmapを除く）。
+//
+// 使い方:
+//   #include "ConfigShm.h"
+//   ConfigShmReader reader;
+//   if (reader.open()) {
+//       int64_t port;
+//       reader.get_int("CONFIG_SYNC", "CPP_RECV_PORT", port);
+//       // 繰り返し読む値はハンドルを使うと検索を省ける
+//       ConfigShmReader::Handle kp_yaw = reader.lookup("THRUSTER_CONTROL", "KP_YAW");
+//       double value;
+//       reader.get_double(kp_yaw, value);
+//   }
+//
+// コンパイル方法（リーダー側）:
+// g++ -std=c++11 your_program.cpp -lrt
+
+#ifndef CONFIG_SHM_H
+#define CONFIG_SHM_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace config_shm {
+
+// 既定の共有メモリ名（config.ini の SHM_NAME で変更できる）
+const char* const DEFAULT_NAME = "/config_sync";
+
+const uint32_t MAGIC = 0x53474643; // "CFGS"
+const uint32_t LAYOUT_VERSION = 1;
+
+// 固定長レイアウト（リーダーとライターで一致している必要がある）
+const size_t MAX_ENTRIES = 512;
+const size_t SECTION_SIZE = 32;
+const size_t KEY_SIZE = 48;
+const size_t VALUE_SIZE = 128;
+
+// 公開時に判定した値の型
+enum ValueType : uint32_t {
+    TYPE_STRING = 0,
+    TYPE_INT = 1,
+    TYPE_DOUBLE = 2,
+    TYPE_BOOL = 3,
+};
+
+// 設定1項目分（文字列はNUL終端）
+struct Entry {
+    char section[SECTION_SIZE];
+    char key[KEY_SIZE];
+    char value[VALUE_SIZE];
+    uint32_t type;
+    uint32_t reserved;
+    int64_t int_value;    // TYPE_INT / TYPE_BOOL のときの値
+    double double_value;  // TYPE_INT / TYPE_DOUBLE のときの値
+};
+
+// 共有メモリ全体。entries は (section, key) の昇順に並ぶ
+struct Segment {
+    uint32_t magic;
+    uint32_t layout_version;
+    std::atomic<uint64_t> sequence;   // 奇数の間は書き込み中
+    uint64_t config_version;          // ConfigSynchronizerの設定バージョン
+    uint64_t layout_generation;       // キーの追加・削除で進む（ハンドルの再検索に使う）
+    uint64_t publish_time_ns;         // 公開時刻（CLOCK_MONOTONIC、ナノ秒）
+    uint32_t entry_count;
+    uint32_t skipped_count;           // 長すぎる・入りきらないため公開できなかった項目数
+    Entry entries[MAX_ENTRIES];
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "共有メモリ上のシーケンス番号にはロックフリーな64ビットアトミックが必要です");
+
+// (section, key) の比較（entriesの並び順）
+inline int compare_entry(const Entry& entry, const char* section, const char* key) {
+    int result = strncmp(entry.section, section, SECTION_SIZE);
+    if (result != 0) {
+        return result;
+    }
+    return strncmp(entry.key, key, KEY_SIZE);
+}
+
+} // namespace config_shm
+
+/**
+ * @brief 共有メモリ上の設定スナップショットを読むリーダー
+ *
+ * 読み出しはすべて待ちなし・システムコールなし。書き込みと重なった場合だけ読み直す。
+ * 1つのリーダーを複数スレッドから同時に使ってよい（Handleはスレッドごとに持つこと）。
+ */
+class ConfigShmReader {
+public:
+    /**
+     * @brief 繰り返し読む項目の位置を覚えておくハンドル
+     *
+     * キーの追加・削除で位置が変わった場合は、次の読み出しで自動的に検索し直す。
+     */
+    struct Handle {
+        std::string section;
+        std::string key;
+        uint64_t generation;
+        int index; // -1 は未検索または見つからない
+    };
+
+    ConfigShmReader() : segment_(nullptr) {}
+    ~ConfigShmReader() { close(); }
+    ConfigShmReader(const ConfigShmReader&) = delete;
+    ConfigShmReader& operator=(const ConfigShmReader&) = delete;
+
+    /**
+     * @brief 共有メモリを開く
+     * @return ConfigSynchronizerが一度でも公開していればtrue
+     */
+    bool open(const char* name = config_shm::DEFAULT_NAME) {
+        close();
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(config_shm::Segment)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, sizeof(config_shm::Segment), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        segment_ = static_cast<const config_shm::Segment*>(mapped);
+        if (segment_->magic != config_shm::MAGIC || segment_->layout_version != config_shm::LAYOUT_VERSION) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (segment_ != nullptr) {
+            munmap(const_cast<config_shm::Segment*>(segment_), sizeof(config_shm::Segment));
+            segment_ = nullptr;
+        }
+    }
+
+    bool is_open() const { return segment_ != nullptr; }
+
+    /**
+     * @brief 現在の設定バージョン（変化の検出用）
+     */
+    uint64_t version() const {
+        uint64_t value = 0;
+        read_consistent([&] { value = segment_->config_version; });
+        return value;
+    }
+
+    /**
+     * @brief 最後に公開された時刻（CLOCK_MONOTONIC、ナノ秒）
+     */
+    uint64_t publish_time_ns() const {
+        uint64_t value = 0;
+        read_consistent([&] { value = segment_->publish_time_ns; });
+        return value;
+    }
+
+    Handle lookup(const char* section, const char* key) const {
+        Handle handle;
+        handle.section = section;
+        handle.key = key;
+        handle.generation = 0;
+        handle.index = -1;
+        return handle;
+    }
+
+    bool get_int(Handle& handle, int64_t& out) const {
+        return read_entry(handle, [&](const config_shm::Entry& entry) {
+            if (entry.type != config_shm::TYPE_INT && entry.type != config_shm::TYPE_BOOL) {
+                return false;
+            }
+            out = entry.int_value;
+            return true;
+        });
+    }
+
+    bool get_double(Handle& handle, double& out) const {
+        return read_entry(handle, [&](const config_shm::Entry& entry) {
+            if (entry.type != config_shm::TYPE_INT && entry.type != config_shm::TYPE_DOUBLE) {
+                return false;
+            }
+            out = entry.double_value;
+            return true;
+        });
+    }
+
+    bool get_bool(Handle& handle, bool& out) const {
+        return read_entry(handle, [&](const config_shm::Entry& entry) {
+            if (entry.type != config_shm::TYPE_BOOL && entry.type != config_shm::TYPE_INT) {
+                return false;
+            }
+            out = entry.int_value != 0;
+            return true;
+        });
+    }
+
+    bool get_string(Handle& handle, std::string& out) const {
+        char value[config_shm::VALUE_SIZE];
+        bool found = read_entry(handle, [&](const config_shm::Entry& entry) {
+            memcpy(value, entry.value, sizeof(value));
+            return true;
+        });
+        if (found) {
+            value[sizeof(value) - 1] = '\0';
+            out = value;
+        }
+        return found;
+    }
+
+    // 1回だけ読む場合の簡易版
+    bool get_int(const char* section, const char* key, int64_t& out) const {
+        Handle handle = lookup(section, key);
+        return get_int(handle, out);
+    }
+
+    bool get_double(const char* section, const char* key, double& out) const {
+        Handle handle = lookup(section, key);
+        return get_double(handle, out);
+    }
+
+    bool get_bool(const char* section, const char* key, bool& out) const {
+        Handle handle = lookup(section, key);
+        return get_bool(handle, out);
+    }
+
+    bool get_string(const char* section, const char* key, std::string& out) const {
+        Handle handle = lookup(section, key);
+        return get_string(handle, out);
+    }
+
+private:
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    // シーケンス番号が同じ偶数の間に読めるまで read を繰り返す
+    template <typename Fn>
+    void read_consistent(Fn read) const {
+        for (;;) {
+            uint64_t before = segment_->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                cpu_relax();
+                continue;
+            }
+            read();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment_->sequence.load(std::memory_order_relaxed) == before) {
+                return;
+            }
+        }
+    }
+
+    // (section, key) の位置を二分探索する（read_consistentの中から呼ぶ）
+    int find_index(const Handle& handle) const {
+        size_t low = 0;
+        size_t high = segment_->entry_count;
+        if (high > config_shm::MAX_ENTRIES) {
+            high = config_shm::MAX_ENTRIES; // 書き込み途中の値でも範囲外を読まない
+        }
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            int result = config_shm::compare_entry(segment_->entries[mid], handle.section.c_str(), handle.key.c_str());
+            if (result == 0) {
+                return static_cast<int>(mid);
+            }
+            if (result < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return -1;
+    }
+
+    template <typename Fn>
+    bool read_entry(Handle& handle, Fn fn) const {
+        if (segment_ == nullptr) {
+            return false;
+        }
+        bool found = false;
+        uint64_t generation = 0;
+        int index = -1;
+        read_consistent([&] {
+            generation = segment_->layout_generation;
+            index = handle.index;
+            if (handle.generation != generation || index < 0) {
+                index = find_index(handle);
+            }
+            found = index >= 0 && fn(segment_->entries[index]);
+        });
+        handle.generation = generation;
+        handle.index = index;
+        return found;
+    }
+
+    const config_shm::Segment* segment_;
+};
+
+#endif // CONFIG_SHM_H
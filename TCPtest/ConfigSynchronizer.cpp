@@ -9,39 +9,83 @@
 // - libiniparser-dev: sudo apt install libiniparser-dev
 //
 // コンパイル方法:
-// g++ -std=c++11 ConfigSynchronizer.cpp -o ConfigSynchronizer -liniparser -lpthread
+// g++ -std=c++20 ConfigSynchronizer.cpp -o ConfigSynchronizer -liniparser -lpthread -lrt
 
 #include <iostream>
 #include <string>
 #include <map>
+#include <list>
 #include <thread>
 #include <mutex>
 #include <vector>
 #include <sstream>
+#include <iomanip>
 #include <fstream>
 #include <chrono>
 #include <atomic>
 #include <set>
+#include <array>
 #include <algorithm>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <optional>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <coroutine>
+#include <future>
+#include <utility>
+#include <string_view>
+#include <random>
+#include <exception>
+#include <cmath>
+#include <cctype>
 
 // Linux用のソケットライブラリ
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <cstring>
+#include <cstdlib>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <alloca.h>
 
 // iniparserライブラリ（Raspberry Piで利用可能）
 #include <iniparser/iniparser.h>
 
+// 共有メモリ上の設定スナップショットのレイアウト
+#include "ConfigShm.h"
+#include "Crc32c.h"
+#include "ConfigCompression.h"
+#include "TrafficCapture.h"
+#include "TraceSpans.h"
+#include "FastPath.h"
+
 // グローバル変数: 設定データと、スレッドセーフなアクセスのためのミューテックス
 std::map<std::string, std::map<std::string, std::string>> g_config_data;
 std::mutex g_config_mutex;
 std::atomic<bool> g_shutdown_flag{false};
 
+// 設定バージョン: 更新が適用されるたびに1つ進む
+std::atomic<uint64_t> g_config_version{0};
+
 // シグナルハンドラー用
 void signal_handler(int signum) {
     std::cout << "\nシグナル " << signum << " を受信しました。終了処理を開始します...\n";
@@ -49,338 +93,7504 @@ void signal_handler(int signum) {
 }
 
 /**
- * @brief iniファイルから設定を読み込む (改良版)
- * @param filename config.iniのパス
- * @return 読み込みが成功した場合はtrue
+ * @brief 設定スナップショットを共有メモリへ公開する（ConfigShm.h のライター側）
+ *
+ * 同じPi上の別プロセスが ConfigShmReader で読めるよう、全設定を型付きで
+ * 固定長レイアウトに書き込む。書き込みはシーケンスロックで保護する。
+ * 終了時も共有メモリは削除しない（読み手は最後に公開された値を使い続けられる）。
+ */
+class ConfigShmPublisher {
+public:
+    ConfigShmPublisher() : segment_(nullptr) {}
+
+    ~ConfigShmPublisher() {
+        if (segment_ != nullptr) {
+            munmap(segment_, sizeof(config_shm::Segment));
+        }
+    }
+
+    ConfigShmPublisher(const ConfigShmPublisher&) = delete;
+    ConfigShmPublisher& operator=(const ConfigShmPublisher&) = delete;
+
+    bool open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, sizeof(config_shm::Segment)) < 0) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, sizeof(config_shm::Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        segment_ = static_cast<config_shm::Segment*>(mapped);
+
+        // 新規作成（またはレイアウトが古い）場合は初期化する。magicは最後に書く
+        if (segment_->magic != config_shm::MAGIC || segment_->layout_version != config_shm::LAYOUT_VERSION) {
+            segment_->sequence.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            segment_->config_version = 0;
+            segment_->layout_generation = 0;
+            segment_->publish_time_ns = 0;
+            segment_->entry_count = 0;
+            segment_->skipped_count = 0;
+            segment_->layout_version = config_shm::LAYOUT_VERSION;
+            segment_->sequence.store(2, std::memory_order_release);
+            segment_->magic = config_shm::MAGIC;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 全設定を公開する（g_config_mutexを保持した状態で呼ぶ）
+     * @param overlay data に加えて公開する項目（派生キー。同じ項目は overlay を使う。nullptrならなし）
+     */
+    void publish(const std::map<std::string, std::map<std::string, std::string>>& data, uint64_t version,
+                 const std::map<std::string, std::map<std::string, std::string>>* overlay = nullptr) {
+        // 書き込み区間を短くするため、先に手元で組み立てる（mapの順序がそのまま検索順になる）
+        entries_.clear();
+        uint32_t skipped = 0;
+        // 項目の並びが前回と同じかを、新しい一覧を作らずに比べる（値だけの変更では確保しない）
+        size_t matched = 0;
+        bool layout_changed = false;
+        auto add = [&](const std::string& section, const std::string& key, const std::string& value) {
+            if (section.size() >= config_shm::SECTION_SIZE || key.size() >= config_shm::KEY_SIZE ||
+                value.size() >= config_shm::VALUE_SIZE || entries_.size() >= config_shm::MAX_ENTRIES) {
+                skipped++;
+                return;
+            }
+            config_shm::Entry entry;
+            memset(&entry, 0, sizeof(entry));
+            memcpy(entry.section, section.data(), section.size());
+            memcpy(entry.key, key.data(), key.size());
+            memcpy(entry.value, value.data(), value.size());
+            classify_value(value, entry);
+            entries_.push_back(entry);
+            if (!layout_changed && matched < published_keys_.size() && published_keys_[matched].first == section &&
+                published_keys_[matched].second == key) {
+                matched++;
+            } else {
+                layout_changed = true;
+            }
+        };
+        // overlay の項目を data と同じ (セクション, キー) 順で差し込む
+        overlay_items_.clear();
+        if (overlay != nullptr) {
+            for (const auto& section_pair : *overlay) {
+                for (const auto& key_value_pair : section_pair.second) {
+                    overlay_items_.push_back(
+                        OverlayItem{&section_pair.first, &key_value_pair.first, &key_value_pair.second});
+                }
+            }
+        }
+        size_t next_overlay = 0;
+        for (const auto& section_pair : data) {
+            for (const auto& key_value_pair : section_pair.second) {
+                int order = 1;
+                while (next_overlay < overlay_items_.size()) {
+                    const OverlayItem& item = overlay_items_[next_overlay];
+                    order = item.section->compare(section_pair.first);
+                    if (order == 0) {
+                        order = item.key->compare(key_value_pair.first);
+                    }
+                    if (order > 0) {
+                        break;
+                    }
+                    add(*item.section, *item.key, *item.value);
+                    next_overlay++;
+                    if (order == 0) {
+                        break;
+                    }
+                }
+                if (order != 0) {
+                    add(section_pair.first, key_value_pair.first, key_value_pair.second);
+                }
+            }
+        }
+        for (; next_overlay < overlay_items_.size(); next_overlay++) {
+            const OverlayItem& item = overlay_items_[next_overlay];
+            add(*item.section, *item.key, *item.value);
+        }
+        if (layout_changed || matched != published_keys_.size()) {
+            layout_changed = true;
+            published_keys_.clear();
+            for (const config_shm::Entry& entry : entries_) {
+                published_keys_.push_back(std::make_pair(std::string(entry.section), std::string(entry.key)));
+            }
+        }
+        if (skipped > 0 && skipped != last_skipped_) {
+            std::cerr << "警告: 共有メモリに公開できない設定が " << skipped << " 項目あります（長すぎるか、上限 "
+                      << config_shm::MAX_ENTRIES << " 項目を超えています）。\n";
+        }
+        last_skipped_ = skipped;
+
+        uint64_t start = segment_->sequence.load(std::memory_order_relaxed) | 1;
+        segment_->sequence.store(start, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (!entries_.empty()) {
+            memcpy(segment_->entries, entries_.data(), entries_.size() * sizeof(config_shm::Entry));
+        }
+        segment_->entry_count = static_cast<uint32_t>(entries_.size());
+        segment_->skipped_count = skipped;
+        segment_->config_version = version;
+        if (layout_changed) {
+            segment_->layout_generation++;
+        }
+        segment_->publish_time_ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        segment_->sequence.store(start + 1, std::memory_order_release);
+        publish_count_++;
+    }
+
+    uint64_t publish_count() const { return publish_count_; }
+
+private:
+    // 値の型を判定する（true/false、整数、実数、それ以外は文字列）
+    static void classify_value(const std::string& value, config_shm::Entry& entry) {
+        entry.type = config_shm::TYPE_STRING;
+        if (value == "true" || value == "false") {
+            entry.type = config_shm::TYPE_BOOL;
+            entry.int_value = value == "true" ? 1 : 0;
+            return;
+        }
+        if (value.empty()) {
+            return;
+        }
+        const char* begin = value.c_str();
+        char* end = nullptr;
+        errno = 0;
+        long long int_value = strtoll(begin, &end, 10);
+        if (errno == 0 && *end == '\0') {
+            entry.type = config_shm::TYPE_INT;
+            entry.int_value = int_value;
+            entry.double_value = static_cast<double>(int_value);
+            return;
+        }
+        errno = 0;
+        double double_value = strtod(begin, &end);
+        if (errno == 0 && *end == '\0') {
+            entry.type = config_shm::TYPE_DOUBLE;
+            entry.double_value = double_value;
+        }
+    }
+
+    struct OverlayItem {
+        const std::string* section;
+        const std::string* key;
+        const std::string* value;
+    };
+
+    config_shm::Segment* segment_;
+    std::vector<config_shm::Entry> entries_;
+    std::vector<OverlayItem> overlay_items_;
+    std::vector<std::pair<std::string, std::string>> published_keys_;
+    uint32_t last_skipped_ = 0;
+    uint64_t publish_count_ = 0;
+};
+
+// 共有メモリへの公開（SHM_NAMEが空なら無効）
+std::unique_ptr<ConfigShmPublisher> g_shm_publisher;
+
+/**
+ * @brief 直列化済みの設定（設定要求への返信に使う読み取り専用のスナップショット）
+ *
+ * 本体と一緒に、行の位置の索引（セクション・キー順）と変更の新しい順の一覧を作っておき、
+ * セクション・キー・パターン・「バージョンN以降の変更」の読み出しを
+ * 設定全体ではなく結果の大きさに比例する手間で返せるようにする。
+ */
+struct ConfigText {
+    // 本体の1行（"[SECTION]KEY=VALUE\n"）の位置
+    struct Line {
+        uint32_t offset;         // 行の先頭（'['）
+        uint32_t length;         // 改行を含む長さ
+        uint32_t section_length;
+        uint32_t key_length;
+    };
+    // 起動後に変わった項目（line が -1 なら削除された項目）
+    struct Change {
+        uint64_t version;
+        int64_t line;
+        std::string section;
+        std::string key;
+    };
+
+    uint64_t version = 0;
+    uint64_t horizon = 0;        // これより前の変更は changes にない（起動時・復元時の設定バージョン）
+    std::string body;            // "[SECTION]KEY=VALUE\n" の並び
+    std::vector<Line> lines;     // (セクション, キー) 順
+    std::vector<Change> changes; // 新しい順
+
+    std::string_view section_of(const Line& line) const {
+        return std::string_view(body).substr(line.offset + 1, line.section_length);
+    }
+    std::string_view key_of(const Line& line) const {
+        return std::string_view(body).substr(line.offset + 2 + line.section_length, line.key_length);
+    }
+};
+
+/**
+ * @brief 起動後に変わった項目の設定バージョン（読み出しの since= に使う。削除された項目も残す）
+ */
+struct KeyChange {
+    uint64_t version;
+    bool removed;
+};
+std::map<std::string, std::map<std::string, KeyChange>> g_key_changes;
+uint64_t g_key_change_horizon = 0; // g_key_changes がこれより前の変更を含まない設定バージョン
+
+// 最新の直列化済み設定。更新のたびに作り直して差し替え、読み手（各シャード）はロックを取らずに参照する
+std::shared_ptr<const ConfigText> g_config_text;
+
+// 派生キー（DERIVED_KEYS、定義は DerivedKeys）
+bool have_derived_keys();
+const std::map<std::string, std::map<std::string, std::string>>& derived_values_locked();
+
+/**
+ * @brief 現在の設定を直列化済みスナップショットと共有メモリへ公開する（g_config_mutexを保持した状態で呼ぶ）
+ */
+void publish_config_snapshot_locked() {
+    trace_spans::Span span("publish");
+    std::shared_ptr<ConfigText> text(new ConfigText());
+    text->version = g_config_version.load();
+    text->horizon = g_key_change_horizon;
+    // 前回の大きさで確保しておき、組み立て中の再確保を避ける
+    std::shared_ptr<const ConfigText> previous = std::atomic_load(&g_config_text);
+    if (previous) {
+        text->body.reserve(previous->body.size() + previous->body.size() / 8);
+        text->lines.reserve(previous->lines.size() + 16);
+        text->changes.reserve(previous->changes.size() + 16);
+    }
+    for (const auto& section_pair : g_config_data) {
+        for (const auto& key_value_pair : section_pair.second) {
+            ConfigText::Line line;
+            line.offset = static_cast<uint32_t>(text->body.size());
+            line.section_length = static_cast<uint32_t>(section_pair.first.size());
+            line.key_length = static_cast<uint32_t>(key_value_pair.first.size());
+            // フォーマット: [SECTION]KEY=VALUE\n
+            text->body += '[';
+            text->body += section_pair.first;
+            text->body += ']';
+            text->body += key_value_pair.first;
+            text->body += '=';
+            text->body += key_value_pair.second;
+            text->body += '\n';
+            line.length = static_cast<uint32_t>(text->body.size()) - line.offset;
+            text->lines.push_back(line);
+        }
+    }
+    // 変更の一覧（現在ある項目は索引の行を引き、削除された項目は名前だけ持つ）
+    const ConfigText& index = *text;
+    for (const auto& section_pair : g_key_changes) {
+        for (const auto& key_change : section_pair.second) {
+            ConfigText::Change change{key_change.second.version, -1, section_pair.first, key_change.first};
+            if (!key_change.second.removed) {
+                std::vector<ConfigText::Line>::const_iterator it = std::lower_bound(
+                    index.lines.begin(), index.lines.end(), change,
+                    [&index](const ConfigText::Line& line, const ConfigText::Change& target) {
+                        int order = index.section_of(line).compare(target.section);
+                        return order < 0 || (order == 0 && index.key_of(line) < target.key);
+                    });
+                change.line = it - index.lines.begin();
+            }
+            text->changes.push_back(std::move(change));
+        }
+    }
+    std::stable_sort(text->changes.begin(), text->changes.end(),
+              [](const ConfigText::Change& a, const ConfigText::Change& b) { return a.version > b.version; });
+    std::atomic_store(&g_config_text, std::shared_ptr<const ConfigText>(std::move(text)));
+    if (g_shm_publisher) {
+        // 派生キーは生のキーと同じように共有メモリから読めるようにする（設定は複製せず、
+        // 派生キーは前回の公開から無効になったものだけ計算し直す）
+        g_shm_publisher->publish(g_config_data, g_config_version.load(),
+                                 have_derived_keys() ? &derived_values_locked() : nullptr);
+    }
+}
+
+// 設定データの型（セクション → キー → 値）
+typedef std::map<std::string, std::map<std::string, std::string>> ConfigMap;
+
+// 設定変更1件分（受信データ1行、ロールバック、ファイル読み込みの差分など）
+struct ConfigUpdate {
+    std::string section;
+    std::string key;
+    std::string value;
+    bool remove = false; // trueならキーを削除する（ロールバックやファイル読み込みで使う）
+};
+
+/**
+ * @brief 読み取り専用でmmapしたファイル
+ *
+ * 起動時に読むスナップショットやジャーナルをコピーせずにそのまま解析するために使う。
+ */
+class MappedFile {
+public:
+    MappedFile() : data_(nullptr), size_(0) {}
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief ファイルを開いてmmapする（空のファイルは開けた扱いでsize()が0になる）
+     */
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                return false;
+            }
+            data_ = static_cast<const char*>(mapped);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+            data_ = nullptr;
+        }
+        size_ = 0;
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+// 設定ファイルの更新日時・サイズと内容のハッシュ（前回同期したファイルから変わったかの判定用）
+struct FileStamp {
+    int64_t mtime_ns = 0;
+    int64_t size = -1;
+    uint32_t content_crc = 0; // 内容のCRC32C（stat_file_stampでは求めない）
+
+    // 更新日時とサイズが同じなら、内容を読まずに同じファイルとみなす
+    bool operator==(const FileStamp& other) const { return mtime_ns == other.mtime_ns && size == other.size; }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+FileStamp stat_file_stamp(const std::string& filename) {
+    FileStamp stamp;
+    struct stat st;
+    if (stat(filename.c_str(), &st) == 0) {
+        stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+        stamp.size = static_cast<int64_t>(st.st_size);
+    }
+    return stamp;
+}
+
+/**
+ * @brief 更新日時・サイズに加えて内容のハッシュも求める
+ *
+ * 更新日時だけが変わった（touchされた、コピーし直された）場合にテキストの再解析を省くために使う。
+ */
+FileStamp hash_file_stamp(const std::string& filename) {
+    FileStamp stamp = stat_file_stamp(filename);
+    MappedFile file;
+    if (file.open(filename)) {
+        stamp.content_crc = crc32c(file.data(), file.size());
+    }
+    return stamp;
+}
+
+// ジャーナルの1レコード（適用された変更1項目分）
+struct JournalRecord {
+    uint64_t version = 0;  // この変更で到達した設定バージョン
+    int64_t time_ms = 0;   // 適用時刻（UNIX時間、ミリ秒）
+    std::string source;    // 変更元（送信元アドレス、"rollback" など）
+    std::string section;
+    std::string key;
+    bool had_old = false;  // 変更前にキーが存在したか
+    bool has_new = false;  // 変更後にキーが存在するか（falseは削除）
+    std::string old_value;
+    std::string new_value;
+};
+
+/**
+ * @brief 適用済みの設定変更を追記するバイナリのジャーナル（先行書き込みログ）
+ *
+ * ファイル構成（いずれも設定ファイルと同じディレクトリ）:
+ * - <設定ファイル>.journal  : ヘッダーの後に [長さ][CRC32C][レコード] を追記していく
+ * - <設定ファイル>.snapshot : ある設定バージョン時点の全設定（コンパクション時に書き直す）
+ *
+ * 追記はメモリ上に溜め、専用スレッドがまとめて書き込んで fdatasync する
+ * （グループコミット）。fsync中に届いた変更は次の書き込みにまとめられる。
+ * レコード数が一定を超えるとスナップショットを書き直し、直近の保持分より
+ * 古いレコードをジャーナルから除く。起動時はスナップショットを読み込み、
+ * それより新しいレコードを再生して復元する。
+ * バイト順はホストのもの（同じPi上でのみ読み書きする）。
+ */
+class ConfigJournal {
+public:
+    // 全設定とそのバージョンを取り出す処理（コンパクション用、g_config_mutexを取って呼ぶ）
+    typedef std::function<void(ConfigMap& data, uint64_t& version)> StateProvider;
+
+    explicit ConfigJournal(const std::string& config_path)
+        : journal_path_(config_path + ".journal"), snapshot_path_(config_path + ".snapshot"), fd_(-1),
+          compact_records_(10000), keep_versions_(1000), records_since_compaction_(0), oldest_version_(0),
+          stopping_(false), appended_(0), fsyncs_(0), compactions_(0) {}
+
+    ~ConfigJournal() { stop(); }
+
+    ConfigJournal(const ConfigJournal&) = delete;
+    ConfigJournal& operator=(const ConfigJournal&) = delete;
+
+    /**
+     * @brief スナップショットとジャーナルから設定を復元する
+     * @param data 復元した設定
+     * @param version 復元した設定バージョン
+     * @param source_stamp スナップショット作成時の設定ファイルの更新日時・サイズ・ハッシュ
+     * @param replayed 再生したレコード数
+     * @return スナップショットがあり復元できた場合はtrue
+     */
+    bool recover(ConfigMap& data, uint64_t& version, FileStamp& source_stamp, size_t& replayed) {
+        replayed = 0;
+        uint64_t snapshot_version = 0;
+        if (!read_snapshot(data, snapshot_version, source_stamp)) {
+            return false;
+        }
+        version = snapshot_version;
+        oldest_version_ = snapshot_version;
+
+        std::vector<JournalRecord> records;
+        read_journal(records);
+        for (const JournalRecord& record : records) {
+            if (record.version > snapshot_version) {
+                if (record.has_new) {
+                    data[record.section][record.key] = record.new_value;
+                } else {
+                    erase_key(data, record.section, record.key);
+                }
+                replayed++;
+            }
+            version = std::max(version, record.version);
+            oldest_version_ = std::min(oldest_version_, record.version - 1);
+        }
+        history_.assign(records.begin(), records.end());
+        return true;
+    }
+
+    /**
+     * @brief 追記用にジャーナルを開き、書き込みスレッドを開始する
+     * @param keep_existing falseなら既存のジャーナルを捨てる（復元できなかった場合）
+     */
+    bool start(bool keep_existing, StateProvider provider) {
+        provider_ = std::move(provider);
+        keep_existing = keep_existing && journal_readable_;
+        if (!keep_existing) {
+            history_.clear();
+        }
+        fd_ = ::open(journal_path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (keep_existing ? 0 : O_TRUNC), 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        if (lseek(fd_, 0, SEEK_END) == 0 && !write_all_fd(fd_, journal_header())) {
+            return false;
+        }
+        writer_ = std::thread(&ConfigJournal::writer_loop, this);
+        return true;
+    }
+
+    /**
+     * @brief コンパクションの設定を変える
+     * @param compact_records この件数を追記するたびにコンパクションする（0で自動コンパクションしない）
+     * @param keep_versions コンパクション後も残す直近のバージョン数（rollback / diff で遡れる範囲）
+     */
+    void configure(long compact_records, long keep_versions) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compact_records_ = compact_records;
+        keep_versions_ = keep_versions;
+    }
+
+    /**
+     * @brief 適用した変更を追記する（g_config_mutexを保持した状態で呼ぶ）
+     *
+     * ディスクへの書き込みは書き込みスレッドが行う。永続化を待つ場合は when_durable() を使う。
+     */
+    void append(const std::vector<JournalRecord>& records) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const JournalRecord& record : records) {
+            encode_record(record, pending_);
+            history_.push_back(record);
+        }
+        appended_ += records.size();
+        records_since_compaction_ += records.size();
+        cv_.notify_one();
+    }
+
+    /**
+     * @brief ここまでに追記した変更がディスクに書き込まれたら fn を呼ぶ（書き込みスレッドから呼ばれる）
+     */
+    void when_durable(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!pending_.empty() || writing_) {
+                waiters_.push_back(std::move(fn));
+                return;
+            }
+        }
+        fn();
+    }
+
+    /**
+     * @brief 指定バージョン時点のスナップショットを書き、古いレコードをジャーナルから除く
+     * @param data version時点の全設定
+     * @param source_stamp 設定ファイルの更新日時・サイズ・ハッシュ（起動時の変更検出用）
+     */
+    bool compact(const ConfigMap& data, uint64_t version, const FileStamp& source_stamp) {
+        std::lock_guard<std::mutex> io_lock(io_mutex_);
+        source_stamp_ = source_stamp;
+        if (!write_snapshot(data, version, source_stamp)) {
+            std::cerr << "エラー: スナップショット " << snapshot_path_ << " を書き込めませんでした。 " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        // 保持するレコードを書いた新しいジャーナルに置き換える。
+        // 未書き込みのレコードもここで書くので、保留分はまとめて完了扱いにする
+        std::string contents = journal_header();
+        std::vector<std::function<void()>> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            uint64_t keep_after = version > static_cast<uint64_t>(keep_versions_) ? version - keep_versions_ : 0;
+            while (!history_.empty() && history_.front().version <= keep_after) {
+                history_.pop_front();
+            }
+            for (const JournalRecord& record : history_) {
+                encode_record(record, contents);
+            }
+            pending_.clear();
+            done.swap(waiters_);
+            records_since_compaction_ = 0;
+            oldest_version_ = history_.empty() ? version : std::min(version, history_.front().version - 1);
+        }
+        std::string temp_path = journal_path_ + ".tmp";
+        bool ok = write_file_durably(temp_path, contents) && rename(temp_path.c_str(), journal_path_.c_str()) == 0;
+        if (ok) {
+            int fd = ::open(journal_path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            if (fd >= 0) {
+                ::close(fd_);
+                fd_ = fd;
+            }
+            sync_directory();
+        } else {
+            std::cerr << "エラー: ジャーナル " << journal_path_ << " を書き直せませんでした。 " << strerror(errno) << std::endl;
+        }
+        compactions_++;
+        for (std::function<void()>& fn : done) {
+            fn();
+        }
+        return ok;
+    }
+
+    /**
+     * @brief バージョン from より後、to 以下のレコードを取り出す（古い順）
+     * @return from 時点まで遡れない場合（コンパクションで削除済み）はfalse
+     */
+    bool history_between(uint64_t from, uint64_t to, std::vector<JournalRecord>& out) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (from < oldest_version_) {
+            return false;
+        }
+        for (const JournalRecord& record : history_) {
+            if (record.version > from && record.version <= to) {
+                out.push_back(record);
+            }
+        }
+        return true;
+    }
+
+    uint64_t oldest_version() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return oldest_version_;
+    }
+
+    FileStamp source_stamp() const {
+        std::lock_guard<std::mutex> lock(io_mutex_);
+        return source_stamp_;
+    }
+
+    /**
+     * @brief 残りを書き込んで書き込みスレッドを止める
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) {
+                return;
+            }
+            stopping_ = true;
+            cv_.notify_one();
+        }
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    const std::string& journal_path() const { return journal_path_; }
+    uint64_t appended() const { return appended_.load(); }
+    uint64_t fsyncs() const { return fsyncs_.load(); }
+    uint64_t compactions() const { return compactions_.load(); }
+
+private:
+    static const uint32_t JOURNAL_MAGIC = 0x4A474643;  // "CFGJ"
+    static const uint32_t SNAPSHOT_MAGIC = 0x4E534643; // "CFSN"
+    static const uint32_t FORMAT_VERSION = 1;
+    static const uint32_t SNAPSHOT_FORMAT_VERSION = 2; // 2: 設定ファイルの内容のハッシュを追加
+
+    static void erase_key(ConfigMap& data, const std::string& section, const std::string& key) {
+        ConfigMap::iterator it = data.find(section);
+        if (it != data.end()) {
+            it->second.erase(key);
+            if (it->second.empty()) {
+                data.erase(it);
+            }
+        }
+    }
+
+    // --- エンコード・デコード ---
+    template <typename T>
+    static void put(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void put_string(std::string& out, const std::string& value) {
+        put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    // 読み出し位置を進めながら値を取り出す（足りなければfalse）
+    struct Reader {
+        const char* pos;
+        const char* end;
+
+        template <typename T>
+        bool get(T& value) {
+            if (static_cast<size_t>(end - pos) < sizeof(T)) {
+                return false;
+            }
+            memcpy(&value, pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        bool get_string(std::string& value) {
+            uint32_t length;
+            if (!get(length) || static_cast<size_t>(end - pos) < length) {
+                return false;
+            }
+            value.assign(pos, length);
+            pos += length;
+            return true;
+        }
+    };
+
+    static std::string journal_header() {
+        std::string header;
+        put<uint32_t>(header, JOURNAL_MAGIC);
+        put<uint32_t>(header, FORMAT_VERSION);
+        return header;
+    }
+
+    static void encode_record(const JournalRecord& record, std::string& out) {
+        std::string payload;
+        put<uint64_t>(payload, record.version);
+        put<int64_t>(payload, record.time_ms);
+        put<uint8_t>(payload, static_cast<uint8_t>((record.had_old ? 1 : 0) | (record.has_new ? 2 : 0)));
+        put_string(payload, record.source);
+        put_string(payload, record.section);
+        put_string(payload, record.key);
+        put_string(payload, record.old_value);
+        put_string(payload, record.new_value);
+        put<uint32_t>(out, static_cast<uint32_t>(payload.size()));
+        put<uint32_t>(out, crc32c(payload.data(), payload.size()));
+        out.append(payload);
+    }
+
+    static bool decode_record(const char* data, size_t length, JournalRecord& record) {
+        Reader reader{data, data + length};
+        uint8_t flags;
+        if (!reader.get(record.version) || !reader.get(record.time_ms) || !reader.get(flags) ||
+            !reader.get_string(record.source) || !reader.get_string(record.section) ||
+            !reader.get_string(record.key) || !reader.get_string(record.old_value) ||
+            !reader.get_string(record.new_value)) {
+            return false;
+        }
+        record.had_old = (flags & 1) != 0;
+        record.has_new = (flags & 2) != 0;
+        return true;
+    }
+
+    /**
+     * @brief ジャーナルを読む。途中で壊れている（書き込み途中で停止した）場合はそこで切り詰める
+     */
+    void read_journal(std::vector<JournalRecord>& records) {
+        MappedFile contents;
+        if (!contents.open(journal_path_)) {
+            return;
+        }
+        Reader reader{contents.data(), contents.data() + contents.size()};
+        uint32_t magic = 0;
+        uint32_t format = 0;
+        if (!reader.get(magic) || !reader.get(format) || magic != JOURNAL_MAGIC || format != FORMAT_VERSION) {
+            std::cerr << "警告: ジャーナル " << journal_path_ << " の形式が不正なため無視します。\n";
+            return;
+        }
+        journal_readable_ = true;
+        const char* valid_end = reader.pos;
+        while (reader.pos < reader.end) {
+            uint32_t length;
+            uint32_t crc;
+            if (!reader.get(length) || !reader.get(crc) || static_cast<size_t>(reader.end - reader.pos) < length ||
+                crc32c(reader.pos, length) != crc) {
+                break;
+            }
+            JournalRecord record;
+            if (!decode_record(reader.pos, length, record)) {
+                break;
+            }
+            records.push_back(record);
+            reader.pos += length;
+            valid_end = reader.pos;
+        }
+        size_t valid_size = static_cast<size_t>(valid_end - contents.data());
+        size_t file_size = contents.size();
+        contents.close();
+        if (valid_size < file_size) {
+            std::cerr << "警告: ジャーナルの末尾 " << (file_size - valid_size)
+                      << " バイトが不完全なため切り詰めます。\n";
+            if (truncate(journal_path_.c_str(), static_cast<off_t>(valid_size)) < 0) {
+                std::cerr << "エラー: ジャーナルを切り詰められませんでした。 " << strerror(errno) << std::endl;
+            }
+        }
+    }
+
+    bool read_snapshot(ConfigMap& data, uint64_t& version, FileStamp& source_stamp) {
+        MappedFile contents;
+        if (!contents.open(snapshot_path_) || contents.size() < sizeof(uint32_t)) {
+            return false;
+        }
+        size_t body_size = contents.size() - sizeof(uint32_t);
+        uint32_t crc;
+        memcpy(&crc, contents.data() + body_size, sizeof(crc));
+        if (crc32c(contents.data(), body_size) != crc) {
+            std::cerr << "警告: スナップショット " << snapshot_path_ << " が壊れているため無視します。\n";
+            return false;
+        }
+        Reader reader{contents.data(), contents.data() + body_size};
+        uint32_t magic;
+        uint32_t format;
+        uint32_t count;
+        if (!reader.get(magic) || !reader.get(format) || magic != SNAPSHOT_MAGIC || format != SNAPSHOT_FORMAT_VERSION ||
+            !reader.get(version) || !reader.get(source_stamp.mtime_ns) || !reader.get(source_stamp.size) ||
+            !reader.get(source_stamp.content_crc) || !reader.get(count)) {
+            return false;
+        }
+        data.clear();
+        for (uint32_t i = 0; i < count; i++) {
+            std::string section;
+            std::string key;
+            std::string value;
+            if (!reader.get_string(section) || !reader.get_string(key) || !reader.get_string(value)) {
+                return false;
+            }
+            data[section][key] = value;
+        }
+        return true;
+    }
+
+    bool write_snapshot(const ConfigMap& data, uint64_t version, const FileStamp& source_stamp) {
+        std::string contents;
+        uint32_t count = 0;
+        for (const auto& section_pair : data) {
+            count += static_cast<uint32_t>(section_pair.second.size());
+        }
+        put<uint32_t>(contents, SNAPSHOT_MAGIC);
+        put<uint32_t>(contents, SNAPSHOT_FORMAT_VERSION);
+        put<uint64_t>(contents, version);
+        put<int64_t>(contents, source_stamp.mtime_ns);
+        put<int64_t>(contents, source_stamp.size);
+        put<uint32_t>(contents, source_stamp.content_crc);
+        put<uint32_t>(contents, count);
+        for (const auto& section_pair : data) {
+            for (const auto& key_value_pair : section_pair.second) {
+                put_string(contents, section_pair.first);
+                put_string(contents, key_value_pair.first);
+                put_string(contents, key_value_pair.second);
+            }
+        }
+        put<uint32_t>(contents, crc32c(contents.data(), contents.size()));
+
+        std::string temp_path = snapshot_path_ + ".tmp";
+        return write_file_durably(temp_path, contents) && rename(temp_path.c_str(), snapshot_path_.c_str()) == 0;
+    }
+
+    static bool write_all_fd(int fd, const std::string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool write_file_durably(const std::string& path, const std::string& contents) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = write_all_fd(fd, contents) && fdatasync(fd) == 0;
+        fsyncs_++;
+        ::close(fd);
+        return ok;
+    }
+
+    // rename を確定させるためにディレクトリも同期する
+    void sync_directory() {
+        std::string::size_type slash = journal_path_.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : journal_path_.substr(0, slash);
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    // 書き込みスレッド: 溜まった分をまとめて書いて fdatasync し、待っている処理を呼ぶ
+    void writer_loop() {
+        trace_spans::name_thread("journal");
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !pending_.empty() || !waiters_.empty(); });
+                if (pending_.empty() && waiters_.empty() && stopping_) {
+                    return;
+                }
+            }
+
+            // 取り出しから書き込みまでを io_mutex_ の中で行い、コンパクションと重ならないようにする
+            std::string batch;
+            std::vector<std::function<void()>> done;
+            bool need_compaction = false;
+            {
+                std::lock_guard<std::mutex> io_lock(io_mutex_);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    batch.swap(pending_);
+                    done.swap(waiters_);
+                    writing_ = true;
+                    need_compaction = compact_records_ > 0 &&
+                                      records_since_compaction_ >= static_cast<size_t>(compact_records_);
+                }
+                if (!batch.empty()) {
+                    trace_spans::Span span("journal_sync");
+                    if (!write_all_fd(fd_, batch) || fdatasync(fd_) != 0) {
+                        std::cerr << "エラー: ジャーナル " << journal_path_ << " への書き込みに失敗しました。 " << strerror(errno) << std::endl;
+                    }
+                    fsyncs_++;
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                writing_ = false;
+            }
+            for (std::function<void()>& fn : done) {
+                fn();
+            }
+            if (need_compaction && provider_) {
+                ConfigMap data;
+                uint64_t version = 0;
+                provider_(data, version);
+                compact(data, version, source_stamp());
+            }
+        }
+    }
+
+    std::string journal_path_;
+    std::string snapshot_path_;
+    int fd_;
+    long compact_records_;
+    long keep_versions_;
+    StateProvider provider_;
+
+    mutable std::mutex mutex_;     // pending_, waiters_, history_ などを保護する
+    mutable std::mutex io_mutex_;  // ファイルへの書き込みを直列化する
+    std::condition_variable cv_;
+    std::string pending_;
+    std::vector<std::function<void()>> waiters_;
+    std::deque<JournalRecord> history_;
+    size_t records_since_compaction_;
+    uint64_t oldest_version_;
+    FileStamp source_stamp_;
+    bool writing_ = false;
+    bool journal_readable_ = false;
+    bool stopping_;
+    std::thread writer_;
+
+    std::atomic<uint64_t> appended_;
+    std::atomic<uint64_t> fsyncs_;
+    std::atomic<uint64_t> compactions_;
+};
+
+// 変更履歴のジャーナル（起動時に作成）
+std::unique_ptr<ConfigJournal> g_journal;
+
+int apply_config_updates_locked(const std::vector<ConfigUpdate>& updates, const std::string& source, bool log_each);
+bool schedule_config_push(size_t changed_keys);
+
+// trueなら設定が変わるたびにWPFへの送信を予約する（PUSH_ON_CHANGE）
+std::atomic<bool> g_push_on_change(false);
+
+/**
+ * @brief iniファイルを読み込む
+ * @param filename config.iniのパス
+ * @param data 読み込んだ設定
+ * @return 読み込みが成功した場合はtrue
+ */
+bool read_config_file(const std::string& filename, ConfigMap& data) {
+    dictionary* ini = iniparser_load(filename.c_str());
+    if (ini == nullptr) {
+        std::cerr << "エラー: '" << filename << "' を読み込めません。\n";
+        return false;
+    }
+
+    // セクション数を取得
+    int n_sections = iniparser_getnsec(ini);
+    
+    for (int i = 0; i < n_sections; i++) {
+        const char* section_name = iniparser_getsecname(ini, i);
+        if (section_name == nullptr) {
+            continue;
+        }
+        
+        std::string section(section_name);
+        
+        // 全キーを取得するため、iniparserの内部構造を利用
+        // より包括的なキーリストを定義
+        std::vector<std::string> common_keys = {
+            // CONFIG_SYNC section
+            "WPF_HOST", "WPF_RECV_PORT", "CPP_RECV_PORT", "WORKER_THREADS", "WORKER_QUEUE_DEPTH",
+            "EVENT_BACKEND", "CLIENT_IDLE_TIMEOUT_MS", "CLIENT_FRAME_TIMEOUT_MS", "CLIENT_MIN_RECV_RATE",
+            "MAX_CONNECTIONS_PER_IP", "MAX_FRAME_SIZE", "SHM_NAME", "JOURNAL_COMPACT_RECORDS",
+            "JOURNAL_KEEP_VERSIONS", "PUSH_COALESCE_MS", "PUSH_MAX_RATE", "PUSH_ON_CHANGE",
+            "REQUIRE_FRAME_CRC", "COMPRESS_MIN_BYTES", "COMPRESSION_LEVEL",
+            "RECV_SHARDS", "SHARD_CPU_AFFINITY", "SOCKET_PROFILE", "TCP_NODELAY", "TCP_QUICKACK",
+            "SOCKET_SNDBUF", "SOCKET_RCVBUF", "TCP_USER_TIMEOUT_MS", "TCP_KEEPALIVE", "TCP_KEEPIDLE_S",
+            "TCP_KEEPINTVL_S", "TCP_KEEPCNT", "LISTEN_BACKLOG", "CONNECT_TIMEOUT_MS", "SEND_TIMEOUT_MS",
+            "REPLICATE_FROM", "REPLICATION_WINDOW_BYTES", "CAPTURE_FILE", "CAPTURE_MAX_MB",
+            "TRACE_RING_EVENTS", "TRACE_FILE", "SUBSYSTEM_MAP", "DERIVED_KEYS", "RT_MODE", "RT_CPU",
+            "RT_PRIORITY", "RT_PREFAULT_KB", "PRESETS_FILE", "FAST_PATH_KEYS", "FAST_PATH_PORT", "FAST_PATH_GROUP",
+            "FAST_PATH_PUBLISH", "FAST_PATH_BEACON_MS", "FAST_PATH_INTERFACE",
+            // PWM section
+            "PWM_MIN", "PWM_NEUTRAL", "PWM_NORMAL_MAX", "PWM_BOOST_MAX", "PWM_FREQUENCY",
+            // JOYSTICK section
+            "DEADZONE",
+            // LED section
+            "CHANNEL", "ON_VALUE", "OFF_VALUE",
+            // THRUSTER_CONTROL section
+            "SMOOTHING_FACTOR_HORIZONTAL", "SMOOTHING_FACTOR_VERTICAL",
+            "KP_ROLL", "KP_YAW", "YAW_THRESHOLD_DPS", "YAW_GAIN",
+            // NETWORK section
+            "RECV_PORT", "SEND_PORT", "CLIENT_HOST", "CONNECTION_TIMEOUT_SECONDS",
+            // APPLICATION section
+            "SENSOR_SEND_INTERVAL", "LOOP_DELAY_US",
+            // GSTREAMER_CAMERA sections
+            "DEVICE", "PORT", "WIDTH", "HEIGHT", "FRAMERATE_NUM", "FRAMERATE_DEN",
+            "IS_H264_NATIVE_SOURCE", "RTP_PAYLOAD_TYPE", "RTP_CONFIG_INTERVAL",
+            "X264_BITRATE", "X264_TUNE", "X264_SPEED_PRESET"
+        };
+        
+        for (const std::string& key : common_keys) {
+            std::string full_key = section + ":" + key;
+            const char* value = iniparser_getstring(ini, full_key.c_str(), nullptr);
+            if (value != nullptr) {
+                data[section][key] = std::string(value);
+            }
+        }
+    }
+
+    iniparser_freedict(ini);
+    return true;
+}
+
+/**
+ * @brief iniファイルから設定を読み込む (改良版)
+ *
+ * 現在の設定との差分を1回の変更として適用する（ジャーナルにも記録される）。
+ * @param filename config.iniのパス
+ * @return 読み込みが成功した場合はtrue
+ */
+bool load_config(const std::string& filename) {
+    ConfigMap loaded;
+    if (!read_config_file(filename, loaded)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    std::vector<ConfigUpdate> changes;
+    for (const auto& section_pair : loaded) {
+        for (const auto& key_value_pair : section_pair.second) {
+            ConfigUpdate update;
+            update.section = section_pair.first;
+            update.key = key_value_pair.first;
+            update.value = key_value_pair.second;
+            changes.push_back(update);
+        }
+    }
+    // ファイルからなくなったキーは削除する
+    for (const auto& section_pair : g_config_data) {
+        for (const auto& key_value_pair : section_pair.second) {
+            ConfigMap::const_iterator it = loaded.find(section_pair.first);
+            if (it == loaded.end() || it->second.count(key_value_pair.first) == 0) {
+                ConfigUpdate update;
+                update.section = section_pair.first;
+                update.key = key_value_pair.first;
+                update.remove = true;
+                changes.push_back(update);
+            }
+        }
+    }
+    apply_config_updates_locked(changes, filename, false);
+    std::cout << "設定ファイルを " << filename << " から読み込みました。\n";
+    return true;
+}
+
+/**
+ * @brief 他のキーから計算する派生キー（DERIVED_KEYS のファイル）
+ *
+ * 1行に "[SECTION]KEY = 式" を書く。式は数値・他のキー（"[SECTION]KEY"、同じセクションなら "KEY"）・
+ * + - * /・括弧・min() max() abs() floor() ceil() round() で、派生キーを参照してもよい（循環は拒否する）。
+ * 式は読み込み時に後置記法へ変換しておき、値は読まれたときに計算してキャッシュする。
+ * 入力のキーが変わったとき（apply_config_updates_locked / set_config_value / 復元）に、
+ * そのキーに依存する派生キーのキャッシュだけを無効にする。
+ * 派生キーは get_config_value と共有メモリから生のキーと同じように読める
+ * （WPFへの送信・設定要求の返信には含めない）。g_config_mutex を保持した状態で使う。
+ */
+class DerivedKeys {
+public:
+    /**
+     * @param raw 現在の設定（同じ名前の生のキーがある定義は使わない）
+     * @return 読み込めた場合true（不正な行・循環があれば error に理由）
+     */
+    bool load(const std::string& path, const ConfigMap& raw, std::string& error) {
+        published_.clear();
+        stale_.clear();
+        if (!read_definitions(path, raw, error)) {
+            derived_.clear();
+            index_.clear();
+            dependents_.clear();
+            return false;
+        }
+        for (size_t i = 0; i < derived_.size(); i++) {
+            mark_stale(i);
+        }
+        return true;
+    }
+
+    bool empty() const { return derived_.empty(); }
+    size_t size() const { return derived_.size(); }
+
+    bool defines(const std::string& section, const std::string& key) const {
+        return !derived_.empty() && find(index_, section, key) != nullptr;
+    }
+
+    /**
+     * @brief 派生キーの値を読む（キャッシュが無効なら計算する）
+     * @return 派生キーで、値を計算できた場合true
+     */
+    bool lookup_locked(const std::string& section, const std::string& key, std::string& value) {
+        const std::vector<size_t>* found = derived_.empty() ? nullptr : find(index_, section, key);
+        if (found == nullptr) {
+            return false;
+        }
+        Derived& derived = derived_[found->front()];
+        refresh(derived);
+        value = derived.value;
+        return derived.ok;
+    }
+
+    /**
+     * @brief 入力のキーが変わった: 依存する派生キー（間接的なものを含む）のキャッシュを無効にする
+     */
+    void invalidate_locked(const std::string& section, const std::string& key) {
+        const std::vector<size_t>* dependents = derived_.empty() ? nullptr : find(dependents_, section, key);
+        if (dependents == nullptr) {
+            return;
+        }
+        for (size_t i : *dependents) {
+            Derived& derived = derived_[i];
+            // 無効なものに依存する派生キーはすでに無効（計算時は入力を先に計算するため）
+            if (derived.valid) {
+                derived.valid = false;
+                invalidations_++;
+                mark_stale(i);
+                invalidate_locked(derived.section, derived.key);
+            }
+        }
+    }
+
+    void invalidate_all_locked() {
+        for (size_t i = 0; i < derived_.size(); i++) {
+            derived_[i].valid = false;
+            mark_stale(i);
+        }
+    }
+
+    /**
+     * @brief 共有メモリへ公開する、計算できる派生キーの値
+     *
+     * 前回から無効になった派生キーだけを計算し直して反映する（有効なものには触れない）。
+     */
+    const ConfigMap& published_locked() {
+        for (size_t i : stale_) {
+            Derived& derived = derived_[i];
+            derived.stale = false;
+            refresh(derived);
+            if (derived.ok) {
+                published_[derived.section][derived.key] = derived.value;
+            } else {
+                ConfigMap::iterator section_it = published_.find(derived.section);
+                if (section_it != published_.end()) {
+                    section_it->second.erase(derived.key);
+                }
+            }
+        }
+        stale_.clear();
+        return published_;
+    }
+
+    /**
+     * @brief 定義と現在の値を表示する
+     */
+    void print_locked() {
+        for (Derived& derived : derived_) {
+            refresh(derived);
+            std::cout << "  [" << derived.section << "]" << derived.key << " = "
+                      << (derived.ok ? derived.value : std::string("（計算できません）")) << "  ← "
+                      << derived.expression << "\n";
+        }
+    }
+
+    uint64_t evaluations() const { return evaluations_.load(); }
+    uint64_t hits() const { return hits_.load(); }
+    uint64_t invalidations() const { return invalidations_.load(); }
+    uint64_t failures() const { return failures_.load(); }
+
+private:
+    struct Input {
+        std::string section;
+        std::string key;
+    };
+
+    // 後置記法の命令
+    struct Op {
+        enum Kind { NUMBER, INPUT, ADD, SUB, MUL, DIV, NEG, MIN, MAX, ABS, FLOOR, CEIL, ROUND };
+        Kind kind;
+        double number; // NUMBER の値
+        size_t index;  // INPUT の入力の位置、MIN / MAX の引数の数
+    };
+
+    struct Derived {
+        std::string section;
+        std::string key;
+        std::string expression;
+        std::vector<Op> code;
+        std::vector<Input> inputs;
+        std::string value;
+        bool valid = false; // キャッシュが有効
+        bool ok = false;    // 計算できた（入力がない・数値でない・0で割った場合はfalse）
+        bool stale = false; // stale_ に入っている
+    };
+
+    typedef std::map<std::string, std::map<std::string, std::vector<size_t>>> KeyIndex;
+
+    void mark_stale(size_t i) {
+        if (!derived_[i].stale) {
+            derived_[i].stale = true;
+            stale_.push_back(i);
+        }
+    }
+
+    static const std::vector<size_t>* find(const KeyIndex& index, const std::string& section, const std::string& key) {
+        KeyIndex::const_iterator section_it = index.find(section);
+        if (section_it == index.end()) {
+            return nullptr;
+        }
+        std::map<std::string, std::vector<size_t>>::const_iterator key_it = section_it->second.find(key);
+        return key_it == section_it->second.end() ? nullptr : &key_it->second;
+    }
+
+    static std::string trim(const std::string& text) {
+        size_t begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            return std::string();
+        }
+        return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
+    }
+
+    static bool is_name_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+    }
+
+    // 式を後置記法に変換する（再帰下降）
+    class Compiler {
+    public:
+        Compiler(Derived& derived) : derived_(derived), text_(derived.expression), pos_(0) {}
+
+        bool run(std::string& error) {
+            if (!expression() || (skip_spaces(), pos_ != text_.size())) {
+                error = error_.empty() ? "式の " + std::to_string(pos_ + 1) + " 文字目が不正です: " + text_ : error_;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        void skip_spaces() {
+            while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t')) {
+                pos_++;
+            }
+        }
+
+        bool accept(char c) {
+            skip_spaces();
+            if (pos_ < text_.size() && text_[pos_] == c) {
+                pos_++;
+                return true;
+            }
+            return false;
+        }
+
+        void emit(Op::Kind kind, double number = 0, size_t index = 0) { derived_.code.push_back(Op{kind, number, index}); }
+
+        bool expression() {
+            if (!term()) {
+                return false;
+            }
+            while (true) {
+                if (accept('+')) {
+                    if (!term()) {
+                        return false;
+                    }
+                    emit(Op::ADD);
+                } else if (accept('-')) {
+                    if (!term()) {
+                        return false;
+                    }
+                    emit(Op::SUB);
+                } else {
+                    return true;
+                }
+            }
+        }
+
+        bool term() {
+            if (!unary()) {
+                return false;
+            }
+            while (true) {
+                if (accept('*')) {
+                    if (!unary()) {
+                        return false;
+                    }
+                    emit(Op::MUL);
+                } else if (accept('/')) {
+                    if (!unary()) {
+                        return false;
+                    }
+                    emit(Op::DIV);
+                } else {
+                    return true;
+                }
+            }
+        }
+
+        bool unary() {
+            if (accept('-')) {
+                if (!unary()) {
+                    return false;
+                }
+                emit(Op::NEG);
+                return true;
+            }
+            return primary();
+        }
+
+        bool primary() {
+            skip_spaces();
+            if (pos_ >= text_.size()) {
+                return false;
+            }
+            char c = text_[pos_];
+            if (c == '(') {
+                pos_++;
+                return expression() && accept(')');
+            }
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                const char* begin = text_.c_str() + pos_;
+                char* end = nullptr;
+                double number = strtod(begin, &end);
+                if (end == begin) {
+                    return false;
+                }
+                pos_ += static_cast<size_t>(end - begin);
+                emit(Op::NUMBER, number);
+                return true;
+            }
+            std::string section = derived_.section;
+            if (c == '[') {
+                size_t close = text_.find(']', pos_);
+                if (close == std::string::npos || close == pos_ + 1) {
+                    return false;
+                }
+                section = text_.substr(pos_ + 1, close - pos_ - 1);
+                pos_ = close + 1;
+            }
+            size_t begin = pos_;
+            while (pos_ < text_.size() && is_name_char(text_[pos_])) {
+                pos_++;
+            }
+            if (pos_ == begin) {
+                return false;
+            }
+            std::string name = text_.substr(begin, pos_ - begin);
+            if (c != '[' && accept('(')) {
+                return function(name);
+            }
+            derived_.inputs.push_back(Input{section, name});
+            emit(Op::INPUT, 0, derived_.inputs.size() - 1);
+            return true;
+        }
+
+        bool function(const std::string& name) {
+            static const std::map<std::string, Op::Kind> functions = {
+                {"min", Op::MIN},     {"max", Op::MAX},   {"abs", Op::ABS},
+                {"floor", Op::FLOOR}, {"ceil", Op::CEIL}, {"round", Op::ROUND},
+            };
+            std::map<std::string, Op::Kind>::const_iterator it = functions.find(name);
+            if (it == functions.end()) {
+                error_ = "不明な関数です: " + name;
+                return false;
+            }
+            size_t count = 0;
+            do {
+                if (!expression()) {
+                    return false;
+                }
+                count++;
+            } while (accept(','));
+            if (!accept(')')) {
+                return false;
+            }
+            bool variadic = it->second == Op::MIN || it->second == Op::MAX;
+            if (variadic ? count < 2 : count != 1) {
+                error_ = name + "() の引数の数が違います";
+                return false;
+            }
+            emit(it->second, 0, count);
+            return true;
+        }
+
+        Derived& derived_;
+        const std::string& text_;
+        size_t pos_;
+        std::string error_;
+    };
+
+    // 定義を読み込み、索引を作って循環を調べる（失敗したら load が途中まで読んだ分を捨てる）
+    bool read_definitions(const std::string& path, const ConfigMap& raw, std::string& error) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "開けません";
+            return false;
+        }
+        std::string line;
+        size_t line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            size_t begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string::npos || line[begin] == '#' || line[begin] == ';') {
+                continue;
+            }
+            Derived derived;
+            size_t equals = line.find('=', begin);
+            std::string name = equals == std::string::npos ? std::string() : trim(line.substr(begin, equals - begin));
+            size_t close = name.find(']');
+            if (name.size() < 4 || name[0] != '[' || close == std::string::npos || close == 1 ||
+                close + 1 == name.size()) {
+                error = std::to_string(line_number) + " 行目: \"[セクション]キー = 式\" ではありません";
+                return false;
+            }
+            derived.section = name.substr(1, close - 1);
+            derived.key = name.substr(close + 1);
+            derived.expression = trim(line.substr(equals + 1));
+            std::string compile_error;
+            if (!compile(derived, compile_error)) {
+                error = std::to_string(line_number) + " 行目: " + compile_error;
+                return false;
+            }
+            if (find(index_, derived.section, derived.key) != nullptr) {
+                error = std::to_string(line_number) + " 行目: [" + derived.section + "]" + derived.key +
+                        " は定義済みです";
+                return false;
+            }
+            ConfigMap::const_iterator section_it = raw.find(derived.section);
+            if (section_it != raw.end() && section_it->second.count(derived.key) > 0) {
+                std::cerr << "警告: 派生キー [" << derived.section << "]" << derived.key
+                          << " は設定ファイルにあるため、定義を使いません。\n";
+                continue;
+            }
+            index_[derived.section][derived.key].push_back(derived_.size());
+            derived_.push_back(std::move(derived));
+        }
+        // 入力 → 依存する派生キーの索引を作り、循環を調べる
+        for (size_t i = 0; i < derived_.size(); i++) {
+            for (const Input& input : derived_[i].inputs) {
+                dependents_[input.section][input.key].push_back(i);
+            }
+        }
+        std::vector<int> state(derived_.size(), 0);
+        for (size_t i = 0; i < derived_.size(); i++) {
+            if (has_cycle(i, state)) {
+                error = "[" + derived_[i].section + "]" + derived_[i].key + " の式が循環しています";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool compile(Derived& derived, std::string& error) {
+        return Compiler(derived).run(error);
+    }
+
+    bool has_cycle(size_t i, std::vector<int>& state) const {
+        if (state[i] == 1) {
+            return true; // 調べている途中の派生キーに戻ってきた
+        }
+        if (state[i] == 2) {
+            return false;
+        }
+        state[i] = 1;
+        for (const Input& input : derived_[i].inputs) {
+            const std::vector<size_t>* found = find(index_, input.section, input.key);
+            if (found != nullptr && has_cycle(found->front(), state)) {
+                return true;
+            }
+        }
+        state[i] = 2;
+        return false;
+    }
+
+    void refresh(Derived& derived) {
+        if (derived.valid) {
+            hits_++;
+        } else {
+            evaluate(derived);
+        }
+    }
+
+    // 入力を読んで計算し、キャッシュする
+    void evaluate(Derived& derived) {
+        evaluations_++;
+        derived.valid = true;
+        derived.ok = false;
+        derived.value.clear();
+        std::vector<double> inputs;
+        inputs.reserve(derived.inputs.size());
+        for (const Input& input : derived.inputs) {
+            std::string text;
+            ConfigMap::const_iterator section_it = g_config_data.find(input.section);
+            std::map<std::string, std::string>::const_iterator key_it;
+            if (section_it != g_config_data.end() &&
+                (key_it = section_it->second.find(input.key)) != section_it->second.end()) {
+                text = key_it->second;
+            } else if (!lookup_locked(input.section, input.key, text)) {
+                failures_++;
+                return;
+            }
+            char* end = nullptr;
+            double number = strtod(text.c_str(), &end);
+            if (text.empty() || *end != '\0') {
+                failures_++;
+                return;
+            }
+            inputs.push_back(number);
+        }
+
+        std::vector<double> stack;
+        for (const Op& op : derived.code) {
+            switch (op.kind) {
+                case Op::NUMBER:
+                    stack.push_back(op.number);
+                    continue;
+                case Op::INPUT:
+                    stack.push_back(inputs[op.index]);
+                    continue;
+                case Op::NEG:
+                    stack.back() = -stack.back();
+                    continue;
+                case Op::ABS:
+                    stack.back() = std::fabs(stack.back());
+                    continue;
+                case Op::FLOOR:
+                    stack.back() = std::floor(stack.back());
+                    continue;
+                case Op::CEIL:
+                    stack.back() = std::ceil(stack.back());
+                    continue;
+                case Op::ROUND:
+                    stack.back() = std::round(stack.back());
+                    continue;
+                case Op::MIN:
+                case Op::MAX: {
+                    double result = stack[stack.size() - op.index];
+                    for (size_t i = stack.size() - op.index + 1; i < stack.size(); i++) {
+                        result = op.kind == Op::MIN ? std::min(result, stack[i]) : std::max(result, stack[i]);
+                    }
+                    stack.resize(stack.size() - op.index);
+                    stack.push_back(result);
+                    continue;
+                }
+                default:
+                    break;
+            }
+            double right = stack.back();
+            stack.pop_back();
+            double& left = stack.back();
+            switch (op.kind) {
+                case Op::ADD:
+                    left += right;
+                    break;
+                case Op::SUB:
+                    left -= right;
+                    break;
+                case Op::MUL:
+                    left *= right;
+                    break;
+                default:
+                    left /= right;
+                    break;
+            }
+        }
+        if (stack.size() != 1 || !std::isfinite(stack.back())) {
+            failures_++;
+            return;
+        }
+        // 整数になる値は小数点なしで書く（共有メモリでは整数として読める）
+        char text[32];
+        snprintf(text, sizeof(text), "%.15g", stack.back() == 0 ? 0.0 : stack.back());
+        derived.value = text;
+        derived.ok = true;
+    }
+
+    std::vector<Derived> derived_;
+    KeyIndex index_;      // 派生キー → derived_ の位置
+    KeyIndex dependents_; // 入力のキー → それを参照する派生キーの位置
+    ConfigMap published_;        // 共有メモリへ公開する値（published_locked で更新する）
+    std::vector<size_t> stale_;  // published_ に反映していない、無効になった派生キーの位置
+    std::atomic<uint64_t> evaluations_{0};
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> invalidations_{0};
+    std::atomic<uint64_t> failures_{0};
+};
+
+// DERIVED_KEYS（空なら派生キーなし）
+DerivedKeys g_derived_keys;
+
+bool have_derived_keys() {
+    return !g_derived_keys.empty();
+}
+
+const ConfigMap& derived_values_locked() {
+    return g_derived_keys.published_locked();
+}
+
+/**
+ * @brief 設定値を安全に取得する
+ * @param section セクション名
+ * @param key キー名
+ * @param default_value デフォルト値
+ * @return 設定値またはデフォルト値
+ */
+std::string get_config_value(const std::string& section, const std::string& key, const std::string& default_value = "") {
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    auto section_it = g_config_data.find(section);
+    if (section_it != g_config_data.end()) {
+        auto key_it = section_it->second.find(key);
+        if (key_it != section_it->second.end()) {
+            return key_it->second;
+        }
+    }
+    // 生のキーになければ派生キー（計算できなければデフォルト値）
+    std::string derived;
+    if (g_derived_keys.lookup_locked(section, key, derived)) {
+        return derived;
+    }
+    return default_value;
+}
+
+/**
+ * @brief 設定値を安全に設定する
+ * @param section セクション名
+ * @param key キー名
+ * @param value 設定する値
+ */
+void set_config_value(const std::string& section, const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    g_config_data[section][key] = value;
+    g_derived_keys.invalidate_locked(section, key);
+}
+
+/**
+ * @brief 整数の設定値を範囲チェック付きで取得する
+ * @param section セクション名
+ * @param key キー名
+ * @param default_value 未設定・不正値・範囲外の場合に使う値
+ * @param min_value 許容する最小値
+ * @param max_value 許容する最大値
+ * @return 設定値またはデフォルト値
+ */
+long get_config_int(const std::string& section, const std::string& key, long default_value,
+                    long min_value, long max_value) {
+    std::string value_str = get_config_value(section, key);
+    if (value_str.empty()) {
+        return default_value;
+    }
+    try {
+        long value = std::stol(value_str);
+        if (value < min_value || value > max_value) {
+            throw std::out_of_range("範囲外です");
+        }
+        return value;
+    } catch (const std::exception& e) {
+        std::cerr << "警告: [" << section << "] " << key << " の値が不正です: " << value_str
+                  << " (" << e.what() << ")。デフォルト値 " << default_value << " を使用します。\n";
+        return default_value;
+    }
+}
+
+/**
+ * @brief 送受信用の文字列バッファを使い回すプール
+ *
+ * 圧縮・展開や返信の組み立てで毎回大きなバッファを確保し直さないよう、
+ * 使い終わったバッファを容量を保ったまま保持しておく。
+ */
+class BufferPool {
+public:
+    BufferPool(size_t max_buffers, size_t max_capacity) : max_buffers_(max_buffers), max_capacity_(max_capacity) {}
+
+    std::string acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            return std::string();
+        }
+        std::string buffer = std::move(free_.back());
+        free_.pop_back();
+        return buffer;
+    }
+
+    void release(std::string&& buffer) {
+        if (buffer.capacity() > max_capacity_) {
+            return; // 極端に大きくなったものは手放す
+        }
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < max_buffers_) {
+            free_.push_back(std::move(buffer));
+        }
+    }
+
+private:
+    const size_t max_buffers_;
+    const size_t max_capacity_;
+    std::mutex mutex_;
+    std::vector<std::string> free_;
+};
+
+BufferPool g_buffer_pool(16, 8 * 1024 * 1024);
+
+/**
+ * @brief プールから借りたバッファ（スコープを抜けると返す）
+ */
+class PooledBuffer {
+public:
+    PooledBuffer() : buffer_(g_buffer_pool.acquire()) {}
+    ~PooledBuffer() { g_buffer_pool.release(std::move(buffer_)); }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    std::string& operator*() { return buffer_; }
+    std::string* operator->() { return &buffer_; }
+
+private:
+    std::string buffer_;
+};
+
+// 圧縮の設定（main()で設定ファイルから読み込む）
+std::atomic<long> g_compress_min_bytes(4096); // これより小さい本体は圧縮しない
+std::atomic<int> g_compression_level(3);      // zstdの圧縮レベル
+
+// 圧縮・展開の件数と時間（統計表示用）
+struct CompressionStats {
+    std::atomic<uint64_t> compressed_frames{0};
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> wire_bytes{0};
+    std::atomic<uint64_t> compress_ns{0};
+    std::atomic<uint64_t> decompressed_frames{0};
+    std::atomic<uint64_t> decompress_ns{0};
+};
+CompressionStats g_compression_stats;
+
+/**
+ * @brief 最新の直列化済み設定を取得する（公開済みならロックを取らない）
+ */
+std::shared_ptr<const ConfigText> current_config_text() {
+    std::shared_ptr<const ConfigText> text = std::atomic_load(&g_config_text);
+    if (!text) {
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        publish_config_snapshot_locked();
+        text = std::atomic_load(&g_config_text);
+    }
+    return text;
+}
+
+/**
+ * @brief 送信用のフレーム "<長さ>[ オプション]\n<本体>[CRCトレーラー]" を組み立てる
+ * @param content 本体
+ * @param extra_options ヘッダーに付けるオプション（パイプライン接続の id= など、先頭は空白）
+ * @param with_crc trueならヘッダーに crc オプションを付け、本体の後にCRC32Cのトレーラーを付ける
+ * @param codec 相手が受け取れる圧縮方式（本体が COMPRESS_MIN_BYTES 以上で、小さくなる場合だけ圧縮する）
+ */
+std::string build_frame(const std::string& content_text, const std::string& extra_options, bool with_crc,
+                        config_compression::Codec codec) {
+    trace_spans::Span span("serialize");
+    const std::string* content = &content_text;
+
+    // 確実なTCP通信のため、[メッセージ長][ オプション]\n[メッセージ本体] という形式で送信する
+    std::string options = extra_options;
+    const std::string* payload = content;
+    PooledBuffer compressed;
+    if (codec != config_compression::NONE && content->size() >= static_cast<size_t>(g_compress_min_bytes.load())) {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        bool ok = config_compression::compress(codec, content->data(), content->size(), *compressed,
+                                               g_compression_level.load());
+        if (ok && compressed->size() < content->size()) {
+            char dict[16];
+            snprintf(dict, sizeof(dict), "%08x", config_compression::dictionary_id());
+            options += std::string(" enc=") + config_compression::codec_name(codec) +
+                      " raw=" + std::to_string(content->size()) + " dict=" + dict;
+            payload = &*compressed;
+            g_compression_stats.compressed_frames++;
+            g_compression_stats.raw_bytes += content->size();
+            g_compression_stats.wire_bytes += compressed->size();
+            g_compression_stats.compress_ns += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+        }
+    }
+
+    std::string frame;
+    if (with_crc) {
+        options += " crc";
+    }
+    frame.reserve(payload->size() + options.size() + 32);
+    frame += std::to_string(payload->size());
+    frame += options;
+    frame += '\n';
+    frame += *payload;
+    if (with_crc) {
+        char trailer[16];
+        snprintf(trailer, sizeof(trailer), "%08x\n", crc32c(payload->data(), payload->size()));
+        frame += trailer;
+    }
+    return frame;
+}
+
+/**
+ * @brief 現在の設定データをWPFへ送信するための文字列形式に変換（シリアライズ）する
+ * @param with_crc trueならヘッダーに crc オプションを付け、本体の後にCRC32Cのトレーラーを付ける
+ * @param codec 相手が受け取れる圧縮方式
+ * @return シリアライズされた設定文字列
+ */
+std::string serialize_config(bool with_crc = false, config_compression::Codec codec = config_compression::NONE) {
+    std::shared_ptr<const ConfigText> text = current_config_text();
+    return build_frame(text->body, "", with_crc, codec);
+}
+
+/**
+ * @brief '*'（0文字以上）と '?'（1文字）を使ったパターンに一致するか
+ */
+bool glob_match(std::string_view pattern, std::string_view text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = std::string_view::npos; // 最後に見た '*' の位置（一致しなければここからやり直す）
+    size_t resume = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = t;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+/**
+ * @brief 設定の読み出し条件（get / subscribe のヘッダーオプション）
+ *
+ * - section=<名前> [key=<名前>] : セクション全体、またはキー1つ
+ * - match=<セクション>[:<キー>] : '*'・'?' を使ったパターン（例: match=GSTREAMER_CAMERA_*:PORT）
+ * - since=<設定バージョン>      : そのバージョンより後に変わった項目だけ（他の条件と組み合わせられる。
+ *                                 削除された項目は "=" のない "[SECTION]KEY" 行で返す）
+ */
+struct ConfigQuery {
+    std::string section;
+    std::string key;
+    std::string section_pattern;
+    std::string key_pattern; // 空ならセクション内のすべてのキー
+    bool has_since = false;
+    uint64_t since = 0;
+
+    // セクション・キーで絞り込むか（since= だけの場合はfalse）
+    bool filtered() const { return !section.empty() || !section_pattern.empty(); }
+
+    // 項目が条件（since= 以外）に当てはまるか
+    bool matches(std::string_view item_section, std::string_view item_key) const {
+        if (!section.empty()) {
+            return item_section == section && (key.empty() || item_key == key);
+        }
+        if (!section_pattern.empty()) {
+            return glob_match(section_pattern, item_section) &&
+                   (key_pattern.empty() || glob_match(key_pattern, item_key));
+        }
+        return true;
+    }
+
+    // ログ表示用
+    std::string describe() const {
+        std::string text = !section.empty()           ? "[" + section + "]" + key
+                           : !section_pattern.empty() ? section_pattern + (key_pattern.empty() ? "" : ":" + key_pattern)
+                                                      : std::string();
+        if (has_since) {
+            text += (text.empty() ? "" : " ") + std::string("since ") + std::to_string(since);
+        }
+        return text;
+    }
+};
+
+/**
+ * @brief 条件付きの読み出しの統計
+ */
+struct QueryStats {
+    std::atomic<uint64_t> queries{0};     // 条件付きの読み出し数
+    std::atomic<uint64_t> reply_bytes{0}; // 返した本体の合計
+    std::atomic<uint64_t> full_bytes{0};  // 同じ要求に設定全体を返した場合の合計
+};
+QueryStats g_query_stats;
+
+/**
+ * @brief パターンの先頭の、ワイルドカードを含まない部分
+ */
+std::string_view literal_prefix(std::string_view pattern) {
+    return pattern.substr(0, std::min(pattern.find_first_of("*?"), pattern.size()));
+}
+
+/**
+ * @brief 索引を使って読み出し条件に当てはまる行を取り出す
+ *
+ * セクション・キーは二分探索、パターンはワイルドカードより前の部分で範囲を絞ってから照合し、
+ * since= は変更の新しい順の一覧を指定バージョンまでたどる。
+ * @param reset since= が変更を記録していない古いバージョンだったため、条件に合う項目をすべて返した場合true
+ */
+std::string run_config_query(const ConfigText& text, const ConfigQuery& query, bool& reset) {
+    std::string result;
+    reset = false;
+    if (query.has_since) {
+        if (query.since >= text.horizon) {
+            for (const ConfigText::Change& change : text.changes) {
+                if (change.version <= query.since) {
+                    break;
+                }
+                if (!query.matches(change.section, change.key)) {
+                    continue;
+                }
+                if (change.line >= 0) {
+                    const ConfigText::Line& line = text.lines[static_cast<size_t>(change.line)];
+                    result.append(text.body, line.offset, line.length);
+                } else {
+                    result += "[" + change.section + "]" + change.key + "\n";
+                }
+            }
+            return result;
+        }
+        reset = true;
+        if (!query.filtered()) {
+            return text.body;
+        }
+    }
+
+    const std::vector<ConfigText::Line>& lines = text.lines;
+    // セクション名の範囲 [first, last) を探す
+    auto section_lower = [&text](const ConfigText::Line& line, std::string_view name) {
+        return text.section_of(line) < name;
+    };
+    auto section_upper = [&text](std::string_view name, const ConfigText::Line& line) {
+        return name < text.section_of(line);
+    };
+    auto key_lower = [&text](const ConfigText::Line& line, std::string_view name) { return text.key_of(line) < name; };
+    auto append_lines = [&result, &text](std::vector<ConfigText::Line>::const_iterator first,
+                                         std::vector<ConfigText::Line>::const_iterator last) {
+        if (first != last) {
+            const ConfigText::Line& back = *(last - 1);
+            result.append(text.body, first->offset, back.offset + back.length - first->offset);
+        }
+    };
+
+    if (!query.section.empty()) {
+        std::vector<ConfigText::Line>::const_iterator first =
+            std::lower_bound(lines.begin(), lines.end(), std::string_view(query.section), section_lower);
+        std::vector<ConfigText::Line>::const_iterator last =
+            std::upper_bound(first, lines.end(), std::string_view(query.section), section_upper);
+        if (query.key.empty()) {
+            append_lines(first, last);
+        } else {
+            std::vector<ConfigText::Line>::const_iterator it =
+                std::lower_bound(first, last, std::string_view(query.key), key_lower);
+            if (it != last && text.key_of(*it) == query.key) {
+                append_lines(it, it + 1);
+            }
+        }
+        return result;
+    }
+
+    std::string_view section_prefix = literal_prefix(query.section_pattern);
+    std::string_view key_prefix = literal_prefix(query.key_pattern);
+    bool exact_key = !query.key_pattern.empty() && key_prefix.size() == query.key_pattern.size();
+    std::vector<ConfigText::Line>::const_iterator first =
+        std::lower_bound(lines.begin(), lines.end(), section_prefix, section_lower);
+    while (first != lines.end() && text.section_of(*first).substr(0, section_prefix.size()) == section_prefix) {
+        std::string_view section = text.section_of(*first);
+        std::vector<ConfigText::Line>::const_iterator last =
+            std::upper_bound(first, lines.end(), section, section_upper);
+        if (glob_match(query.section_pattern, section)) {
+            if (query.key_pattern.empty()) {
+                append_lines(first, last);
+            } else {
+                std::vector<ConfigText::Line>::const_iterator it =
+                    std::lower_bound(first, last, key_prefix, key_lower);
+                for (; it != last && text.key_of(*it).substr(0, key_prefix.size()) == key_prefix; ++it) {
+                    if (exact_key ? text.key_of(*it) == key_prefix : glob_match(query.key_pattern, text.key_of(*it))) {
+                        append_lines(it, it + 1);
+                    }
+                    if (exact_key) {
+                        break;
+                    }
+                }
+            }
+        }
+        first = last;
+    }
+    return result;
+}
+
+/**
+ * @brief WPFから受信したデータを届いた分から1行ずつパースし、設定変更を溜めるパーサー
+ *
+ * 行の途中までしか届いていない分だけを保持するため、フレーム全体を
+ * バッファしなくてよい。同じキーが複数回現れた場合は最後の値だけを残すので、
+ * 溜まる量はフレームの大きさではなく変更するキーの数に比例する。
+ * 溜めた変更は finish() で取り出し、apply_config_updates() で一括適用する。
+ */
+class ConfigUpdateParser {
+public:
+    // 1行の最大長（これを超える行を含むフレームは拒否する）
+    static const size_t MAX_LINE_LENGTH = 64 * 1024;
+
+    /**
+     * @param accept_removals trueなら "=" のない "[SECTION]KEY" 行を削除として受け付ける（複製のバッチ）
+     */
+    explicit ConfigUpdateParser(bool accept_removals = false) : accept_removals_(accept_removals), failed_(false) {}
+
+    /**
+     * @brief 受信データを追加する
+     * @return 1行が長すぎる場合はfalse（以降のデータは無視する）
+     */
+    bool feed(const char* data, size_t length) {
+        if (failed_) {
+            return false;
+        }
+        const char* end = data + length;
+        while (data < end) {
+            const char* newline = static_cast<const char*>(memchr(data, '\n', end - data));
+            const char* line_end = newline != nullptr ? newline : end;
+            if (partial_.size() + (line_end - data) > MAX_LINE_LENGTH) {
+                failed_ = true;
+                partial_.clear();
+                return false;
+            }
+            if (newline == nullptr) {
+                partial_.append(data, end - data);
+                break;
+            }
+            if (partial_.empty()) {
+                parse_line(data, newline - data);
+            } else {
+                partial_.append(data, newline - data);
+                parse_line(partial_.data(), partial_.size());
+                partial_.clear();
+            }
+            data = newline + 1;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 改行で終わっていない最後の行を処理し、溜めた変更を受信順に取り出す
+     */
+    std::vector<ConfigUpdate> finish() {
+        if (!partial_.empty()) {
+            parse_line(partial_.data(), partial_.size());
+            partial_.clear();
+        }
+        index_.clear();
+        return std::move(staged_);
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    // フォーマット: [SECTION]KEY=VALUE（削除を受け付ける場合は [SECTION]KEY も）
+    void parse_line(const char* line, size_t length) {
+        if (length == 0 || line[0] != '[') {
+            return;
+        }
+        const char* line_end = line + length;
+        const char* section_end = static_cast<const char*>(memchr(line, ']', length));
+        if (section_end == nullptr) {
+            return;
+        }
+        const char* equals_pos = static_cast<const char*>(memchr(section_end, '=', line_end - section_end));
+        ConfigUpdate update;
+        update.section.assign(line + 1, section_end);
+        if (equals_pos == nullptr) {
+            if (!accept_removals_) {
+                return;
+            }
+            update.key.assign(section_end + 1, line_end);
+            update.key.erase(update.key.find_last_not_of(" \n\r\t") + 1);
+            if (update.key.empty()) {
+                return;
+            }
+            update.remove = true;
+        } else {
+            update.key.assign(section_end + 1, equals_pos);
+            update.value.assign(equals_pos + 1, line_end);
+            // 改行コードなど、末尾の空白文字を削除
+            update.value.erase(update.value.find_last_not_of(" \n\r\t") + 1);
+        }
+
+        std::pair<std::string, std::string> id(update.section, update.key);
+        std::map<std::pair<std::string, std::string>, size_t>::iterator it = index_.find(id);
+        if (it != index_.end()) {
+            staged_[it->second].value = std::move(update.value);
+            staged_[it->second].remove = update.remove;
+            return;
+        }
+        index_.insert(std::make_pair(std::move(id), staged_.size()));
+        staged_.push_back(std::move(update));
+    }
+
+    std::string partial_;
+    std::vector<ConfigUpdate> staged_;
+    std::map<std::pair<std::string, std::string>, size_t> index_;
+    bool accept_removals_;
+    bool failed_;
+};
+
+/**
+ * @brief 設定変更の購読者一覧（パイプライン接続の op=subscribe）
+ *
+ * 設定が変わるたびに、適用したスレッド（g_config_mutexを保持した状態）から各購読者の通知処理を呼ぶ。
+ * 通知処理は購読者のイベントループに送信を依頼するだけにすること。
+ */
+class SubscriptionHub {
+public:
+    typedef std::function<void(uint64_t version, const std::shared_ptr<const std::vector<ConfigUpdate>>& changes)>
+        Listener;
+
+    uint64_t add(Listener listener) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t id = ++next_id_;
+        listeners_[id] = std::move(listener);
+        count_.store(listeners_.size());
+        return id;
+    }
+
+    void remove(uint64_t id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listeners_.erase(id);
+        count_.store(listeners_.size());
+    }
+
+    bool empty() const { return count_.load() == 0; }
+    size_t size() const { return count_.load(); }
+
+    /**
+     * @brief 変更を全購読者に知らせる
+     * @param changes 実際に変わった項目（削除は remove=true）
+     */
+    void publish(uint64_t version, const std::shared_ptr<const std::vector<ConfigUpdate>>& changes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& entry : listeners_) {
+            entry.second(version, changes);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<uint64_t, Listener> listeners_;
+    uint64_t next_id_ = 0;
+    std::atomic<size_t> count_{0};
+};
+
+SubscriptionHub g_subscription_hub;
+
+/**
+ * @brief 変更の適用区分（サブシステムが動作中に反映できるか）
+ */
+enum ApplyClass {
+    APPLY_HOT = 0,     // 動作中に反映できる
+    APPLY_RESTART = 1, // サブシステムの再起動が必要
+};
+
+const char* apply_class_name(ApplyClass apply_class) {
+    return apply_class == APPLY_HOT ? "hot" : "restart";
+}
+
+// 変更が影響するサブシステムと適用区分（同じサブシステムに両方が当たれば restart）
+typedef std::map<std::string, ApplyClass> SubsystemImpact;
+
+/**
+ * @brief 設定キーからサブシステムへの対応（SUBSYSTEM_MAP のファイル）
+ *
+ * 1行に "<サブシステム> <hot|restart> <セクション>:<キー>" を書く（セクション・キーには * と ? が使える）。
+ * 1つのキーが複数のサブシステムに当たってもよく、同じサブシステムに複数の行が当たる場合は
+ * 後の行の適用区分を使う（広い指定の後に例外を書ける）。どの行にも当たらないキーは
+ * unmapped（restart）として扱う。起動時に読み込み、以降は変更しない。
+ */
+class SubsystemMap {
+public:
+    static constexpr const char* UNMAPPED = "unmapped";
+
+    /**
+     * @return 読み込めた場合true（不正な行があれば error に行番号と理由）
+     */
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "開けません";
+            return false;
+        }
+        std::string line;
+        size_t line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            std::istringstream fields(line);
+            Rule rule;
+            std::string apply_class;
+            std::string target;
+            if (!(fields >> rule.subsystem) || rule.subsystem[0] == '#' || rule.subsystem[0] == ';') {
+                continue;
+            }
+            std::string extra;
+            if (!(fields >> apply_class >> target) || (fields >> extra)) {
+                error = std::to_string(line_number) + " 行目: \"<サブシステム> <hot|restart> <セクション>:<キー>\" ではありません";
+                return false;
+            }
+            if (rule.subsystem.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_") !=
+                std::string::npos) {
+                error = std::to_string(line_number) + " 行目: サブシステム名が不正です: " + rule.subsystem;
+                return false;
+            }
+            if (apply_class == "hot") {
+                rule.apply_class = APPLY_HOT;
+            } else if (apply_class == "restart") {
+                rule.apply_class = APPLY_RESTART;
+            } else {
+                error = std::to_string(line_number) + " 行目: 適用区分は hot か restart です: " + apply_class;
+                return false;
+            }
+            size_t colon = target.find(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == target.size()) {
+                error = std::to_string(line_number) + " 行目: 対象は <セクション>:<キー> です: " + target;
+                return false;
+            }
+            rule.section_pattern = target.substr(0, colon);
+            rule.key_pattern = target.substr(colon + 1);
+            subsystems_.insert(rule.subsystem);
+            rules_.push_back(std::move(rule));
+        }
+        return true;
+    }
+
+    /**
+     * @brief 1つのキーが影響するサブシステムを impact に加える
+     */
+    void add_impact(const std::string& section, const std::string& key, SubsystemImpact& impact) const {
+        SubsystemImpact matched;
+        for (const Rule& rule : rules_) {
+            if (glob_match(rule.section_pattern, section) && glob_match(rule.key_pattern, key)) {
+                matched[rule.subsystem] = rule.apply_class; // 後の行が優先
+            }
+        }
+        if (matched.empty()) {
+            matched[UNMAPPED] = APPLY_RESTART;
+        }
+        for (const auto& entry : matched) {
+            ApplyClass& current = impact.emplace(entry.first, APPLY_HOT).first->second;
+            current = std::max(current, entry.second);
+        }
+    }
+
+    size_t rule_count() const { return rules_.size(); }
+    size_t subsystem_count() const { return subsystems_.size(); }
+
+private:
+    struct Rule {
+        std::string subsystem;
+        ApplyClass apply_class = APPLY_RESTART;
+        std::string section_pattern;
+        std::string key_pattern;
+    };
+
+    std::vector<Rule> rules_;
+    std::set<std::string> subsystems_;
+};
+
+// SUBSYSTEM_MAP（空なら影響の判定をしない）
+std::unique_ptr<const SubsystemMap> g_subsystem_map;
+
+/**
+ * @brief 影響の一覧を "camera2:hot,thruster:restart" の形にする（通知の affects= に使う）
+ */
+std::string format_subsystem_impact(const SubsystemImpact& impact) {
+    std::string text;
+    for (const auto& entry : impact) {
+        if (!text.empty()) {
+            text += ',';
+        }
+        text += entry.first + ":" + apply_class_name(entry.second);
+    }
+    return text;
+}
+
+/**
+ * @brief サブシステムへの影響と反映までの時間（統計表示用）
+ *
+ * 反映までの時間は、変更を適用してから、購読者が通知を反映して op=ack version= で
+ * 知らせるまで。通知に restart が含まれていれば restart、それ以外は hot に数える。
+ */
+class SubsystemStats {
+public:
+    void record_batch(const SubsystemImpact& impact) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& entry : impact) {
+            changes_[entry.first][entry.second]++;
+        }
+    }
+
+    void record_effect(ApplyClass apply_class, std::chrono::steady_clock::duration elapsed) {
+        uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        std::lock_guard<std::mutex> lock(mutex_);
+        EffectTimes& times = effects_[apply_class];
+        times.count++;
+        times.total_us += us;
+        times.max_us = std::max(times.max_us, us);
+    }
+
+    void print() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (changes_.empty()) {
+            return;
+        }
+        std::cout << "サブシステムごとの変更:";
+        for (const auto& entry : changes_) {
+            std::cout << " " << entry.first << " " << entry.second[APPLY_HOT] + entry.second[APPLY_RESTART]
+                      << " 回（restart " << entry.second[APPLY_RESTART] << "）";
+        }
+        std::cout << "\n";
+        for (int apply_class = APPLY_HOT; apply_class <= APPLY_RESTART; apply_class++) {
+            const EffectTimes& times = effects_[apply_class];
+            if (times.count > 0) {
+                std::cout << std::fixed << std::setprecision(1) << "反映までの時間（"
+                          << apply_class_name(static_cast<ApplyClass>(apply_class)) << "）: " << times.count
+                          << " 件 / 平均 " << times.total_us / 1000.0 / times.count << " ms / 最大 "
+                          << times.max_us / 1000.0 << " ms\n";
+                std::cout.unsetf(std::ios::fixed);
+            }
+        }
+    }
+
+private:
+    struct EffectTimes {
+        uint64_t count = 0;
+        uint64_t total_us = 0;
+        uint64_t max_us = 0;
+    };
+
+    std::mutex mutex_;
+    std::map<std::string, std::array<uint64_t, 2>> changes_; // サブシステム → 適用区分ごとのバッチ数
+    EffectTimes effects_[2];
+};
+SubsystemStats g_subsystem_stats;
+
+// UDPの高速経路（FAST_PATH_KEYS、定義は FastPathChannel）
+bool is_fast_path_key(const std::string& section, const std::string& key);
+void publish_fast_path_locked(uint64_t version);
+
+/**
+ * @brief 設定変更を一括で適用する（g_config_mutexを保持した状態で呼ぶ）
+ *
+ * 変更があった場合は設定バージョンを1つ進め、変更した項目をジャーナルに記録し、
+ * 共有メモリへ公開する。高速経路の対象の項目が変わった場合は、その現在値もUDPで送る。
+ * @param updates 適用する変更（同じバッチ内は受信順）
+ * @param source 変更元（送信元アドレスやファイル名。ジャーナルに記録する）
+ * @param log_each trueなら項目ごとに更新ログを出力する
+ * @return 実際に値が変わった項目数
+ */
+int apply_config_updates_locked(const std::vector<ConfigUpdate>& updates, const std::string& source, bool log_each) {
+    trace_spans::Span span("apply");
+    int updates_count = 0;
+    uint64_t version = g_config_version.load() + 1;
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::vector<JournalRecord> records;
+    // 購読者がいる場合だけ、実際に変わった項目を集める
+    std::shared_ptr<std::vector<ConfigUpdate>> changed;
+    if (!g_subscription_hub.empty()) {
+        changed.reset(new std::vector<ConfigUpdate>());
+        changed->reserve(updates.size());
+    }
+    if (g_journal) {
+        records.reserve(updates.size());
+    }
+    SubsystemImpact impact;
+    bool fast_path_changed = false;
+
+    for (const ConfigUpdate& update : updates) {
+        if (g_derived_keys.defines(update.section, update.key)) {
+            std::cerr << "警告: [" << update.section << "] " << update.key
+                      << " は派生キー（DERIVED_KEYS）のため変更できません。\n";
+            continue;
+        }
+        ConfigMap::iterator section_it = g_config_data.find(update.section);
+        std::map<std::string, std::string>::iterator key_it;
+        bool exists = section_it != g_config_data.end() &&
+                      (key_it = section_it->second.find(update.key)) != section_it->second.end();
+        std::string old_value = exists ? key_it->second : std::string();
+
+        if (update.remove) {
+            if (!exists) {
+                continue;
+            }
+            section_it->second.erase(key_it);
+            if (section_it->second.empty()) {
+                g_config_data.erase(section_it);
+            }
+            if (log_each) {
+                std::cout << "設定削除: [" << update.section << "] " << update.key << " (旧値: " << old_value << ")" << std::endl;
+            }
+        } else {
+            // 値が変更された場合のみ更新ログを出力
+            if (exists && old_value == update.value) {
+                continue;
+            }
+            if (exists) {
+                key_it->second = update.value; // 既存の値の領域を使い回す
+            } else {
+                g_config_data[update.section][update.key] = update.value;
+            }
+            if (log_each) {
+                std::cout << "設定更新: [" << update.section << "] " << update.key << " = " << update.value;
+                if (!old_value.empty()) {
+                    std::cout << " (旧値: " << old_value << ")";
+                }
+                std::cout << std::endl;
+            }
+        }
+        updates_count++;
+        g_key_changes[update.section][update.key] = KeyChange{version, update.remove};
+        g_derived_keys.invalidate_locked(update.section, update.key);
+        fast_path_changed = fast_path_changed || is_fast_path_key(update.section, update.key);
+        if (changed) {
+            changed->push_back(update);
+        }
+        if (g_subsystem_map) {
+            g_subsystem_map->add_impact(update.section, update.key, impact);
+        }
+
+        if (g_journal) {
+            JournalRecord record;
+            record.version = version;
+            record.time_ms = now_ms;
+            record.source = source;
+            record.section = update.section;
+            record.key = update.key;
+            record.had_old = exists;
+            record.has_new = !update.remove;
+            record.old_value = old_value;
+            record.new_value = update.remove ? std::string() : update.value;
+            records.push_back(std::move(record));
+        }
+    }
+
+    if (updates_count > 0) {
+        g_config_version.store(version);
+        if (g_journal) {
+            g_journal->append(records);
+        }
+        std::cout << "合計 " << updates_count << " 項目の設定を更新しました。(設定バージョン " << version << ")\n";
+        if (!impact.empty()) {
+            // 下流はここに挙がったサブシステムだけを設定し直せばよい
+            std::cout << "影響するサブシステム: " << format_subsystem_impact(impact) << "\n";
+            g_subsystem_stats.record_batch(impact);
+        }
+        publish_config_snapshot_locked();
+        if (fast_path_changed) {
+            publish_fast_path_locked(version);
+        }
+        if (changed) {
+            g_subscription_hub.publish(version, changed);
+        }
+        if (g_push_on_change.load()) {
+            schedule_config_push(static_cast<size_t>(updates_count));
+        }
+    } else {
+        std::cout << "設定に変更はありませんでした。\n";
+    }
+    return updates_count;
+}
+
+/**
+ * @brief パース済みの設定変更を一括で適用する
+ *
+ * 1回の受信データは1つのバッチとしてロック内でまとめて適用し、
+ * 変更があった場合は設定バージョンを1つ進める。
+ * @param updates ConfigUpdateParser::finish()の結果
+ * @param source 送信元（ジャーナルに記録する）
+ * @return 実際に値が変わった項目数
+ */
+int apply_config_updates(const std::vector<ConfigUpdate>& updates, const std::string& source) {
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    return apply_config_updates_locked(updates, source, true);
+}
+
+/**
+ * @brief 条件付き更新（op=cas）で衝突した項目
+ */
+struct CasConflict {
+    std::string section;
+    std::string key;
+    uint64_t version; // その項目が最後に変わった設定バージョン
+    bool exists;
+    std::string value; // 現在の値（exists のときだけ）
+};
+
+/**
+ * @brief 条件付き更新の結果
+ */
+struct CasResult {
+    size_t accepted = 0; // 受け付けた項目数（すでに同じ値だったものを含む）
+    std::vector<CasConflict> conflicts;
+};
+
+/**
+ * @brief 条件付き更新の要求（基準の版）と結果
+ */
+struct CasRequest {
+    std::vector<uint64_t> bases; // 項目ごとの基準の版
+    bool partial = false;
+    CasResult result;
+};
+
+// 条件付き更新の件数（統計表示用）
+struct CasStats {
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> rejected{0};       // 衝突があり、何も適用しなかった要求
+    std::atomic<uint64_t> conflicted_keys{0};
+};
+CasStats g_cas_stats;
+
+/**
+ * @brief 項目が最後に変わった設定バージョン（g_config_mutexを保持した状態で呼ぶ）
+ *
+ * 起動・復元後に変わっていない項目は、それ以前のどこかで変わったとしか分からないため g_key_change_horizon を返す。
+ */
+uint64_t key_version_locked(const std::string& section, const std::string& key) {
+    std::map<std::string, std::map<std::string, KeyChange>>::const_iterator section_it = g_key_changes.find(section);
+    if (section_it != g_key_changes.end()) {
+        std::map<std::string, KeyChange>::const_iterator key_it = section_it->second.find(key);
+        if (key_it != section_it->second.end()) {
+            return key_it->second.version;
+        }
+    }
+    return g_key_change_horizon;
+}
+
+/**
+ * @brief 条件付きで設定変更を適用する（op=cas）
+ *
+ * 各項目は、最後に変わった設定バージョンが基準の版以下（＝クライアントが読んだ後に誰も変えていない）なら
+ * 適用する。基準の版は読み出しの返信の version= をそのまま使える。すでに同じ値の項目は、条件に関わらず
+ * 受け付けたものとする（返信を失って再送しても衝突しない）。派生キーは書き込めないため、常に衝突として
+ * 計算した現在値を返す。partial でなければ、1つでも衝突すると何も適用しない。
+ * g_config_mutex を保持した状態で使うので、判定と適用の間に他の更新が入ることはない。
+ * @param bases 項目ごとの基準の版（updates と同じ順）
+ * @return 実際に値が変わった項目数
+ */
+int apply_config_updates_if_unchanged_locked(const std::vector<ConfigUpdate>& updates,
+                                             const std::vector<uint64_t>& bases, bool partial,
+                                             const std::string& source, CasResult& result) {
+    g_cas_stats.requests++;
+    std::vector<ConfigUpdate> accepted;
+    accepted.reserve(updates.size());
+    for (size_t i = 0; i < updates.size(); i++) {
+        const ConfigUpdate& update = updates[i];
+        uint64_t version = key_version_locked(update.section, update.key);
+        if (g_derived_keys.defines(update.section, update.key)) {
+            // 派生キーは apply_config_updates_locked が書き込まないので、受け付けずに衝突として現在値を返す
+            std::string value;
+            bool computed = g_derived_keys.lookup_locked(update.section, update.key, value);
+            result.conflicts.push_back(CasConflict{update.section, update.key, version, computed, value});
+            std::cout << "条件付き更新の衝突: [" << update.section << "] " << update.key
+                      << " は派生キー（DERIVED_KEYS）のため変更できません\n";
+            continue;
+        }
+        ConfigMap::const_iterator section_it = g_config_data.find(update.section);
+        std::map<std::string, std::string>::const_iterator key_it;
+        bool exists = section_it != g_config_data.end() &&
+                      (key_it = section_it->second.find(update.key)) != section_it->second.end();
+        if (version <= bases[i] || (exists && key_it->second == update.value)) {
+            accepted.push_back(update);
+            continue;
+        }
+        result.conflicts.push_back(
+            CasConflict{update.section, update.key, version, exists, exists ? key_it->second : std::string()});
+        std::cout << "条件付き更新の衝突: [" << update.section << "] " << update.key << "（基準の版 " << bases[i]
+                  << "、現在の版 " << version << (exists ? "、現在の値 " + key_it->second : std::string()) << "）\n";
+    }
+    g_cas_stats.conflicted_keys += result.conflicts.size();
+    if (!result.conflicts.empty() && !partial) {
+        g_cas_stats.rejected++;
+        std::cout << "衝突があるため、" << updates.size() << " 項目の条件付き更新を適用しませんでした。\n";
+        return 0;
+    }
+    result.accepted = accepted.size();
+    if (accepted.empty()) {
+        return 0;
+    }
+    return apply_config_updates_locked(accepted, source, true);
+}
+
+/**
+ * @brief 名前付きの設定プリセット（PRESETS_FILE のファイル）
+ *
+ * "preset <名前>" の行で始まり、続く "[SECTION]KEY=VALUE" の行がそのプリセットの値になる
+ * （受信データと同じ形式）。起動時に検証・整列した変更の一覧にしておき、切り替えでは現在値と
+ * 違う項目だけを1つのバッチとして適用する。設定バージョンは1つだけ進み、読み手（直列化済み
+ * スナップショットのポインタ・共有メモリ）と購読者には途中の状態を見せず、差分1回だけが届く。
+ * 起動時に読み込み、以降は変更しない。
+ */
+class PresetLibrary {
+public:
+    /**
+     * @param known 現在の設定（ないキーを指定しているプリセットは警告する）
+     * @return 読み込めた場合true（error に理由）
+     */
+    bool load(const std::string& path, const ConfigMap& known, std::string& error) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            error = "開けません";
+            return false;
+        }
+        std::string line;
+        std::string name;
+        std::unique_ptr<ConfigUpdateParser> parser;
+        size_t line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            size_t begin = line.find_first_not_of(" \t\r");
+            if (begin == std::string::npos || line[begin] == '#' || line[begin] == ';') {
+                continue;
+            }
+            if (line.compare(begin, 7, "preset ") == 0) {
+                if (parser) {
+                    add(name, parser->finish(), known);
+                }
+                name = line.substr(begin + 7);
+                name.erase(name.find_last_not_of(" \t\r") + 1);
+                name.erase(0, name.find_first_not_of(" \t"));
+                if (name.empty() || name.size() > 64 || presets_.count(name) > 0 ||
+                    name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") !=
+                        std::string::npos) {
+                    error = std::to_string(line_number) + " 行目: プリセット名が不正か、定義済みです: " + name;
+                    return false;
+                }
+                parser.reset(new ConfigUpdateParser());
+                continue;
+            }
+            if (!parser || line[begin] != '[' || line.find('=') == std::string::npos) {
+                error = std::to_string(line_number) + " 行目: \"preset <名前>\" の後の \"[セクション]キー=値\" ではありません";
+                return false;
+            }
+            line += '\n';
+            parser->feed(line.data() + begin, line.size() - begin);
+        }
+        if (parser) {
+            add(name, parser->finish(), known);
+        }
+        return true;
+    }
+
+    size_t size() const { return presets_.size(); }
+
+    /**
+     * @return プリセットの変更の一覧（(セクション, キー) 順。なければ nullptr）
+     */
+    const std::vector<ConfigUpdate>* find(const std::string& name) const {
+        std::map<std::string, std::vector<ConfigUpdate>>::const_iterator it = presets_.find(name);
+        return it == presets_.end() ? nullptr : &it->second;
+    }
+
+    /**
+     * @brief プリセット名と項目数の一覧（表示用）
+     */
+    std::string describe() const {
+        std::string text;
+        for (const auto& preset : presets_) {
+            text += (text.empty() ? "" : ", ") + preset.first + "(" + std::to_string(preset.second.size()) + ")";
+        }
+        return text;
+    }
+
+private:
+    void add(const std::string& name, std::vector<ConfigUpdate> updates, const ConfigMap& known) {
+        std::sort(updates.begin(), updates.end(), [](const ConfigUpdate& a, const ConfigUpdate& b) {
+            return a.section < b.section || (a.section == b.section && a.key < b.key);
+        });
+        for (const ConfigUpdate& update : updates) {
+            ConfigMap::const_iterator section_it = known.find(update.section);
+            if (section_it == known.end() || section_it->second.count(update.key) == 0) {
+                std::cerr << "警告: プリセット " << name << " の [" << update.section << "] " << update.key
+                          << " は現在の設定にありません（切り替えると追加されます）。\n";
+            }
+        }
+        presets_[name] = std::move(updates);
+    }
+
+    std::map<std::string, std::vector<ConfigUpdate>> presets_;
+};
+
+// PRESETS_FILE（空なら使わない）。起動時に読み込み、以降は変更しない
+std::unique_ptr<const PresetLibrary> g_presets;
+
+// 最後に切り替えたプリセット（g_config_mutexで保護）
+std::string g_active_preset;
+uint64_t g_active_preset_version = 0;
+
+// プリセットの切り替えの件数と所要時間（統計表示用）
+struct PresetStats {
+    std::atomic<uint64_t> switches{0};
+    std::atomic<uint64_t> changed_keys{0};
+    std::atomic<uint64_t> last_us{0}; // ロックを取ってから公開し終えるまで
+    std::atomic<uint64_t> max_us{0};
+};
+PresetStats g_preset_stats;
+
+/**
+ * @brief 設定をプリセットに切り替える（"preset <名前>" コマンド・op=preset）
+ * @param source ジャーナルに記録する変更元
+ * @return 変わった項目数（プリセットがなければ -1）
+ */
+int switch_to_preset(const std::string& name, const std::string& source) {
+    const std::vector<ConfigUpdate>* preset = g_presets ? g_presets->find(name) : nullptr;
+    if (preset == nullptr) {
+        std::cerr << "エラー: プリセット " << name << " はありません。\n";
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    // 現在値と違う項目だけを1つのバッチにする（同じ値の項目でバージョンや通知を増やさない）
+    std::vector<ConfigUpdate> delta;
+    delta.reserve(preset->size());
+    for (const ConfigUpdate& update : *preset) {
+        ConfigMap::const_iterator section_it = g_config_data.find(update.section);
+        std::map<std::string, std::string>::const_iterator key_it;
+        if (section_it == g_config_data.end() ||
+            (key_it = section_it->second.find(update.key)) == section_it->second.end() ||
+            key_it->second != update.value) {
+            delta.push_back(update);
+        }
+    }
+    std::cout << "プリセット " << name << " に切り替えます（" << preset->size() << " 項目中 " << delta.size()
+              << " 項目が変わります）。\n";
+    int changed = delta.empty() ? 0 : apply_config_updates_locked(delta, source + " preset " + name, true);
+    g_active_preset = name;
+    g_active_preset_version = g_config_version.load();
+    uint64_t elapsed_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+    g_preset_stats.switches++;
+    g_preset_stats.changed_keys += static_cast<uint64_t>(changed);
+    g_preset_stats.last_us.store(elapsed_us);
+    if (elapsed_us > g_preset_stats.max_us.load()) {
+        g_preset_stats.max_us.store(elapsed_us);
+    }
+    return changed;
+}
+
+/**
+ * @brief 受信データの適用順序を受信完了順に保つためのゲート
+ *
+ * 受信完了時に整理券を取り、適用処理をワーカーから submit() で預ける。
+ * 預けられた処理は整理券の順番が来たものから順に実行する。
+ * ワーカーが順番待ちでブロックしないよう、先行する整理券の処理を終えた
+ * スレッドが、続けて実行できる処理をまとめて実行する。
+ * これにより設定バージョンは受信完了順に単調に進む。
+ */
+class ApplyOrderGate {
+public:
+    ApplyOrderGate() : next_ticket_(0), now_serving_(0), draining_(false) {}
+
+    /**
+     * @brief 整理券を発行する（受信完了時に呼ぶ）
+     * @return 整理券番号
+     */
+    uint64_t take_ticket() {
+        return next_ticket_.fetch_add(1);
+    }
+
+    /**
+     * @brief 整理券に対応する適用処理を預け、順番が来ていれば実行する
+     * @param ticket take_ticket()で得た整理券番号
+     * @param apply 順番が来たときに実行する処理（空なら整理券を飛ばすだけ）
+     */
+    void submit(uint64_t ticket, std::function<void()> apply) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting_[ticket] = std::move(apply);
+        if (draining_) {
+            return; // 実行中のスレッドが続けて処理する
+        }
+        draining_ = true;
+
+        std::map<uint64_t, std::function<void()>>::iterator it;
+        while ((it = waiting_.find(now_serving_)) != waiting_.end()) {
+            std::function<void()> next = std::move(it->second);
+            waiting_.erase(it);
+            lock.unlock();
+            if (next) {
+                try {
+                    next();
+                } catch (const std::exception& e) {
+                    std::cerr << "エラー: 設定適用中に例外が発生しました: " << e.what() << std::endl;
+                }
+            }
+            lock.lock();
+            now_serving_++;
+        }
+        draining_ = false;
+    }
+
+    /**
+     * @brief 適用しないことになった整理券を飛ばす（過負荷で投入できなかった場合など）
+     * @param ticket take_ticket()で得た整理券番号
+     */
+    void skip(uint64_t ticket) {
+        submit(ticket, std::function<void()>());
+    }
+
+private:
+    std::atomic<uint64_t> next_ticket_;
+    uint64_t now_serving_;
+    bool draining_;
+    std::map<uint64_t, std::function<void()>> waiting_;
+    std::mutex mutex_;
+};
+
+ApplyOrderGate g_apply_gate;
+
+/**
+ * @brief リアルタイム動作の設定（RT_MODE / RT_CPU / RT_PRIORITY / RT_PREFAULT_KB）
+ *
+ * 負荷の高いPiで受信スレッドがスケジュールされなかったりページフォルトで止まったりして、
+ * 更新の反映が数十ミリ秒遅れるのを防ぐ。有効にすると次のようにする:
+ * - mlockall でメモリを固定する（これ以降に作るスレッドのスタックも固定される）
+ * - ヒープを RT_PREFAULT_KB だけ先に触っておき、解放してもOSへ返さない
+ *   （適用処理での確保は触り済みのページから取られ、ページフォルトを起こさない）
+ * - 受信スレッドを RT_CPU に固定し、SCHED_FIFO（RT_PRIORITY）で動かす。
+ *   パース・適用を行うワーカーは1つ低い優先度の SCHED_FIFO にする
+ * 権限（CAP_SYS_NICE / CAP_IPC_LOCK、または RLIMIT_RTPRIO / RLIMIT_MEMLOCK）がなければ警告して通常の動作を続ける。
+ */
+struct RealtimeSettings {
+    bool enabled = false;
+    int cpu = -1;           // 受信スレッドを固定するCPU（シャードnは cpu + n。-1なら固定しない）
+    int priority = 50;      // 受信スレッドの SCHED_FIFO 優先度
+    long prefault_kb = 8192; // 先に触っておくヒープ
+};
+
+RealtimeSettings g_realtime;
+
+// リアルタイム動作の状態（統計表示用）
+struct RealtimeState {
+    std::atomic<bool> memory_locked{false};
+    std::atomic<int> fifo_threads{0}; // SCHED_FIFO にできたスレッド数
+    long start_minor_faults = 0;      // 起動を終えた時点のページフォルト数
+    long start_major_faults = 0;
+};
+
+RealtimeState g_realtime_state;
+
+RealtimeSettings load_realtime_settings() {
+    RealtimeSettings settings;
+    settings.enabled = get_config_int("CONFIG_SYNC", "RT_MODE", 0, 0, 1) != 0;
+    long cpu_count = std::max(1u, std::thread::hardware_concurrency());
+    settings.cpu = static_cast<int>(get_config_int("CONFIG_SYNC", "RT_CPU", -1, -1, cpu_count - 1));
+    settings.priority = static_cast<int>(get_config_int("CONFIG_SYNC", "RT_PRIORITY", 50, 2,
+                                                        sched_get_priority_max(SCHED_FIFO)));
+    settings.prefault_kb = get_config_int("CONFIG_SYNC", "RT_PREFAULT_KB", 8192, 0, 1L << 20);
+    return settings;
+}
+
+/**
+ * @brief スタックを深さ bytes まで触っておく（固定前に伸ばしておけば、以降の呼び出しでフォルトしない）
+ */
+void prefault_stack(size_t bytes) {
+    unsigned char* area = static_cast<unsigned char*>(alloca(bytes));
+    for (size_t i = 0; i < bytes; i += 4096) {
+        static_cast<volatile unsigned char*>(area)[i] = 0;
+    }
+}
+
+/**
+ * @brief メモリを固定し、ヒープを確保済みの状態にする（スレッドを作る前に、mainから1回呼ぶ）
+ */
+void enter_realtime_mode(const RealtimeSettings& settings) {
+    // 解放したメモリをOSへ返さず、大きな確保も mmap ではなくヒープから取る。
+    // アリーナを1つにして、どのスレッドの確保も触り済みのヒープから取られるようにする
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+
+    prefault_stack(256 * 1024);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+        g_realtime_state.memory_locked.store(true);
+    } else {
+        std::cerr << "警告: メモリを固定できませんでした（CAP_IPC_LOCK または RLIMIT_MEMLOCK を確認してください）。 "
+                  << strerror(errno) << std::endl;
+    }
+
+    if (settings.prefault_kb > 0) {
+        size_t bytes = static_cast<size_t>(settings.prefault_kb) * 1024;
+        char* area = static_cast<char*>(malloc(bytes));
+        if (area != nullptr) {
+            for (size_t i = 0; i < bytes; i += 4096) {
+                area[i] = 0;
+            }
+            free(area);
+        }
+    }
+
+    std::cout << "リアルタイム動作: メモリ固定 " << (g_realtime_state.memory_locked.load() ? "あり" : "なし")
+              << " / ヒープ " << settings.prefault_kb << " KB 確保済み / 受信スレッド SCHED_FIFO "
+              << settings.priority;
+    if (settings.cpu >= 0) {
+        std::cout << "（CPU " << settings.cpu << "）";
+    }
+    std::cout << "\n";
+}
+
+/**
+ * @brief ページフォルト数の基準を取る（スレッドを作り終えた後。以降のフォルトを統計に出す）
+ */
+void mark_realtime_baseline() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        g_realtime_state.start_minor_faults = usage.ru_minflt;
+        g_realtime_state.start_major_faults = usage.ru_majflt;
+    }
+}
+
+/**
+ * @brief 呼び出したスレッドを SCHED_FIFO にする（リアルタイム動作でなければ何もしない）
+ * @param label 失敗時の警告に使うスレッド名
+ */
+void make_thread_realtime(int priority, const std::string& label) {
+    if (!g_realtime.enabled) {
+        return;
+    }
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (result != 0) {
+        std::cerr << "警告: " << label << "を SCHED_FIFO（優先度 " << priority
+                  << "）にできませんでした（CAP_SYS_NICE または RLIMIT_RTPRIO を確認してください）。 "
+                  << strerror(result) << std::endl;
+        return;
+    }
+    prefault_stack(256 * 1024);
+    g_realtime_state.fifo_threads++;
+}
+
+/**
+ * @brief UDPの高速経路の設定（FAST_PATH_*）
+ */
+struct FastPathSettings {
+    std::set<std::pair<std::string, std::string>> keys; // (セクション, キー)。キーが "*" ならセクション全体
+    int port = 0;                   // 変更を受信するポート（0で受信しない）
+    std::string group;              // 受信で参加するマルチキャストグループ（空ならユニキャストのみ）
+    std::string publish;            // 対象の項目の現在値を送る先（host:port、空なら送らない）
+    std::string interface_address;  // マルチキャストに使うインターフェースのアドレス
+    long beacon_ms = 1000;          // 現在値をまとめて送る間隔
+};
+
+FastPathSettings load_fast_path_settings() {
+    FastPathSettings settings;
+    std::istringstream keys(get_config_value("CONFIG_SYNC", "FAST_PATH_KEYS", ""));
+    std::string item;
+    while (std::getline(keys, item, ',')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (item.empty()) {
+            continue;
+        }
+        size_t colon = item.find(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == item.size()) {
+            std::cerr << "警告: FAST_PATH_KEYS の " << item << " は SECTION:KEY（または SECTION:*）の形式ではありません。\n";
+            continue;
+        }
+        settings.keys.insert(std::make_pair(item.substr(0, colon), item.substr(colon + 1)));
+    }
+    settings.port = static_cast<int>(get_config_int("CONFIG_SYNC", "FAST_PATH_PORT", 0, 0, 65535));
+    settings.group = get_config_value("CONFIG_SYNC", "FAST_PATH_GROUP", "");
+    settings.publish = get_config_value("CONFIG_SYNC", "FAST_PATH_PUBLISH", "");
+    settings.interface_address = get_config_value("CONFIG_SYNC", "FAST_PATH_INTERFACE", "");
+    settings.beacon_ms = get_config_int("CONFIG_SYNC", "FAST_PATH_BEACON_MS", 1000, 10, 60000);
+    return settings;
+}
+
+/**
+ * @brief 調整用の項目を UDP で受け付け、現在値を配る高速経路（FAST_PATH_KEYS）
+ *
+ * 対象の項目（少数の、連続して変える調整値）だけを、1回ごとのTCP接続なしに受け付ける。
+ * データグラムの形式と規則は FastPath.h を参照。
+ * - 受信: 送り手ごとの seq で古いもの・重複を捨て、対象外の項目は無視して、
+ *   通常の適用処理（apply_config_updates_locked）で1つのバッチとして適用する。
+ *   TCP が正式な経路なので、base= より後に UDP 以外で変わった項目は上書きしない（base= のない変更要求は捨てる）。
+ *   1回の待ちで処理するデータグラムは MAX_DATAGRAMS_PER_TURN までとし、送り続けられてもビーコンを止めない。
+ *   適用の確認は返さない（送り手は状態のデータグラムで反映を確かめ、見えなければ最新値を送り直す）。
+ *   送り直しで値が変わらなかった場合は、その場で状態を送り直す。
+ * - 送信: 対象の項目が変わるたびに、すべての対象の現在値を version= 付きの状態として送る。
+ *   失われても追いつけるよう、FAST_PATH_BEACON_MS ごとにも同じ状態（beacon）を送る。
+ * 受信とビーコンは専用のスレッドで行う（リアルタイム動作では受信スレッドと同じ優先度）。
+ */
+class FastPathChannel {
+public:
+    // 件数（統計表示用）
+    struct Stats {
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> applied{0};      // 値が変わったデータグラム
+        std::atomic<uint64_t> applied_keys{0};
+        std::atomic<uint64_t> stale{0};        // 古い・重複した seq
+        std::atomic<uint64_t> corrupt{0};      // 形式・CRC の誤り
+        std::atomic<uint64_t> not_allowed{0};  // 対象外の項目
+        std::atomic<uint64_t> no_base{0};      // base= のない変更要求
+        std::atomic<uint64_t> overridden{0};   // base= より後に UDP 以外で変わっていたため無視した項目
+        std::atomic<uint64_t> published{0};    // 変更による状態の送信
+        std::atomic<uint64_t> beacons{0};
+        std::atomic<uint64_t> send_errors{0};
+    };
+
+    // 1回の待ちで処理するデータグラムの上限（残りは次の周回で読む）
+    static const int MAX_DATAGRAMS_PER_TURN = 64;
+    // 対象外の項目の警告を出す項目数の上限（項目名はデータグラムから来るため）
+    static const size_t MAX_WARNED_KEYS = 64;
+
+    FastPathChannel() : recv_sock_(-1), send_sock_(-1), seq_(0), enabled_(false), stop_(false) {}
+    ~FastPathChannel() { stop(); }
+
+    /**
+     * @brief ソケットを開き、受信とビーコンのスレッドを開始する
+     * @param read_only trueなら受信はしない（複製先）
+     * @return 開けた場合true（失敗時は error に理由）
+     */
+    bool start(const FastPathSettings& settings, bool read_only, std::string& error) {
+        settings_ = settings;
+        char sid[24];
+        snprintf(sid, sizeof(sid), "cs%08x", std::random_device()());
+        sid_ = sid;
+        if (settings_.port > 0 && !read_only) {
+            recv_sock_ = fast_path::open_receiver(settings_.port, settings_.group, settings_.interface_address);
+            if (recv_sock_ < 0) {
+                error = "ポート " + std::to_string(settings_.port) +
+                        (settings_.group.empty() ? std::string() : "（グループ " + settings_.group + "）") +
+                        " で受信できません: " + strerror(errno);
+                return false;
+            }
+        }
+        if (!settings_.publish.empty()) {
+            if (!fast_path::parse_address(settings_.publish, publish_addr_)) {
+                error = "FAST_PATH_PUBLISH が host:port の形式ではありません: " + settings_.publish;
+                close_sockets();
+                return false;
+            }
+            send_sock_ = fast_path::open_sender(settings_.interface_address);
+            if (send_sock_ < 0) {
+                error = std::string("送信用のソケットを作れません: ") + strerror(errno);
+                close_sockets();
+                return false;
+            }
+        }
+        enabled_.store(true, std::memory_order_release);
+        if (recv_sock_ >= 0 || send_sock_ >= 0) {
+            thread_ = std::thread([this] { run(); });
+        }
+        return true;
+    }
+
+    void stop() {
+        stop_.store(true);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        close_sockets();
+    }
+
+    bool covers(const std::string& section, const std::string& key) const {
+        if (!enabled_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        return settings_.keys.count(std::make_pair(section, key)) > 0 ||
+               settings_.keys.count(std::make_pair(section, std::string("*"))) > 0;
+    }
+
+    /**
+     * @brief 対象の項目の現在値を状態として送る（g_config_mutexを保持した状態で呼ぶ）
+     */
+    void publish_locked(uint64_t version, bool beacon) {
+        if (send_sock_ < 0) {
+            return;
+        }
+        fast_path::Datagram datagram;
+        datagram.sid = sid_;
+        datagram.seq = ++seq_;
+        datagram.has_version = true;
+        datagram.version = version;
+        datagram.beacon = beacon;
+        for (const std::pair<std::string, std::string>& item : settings_.keys) {
+            ConfigMap::const_iterator section_it = g_config_data.find(item.first);
+            if (section_it == g_config_data.end()) {
+                continue;
+            }
+            if (item.second == "*") {
+                for (const std::pair<const std::string, std::string>& entry : section_it->second) {
+                    datagram.values.push_back(fast_path::Value{item.first, entry.first, entry.second});
+                }
+            } else if (settings_.keys.count(std::make_pair(item.first, std::string("*"))) == 0) {
+                std::map<std::string, std::string>::const_iterator key_it = section_it->second.find(item.second);
+                if (key_it != section_it->second.end()) {
+                    datagram.values.push_back(fast_path::Value{item.first, item.second, key_it->second});
+                }
+            }
+        }
+        std::string bytes = fast_path::encode(datagram);
+        if (bytes.size() > fast_path::UNFRAGMENTED_DATAGRAM && !size_warned_) {
+            size_warned_ = true;
+            std::cerr << "警告: 高速経路の状態が " << bytes.size() << " バイトあり、IPで分割されて届きます（1つでも失われると"
+                      << "全体が失われます）。FAST_PATH_KEYS の対象を減らしてください。\n";
+        }
+        if (sendto(send_sock_, bytes.data(), bytes.size(), MSG_DONTWAIT, (const struct sockaddr*)&publish_addr_,
+                   sizeof(publish_addr_)) < 0) {
+            if (stats_.send_errors++ == 0) {
+                std::cerr << "警告: 高速経路の状態を " << settings_.publish << " に送れませんでした。 " << strerror(errno)
+                          << std::endl;
+            }
+            return;
+        }
+        (beacon ? stats_.beacons : stats_.published)++;
+    }
+
+    std::string describe() const {
+        std::string text = std::to_string(settings_.keys.size()) + " 項目";
+        if (recv_sock_ >= 0) {
+            text += " / 受信 UDP " + std::to_string(settings_.port) +
+                    (settings_.group.empty() ? std::string() : "（グループ " + settings_.group + "）");
+        }
+        if (send_sock_ >= 0) {
+            text += " / 現在値の送信先 " + settings_.publish + "（ビーコン " + std::to_string(settings_.beacon_ms) + " ms）";
+        }
+        return text;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    void close_sockets() {
+        if (recv_sock_ >= 0) {
+            close(recv_sock_);
+            recv_sock_ = -1;
+        }
+        if (send_sock_ >= 0) {
+            close(send_sock_);
+            send_sock_ = -1;
+        }
+    }
+
+    void run() {
+        make_thread_realtime(g_realtime.priority, "UDP高速経路のスレッド");
+        std::chrono::steady_clock::time_point next_beacon =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(settings_.beacon_ms);
+        char buffer[fast_path::MAX_DATAGRAM];
+        while (!stop_.load() && !g_shutdown_flag.load()) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            int timeout_ms = 200; // 終了の確認のため
+            if (send_sock_ >= 0) {
+                timeout_ms = static_cast<int>(std::max<int64_t>(
+                    0, std::min<int64_t>(timeout_ms, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                         next_beacon - now).count())));
+            }
+            pollfd pfd{recv_sock_, POLLIN, 0};
+            poll(&pfd, recv_sock_ >= 0 ? 1 : 0, timeout_ms);
+            for (int handled = 0; recv_sock_ >= 0 && handled < MAX_DATAGRAMS_PER_TURN; handled++) {
+                sockaddr_in from;
+                socklen_t from_length = sizeof(from);
+                ssize_t n = recvfrom(recv_sock_, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr*)&from,
+                                     &from_length);
+                if (n < 0) {
+                    break;
+                }
+                handle(buffer, static_cast<size_t>(n), from);
+            }
+            if (send_sock_ >= 0 && std::chrono::steady_clock::now() >= next_beacon) {
+                std::lock_guard<std::mutex> lock(g_config_mutex);
+                publish_locked(g_config_version.load(), true);
+                next_beacon += std::chrono::milliseconds(settings_.beacon_ms);
+            }
+        }
+    }
+
+    void handle(const char* data, size_t size, const sockaddr_in& from) {
+        trace_spans::Span span("fast_path");
+        fast_path::Datagram datagram;
+        std::string error;
+        if (!fast_path::decode(data, size, datagram, error)) {
+            stats_.received++;
+            stats_.corrupt++;
+            return;
+        }
+        if (datagram.sid == sid_ || datagram.has_version) {
+            return; // 自分や他の ConfigSynchronizer が送った状態（同じグループ・ポートで受信している場合）
+        }
+        stats_.received++;
+        if (!datagram.has_base) {
+            // 送り手が見た版が分からなければ、TCP で後から変わった項目を守れない
+            if (stats_.no_base++ == 0) {
+                std::cerr << "警告: base= のない高速経路の変更要求を受け取りました（無視します）。\n";
+            }
+            return;
+        }
+        if (!filter_.accept(datagram.sid, datagram.seq)) {
+            stats_.stale++;
+            return;
+        }
+        std::vector<ConfigUpdate> updates;
+        updates.reserve(datagram.values.size());
+        for (fast_path::Value& value : datagram.values) {
+            if (!covers(value.section, value.key)) {
+                stats_.not_allowed++;
+                if (warned_keys_.size() < MAX_WARNED_KEYS &&
+                    warned_keys_.insert(value.section + ":" + value.key).second) {
+                    std::cerr << "警告: [" << value.section << "] " << value.key
+                              << " は高速経路の対象（FAST_PATH_KEYS）ではないため、UDPでは変更できません。"
+                              << (warned_keys_.size() == MAX_WARNED_KEYS ? "（以降の項目は件数だけ数えます）" : "")
+                              << "\n";
+                }
+                continue;
+            }
+            ConfigUpdate update;
+            update.section = std::move(value.section);
+            update.key = std::move(value.key);
+            update.value = std::move(value.value);
+            updates.push_back(std::move(update));
+        }
+        if (updates.empty()) {
+            return;
+        }
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &from.sin_addr, address, sizeof(address));
+        std::string source = std::string("udp ") + address + ":" + std::to_string(ntohs(from.sin_port));
+
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        std::vector<ConfigUpdate> accepted;
+        accepted.reserve(updates.size());
+        for (ConfigUpdate& update : updates) {
+            // 送り手が見た版より後に、UDP 以外（TCP・ファイル・プリセットなど）で変わっていれば TCP を優先する
+            uint64_t version = key_version_locked(update.section, update.key);
+            std::map<std::pair<std::string, std::string>, uint64_t>::const_iterator own =
+                own_versions_.find(std::make_pair(update.section, update.key));
+            if (version > datagram.base && (own == own_versions_.end() || own->second != version)) {
+                stats_.overridden++;
+                continue;
+            }
+            accepted.push_back(std::move(update));
+        }
+        int changed = accepted.empty() ? 0 : apply_config_updates_locked(accepted, source, false);
+        if (changed > 0) {
+            stats_.applied++;
+            stats_.applied_keys += static_cast<uint64_t>(changed);
+        } else if (!accepted.empty()) {
+            // 値が変わらない = 送り手が反映を確かめられず送り直した。ビーコンを待たせず状態を送り直す
+            publish_locked(g_config_version.load(), false);
+        }
+        for (const ConfigUpdate& update : accepted) {
+            own_versions_[std::make_pair(update.section, update.key)] = key_version_locked(update.section, update.key);
+        }
+    }
+
+    FastPathSettings settings_;
+    std::string sid_;
+    int recv_sock_;
+    int send_sock_;
+    sockaddr_in publish_addr_;
+    uint64_t seq_; // 送った状態の番号（g_config_mutexで保護）
+    bool size_warned_ = false;
+    std::atomic<bool> enabled_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+    Stats stats_;
+    // 以下は受信スレッドだけが使う（own_versions_ は g_config_mutex の中で読み書きする）
+    fast_path::SequenceFilter filter_;
+    std::set<std::string> warned_keys_;
+    std::map<std::pair<std::string, std::string>, uint64_t> own_versions_; // UDPで最後に変えた版
+};
+
+FastPathChannel g_fast_path;
+
+bool is_fast_path_key(const std::string& section, const std::string& key) {
+    return g_fast_path.covers(section, key);
+}
+
+void publish_fast_path_locked(uint64_t version) {
+    g_fast_path.publish_locked(version, false);
+}
+
+/**
+ * @brief 接続処理用の上限付きワークスティーリング・スレッドプール
+ *
+ * 各ワーカーは自分のキューの末尾から仕事を取り、空なら他のワーカーの
+ * キューの先頭から盗む。投入済みで未着手の仕事の総数は max_queued で
+ * 制限し、超えた場合は try_submit() が false を返す（過負荷拒否）。
+ */
+class WorkerPool {
+public:
+    typedef std::function<void()> Task;
+
+    WorkerPool(size_t thread_count, size_t max_queued)
+        : max_queued_(max_queued), queued_(0), pending_(0), next_queue_(0), stopping_(false),
+          completed_(0), rejected_(0), stolen_(0) {
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+        for (size_t i = 0; i < thread_count; i++) {
+            queues_.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (size_t i = 0; i < thread_count; i++) {
+            threads_.push_back(std::thread(&WorkerPool::worker_loop, this, i));
+        }
+    }
+
+    ~WorkerPool() {
+        stop();
+    }
+
+    /**
+     * @brief 仕事を投入する
+     * @param task 実行する処理
+     * @return キューが満杯で投入できなかった場合はfalse
+     */
+    bool try_submit(Task task) {
+        size_t current = queued_.load();
+        do {
+            if (stopping_.load() || current >= max_queued_) {
+                rejected_++;
+                return false;
+            }
+        } while (!queued_.compare_exchange_weak(current, current + 1));
+
+        WorkerQueue& queue = *queues_[next_queue_.fetch_add(1) % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            pending_++;
+        }
+        idle_cv_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief 投入済みの仕事をすべて処理してからワーカーを終了させる
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            stopping_.store(true);
+        }
+        idle_cv_.notify_all();
+        for (std::thread& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    size_t thread_count() const { return threads_.size(); }
+    size_t max_queued() const { return max_queued_; }
+    size_t queued() const { return queued_.load(); }
+    uint64_t completed() const { return completed_.load(); }
+    uint64_t rejected() const { return rejected_.load(); }
+    uint64_t stolen() const { return stolen_.load(); }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_local(size_t index, Task& task) {
+        WorkerQueue& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thief, Task& task) {
+        for (size_t offset = 1; offset < queues_.size(); offset++) {
+            WorkerQueue& queue = *queues_[(thief + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                stolen_++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(size_t index) {
+        trace_spans::name_thread("worker " + std::to_string(index + 1));
+        make_thread_realtime(g_realtime.priority - 1, "ワーカー " + std::to_string(index + 1));
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(idle_mutex_);
+                idle_cv_.wait(lock, [&] { return pending_ > 0 || stopping_.load(); });
+                if (pending_ == 0) {
+                    return; // 停止要求があり、残りの仕事もない
+                }
+                pending_--;
+            }
+
+            Task task;
+            if (!pop_local(index, task) && !steal(index, task)) {
+                // 投入途中の仕事がまだキューに見えていない。取り分を戻して再試行する
+                std::lock_guard<std::mutex> lock(idle_mutex_);
+                pending_++;
+                continue;
+            }
+            queued_--;
+
+            try {
+                task();
+            } catch (const std::exception& e) {
+                std::cerr << "エラー: ワーカースレッドで例外が発生しました: " << e.what() << std::endl;
+            }
+            completed_++;
+        }
+    }
+
+    const size_t max_queued_;
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> threads_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_cv_;
+    std::atomic<size_t> queued_;
+    size_t pending_;
+    std::atomic<size_t> next_queue_;
+    std::atomic<bool> stopping_;
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> rejected_;
+    std::atomic<uint64_t> stolen_;
+};
+
+std::unique_ptr<WorkerPool> g_worker_pool;
+
+/**
+ * @brief ソケットのノンブロッキングモードを設定する
+ * @param sock ソケットディスクリプタ
+ * @param non_blocking trueでノンブロッキング、falseでブロッキング
+ * @return 成功時true
+ */
+bool set_socket_non_blocking(int sock, bool non_blocking) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1) {
+        return false;
+    }
+    
+    if (non_blocking) {
+        flags |= O_NONBLOCK;
+    } else {
+        flags &= ~O_NONBLOCK;
+    }
+    
+    return fcntl(sock, F_SETFL, flags) != -1;
+}
+
+/**
+ * @brief イベントループ用のタイマーホイール（ハッシュ化タイマーホイール）
+ *
+ * 期限を TICK 単位に切り上げてスロットに振り分ける。取り消しはO(1)、登録はO(log n)なので、
+ * 接続ごと・受信ごとに期限を張り直しても負荷が増えない。期限切れの判定は
+ * TICK 単位のため、最大で TICK だけ遅れて実行される。
+ * 次の期限は (tick, id) の最小ヒープで求める（毎回スロットを走査しない）。取り消し・実行済みの
+ * タイマーはヒープに残し、先頭に来たときに捨てる。残った分が生きているタイマーより大きく増えたら作り直す。
+ * ループのスレッドからのみ使う。
+ */
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock::time_point Deadline;
+    typedef uint64_t TimerId;
+
+    static const int TICK_MS = 10;
+    static const size_t SLOT_COUNT = 1024; // 1周 約10秒
+
+    TimerWheel() : slots_(SLOT_COUNT), origin_(std::chrono::steady_clock::now()), current_tick_(0), next_id_(1) {}
+
+    /**
+     * @brief タイマーを登録する
+     * @return cancel()に渡す識別子
+     */
+    TimerId add(Deadline when, std::function<void()> fn) {
+        // 過去の期限は次の advance() で実行する
+        uint64_t tick = std::max(tick_ceil(when), current_tick_);
+        TimerId id = next_id_++;
+        std::list<Entry>& slot = slots_[tick % SLOT_COUNT];
+        slot.push_front(Entry{id, tick, std::move(fn)});
+        index_[id] = std::make_pair(static_cast<size_t>(tick % SLOT_COUNT), slot.begin());
+        earliest_.push(Armed(tick, id));
+        if (earliest_.size() > 2 * index_.size() + MIN_HEAP_SLACK) {
+            rebuild_earliest();
+        }
+        return id;
+    }
+
+    void cancel(TimerId id) {
+        std::unordered_map<TimerId, Location>::iterator it = index_.find(id);
+        if (it != index_.end()) {
+            slots_[it->second.first].erase(it->second.second);
+            index_.erase(it);
+        }
+    }
+
+    size_t size() const { return index_.size(); }
+
+    /**
+     * @brief 次に期限が来るタイマーまでの待ち時間（ミリ秒、切り上げ）
+     *
+     * 1周分より先のタイマーしかない場合は1周分の時間を返す。
+     */
+    int next_timeout(int max_timeout_ms) {
+        // 取り消し・実行済みのものを先頭から捨てる
+        while (!earliest_.empty() && index_.count(earliest_.top().second) == 0) {
+            earliest_.pop();
+        }
+        if (earliest_.empty()) {
+            return max_timeout_ms;
+        }
+        uint64_t tick = earliest_.top().first;
+        if (tick >= current_tick_ + SLOT_COUNT) {
+            return std::min(max_timeout_ms, static_cast<int>(SLOT_COUNT) * TICK_MS);
+        }
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            tick_time(tick) - std::chrono::steady_clock::now()).count() + 1;
+        return static_cast<int>(std::max(0LL, std::min<long long>(ms, max_timeout_ms)));
+    }
+
+    /**
+     * @brief 現在時刻までに期限の来たタイマーを実行する
+     *
+     * 実行中のタイマーから登録・取り消しをしてもよい。
+     */
+    void advance(Deadline now) {
+        uint64_t now_tick = tick_floor(now);
+        if (now_tick < current_tick_) {
+            return;
+        }
+        std::vector<TimerId> due;
+        if (!index_.empty()) {
+            uint64_t last = std::min(now_tick, current_tick_ + SLOT_COUNT - 1);
+            for (uint64_t tick = current_tick_; tick <= last; tick++) {
+                for (const Entry& entry : slots_[tick % SLOT_COUNT]) {
+                    if (entry.tick <= now_tick) {
+                        due.push_back(entry.id);
+                    }
+                }
+            }
+        }
+        current_tick_ = now_tick + 1;
+
+        // 先に実行したタイマーが取り消したものは実行しない
+        for (TimerId id : due) {
+            std::unordered_map<TimerId, Location>::iterator it = index_.find(id);
+            if (it == index_.end()) {
+                continue;
+            }
+            std::function<void()> fn = std::move(it->second.second->fn);
+            slots_[it->second.first].erase(it->second.second);
+            index_.erase(it);
+            fn();
+        }
+    }
+
+private:
+    struct Entry {
+        TimerId id;
+        uint64_t tick;
+        std::function<void()> fn;
+    };
+    typedef std::pair<size_t, std::list<Entry>::iterator> Location;
+    typedef std::pair<uint64_t, TimerId> Armed; // (tick, id)
+
+    // ヒープに残してよい取り消し済みの件数の下限（少ないうちは作り直さない）
+    static const size_t MIN_HEAP_SLACK = 64;
+
+    void rebuild_earliest() {
+        std::vector<Armed> armed;
+        armed.reserve(index_.size());
+        for (const std::pair<const TimerId, Location>& item : index_) {
+            armed.push_back(Armed(item.second.second->tick, item.first));
+        }
+        earliest_ = std::priority_queue<Armed, std::vector<Armed>, std::greater<Armed>>(
+            std::greater<Armed>(), std::move(armed));
+    }
+
+    uint64_t tick_floor(Deadline when) const {
+        if (when <= origin_) {
+            return 0;
+        }
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(when - origin_).count() / TICK_MS);
+    }
+
+    uint64_t tick_ceil(Deadline when) const {
+        if (when == Deadline::max()) {
+            return UINT64_MAX / 2;
+        }
+        uint64_t tick = tick_floor(when);
+        return tick_time(tick) < when ? tick + 1 : tick;
+    }
+
+    Deadline tick_time(uint64_t tick) const {
+        return origin_ + std::chrono::milliseconds(static_cast<long long>(tick) * TICK_MS);
+    }
+
+    std::vector<std::list<Entry>> slots_;
+    std::unordered_map<TimerId, Location> index_;
+    std::priority_queue<Armed, std::vector<Armed>, std::greater<Armed>> earliest_;
+    Deadline origin_;
+    uint64_t current_tick_;
+    TimerId next_id_;
+};
+
+/**
+ * @brief 接続処理バックエンド（epoll / io_uring）の共通インターフェース
+ *
+ * 受け付け・受信・送信・クローズを完了通知型の非同期操作として提供する。
+ * 完了ハンドラーはすべてイベントループのスレッド（wait()を呼ぶスレッド）で
+ * 実行される。post()だけは他スレッドから呼んでよい。
+ */
+class EventBackend {
+public:
+    typedef std::function<void(int sock)> AcceptHandler;
+    // 結果: 0以上は転送バイト数、負の値は -errno
+    typedef std::function<void(ssize_t result)> IoHandler;
+    typedef TimerWheel::Deadline Deadline;
+    typedef TimerWheel::TimerId TimerId;
+    // 非同期操作の識別子（cancel_operation()に渡す。0は無効）
+    typedef uint64_t OperationId;
+
+    // 受信バッファ1個の大きさと個数（io_uringでは固定バッファとして登録する）
+    static const size_t RECV_BUFFER_SIZE = 16 * 1024;
+    static const size_t RECV_BUFFER_COUNT = 64;
+
+    EventBackend()
+        : wake_fd_(-1), wake_pending_(false), closed_(false),
+          buffer_region_(RECV_BUFFER_SIZE * RECV_BUFFER_COUNT), syscalls_(0), requests_(0) {
+        for (size_t i = RECV_BUFFER_COUNT; i > 0; i--) {
+            free_buffers_.push_back(static_cast<int>(i - 1));
+        }
+    }
+
+    virtual ~EventBackend() {
+        if (wake_fd_ >= 0) {
+            ::close(wake_fd_);
+        }
+    }
+
+    virtual const char* name() const = 0;
+
+    /**
+     * @brief リスナーソケットを登録し、受け付けた接続ごとにハンドラーを呼ぶ
+     */
+    virtual bool listen_on(int listen_sock, AcceptHandler on_accept) = 0;
+
+    /**
+     * @brief 非同期受信
+     * @param buffer_index acquire_recv_buffer()で得た番号。-1なら通常のバッファ
+     */
+    virtual OperationId async_recv(int sock, char* buf, size_t len, int buffer_index, IoHandler done) = 0;
+
+    /**
+     * @brief 非同期送信（一部だけ送信された場合もそのバイト数で完了する）
+     */
+    virtual OperationId async_send(int sock, const char* buf, size_t len, IoHandler done) = 0;
+
+    /**
+     * @brief 非同期接続（ソケットはノンブロッキングで作成しておくこと）
+     */
+    virtual OperationId async_connect(int sock, const sockaddr_in& addr, IoHandler done) = 0;
+
+    /**
+     * @brief ソケットの保留中の操作をすべて取り消す（各操作は -ECANCELED で完了する）
+     */
+    virtual void cancel(int sock) = 0;
+
+    /**
+     * @brief 1つの操作だけを取り消す（同じソケットの他の操作には触れない。完了済みなら何もしない）
+     */
+    virtual void cancel_operation(int sock, OperationId id) = 0;
+
+    /**
+     * @brief ソケットを閉じる（保留中の操作がないこと）
+     */
+    virtual void close_socket(int sock) = 0;
+
+    /**
+     * @brief 完了を待ち、届いた完了ハンドラーを実行する
+     *
+     * 完了ハンドラーは非同期操作を登録した呼び出しの中では実行されず、
+     * 必ずwait()（またはタイマー処理）から実行される。
+     * @param timeout_ms 最大待ち時間（ミリ秒）
+     */
+    virtual void wait(int timeout_ms) = 0;
+
+    /**
+     * @brief ループを1回まわす（完了待ちと期限の来たタイマーの実行）
+     * @param max_timeout_ms 最大待ち時間（ミリ秒）
+     */
+    void run_once(int max_timeout_ms) {
+        wait(next_timer_timeout(max_timeout_ms));
+        run_due_timers();
+    }
+
+    /**
+     * @brief 指定時刻に実行するタイマーを登録する（ループのスレッドからのみ）
+     * @return cancel_timer()に渡す識別子
+     */
+    TimerId add_timer(Deadline when, std::function<void()> fn) {
+        return timers_.add(when, std::move(fn));
+    }
+
+    void cancel_timer(TimerId id) {
+        timers_.cancel(id);
+    }
+
+    size_t timer_count() const { return timers_.size(); }
+
+    /**
+     * @brief 処理中のソケットとして登録する（終了時にまとめて取り消すため）
+     */
+    void track_socket(int sock) { active_sockets_.insert(sock); }
+    void untrack_socket(int sock) { active_sockets_.erase(sock); }
+    size_t active_socket_count() const { return active_sockets_.size(); }
+
+    /**
+     * @brief 処理中のすべてのソケットの操作を取り消す（終了処理用）
+     */
+    void cancel_all() {
+        std::vector<int> sockets(active_sockets_.begin(), active_sockets_.end());
+        for (int sock : sockets) {
+            cancel(sock);
+        }
+    }
+
+    /**
+     * @brief イベントループのスレッドで処理を実行するよう依頼する（スレッドセーフ）
+     */
+    void post(std::function<void()> fn) {
+        bool need_wake = false;
+        {
+            std::lock_guard<std::mutex> lock(post_mutex_);
+            if (closed_) {
+                return; // ループ終了後の依頼は破棄する
+            }
+            posted_.push_back(std::move(fn));
+            if (!wake_pending_) {
+                wake_pending_ = true;
+                need_wake = true;
+            }
+        }
+        if (need_wake) {
+            uint64_t one = 1;
+            ssize_t written = ::write(wake_fd_, &one, sizeof(one));
+            (void)written;
+            syscalls_++;
+        }
+    }
+
+    /**
+     * @brief ループを終了する。以降のpost()は破棄される
+     */
+    void shutdown() {
+        std::deque<std::function<void()>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(post_mutex_);
+            closed_ = true;
+            dropped.swap(posted_);
+        }
+        release_pending_operations();
+    }
+
+    /**
+     * @brief 受信バッファを1個借りる
+     * @return バッファ番号。空きがなければ-1
+     */
+    int acquire_recv_buffer() {
+        if (free_buffers_.empty()) {
+            return -1;
+        }
+        int index = free_buffers_.back();
+        free_buffers_.pop_back();
+        return index;
+    }
+
+    void release_recv_buffer(int index) {
+        if (index >= 0) {
+            free_buffers_.push_back(index);
+        }
+    }
+
+    char* recv_buffer(int index) {
+        return buffer_region_.data() + static_cast<size_t>(index) * RECV_BUFFER_SIZE;
+    }
+
+    // 処理したリクエスト（フレーム）数を数える
+    void count_request() { requests_++; }
+
+    uint64_t syscalls() const { return syscalls_.load(); }
+    uint64_t requests() const { return requests_.load(); }
+
+protected:
+    bool create_wake_fd() {
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return wake_fd_ >= 0;
+    }
+
+    // post()された処理をまとめて実行する
+    void run_posted() {
+        std::deque<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock(post_mutex_);
+            tasks.swap(posted_);
+            wake_pending_ = false;
+        }
+        for (std::function<void()>& task : tasks) {
+            task();
+        }
+    }
+
+    // 終了時に、完了しなかった操作のハンドラーを解放する
+    virtual void release_pending_operations() {}
+
+    // 次のタイマーまでの待ち時間（ミリ秒、切り上げ）
+    int next_timer_timeout(int max_timeout_ms) {
+        return timers_.next_timeout(max_timeout_ms);
+    }
+
+    void run_due_timers() {
+        timers_.advance(std::chrono::steady_clock::now());
+    }
+
+    int wake_fd_;
+    std::mutex post_mutex_;
+    std::deque<std::function<void()>> posted_;
+    bool wake_pending_;
+    bool closed_;
+    std::vector<char> buffer_region_;
+    std::vector<int> free_buffers_;
+    TimerWheel timers_;
+    std::unordered_set<int> active_sockets_;
+    std::atomic<uint64_t> syscalls_;
+    std::atomic<uint64_t> requests_;
+};
+
+/**
+ * @brief epollによるバックエンド（エッジトリガー）
+ *
+ * 完了通知型のインターフェースに合わせるため、ソケットごとに保留中の
+ * 受信・送信を1つずつ持ち、読み書き可能になった時点で実行する。
+ */
+class EpollBackend : public EventBackend {
+public:
+    EpollBackend() : epoll_fd_(-1), listen_sock_(-1) {}
+
+    ~EpollBackend() {
+        if (epoll_fd_ >= 0) {
+            ::close(epoll_fd_);
+        }
+    }
+
+    const char* name() const { return "epoll"; }
+
+    bool init() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0 || !create_wake_fd()) {
+            return false;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd_;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) == 0;
+    }
+
+    bool listen_on(int listen_sock, AcceptHandler on_accept) {
+        if (!set_socket_non_blocking(listen_sock, true)) {
+            return false;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = listen_sock;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_sock, &ev) < 0) {
+            return false;
+        }
+        listen_sock_ = listen_sock;
+        on_accept_ = on_accept;
+        return true;
+    }
+
+    OperationId async_recv(int sock, char* buf, size_t len, int /*buffer_index*/, IoHandler done) {
+        SocketState& state = register_socket(sock);
+        state.read.active = true;
+        state.read.id = next_op_id_++;
+        state.read.buf = buf;
+        state.read.len = len;
+        state.read.handler = std::move(done);
+        if (state.readable) {
+            ready_.push_back(sock);
+        }
+        return state.read.id;
+    }
+
+    OperationId async_send(int sock, const char* buf, size_t len, IoHandler done) {
+        SocketState& state = register_socket(sock);
+        state.write.active = true;
+        state.write.id = next_op_id_++;
+        state.write.buf = const_cast<char*>(buf);
+        state.write.len = len;
+        state.write.handler = std::move(done);
+        if (state.writable) {
+            ready_.push_back(sock);
+        }
+        return state.write.id;
+    }
+
+    OperationId async_connect(int sock, const sockaddr_in& addr, IoHandler done) {
+        int ret = ::connect(sock, (const struct sockaddr*)&addr, sizeof(addr));
+        syscalls_++;
+        int error = (ret < 0 && errno != EINPROGRESS) ? errno : 0;
+        // 接続完了は書き込み可能になったことで分かるため、登録はconnectの後に行う
+        SocketState& state = register_socket(sock);
+        state.write.active = true;
+        state.write.id = next_op_id_++;
+        state.write.connecting = true;
+        state.write.immediate_error = error;
+        state.write.handler = std::move(done);
+        if (ret == 0 || error != 0) {
+            state.writable = true;
+            ready_.push_back(sock);
+        }
+        return state.write.id;
+    }
+
+    void cancel(int sock) {
+        std::unordered_map<int, SocketState>::iterator it = sockets_.find(sock);
+        if (it == sockets_.end()) {
+            return;
+        }
+        if (it->second.read.active) {
+            complete(sock, &SocketState::read, -ECANCELED);
+        }
+        it = sockets_.find(sock);
+        if (it != sockets_.end() && it->second.write.active) {
+            complete(sock, &SocketState::write, -ECANCELED);
+        }
+    }
+
+    void cancel_operation(int sock, OperationId id) {
+        std::unordered_map<int, SocketState>::iterator it = sockets_.find(sock);
+        if (it == sockets_.end()) {
+            return;
+        }
+        if (it->second.read.active && it->second.read.id == id) {
+            complete(sock, &SocketState::read, -ECANCELED);
+        } else if (it->second.write.active && it->second.write.id == id) {
+            complete(sock, &SocketState::write, -ECANCELED);
+        }
+    }
+
+    void close_socket(int sock) {
+        sockets_.erase(sock);
+        ::close(sock); // closeでepollの登録も外れる
+        syscalls_++;
+    }
+
+    void wait(int timeout_ms) {
+        struct epoll_event events[64];
+        int n = epoll_wait(epoll_fd_, events, 64, ready_.empty() ? timeout_ms : 0);
+        syscalls_++;
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "エラー: epoll_waitに失敗しました。 " << strerror(errno) << std::endl;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd_) {
+                uint64_t value;
+                ssize_t drained = ::read(wake_fd_, &value, sizeof(value));
+                (void)drained;
+                syscalls_++;
+                run_posted();
+            } else if (fd == listen_sock_) {
+                accept_pending();
+            } else {
+                std::unordered_map<int, SocketState>::iterator it = sockets_.find(fd);
+                if (it == sockets_.end()) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    it->second.readable = true;
+                }
+                if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                    it->second.writable = true;
+                }
+                ready_.push_back(fd);
+            }
+        }
+
+        // 完了ハンドラーが次の操作を積むので、同じ呼び出しの中で一定回数まで繰り返す
+        for (int round = 0; round < 64 && !ready_.empty(); round++) {
+            std::vector<int> ready;
+            ready.swap(ready_);
+            for (int fd : ready) {
+                perform_ready_io(fd);
+            }
+        }
+    }
+
+private:
+    struct PendingIo {
+        PendingIo() : active(false), connecting(false), immediate_error(0), id(0), buf(nullptr), len(0) {}
+        bool active;
+        bool connecting;
+        int immediate_error;
+        OperationId id; // 登録ごとの番号（cancel_operation で別の操作を取り消さないように）
+        char* buf;
+        size_t len;
+        IoHandler handler;
+    };
+
+    struct SocketState {
+        SocketState() : registered(false), readable(false), writable(false) {}
+        bool registered;
+        bool readable;
+        bool writable;
+        PendingIo read;
+        PendingIo write;
+    };
+
+    SocketState& register_socket(int sock) {
+        SocketState& state = sockets_[sock];
+        if (!state.registered) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = sock;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, sock, &ev) < 0) {
+                std::cerr << "エラー: epoll_ctlに失敗しました。 " << strerror(errno) << std::endl;
+            }
+            syscalls_++;
+            state.registered = true;
+        }
+        return state;
+    }
+
+    void accept_pending() {
+        while (true) {
+            int client_sock = accept4(listen_sock_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            syscalls_++;
+            if (client_sock < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && !g_shutdown_flag.load()) {
+                    std::cerr << "エラー: acceptに失敗しました。 " << strerror(errno) << std::endl;
+                }
+                return;
+            }
+            on_accept_(client_sock);
+        }
+    }
+
+    void perform_ready_io(int fd) {
+        std::unordered_map<int, SocketState>::iterator it = sockets_.find(fd);
+        if (it == sockets_.end()) {
+            return;
+        }
+        SocketState& state = it->second;
+
+        if (state.read.active && state.readable) {
+            ssize_t n = ::recv(fd, state.read.buf, state.read.len, 0);
+            syscalls_++;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                state.readable = false;
+            } else {
+                complete(fd, &SocketState::read, n < 0 ? -errno : n);
+                it = sockets_.find(fd); // ハンドラー内で閉じられている場合がある
+                if (it == sockets_.end()) {
+                    return;
+                }
+            }
+        }
+
+        SocketState& current = it->second;
+        if (current.write.active && current.writable && current.write.connecting) {
+            int so_error = current.write.immediate_error;
+            if (so_error == 0) {
+                socklen_t len = sizeof(so_error);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+                syscalls_++;
+            }
+            current.write.connecting = false;
+            complete(fd, &SocketState::write, -so_error);
+        } else if (current.write.active && current.writable) {
+            ssize_t n = ::send(fd, current.write.buf, current.write.len, MSG_NOSIGNAL);
+            syscalls_++;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                current.writable = false;
+            } else {
+                complete(fd, &SocketState::write, n < 0 ? -errno : n);
+            }
+        }
+    }
+
+    void complete(int fd, PendingIo SocketState::*which, ssize_t result) {
+        PendingIo& io = sockets_[fd].*which;
+        IoHandler handler = std::move(io.handler);
+        io.active = false;
+        io.handler = nullptr;
+        handler(result);
+    }
+
+    void release_pending_operations() {
+        sockets_.clear();
+        ready_.clear();
+    }
+
+    int epoll_fd_;
+    int listen_sock_;
+    AcceptHandler on_accept_;
+    std::unordered_map<int, SocketState> sockets_;
+    std::vector<int> ready_;
+    OperationId next_op_id_ = 1;
+};
+
+/**
+ * @brief io_uringによるバックエンド
+ *
+ * liburingを使わず、システムコールとリング共有メモリを直接扱う。
+ * - 受け付けはマルチショットaccept（非対応カーネルでは単発acceptを再登録）
+ * - 受信は登録済み固定バッファへのREAD_FIXED
+ * - SQEはwait()でまとめてio_uring_enter 1回で投入する
+ */
+class IoUringBackend : public EventBackend {
+public:
+    IoUringBackend()
+        : ring_fd_(-1), sq_ptr_(nullptr), cq_ptr_(nullptr), sqes_(nullptr),
+          sq_ring_size_(0), cq_ring_size_(0), sqes_size_(0), sq_local_tail_(0),
+          buffers_registered_(false), multishot_accept_(true), listen_sock_(-1), wake_value_(0), next_op_id_(1), accept_op_(nullptr) {}
+
+    ~IoUringBackend() {
+        release_pending_operations();
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_ring_size_);
+        }
+        if (sq_ptr_ != nullptr) {
+            munmap(sq_ptr_, sq_ring_size_);
+        }
+        if (ring_fd_ >= 0) {
+            ::close(ring_fd_);
+        }
+    }
+
+    const char* name() const { return "io_uring"; }
+
+    /**
+     * @brief リングを作成する
+     * @return io_uringが使えない場合false（呼び出し側でepollにフォールバックする）
+     */
+    bool init() {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, 256, &params));
+        if (ring_fd_ < 0) {
+            std::cerr << "情報: io_uringを利用できません: " << strerror(errno) << std::endl;
+            return false;
+        }
+        // タイムアウト付き待機（IORING_ENTER_EXT_ARG）に対応していないカーネルは対象外
+        if (!(params.features & IORING_FEAT_EXT_ARG)) {
+            std::cerr << "情報: このカーネルのio_uringはEXT_ARGに対応していません。\n";
+            return false;
+        }
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ptr_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            sq_ptr_ = nullptr;
+            return false;
+        }
+        if (single_mmap) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            cq_ptr_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) {
+                cq_ptr_ = nullptr;
+                return false;
+            }
+        }
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                                       MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            sqes_ = nullptr;
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        char* cq = static_cast<char*>(cq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        sq_local_tail_ = *sq_tail_;
+
+        // 受信バッファ領域を固定バッファとして登録する（memlock制限などで失敗したら通常の受信）
+        std::vector<struct iovec> iovecs(RECV_BUFFER_COUNT);
+        for (size_t i = 0; i < RECV_BUFFER_COUNT; i++) {
+            iovecs[i].iov_base = recv_buffer(static_cast<int>(i));
+            iovecs[i].iov_len = RECV_BUFFER_SIZE;
+        }
+        buffers_registered_ = syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                                      iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+        if (!buffers_registered_) {
+            std::cerr << "情報: 固定バッファの登録に失敗しました（通常の受信を使用）: " << strerror(errno) << std::endl;
+        }
+
+        if (!create_wake_fd()) {
+            return false;
+        }
+        arm_wake_read();
+        return true;
+    }
+
+    bool listen_on(int listen_sock, AcceptHandler on_accept) {
+        listen_sock_ = listen_sock;
+        on_accept_ = on_accept;
+        arm_accept();
+        return true;
+    }
+
+    OperationId async_recv(int sock, char* buf, size_t len, int buffer_index, IoHandler done) {
+        struct io_uring_sqe* sqe = next_sqe();
+        if (buffers_registered_ && buffer_index >= 0) {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->buf_index = static_cast<__u16>(buffer_index);
+        } else {
+            sqe->opcode = IORING_OP_RECV;
+        }
+        sqe->fd = sock;
+        sqe->addr = reinterpret_cast<__u64>(buf);
+        sqe->len = static_cast<__u32>(len);
+        return queue_sqe(sqe, new PendingOp(sock, std::move(done)));
+    }
+
+    OperationId async_send(int sock, const char* buf, size_t len, IoHandler done) {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = sock;
+        sqe->addr = reinterpret_cast<__u64>(buf);
+        sqe->len = static_cast<__u32>(len);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        return queue_sqe(sqe, new PendingOp(sock, std::move(done)));
+    }
+
+    OperationId async_connect(int sock, const sockaddr_in& addr, IoHandler done) {
+        PendingOp* op = new PendingOp(sock, std::move(done));
+        op->addr = addr; // 完了までカーネルが参照するため操作側で保持する
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->fd = sock;
+        sqe->addr = reinterpret_cast<__u64>(&op->addr);
+        sqe->off = sizeof(op->addr);
+        return queue_sqe(sqe, op);
+    }
+
+    void cancel(int sock) {
+        std::vector<uint64_t> targets;
+        for (const auto& entry : pending_ops_) {
+            if (entry.second->fd == sock && entry.second->handler) {
+                targets.push_back(entry.first);
+            }
+        }
+        for (uint64_t target : targets) {
+            queue_cancel(target);
+        }
+    }
+
+    void cancel_operation(int sock, OperationId id) {
+        std::unordered_map<uint64_t, PendingOp*>::const_iterator it = pending_ops_.find(id);
+        if (it != pending_ops_.end() && it->second->fd == sock && it->second->handler) {
+            queue_cancel(id);
+        }
+    }
+
+    void close_socket(int sock) {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = sock;
+        queue_sqe(sqe, new PendingOp(-1, IoHandler()));
+    }
+
+    void wait(int timeout_ms) {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<__u64>(&ts);
+
+        unsigned to_submit = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        // 積まれたSQEの投入と完了待ちを1回のシステムコールで行う
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit, 1,
+                                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                                           &arg, sizeof(arg)));
+        syscalls_++;
+        if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            std::cerr << "エラー: io_uring_enterに失敗しました。 " << strerror(errno) << std::endl;
+        }
+        reap_completions();
+    }
+
+private:
+    struct PendingOp {
+        PendingOp(int target_fd, IoHandler h) : fd(target_fd), handler(std::move(h)) {
+            memset(&addr, 0, sizeof(addr));
+        }
+        int fd;
+        IoHandler handler;
+        sockaddr_in addr;
+    };
+
+    struct io_uring_sqe* next_sqe() {
+        if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            // SQが満杯: 待たずに投入だけ行う
+            syscall(__NR_io_uring_enter, ring_fd_, sq_entries_, 0, 0, nullptr, 0);
+            syscalls_++;
+        }
+        unsigned index = sq_local_tail_ & sq_mask_;
+        struct io_uring_sqe* sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void queue_cancel(uint64_t target) {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = target;
+        queue_sqe(sqe, new PendingOp(-1, IoHandler()));
+    }
+
+    OperationId queue_sqe(struct io_uring_sqe* sqe, PendingOp* op) {
+        // user_dataにはポインタではなく通し番号を使う（取り消し対象がアドレス再利用で入れ替わらないように）
+        uint64_t id = next_op_id_++;
+        sqe->user_data = id;
+        pending_ops_[id] = op;
+        unsigned index = sq_local_tail_ & sq_mask_;
+        sq_array_[index] = index;
+        sq_local_tail_++;
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+        return id;
+    }
+
+    void arm_accept() {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_sock_;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        if (multishot_accept_) {
+            sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+        }
+        accept_op_ = new PendingOp(listen_sock_, [this](ssize_t result) { on_accept_completion(result); });
+        queue_sqe(sqe, accept_op_);
+    }
+
+    void on_accept_completion(ssize_t result) {
+        if (result >= 0) {
+            on_accept_(static_cast<int>(result));
+        } else if (result == -EINVAL && multishot_accept_) {
+            std::cerr << "情報: マルチショットacceptに非対応のため、単発acceptを使用します。\n";
+            multishot_accept_ = false;
+        } else if (!g_shutdown_flag.load()) {
+            std::cerr << "エラー: acceptに失敗しました。 " << strerror(static_cast<int>(-result)) << std::endl;
+        }
+    }
+
+    void arm_wake_read() {
+        struct io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wake_fd_;
+        sqe->addr = reinterpret_cast<__u64>(&wake_value_);
+        sqe->len = sizeof(wake_value_);
+        queue_sqe(sqe, new PendingOp(wake_fd_, [this](ssize_t) {
+            run_posted();
+            arm_wake_read();
+        }));
+    }
+
+    void reap_completions() {
+        unsigned head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+            uint64_t id = cqe->user_data;
+            ssize_t result = cqe->res;
+            bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            head++;
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+            std::unordered_map<uint64_t, PendingOp*>::iterator it = pending_ops_.find(id);
+            if (it == pending_ops_.end()) {
+                continue;
+            }
+            PendingOp* op = it->second;
+            if (op->handler) {
+                op->handler(result);
+            }
+            if (!more) {
+                bool accept_finished = (op == accept_op_);
+                pending_ops_.erase(id);
+                delete op;
+                // acceptの登録が終わったら（単発、またはマルチショットの打ち切り）再登録する
+                if (accept_finished) {
+                    accept_op_ = nullptr;
+                    if (!g_shutdown_flag.load()) {
+                        arm_accept();
+                    }
+                }
+            }
+        }
+    }
+
+    void release_pending_operations() {
+        for (const auto& entry : pending_ops_) {
+            delete entry.second;
+        }
+        pending_ops_.clear();
+    }
+
+    int ring_fd_;
+    void* sq_ptr_;
+    void* cq_ptr_;
+    struct io_uring_sqe* sqes_;
+    size_t sq_ring_size_;
+    size_t cq_ring_size_;
+    size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned* sq_array_;
+    unsigned sq_local_tail_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+    bool buffers_registered_;
+    bool multishot_accept_;
+    int listen_sock_;
+    AcceptHandler on_accept_;
+    uint64_t wake_value_;
+    std::unordered_map<uint64_t, PendingOp*> pending_ops_;
+    uint64_t next_op_id_;
+    PendingOp* accept_op_;
+};
+
+/**
+ * @brief イベントループ上で動くコルーチンの戻り値型（呼び出し側がco_awaitする）
+ *
+ * 呼ばれた時点では開始せず、co_awaitされた時点で開始する。完了すると
+ * 待っていたコルーチンに直接制御を戻す。
+ */
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        T value{};
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+    T await_resume() {
+        if (handle_.promise().error) {
+            std::rethrow_exception(handle_.promise().error);
+        }
+        return std::move(handle_.promise().value);
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * @brief 投げっぱなしで実行する最上位のコルーチン（接続1本分のセッションなど）
+ */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {
+            try {
+                throw;
+            } catch (const std::exception& e) {
+                std::cerr << "エラー: 接続処理中に例外が発生しました: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "エラー: 接続処理中に不明な例外が発生しました。\n";
+            }
+        }
+    };
+};
+
+/**
+ * @brief 送受信したバイト列を時刻付きでファイルに記録する（CAPTURE_FILE。形式は TrafficCapture.h）
+ *
+ * 各イベントループは記録をメモリ上のバッファに追加するだけで、ファイルへの書き込みは
+ * 専用のスレッドがまとめて行う（ループがディスクの待ちで止まらないようにする）。
+ * 記録した合計が上限に達したら、以降は記録せずに数だけ数える。
+ */
+class TrafficRecorder {
+public:
+    TrafficRecorder()
+        : file_(nullptr), max_bytes_(0), written_(0), next_connection_(0), dropped_(0), stopping_(false),
+          started_(std::chrono::steady_clock::now()) {}
+
+    ~TrafficRecorder() { stop(); }
+
+    TrafficRecorder(const TrafficRecorder&) = delete;
+    TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+    /**
+     * @brief 記録ファイルを作り、書き込みスレッドを開始する
+     * @param max_bytes 記録する合計の上限（0なら無制限）
+     */
+    bool start(const std::string& path, uint64_t max_bytes) {
+        file_ = fopen(path.c_str(), "wb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        path_ = path;
+        max_bytes_ = max_bytes;
+        started_ = std::chrono::steady_clock::now();
+        uint64_t start_unix_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                           std::chrono::system_clock::now().time_since_epoch())
+                                                           .count());
+        buffer_ = traffic_capture::file_header(start_unix_ns);
+        writer_ = std::thread(&TrafficRecorder::run_writer, this);
+        return true;
+    }
+
+    /**
+     * @brief 接続の開始を記録する（以降このソケットの送受信を記録する）
+     */
+    void open(int sock, traffic_capture::RecordType type, const std::string& peer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint32_t connection = ++next_connection_;
+        connections_[sock] = connection;
+        append_locked(connection, type, peer.data(), peer.size());
+    }
+
+    void data(int sock, traffic_capture::RecordType type, const char* data, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unordered_map<int, uint32_t>::const_iterator it = connections_.find(sock);
+        if (it != connections_.end()) {
+            append_locked(it->second, type, data, length);
+        }
+    }
+
+    // ソケットを閉じる前に呼ぶ（閉じた後は同じ番号のソケットが別の接続に使われる）
+    void close(int sock) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unordered_map<int, uint32_t>::iterator it = connections_.find(sock);
+        if (it != connections_.end()) {
+            append_locked(it->second, traffic_capture::CLOSED, nullptr, 0);
+            connections_.erase(it);
+        }
+    }
+
+    /**
+     * @brief 残りを書き込んでファイルを閉じる
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        if (file_ != nullptr) {
+            fclose(file_);
+            file_ = nullptr;
+        }
+    }
+
+    const std::string& path() const { return path_; }
+    uint64_t connections() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return next_connection_;
+    }
+    uint64_t written() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_;
+    }
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_;
+    }
+
+private:
+    void append_locked(uint32_t connection, traffic_capture::RecordType type, const char* data, size_t length) {
+        size_t record_size = traffic_capture::RECORD_HEADER_SIZE + length;
+        if (max_bytes_ != 0 && written_ + record_size > max_bytes_) {
+            dropped_++;
+            return;
+        }
+        uint64_t time_ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started_).count());
+        traffic_capture::append_record(buffer_, time_ns, connection, type, data, length);
+        written_ += record_size;
+        if (buffer_.size() >= FLUSH_BYTES) {
+            cv_.notify_one();
+        }
+    }
+
+    // バッファが溜まるか100ミリ秒ごとに、まとめてファイルへ書き込む
+    void run_writer() {
+        std::string pending;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait_for(lock, std::chrono::milliseconds(100),
+                         [this] { return stopping_ || buffer_.size() >= FLUSH_BYTES; });
+            pending.swap(buffer_);
+            bool stopping = stopping_;
+            lock.unlock();
+            if (!pending.empty()) {
+                if (fwrite(pending.data(), 1, pending.size(), file_) != pending.size()) {
+                    std::cerr << "エラー: 通信の記録 " << path_ << " に書き込めませんでした。 " << strerror(errno)
+                              << std::endl;
+                }
+                fflush(file_);
+                pending.clear();
+            }
+            lock.lock();
+            if (stopping && buffer_.empty()) {
+                break;
+            }
+        }
+    }
+
+    static const size_t FLUSH_BYTES = 256 * 1024;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::string buffer_;
+    std::unordered_map<int, uint32_t> connections_; // ソケット → 接続番号
+    std::string path_;
+    FILE* file_;
+    uint64_t max_bytes_;
+    uint64_t written_;
+    uint32_t next_connection_;
+    uint64_t dropped_;
+    bool stopping_;
+    std::chrono::steady_clock::time_point started_;
+    std::thread writer_;
+};
+
+// 通信の記録（CAPTURE_FILE が空なら無効。受信スレッドの開始前に作り、終了後に止める）
+std::unique_ptr<TrafficRecorder> g_traffic_recorder;
+
+/**
+ * @brief バックエンドの非同期操作1回分を待つawaitable（期限付き）
+ *
+ * 期限までに完了しなければこの操作だけを取り消し、結果は -ETIMEDOUT になる
+ * （パイプライン接続では同じソケットで受信と送信が同時に保留されるため、もう一方には触れない）。
+ */
+class IoAwaitable {
+public:
+    enum Kind { RECV, SEND, CONNECT };
+
+    IoAwaitable(EventBackend& backend, Kind kind, int sock, char* buf, size_t len, int buffer_index,
+                const sockaddr_in* addr, EventBackend::Deadline deadline)
+        : backend_(backend), kind_(kind), sock_(sock), buf_(buf), len_(len), buffer_index_(buffer_index),
+          addr_(addr), deadline_(deadline), timer_(0), operation_(0), timed_out_(false), result_(0) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        if (deadline_ != EventBackend::Deadline::max()) {
+            timer_ = backend_.add_timer(deadline_, [this] {
+                timer_ = 0;
+                timed_out_ = true;
+                backend_.cancel_operation(sock_, operation_);
+            });
+        }
+        EventBackend::IoHandler done = [this](ssize_t result) {
+            if (timer_ != 0) {
+                backend_.cancel_timer(timer_);
+                timer_ = 0;
+            }
+            result_ = timed_out_ ? -ETIMEDOUT : result;
+            if (g_traffic_recorder && result_ >= 0) {
+                record_traffic();
+            }
+            handle_.resume();
+        };
+        switch (kind_) {
+            case RECV:
+                operation_ = backend_.async_recv(sock_, buf_, len_, buffer_index_, std::move(done));
+                break;
+            case SEND:
+                operation_ = backend_.async_send(sock_, buf_, len_, std::move(done));
+                break;
+            case CONNECT:
+                operation_ = backend_.async_connect(sock_, *addr_, std::move(done));
+                break;
+        }
+    }
+
+    ssize_t await_resume() const noexcept { return result_; }
+
+private:
+    void record_traffic() {
+        if (kind_ == CONNECT) {
+            char address[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr_->sin_addr, address, sizeof(address));
+            g_traffic_recorder->open(sock_, traffic_capture::CONNECTED,
+                                     std::string(address) + ":" + std::to_string(ntohs(addr_->sin_port)));
+        } else if (result_ > 0) {
+            g_traffic_recorder->data(sock_, kind_ == RECV ? traffic_capture::RECEIVED : traffic_capture::SENT, buf_,
+                                     static_cast<size_t>(result_));
+        }
+    }
+
+    EventBackend& backend_;
+    Kind kind_;
+    int sock_;
+    char* buf_;
+    size_t len_;
+    int buffer_index_;
+    const sockaddr_in* addr_;
+    EventBackend::Deadline deadline_;
+    EventBackend::TimerId timer_;
+    EventBackend::OperationId operation_; // 期限切れで取り消す操作
+    bool timed_out_;
+    ssize_t result_;
+    std::coroutine_handle<> handle_;
+};
+
+/**
+ * @brief 他スレッド（ワーカーなど）に処理を渡し、終わったらループ上で再開するawaitable
+ *
+ * start には「処理の最後に呼ぶ resume」が渡される。start が false を返した
+ * 場合（過負荷で投入できなかった場合など）は中断せずにそのまま続行し、
+ * co_await の結果は false になる。
+ */
+class OffloadAwaitable {
+public:
+    typedef std::function<bool(std::function<void()> resume)> Starter;
+
+    OffloadAwaitable(std::shared_ptr<EventBackend> backend, Starter start)
+        : backend_(std::move(backend)), start_(std::move(start)), started_(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        std::shared_ptr<EventBackend> backend = backend_;
+        started_ = start_([backend, handle] { backend->post([handle] { handle.resume(); }); });
+        return started_;
+    }
+
+    bool await_resume() const noexcept { return started_; }
+
+private:
+    std::shared_ptr<EventBackend> backend_;
+    Starter start_;
+    bool started_;
+};
+
+/**
+ * @brief 期限付きで接続する
+ * @return 0で成功、負の値は -errno（期限切れは -ETIMEDOUT）
+ */
+IoAwaitable async_connect(EventBackend& backend, int sock, const sockaddr_in& addr, EventBackend::Deadline deadline) {
+    return IoAwaitable(backend, IoAwaitable::CONNECT, sock, nullptr, 0, -1, &addr, deadline);
+}
+
+/**
+ * @brief 指定時間だけ待つ（ループのタイマーで再開する。ループのスレッドから）
+ */
+OffloadAwaitable async_sleep(std::shared_ptr<EventBackend> backend, std::chrono::milliseconds delay) {
+    EventBackend* loop = backend.get();
+    return OffloadAwaitable(backend, [loop, delay](std::function<void()> resume) {
+        loop->add_timer(std::chrono::steady_clock::now() + delay, std::move(resume));
+        return true;
+    });
+}
+
+/**
+ * @brief 期限付きで届いている分だけ受信する
+ * @return 受信バイト数（0は切断）、負の値は -errno
+ */
+IoAwaitable async_read_some(EventBackend& backend, int sock, char* buf, size_t len, int buffer_index,
+                            EventBackend::Deadline deadline) {
+    return IoAwaitable(backend, IoAwaitable::RECV, sock, buf, len, buffer_index, nullptr, deadline);
+}
+
+/**
+ * @brief バックエンドから借りた受信バッファ（借りられなければヒープに確保）
+ */
+class RecvBuffer {
+public:
+    explicit RecvBuffer(EventBackend& backend) : backend_(backend), index_(backend.acquire_recv_buffer()) {
+        if (index_ < 0) {
+            heap_.resize(EventBackend::RECV_BUFFER_SIZE);
+        }
+    }
+    ~RecvBuffer() { backend_.release_recv_buffer(index_); }
+    RecvBuffer(const RecvBuffer&) = delete;
+    RecvBuffer& operator=(const RecvBuffer&) = delete;
+
+    char* data() { return index_ >= 0 ? backend_.recv_buffer(index_) : heap_.data(); }
+    size_t size() const { return EventBackend::RECV_BUFFER_SIZE; }
+    int index() const { return index_; }
+
+private:
+    EventBackend& backend_;
+    int index_;
+    std::vector<char> heap_;
+};
+
+/**
+ * @brief 受信側の接続制限（CONFIG_SYNCから読み込む）
+ */
+struct ConnectionLimits {
+    std::chrono::milliseconds idle_timeout;  // 1回の受信を待つ最大時間
+    std::chrono::milliseconds frame_timeout; // 1フレーム（ヘッダー＋本体）を受信し終えるまでの期限
+    long min_recv_rate;                      // 最低受信速度（バイト/秒、0で無効）
+    long max_connections_per_ip;             // 送信元IPごとの同時接続数の上限（0で無制限）
+    size_t max_frame_size;                   // 更新フレームの最大長（バイト）
+    bool require_crc;                        // trueならCRC32Cのトレーラーがない更新フレームを拒否する
+};
+
+// 最低受信速度の判定を始めるまでの猶予
+const std::chrono::seconds MIN_RATE_GRACE(2);
+
+ConnectionLimits load_connection_limits() {
+    ConnectionLimits limits;
+    limits.idle_timeout = std::chrono::milliseconds(get_config_int("CONFIG_SYNC", "CLIENT_IDLE_TIMEOUT_MS", 10000, 100, 3600000));
+    limits.frame_timeout = std::chrono::milliseconds(get_config_int("CONFIG_SYNC", "CLIENT_FRAME_TIMEOUT_MS", 30000, 100, 3600000));
+    limits.min_recv_rate = get_config_int("CONFIG_SYNC", "CLIENT_MIN_RECV_RATE", 512, 0, 1L << 30);
+    limits.max_connections_per_ip = get_config_int("CONFIG_SYNC", "MAX_CONNECTIONS_PER_IP", 8, 0, 65535);
+    limits.max_frame_size = static_cast<size_t>(
+        get_config_int("CONFIG_SYNC", "MAX_FRAME_SIZE", 1024 * 1024, 1, 1L << 30));
+    limits.require_crc = get_config_int("CONFIG_SYNC", "REQUIRE_FRAME_CRC", 0, 0, 1) != 0;
+    return limits;
+}
+
+/**
+ * @brief ソケットの調整項目（SOCKET_PROFILE と個別の設定キーで決まる）
+ *
+ * 待ち受け・受け付けた接続・WPFへの送信の各ソケットに同じ内容を適用する。
+ * 0 の項目はカーネルの既定値のまま変更しない。
+ */
+struct SocketProfile {
+    std::string name;
+    bool no_delay = false;               // TCP_NODELAY（Nagleアルゴリズムを無効にする）
+    bool quick_ack = false;              // TCP_QUICKACK（遅延ACKを使わない。受信のたびに設定し直す）
+    long send_buffer = 0;                // SO_SNDBUF（バイト）
+    long recv_buffer = 0;                // SO_RCVBUF（バイト）
+    long user_timeout_ms = 0;            // TCP_USER_TIMEOUT（未ACKのデータを抱えたまま切断とみなすまで）
+    bool keepalive = false;              // SO_KEEPALIVE
+    long keepalive_idle_s = 0;           // TCP_KEEPIDLE
+    long keepalive_interval_s = 0;       // TCP_KEEPINTVL
+    long keepalive_count = 0;            // TCP_KEEPCNT
+    long listen_backlog = 128;           // listen() の受け付け待ち上限
+    std::chrono::milliseconds connect_timeout{5000}; // WPFへの接続のタイムアウト
+    std::chrono::milliseconds send_timeout{5000};    // 1回の送信を終えるまでのタイムアウト
+};
+
+/**
+ * @brief SOCKET_PROFILE の既定値に個別の設定キーを重ねてソケットの調整項目を読み込む
+ *
+ * プロファイル:
+ * - default     : カーネルの既定値のまま（従来の動作）
+ * - low_latency : TCP_NODELAY・TCP_QUICKACK を有効にし、切断を早く検知する（小さな要求/応答向け）
+ * - throughput  : 送受信バッファを大きくする（大きな設定の一括転送向け）
+ */
+SocketProfile load_socket_profile() {
+    SocketProfile base;
+    base.name = get_config_value("CONFIG_SYNC", "SOCKET_PROFILE", "default");
+    if (base.name == "low_latency") {
+        base.no_delay = true;
+        base.quick_ack = true;
+        base.user_timeout_ms = 5000;
+        base.keepalive = true;
+        base.keepalive_idle_s = 10;
+        base.keepalive_interval_s = 2;
+        base.keepalive_count = 3;
+    } else if (base.name == "throughput") {
+        base.send_buffer = 1024 * 1024;
+        base.recv_buffer = 1024 * 1024;
+        base.keepalive = true;
+        base.keepalive_idle_s = 60;
+        base.keepalive_interval_s = 10;
+        base.keepalive_count = 5;
+    } else if (base.name != "default") {
+        std::cerr << "警告: 不明なSOCKET_PROFILE: " << base.name << "。default を使用します。\n";
+        base.name = "default";
+    }
+
+    SocketProfile profile = base;
+    profile.no_delay = get_config_int("CONFIG_SYNC", "TCP_NODELAY", base.no_delay, 0, 1) != 0;
+    profile.quick_ack = get_config_int("CONFIG_SYNC", "TCP_QUICKACK", base.quick_ack, 0, 1) != 0;
+    profile.send_buffer = get_config_int("CONFIG_SYNC", "SOCKET_SNDBUF", base.send_buffer, 0, 64L * 1024 * 1024);
+    profile.recv_buffer = get_config_int("CONFIG_SYNC", "SOCKET_RCVBUF", base.recv_buffer, 0, 64L * 1024 * 1024);
+    profile.user_timeout_ms = get_config_int("CONFIG_SYNC", "TCP_USER_TIMEOUT_MS", base.user_timeout_ms, 0, 3600000);
+    profile.keepalive = get_config_int("CONFIG_SYNC", "TCP_KEEPALIVE", base.keepalive, 0, 1) != 0;
+    profile.keepalive_idle_s = get_config_int("CONFIG_SYNC", "TCP_KEEPIDLE_S", base.keepalive_idle_s, 0, 32767);
+    profile.keepalive_interval_s = get_config_int("CONFIG_SYNC", "TCP_KEEPINTVL_S", base.keepalive_interval_s, 0, 32767);
+    profile.keepalive_count = get_config_int("CONFIG_SYNC", "TCP_KEEPCNT", base.keepalive_count, 0, 127);
+    profile.listen_backlog = get_config_int("CONFIG_SYNC", "LISTEN_BACKLOG", base.listen_backlog, 1, 65535);
+    profile.connect_timeout = std::chrono::milliseconds(
+        get_config_int("CONFIG_SYNC", "CONNECT_TIMEOUT_MS", base.connect_timeout.count(), 100, 3600000));
+    profile.send_timeout = std::chrono::milliseconds(
+        get_config_int("CONFIG_SYNC", "SEND_TIMEOUT_MS", base.send_timeout.count(), 100, 3600000));
+    return profile;
+}
+
+// 使用中のソケットの調整項目（main()で受信スレッドの開始前に読み込む）
+SocketProfile g_socket_profile;
+
+/**
+ * @brief ソケットの調整項目を1つのソケットに適用する
+ *
+ * 失敗した項目は警告を出して飛ばす（接続自体は続ける）。
+ * @param listener 待ち受けソケットならtrue（バッファはここで設定しないとウィンドウスケールに反映されない）
+ * @return すべて適用できた場合true
+ */
+bool apply_socket_profile(int sock, const SocketProfile& profile, bool listener) {
+    bool ok = true;
+    auto set_option = [sock, &ok](int level, int name, int value, const char* label) {
+        if (setsockopt(sock, level, name, &value, sizeof(value)) < 0) {
+            std::cerr << "警告: " << label << " を設定できませんでした。 " << strerror(errno) << std::endl;
+            ok = false;
+        }
+    };
+    if (profile.send_buffer > 0) {
+        set_option(SOL_SOCKET, SO_SNDBUF, static_cast<int>(profile.send_buffer), "SO_SNDBUF");
+    }
+    if (profile.recv_buffer > 0) {
+        set_option(SOL_SOCKET, SO_RCVBUF, static_cast<int>(profile.recv_buffer), "SO_RCVBUF");
+    }
+    if (profile.no_delay) {
+        set_option(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (profile.user_timeout_ms > 0) {
+        set_option(IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(profile.user_timeout_ms), "TCP_USER_TIMEOUT");
+    }
+    if (profile.keepalive) {
+        set_option(SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+        if (profile.keepalive_idle_s > 0) {
+            set_option(IPPROTO_TCP, TCP_KEEPIDLE, static_cast<int>(profile.keepalive_idle_s), "TCP_KEEPIDLE");
+        }
+        if (profile.keepalive_interval_s > 0) {
+            set_option(IPPROTO_TCP, TCP_KEEPINTVL, static_cast<int>(profile.keepalive_interval_s), "TCP_KEEPINTVL");
+        }
+        if (profile.keepalive_count > 0) {
+            set_option(IPPROTO_TCP, TCP_KEEPCNT, static_cast<int>(profile.keepalive_count), "TCP_KEEPCNT");
+        }
+    }
+    if (profile.quick_ack && !listener) {
+        set_option(IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    }
+    return ok;
+}
+
+/**
+ * @brief TCP_QUICKACK を設定し直す（カーネルが遅延ACKに戻すことがあるため、受信のたびに呼ぶ）
+ */
+void rearm_quick_ack(int sock) {
+    if (g_socket_profile.quick_ack) {
+        int value = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value));
+    }
+}
+
+// 制限による切断の件数（統計表示用）
+struct EvictionStats {
+    std::atomic<uint64_t> idle{0};
+    std::atomic<uint64_t> frame_deadline{0};
+    std::atomic<uint64_t> slow_rate{0};
+    std::atomic<uint64_t> per_ip_limit{0};
+};
+EvictionStats g_eviction_stats;
+
+/**
+ * @brief フレームヘッダー "<長さ>[ オプション...]\n" の内容
+ *
+ * オプション（空白区切り、いずれも省略可）:
+ * - crc          : 本体の後に8桁16進のCRC32Cと改行 "xxxxxxxx\n" が続く
+ * - sid=<名前>   : 送信側のセッション名（英数字・'-'・'_'、32文字まで）
+ * - seq=<番号>   : セッション内の通し番号（1から。sidと組で使う）
+ * - accept=<方式,...> : 返信を圧縮してよい方式（ConfigCompression.h）
+ * - enc=<方式> raw=<長さ> dict=<辞書ID> : 本体が圧縮されている（長さ・CRCは圧縮後のもの）
+ * - id=<名前>    : 要求の識別子（英数字・'-'・'_'、32文字まで）。最初のフレームに付けると
+ *                  その接続はパイプライン接続になり、返信は同じ id を付けて処理が終わった順に返る
+ * - op=<操作>    : get / update / subscribe（省略時は長さ0なら get、それ以外は update）
+ * - section= key= match= since= : get / subscribe の読み出し条件（ConfigQuery を参照）
+ * - op=replicate [since=<版> epoch=<エポック>] : 設定の複製を始める（複製先が送る。ReplicaStream を参照）
+ * - op=ack version=<版> : 複製したバッチの適用完了を知らせる（購読では、通知を反映し終えたことを知らせる）
+ * - subscribe の subsystem=<名前> : そのサブシステムに影響する変更だけを通知する（SUBSYSTEM_MAP）
+ * - op=cas [version=<版>] [partial] : 条件付き更新。本体の各行 "[SECTION]KEY@<版>=VALUE"（@<版> を省略すると
+ *   version= の値）の項目が、その版より後に変わっていなければ適用する。partial がなければ1つでも衝突すると
+ *   何も適用せず、衝突した項目の現在の版と値を返す（apply_config_updates_if_unchanged_locked を参照）
+ * - op=preset name=<名前> : 設定をプリセット（PRESETS_FILE）に切り替える。変わる項目は1つのバッチとして適用する
+ * - event=snapshot|append version= base= epoch= : 複製元から複製先へのバッチ（複製先だけが受け付ける）
+ *   パイプライン接続の要求は並行して処理するため、先に送った update の適用を待たずに
+ *   後の get が返ることがある（順序が必要なら update の返信を待ってから送る）。
+ * オプションのない "<長さ>\n" は従来どおり扱う。
+ */
+struct FrameHeader {
+    enum Op { GET, UPDATE, SUBSCRIBE, REPLICATE, ACK, CAS, PRESET };
+
+    size_t length = 0;
+    bool crc = false;
+    std::string session;
+    uint64_t seq = 0; // 0は番号なし
+    std::string accept; // 返信に使ってよい圧縮方式（設定要求のみ）
+    config_compression::Codec codec = config_compression::NONE; // 本体の圧縮方式
+    size_t raw_length = 0; // 展開後の長さ
+    std::string id;        // 要求の識別子（パイプライン接続）
+    Op op = UPDATE;
+    ConfigQuery query;     // get / subscribe の読み出し条件
+    std::string event;     // 複製のバッチの種類（snapshot / append）
+    uint64_t version = 0;  // ack・バッチの設定バージョン（複製元の番号）
+    uint64_t base = 0;     // append の直前のバッチの設定バージョン
+    std::string epoch;     // 複製元のエポック（起動ごとに変わる）
+    std::string subsystem; // subscribe で通知を受けるサブシステム
+    bool partial = false;  // cas で、衝突しなかった項目だけでも適用する
+    std::string preset;    // preset で切り替えるプリセット名
+};
+
+const size_t CRC_TRAILER_LENGTH = 9; // "xxxxxxxx\n"
+const size_t MAX_SESSION_NAME_LENGTH = 32;
+const size_t MAX_FRAME_NAME_LENGTH = 64; // section= / key= / name= / subsystem= / accept= と match= の片側
+
+/**
+ * @brief 識別子（sid= / id= / section= / key=）に使える文字だけでできているか
+ */
+bool is_valid_frame_name(const std::string& name) {
+    return !name.empty() && name.size() <= MAX_FRAME_NAME_LENGTH &&
+           name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") ==
+               std::string::npos;
+}
+
+/**
+ * @brief match= のパターン（識別子の文字と '*'・'?'）として正しいか
+ */
+bool is_valid_query_pattern(const std::string& pattern) {
+    return !pattern.empty() && pattern.size() <= MAX_FRAME_NAME_LENGTH &&
+           pattern.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_*?") ==
+               std::string::npos;
+}
+
+/**
+ * @brief 10進の設定バージョン（19桁まで）を読む
+ */
+bool parse_version_number(const std::string& number, uint64_t& version) {
+    if (number.empty() || number.size() > 19 || number.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    version = std::stoull(number);
+    return true;
+}
+
+/**
+ * @brief フレームヘッダーをパースする
+ * @param error 不正な場合の理由
+ * @param from_leader trueなら複製元からのバッチ（event=）を受け付ける
+ */
+bool parse_frame_header(const std::string& header, FrameHeader& frame, std::string& error,
+                        bool from_leader = false) {
+    trace_spans::Span span("parse");
+    std::istringstream tokens(header);
+    std::string token;
+    if (!(tokens >> token) || token.find_first_not_of("0123456789") != std::string::npos || token.size() > 19) {
+        error = "メッセージ長が不正です";
+        return false;
+    }
+    frame.length = std::stoull(token);
+    bool has_raw = false;
+    bool has_dict = false;
+    bool has_op = false;
+    while (tokens >> token) {
+        if (token == "crc") {
+            frame.crc = true;
+        } else if (token == "partial") {
+            frame.partial = true;
+        } else if (token.compare(0, 4, "sid=") == 0) {
+            frame.session = token.substr(4);
+            if (frame.session.empty() || frame.session.size() > MAX_SESSION_NAME_LENGTH ||
+                frame.session.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") !=
+                    std::string::npos) {
+                error = "セッション名が不正です: " + frame.session;
+                return false;
+            }
+        } else if (token.compare(0, 4, "seq=") == 0) {
+            std::string number = token.substr(4);
+            if (number.empty() || number.size() > 19 || number.find_first_not_of("0123456789") != std::string::npos ||
+                (frame.seq = std::stoull(number)) == 0) {
+                error = "シーケンス番号が不正です: " + number;
+                return false;
+            }
+        } else if (token.compare(0, 3, "id=") == 0) {
+            frame.id = token.substr(3);
+            if (!is_valid_frame_name(frame.id) || frame.id.size() > MAX_SESSION_NAME_LENGTH) {
+                error = "要求の識別子が不正です: " + frame.id;
+                return false;
+            }
+        } else if (token.compare(0, 3, "op=") == 0) {
+            std::string op = token.substr(3);
+            if (op == "get") {
+                frame.op = FrameHeader::GET;
+            } else if (op == "update") {
+                frame.op = FrameHeader::UPDATE;
+            } else if (op == "subscribe") {
+                frame.op = FrameHeader::SUBSCRIBE;
+            } else if (op == "replicate") {
+                frame.op = FrameHeader::REPLICATE;
+            } else if (op == "ack") {
+                frame.op = FrameHeader::ACK;
+            } else if (op == "cas") {
+                frame.op = FrameHeader::CAS;
+            } else if (op == "preset") {
+                frame.op = FrameHeader::PRESET;
+            } else {
+                error = "不明な操作です: " + op;
+                return false;
+            }
+            has_op = true;
+        } else if (token.compare(0, 8, "section=") == 0) {
+            frame.query.section = token.substr(8);
+            if (!is_valid_frame_name(frame.query.section)) {
+                error = "セクション名が不正です: " + frame.query.section;
+                return false;
+            }
+        } else if (token.compare(0, 4, "key=") == 0) {
+            frame.query.key = token.substr(4);
+            if (!is_valid_frame_name(frame.query.key)) {
+                error = "キー名が不正です: " + frame.query.key;
+                return false;
+            }
+        } else if (token.compare(0, 6, "match=") == 0) {
+            std::string pattern = token.substr(6);
+            size_t colon = pattern.find(':');
+            frame.query.section_pattern = pattern.substr(0, colon);
+            frame.query.key_pattern = colon == std::string::npos ? std::string() : pattern.substr(colon + 1);
+            if (!is_valid_query_pattern(frame.query.section_pattern) ||
+                (colon != std::string::npos && !is_valid_query_pattern(frame.query.key_pattern))) {
+                error = "パターンが不正です: " + pattern;
+                return false;
+            }
+        } else if (token.compare(0, 6, "since=") == 0) {
+            std::string number = token.substr(6);
+            if (number.empty() || number.size() > 19 || number.find_first_not_of("0123456789") != std::string::npos) {
+                error = "設定バージョンが不正です: " + number;
+                return false;
+            }
+            frame.query.since = std::stoull(number);
+            frame.query.has_since = true;
+        } else if (token.compare(0, 8, "version=") == 0 || token.compare(0, 5, "base=") == 0) {
+            bool is_base = token[0] == 'b';
+            std::string number = token.substr(is_base ? 5 : 8);
+            if (!parse_version_number(number, is_base ? frame.base : frame.version)) {
+                error = "設定バージョンが不正です: " + number;
+                return false;
+            }
+        } else if (token.compare(0, 5, "name=") == 0) {
+            frame.preset = token.substr(5);
+            if (!is_valid_frame_name(frame.preset)) {
+                error = "プリセット名が不正です: " + frame.preset;
+                return false;
+            }
+        } else if (token.compare(0, 10, "subsystem=") == 0) {
+            frame.subsystem = token.substr(10);
+            if (!is_valid_frame_name(frame.subsystem)) {
+                error = "サブシステム名が不正です: " + frame.subsystem;
+                return false;
+            }
+        } else if (token.compare(0, 6, "epoch=") == 0) {
+            frame.epoch = token.substr(6);
+            if (!is_valid_frame_name(frame.epoch) || frame.epoch.size() > MAX_SESSION_NAME_LENGTH) {
+                error = "エポックが不正です: " + frame.epoch;
+                return false;
+            }
+        } else if (from_leader && token.compare(0, 6, "event=") == 0) {
+            frame.event = token.substr(6);
+            if (frame.event != "snapshot" && frame.event != "append") {
+                error = "不明なバッチの種類です: " + frame.event;
+                return false;
+            }
+        } else if (token.compare(0, 7, "accept=") == 0) {
+            frame.accept = token.substr(7);
+            if (frame.accept.size() > MAX_FRAME_NAME_LENGTH) {
+                error = "圧縮方式の一覧が長すぎます";
+                return false;
+            }
+        } else if (token.compare(0, 4, "enc=") == 0) {
+            if (!config_compression::parse_codec(token.substr(4), frame.codec) ||
+                (frame.codec != config_compression::NONE && !config_compression::is_supported(frame.codec))) {
+                error = "未対応の圧縮方式です: " + token.substr(4);
+                return false;
+            }
+        } else if (token.compare(0, 4, "raw=") == 0) {
+            std::string number = token.substr(4);
+            if (number.empty() || number.size() > 19 || number.find_first_not_of("0123456789") != std::string::npos) {
+                error = "展開後の長さが不正です: " + number;
+                return false;
+            }
+            frame.raw_length = std::stoull(number);
+            has_raw = true;
+        } else if (token.compare(0, 5, "dict=") == 0) {
+            char id[16];
+            snprintf(id, sizeof(id), "%08x", config_compression::dictionary_id());
+            if (token.substr(5) != id) {
+                error = "圧縮辞書が一致しません: " + token.substr(5) + "（こちらは " + id + "）";
+                return false;
+            }
+            has_dict = true;
+        } else {
+            error = "不明なオプションです: " + token;
+            return false;
+        }
+    }
+    if (frame.seq != 0 && frame.session.empty()) {
+        error = "seq には sid が必要です";
+        return false;
+    }
+    if (frame.codec != config_compression::NONE && (!has_raw || !has_dict)) {
+        error = "enc には raw と dict が必要です";
+        return false;
+    }
+    if (!frame.event.empty()) {
+        if (has_op) {
+            error = "event と op は同時に指定できません";
+            return false;
+        }
+        frame.op = FrameHeader::UPDATE; // バッチの本体は更新と同じ形式で受信する
+        has_op = true;
+    }
+    if (!has_op) {
+        frame.op = frame.length == 0 ? FrameHeader::GET : FrameHeader::UPDATE;
+    }
+    if (frame.op != FrameHeader::UPDATE && frame.op != FrameHeader::CAS && frame.length != 0) {
+        error = "get / subscribe / replicate / ack / preset には本体を付けられません";
+        return false;
+    }
+    if (frame.op == FrameHeader::CAS && frame.id.empty()) {
+        error = "cas には id が必要です";
+        return false;
+    }
+    if (frame.op == FrameHeader::PRESET && (frame.id.empty() || frame.preset.empty())) {
+        error = "preset には id と name が必要です";
+        return false;
+    }
+    if (!frame.preset.empty() && frame.op != FrameHeader::PRESET) {
+        error = "name は preset にだけ付けられます";
+        return false;
+    }
+    if (frame.partial && frame.op != FrameHeader::CAS) {
+        error = "partial は cas にだけ付けられます";
+        return false;
+    }
+    if ((frame.op == FrameHeader::REPLICATE || frame.op == FrameHeader::ACK) && frame.id.empty()) {
+        error = "replicate / ack には id が必要です";
+        return false;
+    }
+    if (frame.op == FrameHeader::REPLICATE && frame.query.filtered()) {
+        error = "replicate には section / match を付けられません";
+        return false;
+    }
+    if (frame.op == FrameHeader::SUBSCRIBE && frame.id.empty()) {
+        error = "subscribe には id が必要です";
+        return false;
+    }
+    if (!frame.subsystem.empty() && frame.op != FrameHeader::SUBSCRIBE) {
+        error = "subsystem は subscribe にだけ付けられます";
+        return false;
+    }
+    if (!frame.query.key.empty() && frame.query.section.empty()) {
+        error = "key には section が必要です";
+        return false;
+    }
+    if (!frame.query.section.empty() && !frame.query.section_pattern.empty()) {
+        error = "section と match は同時に指定できません";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief CRCトレーラー "xxxxxxxx\n" を読む
+ */
+bool parse_crc_trailer(const std::string& trailer, uint32_t& crc) {
+    if (trailer.size() != CRC_TRAILER_LENGTH || trailer[8] != '\n' ||
+        trailer.find_first_not_of("0123456789abcdefABCDEF") != 8) {
+        return false;
+    }
+    crc = static_cast<uint32_t>(std::stoul(trailer.substr(0, 8), nullptr, 16));
+    return true;
+}
+
+// フレームの整合性チェックの件数（統計表示用）
+struct FrameIntegrityStats {
+    std::atomic<uint64_t> crc_verified{0};
+    std::atomic<uint64_t> crc_failed{0};
+    std::atomic<uint64_t> duplicates{0};
+    std::atomic<uint64_t> gaps{0};
+};
+FrameIntegrityStats g_integrity_stats;
+
+/**
+ * @brief セッションごとに適用済みの最後のシーケンス番号を覚え、重複と欠番を見つける
+ *
+ * 再送された更新（番号が適用済み以下）は適用せずに拒否し、古い値の再適用を防ぐ。
+ * 番号が飛んだ場合は途中の更新が失われたことを警告して、受信した更新は適用する。
+ * 受信時の check() は早めに断るためのもので、確定は適用の直前の claim() で行う
+ * （同じ番号の再送が別の接続から届き、先のものが適用待ちの間に check() を通っても二重に適用しない）。
+ * 覚えるセッション数には上限があり、超えた場合は最も長く使われていないものを忘れる。
+ */
+class SequenceTracker {
+public:
+    enum Verdict { IN_ORDER, DUPLICATE, GAP };
+
+    static const size_t MAX_SESSIONS = 1024;
+
+    /**
+     * @brief 番号を判定する（記録はしない）
+     * @param expected 次に期待していた番号（GAPの表示用）
+     */
+    Verdict check(const std::string& session, uint64_t seq, uint64_t& expected) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, Entry>::const_iterator it = sessions_.find(session);
+        if (it == sessions_.end()) {
+            expected = seq; // 初めてのセッションはどの番号から始まってもよい（送信側の再起動など）
+            return IN_ORDER;
+        }
+        expected = it->second.last + 1;
+        if (seq <= it->second.last) {
+            return DUPLICATE;
+        }
+        return seq == expected ? IN_ORDER : GAP;
+    }
+
+    /**
+     * @brief 重複でなければ番号を記録する（判定と記録を1回のロックで行う）
+     * @param last_applied 重複の場合、適用済みの最後の番号
+     * @return 重複ならfalse（記録しない）
+     */
+    bool claim(const std::string& session, uint64_t seq, uint64_t& last_applied) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, Entry>::const_iterator it = sessions_.find(session);
+        if (it != sessions_.end() && seq <= it->second.last) {
+            last_applied = it->second.last;
+            return false;
+        }
+        Entry& entry = sessions_[session];
+        entry.last = std::max(entry.last, seq);
+        entry.touched = ++clock_;
+        if (sessions_.size() > MAX_SESSIONS) {
+            std::map<std::string, Entry>::iterator oldest = sessions_.begin();
+            for (std::map<std::string, Entry>::iterator it = sessions_.begin(); it != sessions_.end(); ++it) {
+                if (it->second.touched < oldest->second.touched) {
+                    oldest = it;
+                }
+            }
+            sessions_.erase(oldest);
+        }
+        return true;
+    }
+
+private:
+    struct Entry {
+        uint64_t last = 0;
+        uint64_t touched = 0;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Entry> sessions_;
+    uint64_t clock_ = 0;
+};
+
+SequenceTracker g_sequence_tracker;
+
+/**
+ * @brief 1フレーム分の受信期限と受信速度を見張る
+ *
+ * 1バイトずつ少しずつ送ってくるクライアント（slow loris）が接続を
+ * 保持し続けられないよう、受信ごとのアイドル期限に加えてフレーム全体の
+ * 期限と最低受信速度を課す。
+ */
+class FrameGuard {
+public:
+    enum Verdict { OK, IDLE, FRAME_DEADLINE, SLOW_RATE };
+
+    explicit FrameGuard(const ConnectionLimits& limits)
+        : limits_(limits), started_(std::chrono::steady_clock::now()),
+          frame_deadline_(started_ + limits.frame_timeout), received_(0), verdict_(OK) {}
+
+    // 次の受信の期限（アイドル期限とフレーム期限の早い方）
+    EventBackend::Deadline next_read_deadline() const {
+        return std::min(frame_deadline_, std::chrono::steady_clock::now() + limits_.idle_timeout);
+    }
+
+    /**
+     * @brief 受信したバイト数を記録する
+     * @param more_expected まだ続きを受信する必要があるか
+     * @return 最低受信速度を下回っていればfalse
+     */
+    bool on_received(size_t bytes, bool more_expected) {
+        received_ += bytes;
+        if (!more_expected || limits_.min_recv_rate <= 0) {
+            return true;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started_;
+        if (elapsed > MIN_RATE_GRACE && received_ < elapsed.count() * limits_.min_recv_rate) {
+            verdict_ = SLOW_RATE;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 次のフレームの受信を始める（期限と受信量を数え直す。パイプライン接続用）
+     */
+    void restart() {
+        started_ = std::chrono::steady_clock::now();
+        frame_deadline_ = started_ + limits_.frame_timeout;
+        received_ = 0;
+        verdict_ = OK;
+    }
+
+    // 受信がタイムアウトした理由を記録する
+    void on_timeout() {
+        verdict_ = std::chrono::steady_clock::now() >= frame_deadline_ ? FRAME_DEADLINE : IDLE;
+    }
+
+    Verdict verdict() const { return verdict_; }
+
+private:
+    const ConnectionLimits& limits_;
+    std::chrono::steady_clock::time_point started_;
+    EventBackend::Deadline frame_deadline_;
+    size_t received_;
+    Verdict verdict_;
+};
+
+/**
+ * @brief 制限による切断を記録し、ログに出す
+ */
+void record_eviction(FrameGuard::Verdict verdict, const std::string& peer) {
+    switch (verdict) {
+        case FrameGuard::IDLE:
+            g_eviction_stats.idle++;
+            std::cerr << "エラー: 受信がタイムアウトしました（" << peer << "）。\n";
+            break;
+        case FrameGuard::FRAME_DEADLINE:
+            g_eviction_stats.frame_deadline++;
+            std::cerr << "エラー: フレームの受信期限を過ぎたため " << peer << " を切断しました。\n";
+            break;
+        case FrameGuard::SLOW_RATE:
+            g_eviction_stats.slow_rate++;
+            std::cerr << "エラー: 受信速度が最低値を下回ったため " << peer << " を切断しました。\n";
+            break;
+        case FrameGuard::OK:
+            break;
+    }
+}
+
+/**
+ * @brief 送信元IPごとの同時接続数を数える（全シャードで共有する）
+ */
+class PeerConnectionCounter {
+public:
+    explicit PeerConnectionCounter(long limit) : limit_(limit) {}
+
+    // 上限に達していなければ1つ数えてtrueを返す
+    bool try_acquire(uint32_t ip) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int& count = counts_[ip];
+        if (limit_ > 0 && count >= limit_) {
+            if (count == 0) {
+                counts_.erase(ip);
+            }
+            return false;
+        }
+        count++;
+        return true;
+    }
+
+    void release(uint32_t ip) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::unordered_map<uint32_t, int>::iterator it = counts_.find(ip);
+        if (it != counts_.end() && --it->second <= 0) {
+            counts_.erase(it);
+        }
+    }
+
+private:
+    long limit_;
+    std::mutex mutex_;
+    std::unordered_map<uint32_t, int> counts_;
+};
+
+/**
+ * @brief セッション終了時に送信元IPの接続数を1つ減らす
+ */
+class PeerSlot {
+public:
+    PeerSlot(std::shared_ptr<PeerConnectionCounter> counter, uint32_t ip) : counter_(std::move(counter)), ip_(ip) {}
+    ~PeerSlot() { counter_->release(ip_); }
+    PeerSlot(const PeerSlot&) = delete;
+    PeerSlot& operator=(const PeerSlot&) = delete;
+
+private:
+    std::shared_ptr<PeerConnectionCounter> counter_;
+    uint32_t ip_;
+};
+
+/**
+ * @brief 指定バイト数を受信し終えるまで読み続け、届いた分から順に consume に渡す
+ * @param length 受信するバイト数
+ * @param guard 受信期限と受信速度の見張り（切断理由は guard.verdict() に残る）
+ * @param consume 受信データの処理。falseを返すと受信を打ち切る
+ * @return 受信したバイト数、負の値は -errno（途中切断は -ECONNRESET、制限による切断は -ETIMEDOUT、
+ *         consumeが打ち切った場合は -EBADMSG）
+ */
+Task<ssize_t> read_stream(EventBackend& backend, int sock, RecvBuffer& buffer, size_t length, FrameGuard& guard,
+                          std::function<bool(const char*, size_t)> consume) {
+    size_t received = 0;
+    while (received < length) {
+        if (g_shutdown_flag.load()) {
+            co_return -ECANCELED;
+        }
+        size_t to_read = std::min(buffer.size(), length - received);
+        ssize_t n = co_await async_read_some(backend, sock, buffer.data(), to_read, buffer.index(),
+                                             guard.next_read_deadline());
+        if (n == -ETIMEDOUT) {
+            guard.on_timeout();
+        }
+        if (n <= 0) {
+            co_return n == 0 ? -ECONNRESET : n;
+        }
+        received += static_cast<size_t>(n);
+        rearm_quick_ack(sock);
+        if (!consume(buffer.data(), static_cast<size_t>(n))) {
+            co_return -EBADMSG;
+        }
+        if (!guard.on_received(static_cast<size_t>(n), received < length)) {
+            co_return -ETIMEDOUT;
+        }
+    }
+    co_return static_cast<ssize_t>(received);
+}
+
+/**
+ * @brief すべて送信し終えるまで送り続ける
+ * @return 送信したバイト数、負の値は -errno（終了要求で中断した場合は -ECANCELED）
+ */
+Task<ssize_t> write_all(EventBackend& backend, int sock, const char* data, size_t length,
+                        EventBackend::Deadline deadline) {
+    trace_spans::Span span("send", sock);
+    size_t sent = 0;
+    while (sent < length) {
+        if (g_shutdown_flag.load()) {
+            co_return -ECANCELED;
+        }
+        ssize_t n = co_await IoAwaitable(backend, IoAwaitable::SEND, sock, const_cast<char*>(data + sent),
+                                         length - sent, -1, nullptr, deadline);
+        if (n < 0) {
+            co_return n;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    co_return static_cast<ssize_t>(sent);
+}
+
+/**
+ * @brief セッション終了時にソケットを閉じ、処理中の一覧から外す
+ */
+class SessionScope {
+public:
+    SessionScope(EventBackend& backend, int sock) : backend_(backend), sock_(sock) {
+        backend_.track_socket(sock_);
+    }
+    ~SessionScope() {
+        if (g_traffic_recorder) {
+            g_traffic_recorder->close(sock_);
+        }
+        backend_.untrack_socket(sock_);
+        backend_.close_socket(sock_);
+    }
+    SessionScope(const SessionScope&) = delete;
+    SessionScope& operator=(const SessionScope&) = delete;
+
+private:
+    EventBackend& backend_;
+    int sock_;
+};
+
+/**
+ * @brief 設定に従って接続処理バックエンドを作成する
+ * @param preference "auto"（io_uring優先）、"io_uring"、"epoll" のいずれか
+ * @return 作成したバックエンド。どれも使えなければnullptr
+ */
+std::shared_ptr<EventBackend> create_event_backend(const std::string& preference) {
+    if (preference != "epoll") {
+        std::shared_ptr<IoUringBackend> uring(new IoUringBackend());
+        if (uring->init()) {
+            return uring;
+        }
+        std::cerr << "警告: io_uringバックエンドを初期化できませんでした。epollにフォールバックします。\n";
+    }
+    std::shared_ptr<EpollBackend> epoll_backend(new EpollBackend());
+    if (epoll_backend->init()) {
+        return epoll_backend;
+    }
+    std::cerr << "エラー: epollバックエンドを初期化できませんでした。 " << strerror(errno) << std::endl;
+    return std::shared_ptr<EventBackend>();
+}
+
+// 動作中のイベントループ（受信スレッドが所有し、送信や統計表示からも使う）。
+// シャードが複数ある場合は最初のシャードのもの
+std::shared_ptr<EventBackend> g_event_backend;
+
+// 全シャードのイベントループ（統計表示用）
+std::vector<std::shared_ptr<EventBackend>> g_shard_backends;
+std::mutex g_shard_mutex;
+
+
+/**
+ * @brief 受信エラーをログに出す
+ */
+void report_recv_error(ssize_t result, bool in_body) {
+    if (result == 0 || result == -ECONNRESET) {
+        if (in_body) {
+            std::cerr << "エラー: クライアントが接続を閉じました。" << std::endl;
+        }
+    } else if (result != -ECANCELED) {
+        std::cerr << "エラー: データ受信中にエラーが発生しました: " << strerror(static_cast<int>(-result)) << std::endl;
+    }
+}
+
+// ヘッダー行の最大長（長さ＋オプション）。parse_frame_header が受け付けるオプションを
+// すべて上限の長さで1回ずつ付けても収まるように、各オプションの上限から求める
+const size_t MAX_HEADER_LENGTH =
+    19 + sizeof(" crc partial op=subscribe event=snapshot enc=zstd dict=xxxxxxxx") - 1 +
+    sizeof(" sid= id= epoch=") - 1 + 3 * MAX_SESSION_NAME_LENGTH +
+    sizeof(" section= key= name= subsystem= accept= match=:") - 1 + 7 * MAX_FRAME_NAME_LENGTH +
+    sizeof(" seq= since= version= base= raw=") - 1 + 5 * 19;
+
+// パイプライン接続で同時に処理中にできる要求数（超えた要求には status=busy を返す）
+const size_t MAX_PIPELINED_REQUESTS = 64;
+
+// パイプライン接続の未送信の返信・通知の上限（読まないクライアントはこれを超えた時点で切断する）
+const size_t MAX_SESSION_OUTBOX_BYTES = 8 * 1024 * 1024;
+
+/**
+ * @brief パイプライン接続の統計
+ */
+struct PipelineStats {
+    std::atomic<uint64_t> sessions{0}; // パイプライン接続になった接続数
+    std::atomic<uint64_t> requests{0}; // パイプライン接続で受けた要求数
+    std::atomic<uint64_t> rejected{0}; // 同時処理数の上限で拒否した要求数
+    std::atomic<uint64_t> events{0};   // 送った変更通知の数
+};
+PipelineStats g_pipeline_stats;
+
+/**
+ * @brief 1本の接続からフレームを順に読み出す
+ *
+ * ヘッダー行の受信でまとめて届いた続き（次のフレームの一部を含む）は
+ * 手元に残し、次の読み出しで先に使う。
+ */
+class FrameReader {
+public:
+    FrameReader(EventBackend& backend, int sock) : backend_(backend), sock_(sock), buffer_(backend) {}
+
+    /**
+     * @brief 改行までの1行を読む（改行は含めない）
+     * @param wait_forever trueなら最初の1バイトはアイドル期限なしで待つ（購読中の接続）
+     * @return 1で成功、0は行の途中でない切断、負の値は -errno
+     *         （長すぎる行は -EMSGSIZE、制限による切断は -ETIMEDOUT で理由は guard.verdict()）
+     */
+    Task<ssize_t> read_line(std::string& line, size_t max_length, FrameGuard& guard, bool wait_forever) {
+        line.clear();
+        while (true) {
+            size_t newline = pending_.find('\n');
+            if (newline != std::string::npos) {
+                line.assign(pending_, 0, newline);
+                pending_.erase(0, newline + 1);
+                co_return line.size() > max_length ? -EMSGSIZE : 1;
+            }
+            if (pending_.size() > max_length) {
+                co_return -EMSGSIZE;
+            }
+            EventBackend::Deadline deadline = wait_forever && pending_.empty() ? EventBackend::Deadline::max()
+                                                                                : guard.next_read_deadline();
+            ssize_t n = co_await async_read_some(backend_, sock_, buffer_.data(), buffer_.size(), buffer_.index(),
+                                                 deadline);
+            if (n == -ETIMEDOUT) {
+                guard.on_timeout();
+            }
+            if (g_shutdown_flag.load()) {
+                co_return -ECANCELED;
+            }
+            if (n <= 0) {
+                co_return n == 0 && !pending_.empty() ? -ECONNRESET : n;
+            }
+            if (deadline == EventBackend::Deadline::max()) {
+                guard.restart(); // 待っていた時間はフレームの受信期限に含めない
+            }
+            rearm_quick_ack(sock_);
+            pending_.append(buffer_.data(), static_cast<size_t>(n));
+            if (!guard.on_received(static_cast<size_t>(n), true)) {
+                co_return -ETIMEDOUT;
+            }
+        }
+    }
+
+    /**
+     * @brief 指定バイト数を読み、届いた分から順に consume に渡す（read_stream と同じ結果を返す）
+     */
+    Task<ssize_t> read_exact(size_t length, FrameGuard& guard, std::function<bool(const char*, size_t)> consume) {
+        size_t taken = std::min(length, pending_.size());
+        if (taken > 0) {
+            std::string head = pending_.substr(0, taken);
+            pending_.erase(0, taken);
+            if (!consume(head.data(), head.size())) {
+                co_return -EBADMSG;
+            }
+        }
+        if (taken == length) {
+            co_return static_cast<ssize_t>(length);
+        }
+        ssize_t received = co_await read_stream(backend_, sock_, buffer_, length - taken, guard, consume);
+        co_return received < 0 ? received : static_cast<ssize_t>(length);
+    }
+
+    // 読み出していないデータが手元に残っているか
+    bool has_pending() const { return !pending_.empty(); }
+
+    int sock() const { return sock_; }
+
+private:
+    EventBackend& backend_;
+    int sock_;
+    RecvBuffer buffer_;
+    std::string pending_;
+};
+
+/**
+ * @brief 受信エラー・制限による切断をログに出す
+ */
+void report_frame_error(ssize_t result, const FrameGuard& guard, const std::string& peer, bool in_body) {
+    if (guard.verdict() != FrameGuard::OK) {
+        record_eviction(guard.verdict(), peer);
+    } else {
+        report_recv_error(result, in_body);
+    }
+}
+
+/**
+ * @brief 更新フレームの本体を受信した結果
+ */
+enum UpdateReceipt {
+    UPDATE_RECEIVED,    // 受信・検証・パースまで終わった
+    UPDATE_CRC_ERROR,   // CRCが一致しない（本体は読み終えている）
+    UPDATE_UNDECODABLE, // 展開できない、または長すぎる行がある（本体は読み終えている）
+    UPDATE_ABORTED,     // 受信中に切断・期限切れになった
+};
+
+/**
+ * @brief 更新フレームの本体（とCRCトレーラー）を受信して検証し、パースする
+ *
+ * 本体は届いた分から行単位でパースして溜め、CRCも届いた分から計算する。
+ * 圧縮された本体はプールのバッファに溜め、受信し終えてから展開してパースする。
+ * @param drain_rejected trueならパースに失敗しても本体の最後まで読む（接続を使い続ける場合）
+ * @param updates 受信した変更（UPDATE_RECEIVED の場合）
+ */
+Task<UpdateReceipt> receive_update_body(FrameReader& reader, const FrameHeader& frame, FrameGuard& guard,
+                                        const std::string& peer, bool drain_rejected,
+                                        std::vector<ConfigUpdate>& updates) {
+    ConfigUpdateParser parser(!frame.event.empty()); // 複製のバッチには削除の行がある
+    PooledBuffer compressed;
+    bool is_compressed = frame.codec != config_compression::NONE;
+    bool with_crc = frame.crc;
+    uint32_t body_crc = 0;
+    // 圧縮していない本体のパースは受信と重なるため、body_read に含まれる
+    std::optional<trace_spans::Span> body_span(std::in_place, "body_read", reader.sock());
+    ssize_t received = co_await reader.read_exact(
+        frame.length, guard,
+        [&parser, &compressed, &body_crc, is_compressed, with_crc, drain_rejected](const char* data, size_t length) {
+            if (with_crc) {
+                body_crc = crc32c(data, length, body_crc);
+            }
+            if (is_compressed) {
+                compressed->append(data, length);
+                return true;
+            }
+            return parser.feed(data, length) || drain_rejected;
+        });
+    if (received < 0 && received != -EBADMSG) {
+        report_frame_error(received, guard, peer, true);
+        co_return UPDATE_ABORTED;
+    }
+
+    // CRCトレーラーを受信して照合する（不一致なら何も適用しない）
+    if (frame.crc) {
+        std::string trailer;
+        if (received != -EBADMSG) {
+            ssize_t result = co_await reader.read_exact(CRC_TRAILER_LENGTH, guard,
+                                                        [&trailer](const char* data, size_t length) {
+                                                            trailer.append(data, length);
+                                                            return true;
+                                                        });
+            if (result < 0) {
+                report_frame_error(result, guard, peer, true);
+                co_return UPDATE_ABORTED;
+            }
+        }
+        uint32_t expected_crc;
+        if (!parser.failed() && (!parse_crc_trailer(trailer, expected_crc) || expected_crc != body_crc)) {
+            g_integrity_stats.crc_failed++;
+            std::cerr << "エラー: " << peer << " からの更新のCRCが一致しないため破棄しました。\n";
+            co_return UPDATE_CRC_ERROR;
+        }
+    }
+    if (parser.failed()) {
+        std::cerr << "エラー: 1行が長すぎるため設定データを破棄しました（上限 "
+                  << ConfigUpdateParser::MAX_LINE_LENGTH << " バイト）。\n";
+        co_return UPDATE_UNDECODABLE;
+    }
+    if (frame.crc) {
+        g_integrity_stats.crc_verified++;
+    }
+    body_span.reset();
+
+    // 圧縮された本体を展開してパースする
+    trace_spans::Span parse_span("parse");
+    if (is_compressed) {
+        PooledBuffer raw;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (!config_compression::decompress(frame.codec, compressed->data(), compressed->size(), frame.raw_length,
+                                            *raw)) {
+            std::cerr << "エラー: " << peer << " からの更新を展開できませんでした（"
+                      << config_compression::codec_name(frame.codec) << "）。\n";
+            co_return UPDATE_UNDECODABLE;
+        }
+        g_compression_stats.decompressed_frames++;
+        g_compression_stats.decompress_ns += static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+        if (!parser.feed(raw->data(), raw->size())) {
+            std::cerr << "エラー: 1行が長すぎるため設定データを破棄しました（上限 "
+                      << ConfigUpdateParser::MAX_LINE_LENGTH << " バイト）。\n";
+            co_return UPDATE_UNDECODABLE;
+        }
+    }
+    updates = parser.finish();
+    co_return UPDATE_RECEIVED;
+}
+
+/**
+ * @brief シーケンス番号で重複（再送）と欠番を調べる
+ *
+ * パイプライン接続では前の更新の適用が終わる前に次の更新が届くため、
+ * その接続で受け付け済み（適用待ちを含む）の番号も合わせて判定する。
+ * @param dispatched 接続内で受け付け済みの番号（セッションごと、nullなら使わない）
+ * @param last_applied 重複の場合、適用済み（受け付け済み）の最後の番号
+ * @return 重複ならfalse
+ */
+bool check_frame_sequence(const FrameHeader& frame, std::map<std::string, uint64_t>* dispatched,
+                          uint64_t& last_applied) {
+    if (frame.seq == 0) {
+        return true;
+    }
+    uint64_t expected_seq;
+    SequenceTracker::Verdict verdict = g_sequence_tracker.check(frame.session, frame.seq, expected_seq);
+    if (dispatched) {
+        std::map<std::string, uint64_t>::iterator it = dispatched->find(frame.session);
+        if (it != dispatched->end() && it->second + 1 >= expected_seq) {
+            expected_seq = it->second + 1;
+            verdict = frame.seq < expected_seq    ? SequenceTracker::DUPLICATE
+                      : frame.seq == expected_seq ? SequenceTracker::IN_ORDER
+                                                  : SequenceTracker::GAP;
+        }
+    }
+    if (verdict == SequenceTracker::DUPLICATE) {
+        g_integrity_stats.duplicates++;
+        std::cerr << "警告: セッション " << frame.session << " の更新 seq=" << frame.seq
+                  << " は適用済みのため無視しました（重複）。\n";
+        last_applied = expected_seq - 1;
+        return false;
+    }
+    if (verdict == SequenceTracker::GAP) {
+        g_integrity_stats.gaps++;
+        std::cerr << "警告: セッション " << frame.session << " のシーケンス番号が飛んでいます（期待 "
+                  << expected_seq << "、受信 " << frame.seq << "）。途中の更新が失われた可能性があります。\n";
+    }
+    if (dispatched) {
+        (*dispatched)[frame.session] = frame.seq;
+    }
+    return true;
+}
+
+/**
+ * @brief 更新フレームのシーケンス番号（適用の直前に g_sequence_tracker で確定する）
+ */
+struct SequenceClaim {
+    std::string session;
+    uint64_t seq = 0;           // 0なら番号なし
+    bool duplicate = false;     // 適用の時点で適用済みの番号だった（何も適用していない）
+    uint64_t last_applied = 0;  // duplicate のとき、適用済みの最後の番号
+};
+
+/**
+ * @brief 重複として適用しなかった更新を数えてログに出す
+ */
+void report_duplicate_frame(const SequenceClaim& claim) {
+    g_integrity_stats.duplicates++;
+    std::cerr << "警告: セッション " << claim.session << " の更新 seq=" << claim.seq
+              << " は適用済みのため無視しました（重複）。\n";
+}
+
+/**
+ * @brief 変更の適用を整理券順にワーカーで行い、ジャーナルに書き込まれるまで待つ
+ *
+ * 整理券は呼び出した時点（最初の中断より前）に取るため、呼び出し順に適用される。
+ * @param apply ワーカーで呼ぶ適用処理（g_config_mutex は自分で取る）
+ * @param version 適用後の設定バージョン
+ * @return ワーカーキューが満杯で投入できなかった場合はfalse
+ */
+Task<bool> run_ordered_apply(std::shared_ptr<EventBackend> backend, const std::string& peer,
+                             std::function<void()> apply, uint64_t& version) {
+    uint64_t ticket = g_apply_gate.take_ticket();
+    bool accepted = co_await OffloadAwaitable(backend, [&apply, &version, ticket](std::function<void()> resume) {
+        bool submitted = g_worker_pool->try_submit([&apply, &version, ticket, resume] {
+            g_apply_gate.submit(ticket, [&apply, &version, resume] {
+                apply();
+                version = g_config_version.load();
+                if (g_journal) {
+                    g_journal->when_durable(resume);
+                } else {
+                    resume();
+                }
+            });
+        });
+        if (!submitted) {
+            g_apply_gate.skip(ticket);
+        }
+        return submitted;
+    });
+    if (!accepted) {
+        std::cerr << "エラー: ワーカーキューが満杯のため " << peer << " からの要求を拒否しました（上限 "
+                  << g_worker_pool->max_queued() << " 件）。\n";
+    }
+    co_return accepted;
+}
+
+/**
+ * @brief 受信した変更を整理券順にワーカーで適用し、ジャーナルに書き込まれるまで待つ
+ *
+ * シーケンス番号の確定と適用は、g_config_mutex を保持したまま続けて行う。
+ * @param version 適用後の設定バージョン
+ * @param claim シーケンス番号（重複だった場合は何も適用せず claim.duplicate を立てる）
+ * @param cas 条件付き更新（op=cas）なら基準の版。結果もここに入る
+ * @return ワーカーキューが満杯で投入できなかった場合はfalse
+ */
+Task<bool> apply_received_updates(std::shared_ptr<EventBackend> backend, const std::vector<ConfigUpdate>& updates,
+                                  const std::string& peer, uint64_t& version, SequenceClaim& claim,
+                                  CasRequest* cas = nullptr) {
+    co_return co_await run_ordered_apply(backend, peer, [&updates, &peer, &claim, cas] {
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        if (claim.seq != 0 && !g_sequence_tracker.claim(claim.session, claim.seq, claim.last_applied)) {
+            claim.duplicate = true;
+            return;
+        }
+        if (cas != nullptr) {
+            apply_config_updates_if_unchanged_locked(updates, cas->bases, cas->partial, peer, cas->result);
+        } else {
+            apply_config_updates_locked(updates, peer, true);
+        }
+    }, version);
+}
+
+/**
+ * @brief 設定要求（get）への返信フレームを作る
+ *
+ * 読み出し条件があれば索引から該当する行だけを返す。since= の場合はヘッダーに現在の
+ * version を付け（次の since= に使う）、変更を記録していない古いバージョンからの
+ * 要求には reset を付けて条件に合う項目をすべて返す（受け取った側は差分ではなく置き換える）。
+ * @param tagged trueならパイプライン接続の形式（id・status・version付き、該当なしは status=notfound）
+ */
+std::string build_config_reply_frame(const FrameHeader& frame, bool tagged) {
+    std::shared_ptr<const ConfigText> text = current_config_text();
+    config_compression::Codec codec = config_compression::choose_codec(frame.accept);
+    const ConfigQuery& query = frame.query;
+    if (!query.filtered() && !query.has_since) {
+        return build_frame(text->body, tagged ? " id=" + frame.id + " status=ok version=" +
+                                                    std::to_string(text->version)
+                                              : std::string(),
+                           frame.crc, codec);
+    }
+    bool reset = false;
+    std::string content = run_config_query(*text, query, reset);
+    g_query_stats.queries++;
+    g_query_stats.reply_bytes += content.size();
+    g_query_stats.full_bytes += text->body.size();
+    std::string options;
+    if (tagged) {
+        bool found = !content.empty() || query.has_since;
+        options = " id=" + frame.id + (found ? " status=ok" : " status=notfound");
+    }
+    if (tagged || query.has_since) {
+        options += " version=" + std::to_string(text->version) + (reset ? " reset" : "");
+    }
+    return build_frame(content, options, frame.crc, codec);
+}
+
+/**
+ * @brief 本体のない返信フレーム "0 id=<id> status=<状態>[ 追加]\n"
+ */
+std::string tagged_status_frame(const std::string& id, const char* status, const std::string& extra = "") {
+    return "0 id=" + id + " status=" + status + extra + "\n";
+}
+
+// 複製元としてのエポック（起動ごとに作り直す。複製先は違うエポックの since= を使わない）
+std::string g_replication_epoch;
+// 複製先ごとの、確認（ack）を待っているバッチの合計の上限（REPLICATION_WINDOW_BYTES）
+std::atomic<size_t> g_replication_window{1024 * 1024};
+// 複製元のアドレス（REPLICATE_FROM、空なら複製先ではない。複製先は読み取り専用になる）
+std::string g_replicate_from;
+
+/**
+ * @brief 複製先1つ分の状態（複製元から見た遅れ。統計表示用）
+ */
+struct ReplicaMetrics {
+    std::string peer;
+    std::atomic<uint64_t> sent_version{0};   // 最後に送ったバッチの設定バージョン
+    std::atomic<uint64_t> acked_version{0};  // 複製先が適用を確認した設定バージョン
+    std::atomic<uint64_t> unacked_bytes{0};  // 確認を待っているバッチの合計
+    std::atomic<int64_t> oldest_unacked_ns{0}; // 確認を待っている最も古いバッチの送信時刻（なければ0）
+    std::atomic<uint64_t> rtt_us{0};         // 直近のバッチの送信から確認までの時間
+    std::atomic<uint64_t> batches{0};        // 送ったバッチ数
+    std::atomic<uint64_t> snapshots{0};      // そのうち設定全体を送った数
+    std::atomic<uint64_t> window_full{0};    // 確認待ちが上限に達して送信を待った回数
+};
+
+/**
+ * @brief 接続中の複製先の一覧（統計表示用。接続が切れたものは次の参照で取り除く）
+ */
+class ReplicaRegistry {
+public:
+    void add(const std::shared_ptr<ReplicaMetrics>& metrics) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        replicas_.push_back(metrics);
+    }
+
+    std::vector<std::shared_ptr<ReplicaMetrics>> list() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::shared_ptr<ReplicaMetrics>> alive;
+        for (std::vector<std::weak_ptr<ReplicaMetrics>>::iterator it = replicas_.begin(); it != replicas_.end();) {
+            if (std::shared_ptr<ReplicaMetrics> metrics = it->lock()) {
+                alive.push_back(metrics);
+                ++it;
+            } else {
+                it = replicas_.erase(it);
+            }
+        }
+        return alive;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<ReplicaMetrics>> replicas_;
+};
+ReplicaRegistry g_replica_registry;
+
+/**
+ * @brief 複製先へ送る変更の流れ（op=replicate を受けたパイプライン接続が持つ）
+ *
+ * 最初に since= からの差分（エポックが違う・古すぎる場合は設定全体）を送り、
+ * 以降は変更通知を溜めて、送信中でなく確認待ちが上限未満になった時点で
+ * 1つのバッチ "<長さ> id=<id> event=append version=<V> base=<前のV> epoch=<E>" にまとめて送る。
+ * 複製先は base が手元のバージョンと違えば（欠落）接続し直して差分から取り直す。
+ */
+struct ReplicaStream {
+    struct InFlight {
+        uint64_t version;
+        size_t bytes;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    std::string id;
+    bool with_crc = false;
+    config_compression::Codec codec = config_compression::NONE; // 設定全体を送るときの圧縮方式
+    uint64_t queued_version = 0; // 送信待ちに加えた（または送った）最新の設定バージョン
+    uint64_t sent_version = 0;   // 最後に送ったバッチの設定バージョン（次の base）
+    std::string pending;         // まだ送っていない変更の行
+    bool resync = false;         // 送信待ちが溢れたため、次は設定全体を送る
+    std::deque<InFlight> unacked;
+    size_t unacked_bytes = 0;
+    std::shared_ptr<ReplicaMetrics> metrics;
+};
+
+/**
+ * @brief WPFからの接続1本分の状態
+ *
+ * 従来の接続（1接続1フレーム）ではソケットと接続数の枠を持つだけ。
+ * パイプライン接続では処理中の要求数・未送信の返信（outbox）・購読を持ち、
+ * 返信は処理が終わった順に outbox に積んで1つの送信コルーチンが順に送る。
+ * 受信コルーチン・処理中の要求・送信コルーチンがすべて終わった時点で破棄され、ソケットを閉じる。
+ */
+class ClientSession : public std::enable_shared_from_this<ClientSession> {
+public:
+    ClientSession(std::shared_ptr<EventBackend> backend, int sock, std::string peer, ConnectionLimits limits,
+                  std::shared_ptr<PeerConnectionCounter> peers, uint32_t peer_ip)
+        : backend(std::move(backend)), sock(sock), peer(std::move(peer)), limits(limits),
+          scope_(*this->backend, sock), slot_(std::move(peers), peer_ip) {}
+
+    ~ClientSession() {
+        for (uint64_t id : subscriptions_) {
+            g_subscription_hub.remove(id);
+        }
+    }
+
+    ClientSession(const ClientSession&) = delete;
+    ClientSession& operator=(const ClientSession&) = delete;
+
+    /**
+     * @brief 返信・通知を送信待ちに積む（イベントループのスレッドから）
+     */
+    void send(std::string frame) {
+        if (closing_) {
+            return;
+        }
+        if (outbox_bytes_ + frame.size() > MAX_SESSION_OUTBOX_BYTES) {
+            std::cerr << "エラー: " << peer << " が返信を受信しないため切断しました（未送信 " << outbox_bytes_
+                      << " バイト）。\n";
+            close();
+            return;
+        }
+        outbox_bytes_ += frame.size();
+        outbox_.push_back(std::move(frame));
+        if (!writing_) {
+            writing_ = true;
+            flush(shared_from_this());
+        }
+    }
+
+    /**
+     * @brief 受信も送信もやめて接続を閉じる（保留中の操作はループの次の周回で取り消す）
+     */
+    void close() {
+        closing_ = true;
+        outbox_.clear();
+        outbox_bytes_ = 0;
+        std::weak_ptr<ClientSession> weak = shared_from_this();
+        backend->post([weak] {
+            if (std::shared_ptr<ClientSession> self = weak.lock()) {
+                self->backend->cancel(self->sock);
+            }
+        });
+    }
+
+    bool closing() const { return closing_; }
+
+    /**
+     * @brief 設定の変更を購読する（返信はこの後の現在の設定、以降は変更のたびに通知）
+     */
+    void subscribe(const FrameHeader& frame) {
+        std::weak_ptr<ClientSession> weak = shared_from_this();
+        std::shared_ptr<EventBackend> owner = backend;
+        Subscription subscription;
+        subscription.id = frame.id;
+        subscription.query = frame.query;
+        subscription.subsystem = frame.subsystem;
+        subscription.with_crc = frame.crc;
+        subscriptions_.push_back(g_subscription_hub.add(
+            [weak, owner, subscription](uint64_t version,
+                                        const std::shared_ptr<const std::vector<ConfigUpdate>>& changes) {
+                std::chrono::steady_clock::time_point applied = std::chrono::steady_clock::now();
+                owner->post([weak, subscription, version, applied, changes] {
+                    std::shared_ptr<ClientSession> self = weak.lock();
+                    if (self) {
+                        self->notify(subscription, version, applied, *changes);
+                    }
+                });
+            }));
+    }
+
+    size_t subscription_count() const { return subscriptions_.size(); }
+
+    /**
+     * @brief 設定の複製を始める（op=replicate）
+     *
+     * 変更通知を先に購読してから最初のバッチを送るので、間の変更は取りこぼさない
+     * （最初のバッチに含まれる版以前の通知は捨てる）。
+     */
+    void start_replication(const FrameHeader& frame) {
+        replica_.reset(new ReplicaStream());
+        replica_->id = frame.id;
+        replica_->with_crc = frame.crc;
+        replica_->codec = config_compression::choose_codec(frame.accept);
+        replica_->metrics = std::make_shared<ReplicaMetrics>();
+        replica_->metrics->peer = peer;
+        g_replica_registry.add(replica_->metrics);
+
+        std::weak_ptr<ClientSession> weak = shared_from_this();
+        std::shared_ptr<EventBackend> owner = backend;
+        subscriptions_.push_back(g_subscription_hub.add(
+            [weak, owner](uint64_t version, const std::shared_ptr<const std::vector<ConfigUpdate>>& changes) {
+                owner->post([weak, version, changes] {
+                    std::shared_ptr<ClientSession> self = weak.lock();
+                    if (self) {
+                        self->replicate(version, *changes);
+                    }
+                });
+            }));
+
+        std::shared_ptr<const ConfigText> text = current_config_text();
+        bool reset = true;
+        std::string delta;
+        if (frame.query.has_since && frame.epoch == g_replication_epoch && frame.query.since <= text->version) {
+            ConfigQuery query;
+            query.has_since = true;
+            query.since = frame.query.since;
+            delta = run_config_query(*text, query, reset);
+        }
+        if (reset) {
+            send_replica_snapshot(*text);
+        } else {
+            replica_->sent_version = frame.query.since;
+            replica_->queued_version = text->version;
+            replica_->pending = std::move(delta);
+            send_replica_append();
+        }
+    }
+
+    bool replicating() const { return replica_ != nullptr; }
+
+    /**
+     * @brief 複製先がバッチの適用を確認した、または購読者が通知を反映し終えた（op=ack）
+     */
+    void acknowledge(const std::string& id, uint64_t version) {
+        if (!replica_) {
+            confirm_effects(id, version);
+            return;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        ReplicaMetrics& metrics = *replica_->metrics;
+        while (!replica_->unacked.empty() && replica_->unacked.front().version <= version) {
+            metrics.rtt_us.store(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(now - replica_->unacked.front().sent).count()));
+            replica_->unacked_bytes -= replica_->unacked.front().bytes;
+            replica_->unacked.pop_front();
+        }
+        metrics.acked_version.store(version);
+        update_unacked_metrics();
+        pump_replication();
+    }
+
+    size_t in_flight = 0;                          // 処理中の要求数
+    std::map<std::string, uint64_t> dispatched;    // 受け付け済みのシーケンス番号（セッションごと）
+
+    const std::shared_ptr<EventBackend> backend;
+    const int sock;
+    const std::string peer;
+    const ConnectionLimits limits;
+
+private:
+    // 購読1つ分の条件
+    struct Subscription {
+        std::string id;
+        ConfigQuery query;
+        std::string subsystem;
+        bool with_crc = false;
+    };
+
+    // 反映の確認（op=ack）を待っている通知
+    struct PendingEffect {
+        uint64_t version;
+        std::chrono::steady_clock::time_point applied;
+        ApplyClass apply_class;
+    };
+    static const size_t MAX_PENDING_EFFECTS = 1024; // 確認しない購読者のために溜める上限
+
+    /**
+     * @brief 購読の対象に当たる変更を "<長さ> id=<id> event=changed version=<V>[ affects=...]\n" の通知で送る
+     *
+     * 本体は変わった項目の "[SECTION]KEY=VALUE" 行（削除された項目は "=" のない "[SECTION]KEY"）。
+     * SUBSYSTEM_MAP があれば、通知した変更が影響するサブシステムと適用区分を affects= に付ける。
+     */
+    void notify(const Subscription& subscription, uint64_t version, std::chrono::steady_clock::time_point applied,
+                const std::vector<ConfigUpdate>& changes) {
+        std::string lines;
+        SubsystemImpact impact;
+        for (const ConfigUpdate& change : changes) {
+            if (!subscription.query.matches(change.section, change.key)) {
+                continue;
+            }
+            if (g_subsystem_map) {
+                SubsystemImpact change_impact;
+                g_subsystem_map->add_impact(change.section, change.key, change_impact);
+                if (!subscription.subsystem.empty() && change_impact.count(subscription.subsystem) == 0) {
+                    continue;
+                }
+                for (const auto& entry : change_impact) {
+                    if (subscription.subsystem.empty() || entry.first == subscription.subsystem) {
+                        ApplyClass& current = impact.emplace(entry.first, APPLY_HOT).first->second;
+                        current = std::max(current, entry.second);
+                    }
+                }
+            }
+            lines += "[" + change.section + "]" + change.key;
+            if (!change.remove) {
+                lines += "=" + change.value;
+            }
+            lines += "\n";
+        }
+        if (lines.empty()) {
+            return;
+        }
+        std::string options = " id=" + subscription.id + " event=changed version=" + std::to_string(version);
+        if (!impact.empty()) {
+            options += " affects=" + format_subsystem_impact(impact);
+            ApplyClass apply_class = APPLY_HOT;
+            for (const auto& entry : impact) {
+                apply_class = std::max(apply_class, entry.second);
+            }
+            std::deque<PendingEffect>& pending = effects_[subscription.id];
+            if (pending.size() >= MAX_PENDING_EFFECTS) {
+                pending.pop_front();
+            }
+            pending.push_back(PendingEffect{version, applied, apply_class});
+        }
+        g_pipeline_stats.events++;
+        send(build_frame(lines, options, subscription.with_crc, config_compression::NONE));
+    }
+
+    /**
+     * @brief 購読者が version までの通知を反映し終えた: 適用から反映までの時間を記録する
+     */
+    void confirm_effects(const std::string& id, uint64_t version) {
+        std::map<std::string, std::deque<PendingEffect>>::iterator it = effects_.find(id);
+        if (it == effects_.end()) {
+            return;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        while (!it->second.empty() && it->second.front().version <= version) {
+            g_subsystem_stats.record_effect(it->second.front().apply_class, now - it->second.front().applied);
+            it->second.pop_front();
+        }
+    }
+
+    /**
+     * @brief 複製先へ送る変更を溜める（変更通知ごとに、イベントループのスレッドで）
+     */
+    void replicate(uint64_t version, const std::vector<ConfigUpdate>& changes) {
+        if (!replica_ || version <= replica_->queued_version) {
+            return; // 送った設定全体・差分に含まれている
+        }
+        replica_->queued_version = version;
+        if (replica_->resync) {
+            return;
+        }
+        for (const ConfigUpdate& change : changes) {
+            replica_->pending += "[" + change.section + "]" + change.key;
+            if (!change.remove) {
+                replica_->pending += "=" + change.value;
+            }
+            replica_->pending += "\n";
+        }
+        if (replica_->pending.size() > MAX_SESSION_OUTBOX_BYTES) {
+            // 複製先が追いつかない: 溜めた変更は捨て、追いついた時点の設定全体を送る
+            std::cerr << "警告: 複製先 " << peer << " への変更が溜まりすぎたため、設定全体を送り直します。\n";
+            replica_->pending.clear();
+            replica_->resync = true;
+        }
+        pump_replication();
+    }
+
+    /**
+     * @brief 送信中でなく確認待ちが上限未満なら、溜めた変更を1つのバッチにまとめて送る
+     */
+    void pump_replication() {
+        if (!replica_ || closing_ || writing_) {
+            return;
+        }
+        if (replica_->resync || !replica_->pending.empty()) {
+            if (replica_->unacked_bytes >= g_replication_window.load()) {
+                replica_->metrics->window_full++;
+                return;
+            }
+            if (replica_->resync) {
+                send_replica_snapshot(*current_config_text());
+            } else {
+                send_replica_append();
+            }
+        }
+    }
+
+    void send_replica_snapshot(const ConfigText& text) {
+        replica_->pending.clear();
+        replica_->resync = false;
+        replica_->queued_version = text.version;
+        replica_->sent_version = text.version;
+        replica_->metrics->snapshots++;
+        send_replica_batch(build_frame(text.body,
+                                       " id=" + replica_->id + " event=snapshot version=" + std::to_string(text.version) +
+                                           " epoch=" + g_replication_epoch,
+                                       replica_->with_crc, replica_->codec),
+                           text.version);
+    }
+
+    void send_replica_append() {
+        std::string options = " id=" + replica_->id + " event=append version=" +
+                              std::to_string(replica_->queued_version) + " base=" +
+                              std::to_string(replica_->sent_version) + " epoch=" + g_replication_epoch;
+        replica_->sent_version = replica_->queued_version;
+        std::string frame = build_frame(replica_->pending, options, replica_->with_crc, config_compression::NONE);
+        replica_->pending.clear();
+        send_replica_batch(std::move(frame), replica_->sent_version);
+    }
+
+    void send_replica_batch(std::string frame, uint64_t version) {
+        replica_->unacked.push_back(ReplicaStream::InFlight{version, frame.size(), std::chrono::steady_clock::now()});
+        replica_->unacked_bytes += frame.size();
+        replica_->metrics->batches++;
+        replica_->metrics->sent_version.store(version);
+        update_unacked_metrics();
+        send(std::move(frame));
+    }
+
+    void update_unacked_metrics() {
+        ReplicaMetrics& metrics = *replica_->metrics;
+        metrics.unacked_bytes.store(replica_->unacked_bytes);
+        metrics.oldest_unacked_ns.store(
+            replica_->unacked.empty()
+                ? 0
+                : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      replica_->unacked.front().sent.time_since_epoch())
+                      .count());
+    }
+
+    /**
+     * @brief 送信待ちを順に送る（送信待ちが空になったら終わる）
+     */
+    static DetachedTask flush(std::shared_ptr<ClientSession> self) {
+        while (!self->outbox_.empty() && !self->closing_) {
+            std::string frame = std::move(self->outbox_.front());
+            self->outbox_.pop_front();
+            self->outbox_bytes_ -= frame.size();
+            ssize_t sent = co_await write_all(*self->backend, self->sock, frame.data(), frame.size(),
+                                              std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+            if (sent < 0) {
+                if (sent != -ECANCELED) {
+                    std::cerr << "エラー: " << self->peer << " への返信に失敗しました。 "
+                              << strerror(static_cast<int>(-sent)) << std::endl;
+                }
+                self->close();
+            }
+        }
+        self->writing_ = false;
+        self->pump_replication();
+    }
+
+    SessionScope scope_;
+    PeerSlot slot_;
+    std::deque<std::string> outbox_;
+    size_t outbox_bytes_ = 0;
+    bool writing_ = false;
+    bool closing_ = false;
+    std::vector<uint64_t> subscriptions_;
+    std::map<std::string, std::deque<PendingEffect>> effects_; // 購読の id → 反映の確認待ち
+    std::unique_ptr<ReplicaStream> replica_;
+};
+
+/**
+ * @brief パイプライン接続の設定要求（get）を処理する
+ */
+DetachedTask handle_pipelined_get(std::shared_ptr<ClientSession> session, FrameHeader frame) {
+    session->in_flight++;
+    std::string reply;
+    bool accepted = co_await OffloadAwaitable(session->backend, [&reply, &frame](std::function<void()> resume) {
+        return g_worker_pool->try_submit([&reply, &frame, resume] {
+            reply = build_config_reply_frame(frame, true);
+            resume();
+        });
+    });
+    if (!accepted) {
+        std::cerr << "エラー: ワーカーキューが満杯のため " << session->peer << " からの要求を拒否しました（上限 "
+                  << g_worker_pool->max_queued() << " 件）。\n";
+        reply = tagged_status_frame(frame.id, "busy");
+    }
+    session->in_flight--;
+    session->send(std::move(reply));
+}
+
+/**
+ * @brief パイプライン接続のプリセットの切り替え（op=preset）を、更新と同じ順序で適用して返信する
+ *
+ * 返信は "0 id=<id> status=ok version=<版> changed=<変わった項目数>"（プリセットがなければ status=notfound）。
+ */
+DetachedTask handle_pipelined_preset(std::shared_ptr<ClientSession> session, FrameHeader frame) {
+    session->in_flight++;
+    uint64_t version = 0;
+    int changed = 0;
+    std::cout << "\n" << session->peer << " からプリセット " << frame.preset << " への切り替えを受信しました（id="
+              << frame.id << "）\n";
+    bool accepted = co_await run_ordered_apply(session->backend, session->peer, [&frame, &session, &changed] {
+        changed = switch_to_preset(frame.preset, session->peer);
+    }, version);
+    session->in_flight--;
+    if (!accepted) {
+        session->send(tagged_status_frame(frame.id, "busy"));
+    } else if (changed < 0) {
+        session->send(tagged_status_frame(frame.id, "notfound"));
+    } else {
+        session->send(tagged_status_frame(frame.id, "ok", " version=" + std::to_string(version) +
+                                                              " changed=" + std::to_string(changed)));
+    }
+}
+
+/**
+ * @brief op=cas の本体の "[SECTION]KEY@<版>" から基準の版を取り出す（@<版> がなければ version= の値）
+ * @return 基準の版がない項目や不正な版があればfalse
+ */
+bool split_cas_bases(const FrameHeader& frame, std::vector<ConfigUpdate>& updates, CasRequest& cas,
+                     std::string& error) {
+    cas.partial = frame.partial;
+    cas.bases.reserve(updates.size());
+    for (ConfigUpdate& update : updates) {
+        size_t at = update.key.find('@');
+        uint64_t base = frame.version;
+        if (at != std::string::npos) {
+            if (!parse_version_number(update.key.substr(at + 1), base)) {
+                error = "基準の版が不正です: " + update.key;
+                return false;
+            }
+            update.key.erase(at);
+        } else if (frame.version == 0) {
+            error = "[" + update.section + "]" + update.key + " に基準の版（@<版> または version=）がありません";
+            return false;
+        }
+        cas.bases.push_back(base);
+    }
+    return true;
+}
+
+/**
+ * @brief 条件付き更新への返信 "<長さ> id=<id> status=ok|conflict version=<版> accepted=<数>[ conflicts=<数>]"
+ *
+ * 衝突があれば、本体に衝突した項目の現在の版と値を "[SECTION]KEY@<版>=VALUE"（項目がなければ
+ * "[SECTION]KEY@<版>"）で並べる。クライアントはこの版と値でそのまま再試行できる。
+ */
+std::string build_cas_reply_frame(const FrameHeader& frame, uint64_t version, const CasResult& result) {
+    std::string options = " id=" + frame.id + (result.conflicts.empty() ? " status=ok" : " status=conflict") +
+                          " version=" + std::to_string(version) + " accepted=" + std::to_string(result.accepted);
+    std::string body;
+    if (!result.conflicts.empty()) {
+        options += " conflicts=" + std::to_string(result.conflicts.size());
+        for (const CasConflict& conflict : result.conflicts) {
+            body += "[" + conflict.section + "]" + conflict.key + "@" + std::to_string(conflict.version);
+            if (conflict.exists) {
+                body += "=" + conflict.value;
+            }
+            body += "\n";
+        }
+    }
+    return build_frame(body, options, frame.crc, config_compression::NONE);
+}
+
+/**
+ * @brief パイプライン接続の受信済みの更新を適用して返信する
+ *
+ * 整理券はこの関数を呼んだ時点で取るため、同じ接続の更新は受信順に適用される。
+ * @param cas 条件付き更新（op=cas）なら基準の版（通常の更新なら空）
+ */
+DetachedTask handle_pipelined_update(std::shared_ptr<ClientSession> session, FrameHeader frame,
+                                     std::vector<ConfigUpdate> updates, std::unique_ptr<CasRequest> cas) {
+    session->in_flight++;
+    uint64_t version = 0;
+    SequenceClaim claim;
+    claim.session = frame.session;
+    claim.seq = frame.seq;
+    bool accepted =
+        co_await apply_received_updates(session->backend, updates, session->peer, version, claim, cas.get());
+    if (accepted && claim.duplicate) {
+        session->in_flight--;
+        report_duplicate_frame(claim);
+        session->send(tagged_status_frame(frame.id, "dup", " last=" + std::to_string(claim.last_applied)));
+        co_return;
+    }
+    if (!accepted && frame.seq != 0) {
+        // 拒否した番号は再送を受け付けられるよう、受け付け済みから外す
+        std::map<std::string, uint64_t>::iterator it = session->dispatched.find(frame.session);
+        if (it != session->dispatched.end() && it->second >= frame.seq) {
+            it->second = frame.seq - 1;
+        }
+    }
+    session->in_flight--;
+    if (accepted && cas) {
+        session->send(build_cas_reply_frame(frame, version, cas->result));
+        co_return;
+    }
+    session->send(accepted ? tagged_status_frame(frame.id, "ok", " version=" + std::to_string(version))
+                           : tagged_status_frame(frame.id, "busy"));
+}
+
+/**
+ * @brief パイプライン接続のフレームを1つ処理する（更新の本体はここで受信する）
+ * @return 接続を続けられない場合はfalse
+ */
+Task<bool> dispatch_pipelined_frame(std::shared_ptr<ClientSession> session, FrameReader& reader,
+                                    const FrameHeader& frame, FrameGuard& guard) {
+    g_pipeline_stats.requests++;
+    if (frame.id.empty()) {
+        std::cerr << "エラー: パイプライン接続のフレームに id がありません（" << session->peer << "）。\n";
+        co_return false;
+    }
+
+    if (frame.op == FrameHeader::SUBSCRIBE) {
+        if (session->subscription_count() >= MAX_PIPELINED_REQUESTS) {
+            g_pipeline_stats.rejected++;
+            session->send(tagged_status_frame(frame.id, "busy"));
+            co_return true;
+        }
+        // 先に購読してから現在の設定を返す（間の変更は通知の version で見分けられる）
+        session->subscribe(frame);
+        std::cout << session->peer << " が設定の変更を購読しました（id=" << frame.id
+                  << (frame.query.filtered() ? "、" + frame.query.describe() : "") << "）\n";
+        session->send(build_config_reply_frame(frame, true));
+        co_return true;
+    }
+
+    if (frame.op == FrameHeader::REPLICATE) {
+        if (session->replicating()) {
+            session->send(tagged_status_frame(frame.id, "error"));
+            co_return true;
+        }
+        bool delta = frame.query.has_since && frame.epoch == g_replication_epoch;
+        std::cout << session->peer << " が設定の複製を開始しました（"
+                  << (delta ? "設定バージョン " + std::to_string(frame.query.since) + " から" : std::string("設定全体から"))
+                  << "）\n";
+        session->start_replication(frame);
+        co_return true;
+    }
+
+    if (frame.op == FrameHeader::ACK) {
+        session->acknowledge(frame.id, frame.version);
+        co_return true;
+    }
+
+    if (frame.op == FrameHeader::PRESET) {
+        if (!g_replicate_from.empty()) {
+            std::cerr << "エラー: 複製先（読み取り専用）のため " << session->peer << " からの切り替えを拒否しました。\n";
+            session->send(tagged_status_frame(frame.id, "readonly"));
+        } else if (session->in_flight >= MAX_PIPELINED_REQUESTS) {
+            g_pipeline_stats.rejected++;
+            session->send(tagged_status_frame(frame.id, "busy"));
+        } else {
+            handle_pipelined_preset(session, frame);
+        }
+        co_return true;
+    }
+
+    if (frame.op == FrameHeader::GET) {
+        if (session->in_flight >= MAX_PIPELINED_REQUESTS) {
+            g_pipeline_stats.rejected++;
+            session->send(tagged_status_frame(frame.id, "busy"));
+        } else {
+            handle_pipelined_get(session, frame);
+        }
+        co_return true;
+    }
+
+    // 更新: 本体を読み終えないと次のフレームに進めないため、長さの上限を超えるものは接続ごと拒否する
+    if (frame.length > session->limits.max_frame_size ||
+        (frame.codec != config_compression::NONE && frame.raw_length > session->limits.max_frame_size)) {
+        std::cerr << "エラー: メッセージサイズが大きすぎます: "
+                  << std::max(frame.length, frame.raw_length) << " bytes（上限 " << session->limits.max_frame_size
+                  << "）\n";
+        session->send(tagged_status_frame(frame.id, "error"));
+        co_return false;
+    }
+    std::vector<ConfigUpdate> updates;
+    UpdateReceipt receipt = co_await receive_update_body(reader, frame, guard, session->peer, true, updates);
+    if (receipt == UPDATE_ABORTED) {
+        co_return false;
+    }
+    if (session->limits.require_crc && !frame.crc) {
+        std::cerr << "エラー: " << session->peer << " からの更新にCRCがないため拒否しました（REQUIRE_FRAME_CRC=1）。\n";
+        g_integrity_stats.crc_failed++;
+        receipt = UPDATE_CRC_ERROR;
+    }
+    if (receipt != UPDATE_RECEIVED) {
+        session->send(tagged_status_frame(frame.id, receipt == UPDATE_CRC_ERROR ? "crcerr" : "error"));
+        co_return true;
+    }
+    if (!g_replicate_from.empty()) {
+        std::cerr << "エラー: 複製先（読み取り専用）のため " << session->peer << " からの更新を拒否しました。\n";
+        session->send(tagged_status_frame(frame.id, "readonly"));
+        co_return true;
+    }
+    if (session->in_flight >= MAX_PIPELINED_REQUESTS) {
+        g_pipeline_stats.rejected++;
+        session->send(tagged_status_frame(frame.id, "busy"));
+        co_return true;
+    }
+    uint64_t last_applied = 0;
+    if (!check_frame_sequence(frame, &session->dispatched, last_applied)) {
+        session->send(tagged_status_frame(frame.id, "dup", " last=" + std::to_string(last_applied)));
+        co_return true;
+    }
+    std::unique_ptr<CasRequest> cas;
+    if (frame.op == FrameHeader::CAS) {
+        cas.reset(new CasRequest());
+        std::string cas_error;
+        if (!split_cas_bases(frame, updates, *cas, cas_error)) {
+            std::cerr << "エラー: " << session->peer << " からの条件付き更新を拒否しました（" << cas_error << "）。\n";
+            session->send(tagged_status_frame(frame.id, "error"));
+            co_return true;
+        }
+    }
+    std::cout << "\nWPFから" << (cas ? "条件付きの" : "") << "設定データを受信しました（" << frame.length << " バイト、"
+              << updates.size() << " 項目、id=" << frame.id << "）\n";
+    handle_pipelined_update(session, frame, std::move(updates), std::move(cas));
+    co_return true;
+}
+
+/**
+ * @brief WPFからの接続1本分を処理するセッション（イベントループ上のコルーチン）
+ *
+ * 従来の接続はヘッダーと本体を受信し終えたら、パース・適用（または設定の直列化）を
+ * ワーカープールに渡し、終わったらループ上で返信・クローズする。
+ * 最初のフレームに id= が付いていればパイプライン接続として、切断されるまで
+ * フレームを読み続け、各要求の返信を処理が終わった順に id 付きで返す。
+ * 受信はアイドル期限・フレーム期限・最低受信速度の制限を受ける（購読中の接続の
+ * フレーム間の待ちにはアイドル期限を課さない）。
  */
-bool load_config(const std::string& filename) {
-    dictionary* ini = iniparser_load(filename.c_str());
-    if (ini == nullptr) {
-        std::cerr << "エラー: '" << filename << "' を読み込めません。\n";
-        return false;
+DetachedTask serve_connection(std::shared_ptr<EventBackend> backend, int sock, std::string peer,
+                              ConnectionLimits limits, std::shared_ptr<PeerConnectionCounter> peers, uint32_t peer_ip) {
+    std::shared_ptr<ClientSession> session(new ClientSession(backend, sock, peer, limits, std::move(peers), peer_ip));
+    FrameReader reader(*backend, sock);
+    FrameGuard guard(session->limits);
+    backend->count_request();
+
+    // 1. ヘッダー（メッセージ長とオプション）を改行まで読み込み、パースする
+    std::string header;
+    std::optional<trace_spans::Span> header_span(std::in_place, "header_read", sock);
+    ssize_t result = co_await reader.read_line(header, MAX_HEADER_LENGTH, guard, false);
+    header_span.reset();
+    if (result == -EMSGSIZE) {
+        std::cerr << "エラー: ヘッダーが長すぎます。\n";
+        co_return;
+    }
+    if (result <= 0) {
+        report_frame_error(result, guard, peer, false);
+        co_return;
+    }
+    FrameHeader frame;
+    std::string header_error;
+    if (!parse_frame_header(header, frame, header_error)) {
+        std::cerr << "エラー: 不正なヘッダー形式: " << header << " (" << header_error << ")" << std::endl;
+        co_return;
     }
 
-    std::lock_guard<std::mutex> lock(g_config_mutex);
-    g_config_data.clear();
+    if (!frame.id.empty()) {
+        // パイプライン接続: 切断・エラー・終了要求まで次のフレームを読み続ける
+        g_pipeline_stats.sessions++;
+        while (!session->closing()) {
+            bool keep = co_await dispatch_pipelined_frame(session, reader, frame, guard);
+            if (!keep) {
+                break;
+            }
+            guard.restart();
+            result = co_await reader.read_line(header, MAX_HEADER_LENGTH, guard,
+                                               session->subscription_count() > 0);
+            if (result == -EMSGSIZE) {
+                std::cerr << "エラー: ヘッダーが長すぎます。\n";
+                break;
+            }
+            if (result <= 0) {
+                report_frame_error(result, guard, peer, false);
+                break;
+            }
+            backend->count_request();
+            frame = FrameHeader();
+            if (!parse_frame_header(header, frame, header_error)) {
+                std::cerr << "エラー: 不正なヘッダー形式: " << header << " (" << header_error << ")" << std::endl;
+                session->send(tagged_status_frame(frame.id.empty() ? "-" : frame.id, "error"));
+                break;
+            }
+        }
+        // 処理中の要求と送信待ちは session が破棄されるまで続き、その後ソケットを閉じる
+        co_return;
+    }
 
-    // セクション数を取得
-    int n_sections = iniparser_getnsec(ini);
-    
-    for (int i = 0; i < n_sections; i++) {
-        const char* section_name = iniparser_getsecname(ini, i);
-        if (section_name == nullptr) {
-            continue;
+    // 0バイトデータは「設定要求」として扱い、直列化はワーカーで行う
+    // （crcオプション付きの要求には、CRCトレーラー付きで返信する）
+    if (frame.op == FrameHeader::GET) {
+        std::cout << "\nWPFから設定要求（0バイト）を受信しました。現在の設定を返信します。\n";
+        std::string reply;
+        bool accepted = co_await OffloadAwaitable(backend, [&reply, &frame](std::function<void()> resume) {
+            return g_worker_pool->try_submit([&reply, &frame, resume] {
+                reply = build_config_reply_frame(frame, false);
+                resume();
+            });
+        });
+        if (!accepted) {
+            std::cerr << "エラー: ワーカーキューが満杯のため " << peer << " からの要求を拒否しました（上限 "
+                      << g_worker_pool->max_queued() << " 件）。\n";
+            reply = "BUSY\n";
         }
-        
-        std::string section(section_name);
-        
-        // 全キーを取得するため、iniparserの内部構造を利用
-        // より包括的なキーリストを定義
-        std::vector<std::string> common_keys = {
-            // CONFIG_SYNC section
-            "WPF_HOST", "WPF_RECV_PORT", "CPP_RECV_PORT",
-            // PWM section
-            "PWM_MIN", "PWM_NEUTRAL", "PWM_NORMAL_MAX", "PWM_BOOST_MAX", "PWM_FREQUENCY",
-            // JOYSTICK section
-            "DEADZONE",
-            // LED section
-            "CHANNEL", "ON_VALUE", "OFF_VALUE",
-            // THRUSTER_CONTROL section
-            "SMOOTHING_FACTOR_HORIZONTAL", "SMOOTHING_FACTOR_VERTICAL",
-            "KP_ROLL", "KP_YAW", "YAW_THRESHOLD_DPS", "YAW_GAIN",
-            // NETWORK section
-            "RECV_PORT", "SEND_PORT", "CLIENT_HOST", "CONNECTION_TIMEOUT_SECONDS",
-            // APPLICATION section
-            "SENSOR_SEND_INTERVAL", "LOOP_DELAY_US",
-            // GSTREAMER_CAMERA sections
-            "DEVICE", "PORT", "WIDTH", "HEIGHT", "FRAMERATE_NUM", "FRAMERATE_DEN",
-            "IS_H264_NATIVE_SOURCE", "RTP_PAYLOAD_TYPE", "RTP_CONFIG_INTERVAL",
-            "X264_BITRATE", "X264_TUNE", "X264_SPEED_PRESET"
-        };
-        
-        for (const std::string& key : common_keys) {
-            std::string full_key = section + ":" + key;
-            const char* value = iniparser_getstring(ini, full_key.c_str(), nullptr);
-            if (value != nullptr) {
-                g_config_data[section][key] = std::string(value);
-            }
+        ssize_t sent = co_await write_all(*backend, sock, reply.data(), reply.size(),
+                                          std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        if (sent == -ECANCELED) {
+            std::cout << "設定の返信がキャンセルされました。\n";
+        } else if (sent < 0) {
+            std::cerr << "エラー: 設定の返信に失敗しました。 " << strerror(static_cast<int>(-sent)) << std::endl;
+        } else if (accepted) {
+            std::cout << "設定を返信しました（" << sent << " バイト）\n";
         }
+        co_return;
+    }
+    // 2. 異常に大きなメッセージサイズを防ぐ
+    if (frame.length > limits.max_frame_size) {
+        std::cerr << "エラー: メッセージサイズが大きすぎます: " << frame.length << " bytes（上限 "
+                  << limits.max_frame_size << "）\n";
+        co_return;
     }
 
-    iniparser_freedict(ini);
-    std::cout << "設定ファイルを " << filename << " から読み込みました。\n";
-    return true;
-}
+    if (frame.codec != config_compression::NONE && frame.raw_length > limits.max_frame_size) {
+        std::cerr << "エラー: 展開後のメッセージサイズが大きすぎます: " << frame.raw_length << " bytes（上限 "
+                  << limits.max_frame_size << "）\n";
+        co_return;
+    }
 
-/**
- * @brief 設定値を安全に取得する
- * @param section セクション名
- * @param key キー名
- * @param default_value デフォルト値
- * @return 設定値またはデフォルト値
- */
-std::string get_config_value(const std::string& section, const std::string& key, const std::string& default_value = "") {
-    std::lock_guard<std::mutex> lock(g_config_mutex);
-    auto section_it = g_config_data.find(section);
-    if (section_it == g_config_data.end()) {
-        return default_value;
+    static const char crc_reply[] = "CRCERR\n";
+    if (limits.require_crc && !frame.crc) {
+        std::cerr << "エラー: " << peer << " からの更新にCRCがないため拒否しました（REQUIRE_FRAME_CRC=1）。\n";
+        g_integrity_stats.crc_failed++;
+        co_await write_all(*backend, sock, crc_reply, sizeof(crc_reply) - 1,
+                           std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        co_return;
     }
-    auto key_it = section_it->second.find(key);
-    if (key_it == section_it->second.end()) {
-        return default_value;
+
+    // 3. 本体とCRCトレーラーを受信して検証・パースする（受信途中で切断された場合は何も適用しない）
+    std::vector<ConfigUpdate> updates;
+    UpdateReceipt receipt = co_await receive_update_body(reader, frame, guard, peer, false, updates);
+    if (receipt == UPDATE_CRC_ERROR) {
+        co_await write_all(*backend, sock, crc_reply, sizeof(crc_reply) - 1,
+                           std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        co_return;
+    }
+    if (receipt != UPDATE_RECEIVED) {
+        co_return;
+    }
+    if (!g_replicate_from.empty()) {
+        std::cerr << "エラー: 複製先（読み取り専用）のため " << peer << " からの更新を拒否しました。\n";
+        static const char readonly_reply[] = "READONLY\n";
+        co_await write_all(*backend, sock, readonly_reply, sizeof(readonly_reply) - 1,
+                           std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        co_return;
+    }
+
+    // 4. シーケンス番号で重複（再送）と欠番を調べる
+    uint64_t last_applied = 0;
+    if (!check_frame_sequence(frame, nullptr, last_applied)) {
+        std::string dup_reply = "DUP " + std::to_string(last_applied) + "\n";
+        co_await write_all(*backend, sock, dup_reply.data(), dup_reply.size(),
+                           std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        co_return;
+    }
+    std::cout << "\nWPFから設定データを受信しました（" << frame.length << " バイト、" << updates.size()
+              << " 項目）\n";
+
+    // 受信完了順に整理券を取り、適用は整理券順にワーカーで行う。
+    // 適用がジャーナルに書き込まれてから接続を閉じる（クライアントは切断で適用完了を知る）
+    uint64_t version = 0;
+    SequenceClaim claim;
+    claim.session = frame.session;
+    claim.seq = frame.seq;
+    bool accepted = co_await apply_received_updates(backend, updates, peer, version, claim);
+    if (accepted && claim.duplicate) {
+        report_duplicate_frame(claim);
+        std::string dup_reply = "DUP " + std::to_string(claim.last_applied) + "\n";
+        co_await write_all(*backend, sock, dup_reply.data(), dup_reply.size(),
+                           std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        co_return;
+    }
+    if (!accepted) {
+        // 過負荷時は "BUSY" 行を返して明示的に拒否する
+        static const char busy_reply[] = "BUSY\n";
+        co_await write_all(*backend, sock, busy_reply, sizeof(busy_reply) - 1,
+                           std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
     }
-    return key_it->second;
 }
 
 /**
- * @brief 設定値を安全に設定する
- * @param section セクション名
- * @param key キー名
- * @param value 設定する値
+ * @brief 複製先としての状態（REPLICATE_FROM が設定されている場合）
  */
-void set_config_value(const std::string& section, const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(g_config_mutex);
-    g_config_data[section][key] = value;
-}
+struct ReplicaState {
+    std::atomic<bool> connected{false};
+    std::atomic<uint64_t> version{0};       // 適用済みのバッチの設定バージョン（複製元の番号）
+    std::atomic<uint64_t> batches{0};       // 適用したバッチ数
+    std::atomic<uint64_t> snapshots{0};     // そのうち設定全体だった数
+    std::atomic<uint64_t> reconnects{0};    // 接続し直した回数
+    std::atomic<uint64_t> gaps{0};          // バッチの欠落を検出した回数
+    std::atomic<uint64_t> apply_us{0};      // 直近のバッチの受信完了から適用完了（ジャーナル書き込み）まで
+    std::atomic<int64_t> last_batch_ms{0};  // 直近のバッチを受信した時刻（UNIX時刻ミリ秒）
+    std::string epoch;                      // 複製元のエポック（イベントループのスレッドだけが使う）
+};
+ReplicaState g_replica_state;
+
+// 複製しないセクション（待ち受けポートなど、インスタンスごとの設定）
+const char REPLICA_LOCAL_SECTION[] = "CONFIG_SYNC";
 
 /**
- * @brief 現在の設定データをWPFへ送信するための文字列形式に変換（シリアライズ）する
- * @return シリアライズされた設定文字列
+ * @brief 複製元から受け取ったバッチを、手元の設定に当てはめる変更にする
+ *
+ * CONFIG_SYNC セクションは手元の値を残す。設定全体（snapshot）の場合は、
+ * 手元にあって複製元にないキーの削除も加える。
  */
-std::string serialize_config() {
-    std::lock_guard<std::mutex> lock(g_config_mutex);
-    std::stringstream ss;
-    std::stringstream content_ss;
-    for (const auto& section_pair : g_config_data) {
-        for (const auto& key_value_pair : section_pair.second) {
-            // フォーマット: [SECTION]KEY=VALUE\n
-            content_ss << "[" << section_pair.first << "]"
-               << key_value_pair.first << "=" << key_value_pair.second << "\n";
+std::vector<ConfigUpdate> replica_changes(std::vector<ConfigUpdate> received, bool snapshot) {
+    std::vector<ConfigUpdate> changes;
+    changes.reserve(received.size());
+    std::set<std::pair<std::string, std::string>> present;
+    for (ConfigUpdate& update : received) {
+        if (update.section == REPLICA_LOCAL_SECTION) {
+            continue;
+        }
+        if (snapshot) {
+            present.insert(std::make_pair(update.section, update.key));
+        }
+        changes.push_back(std::move(update));
+    }
+    if (snapshot) {
+        // 複製先の設定は複製でしか変わらないので、公開済みのスナップショットと比べればよい
+        std::shared_ptr<const ConfigText> text = current_config_text();
+        for (const ConfigText::Line& line : text->lines) {
+            std::string section(text->section_of(line));
+            std::string key(text->key_of(line));
+            if (section != REPLICA_LOCAL_SECTION && present.count(std::make_pair(section, key)) == 0) {
+                ConfigUpdate removal;
+                removal.section = std::move(section);
+                removal.key = std::move(key);
+                removal.remove = true;
+                changes.push_back(std::move(removal));
+            }
         }
     }
-    // 確実なTCP通信のため、[メッセージ長]\n[メッセージ本体] という形式で送信する
-    std::string content = content_ss.str();
-    ss << content.length() << "\n" << content;
-    return ss.str();
+    return changes;
 }
 
 /**
- * @brief WPFから受信した文字列をパースして設定データを更新する
- * @param data 受信した文字列データ
+ * @brief 複製元に1回接続し、切断されるまでバッチを受信・適用して確認（ack）を返す
+ *
+ * 前回までのバッチを適用済みなら "since=<版> epoch=<エポック>" で差分から再開する
+ * （複製元が違うエポック・古すぎる版と判断すれば設定全体が届く）。
+ * バッチの base が手元の版と合わなければ欠落とみなし、接続し直して取り直す。
+ * @return 接続できた場合はtrue
  */
-void update_config_from_string(const std::string& data) {
-    std::stringstream ss(data);
-    std::string line;
-    int updates_count = 0;
-
-    while (std::getline(ss, line)) {
-        if (line.empty() || line[0] != '[') continue;
-
-        size_t section_end = line.find(']');
-        size_t equals_pos = line.find('=', section_end);
+Task<bool> follow_leader(std::shared_ptr<EventBackend> backend, sockaddr_in leader_addr, std::string leader,
+                         ConnectionLimits limits) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "エラー: 複製用ソケットを作成できませんでした。" << strerror(errno) << std::endl;
+        co_return false;
+    }
+    SessionScope scope(*backend, sock);
+    apply_socket_profile(sock, g_socket_profile, false);
+    std::optional<trace_spans::Span> connect_span(std::in_place, "connect", sock);
+    ssize_t connected = co_await async_connect(*backend, sock, leader_addr,
+                                               std::chrono::steady_clock::now() + g_socket_profile.connect_timeout);
+    connect_span.reset();
+    if (connected < 0) {
+        co_return false;
+    }
 
-        if (section_end != std::string::npos && equals_pos != std::string::npos) {
-            std::string section = line.substr(1, section_end - 1);
-            std::string key = line.substr(section_end + 1, equals_pos - (section_end + 1));
-            std::string value = line.substr(equals_pos + 1);
+    std::string request = "0 id=repl op=replicate crc";
+    std::string codecs = config_compression::supported_codecs();
+    if (!codecs.empty()) {
+        request += " accept=" + codecs;
+    }
+    if (!g_replica_state.epoch.empty()) {
+        request += " since=" + std::to_string(g_replica_state.version.load()) + " epoch=" + g_replica_state.epoch;
+    }
+    request += "\n";
+    ssize_t sent = co_await write_all(*backend, sock, request.data(), request.size(),
+                                      std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+    if (sent < 0) {
+        co_return false;
+    }
+    g_replica_state.connected.store(true);
+    std::cout << "複製元 " << leader << " に接続しました。\n";
 
-            // 改行コードなど、末尾の空白文字を削除
-            value.erase(value.find_last_not_of(" \n\r\t") + 1);
+    FrameReader reader(*backend, sock);
+    FrameGuard guard(limits);
+    std::string source = "replica " + leader;
+    while (!g_shutdown_flag.load()) {
+        guard.restart();
+        std::string header;
+        ssize_t result = co_await reader.read_line(header, MAX_HEADER_LENGTH, guard, true);
+        if (result <= 0) {
+            if (result != -ECANCELED) {
+                report_frame_error(result, guard, leader, false);
+            }
+            break;
+        }
+        FrameHeader frame;
+        std::string header_error;
+        if (!parse_frame_header(header, frame, header_error, true) || frame.event.empty()) {
+            std::cerr << "エラー: 複製元からの不正なヘッダー: " << header
+                      << (header_error.empty() ? "" : " (" + header_error + ")") << std::endl;
+            break;
+        }
+        if (frame.length > limits.max_frame_size ||
+            (frame.codec != config_compression::NONE && frame.raw_length > limits.max_frame_size)) {
+            std::cerr << "エラー: 複製元からのバッチが大きすぎます: " << std::max(frame.length, frame.raw_length)
+                      << " bytes（上限 " << limits.max_frame_size << "）\n";
+            break;
+        }
+        std::vector<ConfigUpdate> received;
+        if (co_await receive_update_body(reader, frame, guard, leader, false, received) != UPDATE_RECEIVED) {
+            break;
+        }
+        std::chrono::steady_clock::time_point received_at = std::chrono::steady_clock::now();
+        bool snapshot = frame.event == "snapshot";
+        if (!snapshot && (frame.epoch != g_replica_state.epoch || frame.base != g_replica_state.version.load())) {
+            g_replica_state.gaps++;
+            std::cerr << "警告: 複製元からのバッチが欠落しています（手元 " << g_replica_state.version.load()
+                      << "、バッチの base " << frame.base << "）。接続し直して取り直します。\n";
+            break;
+        }
 
-            // 値が変更された場合のみ更新ログを出力
-            std::string old_value = get_config_value(section, key);
-            if (old_value != value) {
-                set_config_value(section, key, value);
-                std::cout << "設定更新: [" << section << "] " << key << " = " << value;
-                if (!old_value.empty()) {
-                    std::cout << " (旧値: " << old_value << ")";
-                }
-                std::cout << std::endl;
-                updates_count++;
+        // 整理券順に適用し、ジャーナルに書き込まれてから確認を返す（ワーカーが満杯なら少し待って再投入する）
+        std::vector<ConfigUpdate> changes = replica_changes(std::move(received), snapshot);
+        uint64_t local_version = 0;
+        SequenceClaim unsequenced; // 複製のバッチは版で順序を保つため、シーケンス番号は使わない
+        while (!changes.empty() &&
+               !co_await apply_received_updates(backend, changes, source, local_version, unsequenced)) {
+            co_await async_sleep(backend, std::chrono::milliseconds(10));
+            if (g_shutdown_flag.load()) {
+                co_return true;
             }
         }
+        g_replica_state.epoch = frame.epoch;
+        g_replica_state.version.store(frame.version);
+        g_replica_state.batches++;
+        if (snapshot) {
+            g_replica_state.snapshots++;
+            std::cout << "複製元から設定全体を受信しました（設定バージョン " << frame.version << "）\n";
+        }
+        g_replica_state.apply_us.store(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                                                 std::chrono::steady_clock::now() - received_at)
+                                                                 .count()));
+        g_replica_state.last_batch_ms.store(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                std::chrono::system_clock::now().time_since_epoch())
+                                                .count());
+
+        std::string ack = "0 id=repl op=ack version=" + std::to_string(frame.version) + "\n";
+        sent = co_await write_all(*backend, sock, ack.data(), ack.size(),
+                                  std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+        if (sent < 0) {
+            break;
+        }
     }
-    
-    if (updates_count > 0) {
-        std::cout << "合計 " << updates_count << " 項目の設定を更新しました。\n";
-    } else {
-        std::cout << "設定に変更はありませんでした。\n";
+    g_replica_state.connected.store(false);
+    if (!g_shutdown_flag.load()) {
+        std::cerr << "警告: 複製元 " << leader << " との接続が切れました。\n";
     }
+    co_return true;
 }
 
 /**
- * @brief ソケットのノンブロッキングモードを設定する
- * @param sock ソケットディスクリプタ
- * @param non_blocking trueでノンブロッキング、falseでブロッキング
- * @return 成功時true
+ * @brief 複製元に接続し続ける（切断・接続失敗のたびに1秒待って接続し直す。終了要求まで）
  */
-bool set_socket_non_blocking(int sock, bool non_blocking) {
-    int flags = fcntl(sock, F_GETFL, 0);
-    if (flags == -1) {
-        return false;
+DetachedTask run_replica_follower(std::shared_ptr<EventBackend> backend, std::string host, int port) {
+    struct sockaddr_in leader_addr;
+    memset(&leader_addr, 0, sizeof(leader_addr));
+    leader_addr.sin_family = AF_INET;
+    leader_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &leader_addr.sin_addr) <= 0) {
+        std::cerr << "エラー: 不正な複製元のIPアドレス: " << host << std::endl;
+        co_return;
     }
-    
-    if (non_blocking) {
-        flags |= O_NONBLOCK;
-    } else {
-        flags &= ~O_NONBLOCK;
+    std::string leader = host + ":" + std::to_string(port);
+    ConnectionLimits limits = load_connection_limits();
+    bool reachable = true;
+    while (!g_shutdown_flag.load()) {
+        bool connected = co_await follow_leader(backend, leader_addr, leader, limits);
+        if (g_shutdown_flag.load()) {
+            break;
+        }
+        if (!connected && reachable) {
+            std::cerr << "エラー: 複製元 " << leader << " に接続できません。1秒ごとに接続し直します。\n";
+        }
+        reachable = connected;
+        g_replica_state.reconnects++;
+        co_await async_sleep(backend, std::chrono::seconds(1));
     }
-    
-    return fcntl(sock, F_SETFL, flags) != -1;
 }
 
 /**
- * @brief WPFアプリケーションに現在の設定を送信する (改良版)
+ * @brief 複製元への接続を受信スレッドのイベントループ上で始める（REPLICATE_FROM=host:port）
  */
-void send_config_to_wpf() {
-    std::string host = get_config_value("CONFIG_SYNC", "WPF_HOST", "192.168.4.10");
-    std::string port_str = get_config_value("CONFIG_SYNC", "WPF_RECV_PORT", "12347");
-    
-    int port;
+bool start_replica_follower(const std::string& address) {
+    size_t colon = address.rfind(':');
+    int port = 0;
     try {
-        port = std::stoi(port_str);
-        if (port <= 0 || port > 65535) {
-            throw std::out_of_range("ポート番号が範囲外です");
-        }
+        port = colon == std::string::npos ? 0 : std::stoi(address.substr(colon + 1));
     } catch (const std::exception& e) {
-        std::cerr << "エラー: 不正なポート番号: " << port_str << " (" << e.what() << ")" << std::endl;
-        return;
+        port = 0;
     }
-
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        std::cerr << "エラー: 送信用ソケットを作成できませんでした。" << strerror(errno) << std::endl;
-        return;
-    }
-
-    // ソケットタイムアウトを設定
-    struct timeval timeout;
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
-    if (setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
-        std::cerr << "警告: 送信タイムアウトの設定に失敗しました。\n";
+    if (port <= 0 || port > 65535) {
+        std::cerr << "エラー: REPLICATE_FROM の形式が不正です（host:port）: " << address << std::endl;
+        return false;
     }
-    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        std::cerr << "警告: 受信タイムアウトの設定に失敗しました。\n";
+    std::shared_ptr<EventBackend> backend = std::atomic_load(&g_event_backend);
+    if (!backend) {
+        std::cerr << "エラー: イベントループが動いていないため複製を開始できません。\n";
+        return false;
     }
+    std::string host = address.substr(0, colon);
+    backend->post([backend, host, port] { run_replica_follower(backend, host, port); });
+    return true;
+}
 
+/**
+ * @brief WPFアプリケーションへ現在の設定を送信するセッション（イベントループ上のコルーチン）
+ * @param done 送信結果（成功時true）を受け取る処理（イベントループのスレッドで呼ばれる）
+ */
+DetachedTask push_config_to_wpf(std::shared_ptr<EventBackend> backend, std::string host, int port,
+                                std::function<void(bool)> done) {
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(port);
-    
     if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
         std::cerr << "エラー: 不正なIPアドレス: " << host << std::endl;
-        close(sock);
-        return;
+        done(false);
+        co_return;
     }
 
-    // ソケットをノンブロッキングモードに設定
-    if (!set_socket_non_blocking(sock, true)) {
-        std::cerr << "エラー: ソケットをノンブロッキングモードに設定できませんでした。\n";
-        close(sock);
-        return;
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "エラー: 送信用ソケットを作成できませんでした。" << strerror(errno) << std::endl;
+        done(false);
+        co_return;
     }
+    SessionScope scope(*backend, sock);
+    apply_socket_profile(sock, g_socket_profile, false);
 
     std::cout << "WPFアプリケーション(" << host << ":" << port << ")に接続を試行中...\n";
-    
-    int ret = connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr));
-    if (ret < 0) {
-        if (errno == EINPROGRESS) {
-            // ノンブロッキング接続が進行中。select()で完了を待つ
-            fd_set writefds;
-            FD_ZERO(&writefds);
-            FD_SET(sock, &writefds);
-
-            // 接続タイムアウトを設定
-            struct timeval connect_timeout;
-            connect_timeout.tv_sec = 5;
-            connect_timeout.tv_usec = 0;
-
-            int activity = select(sock + 1, nullptr, &writefds, nullptr, &connect_timeout);
-            if (activity > 0) {
-                // ソケットが書き込み可能になった。接続結果を確認する
-                int so_error;
-                socklen_t len = sizeof(so_error);
-                getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &len);
-                if (so_error != 0) {
-                    std::cerr << "エラー: WPFアプリケーション(" << host << ":" << port << ")に接続できませんでした。 " 
-                              << strerror(so_error) << std::endl;
-                    close(sock);
-                    return;
-                }
-                // 接続成功
-            } else {
-                // select()が0を返した場合はタイムアウト、-1の場合はエラー
-                std::cerr << "エラー: WPFアプリケーション(" << host << ":" << port << ")への接続がタイムアウトまたは失敗しました。" << std::endl;
-                close(sock);
-                return;
-            }
+    std::optional<trace_spans::Span> connect_span(std::in_place, "connect", sock);
+    ssize_t connected = co_await async_connect(*backend, sock, server_addr,
+                                               std::chrono::steady_clock::now() + g_socket_profile.connect_timeout);
+    connect_span.reset();
+    if (connected < 0) {
+        if (connected == -ETIMEDOUT) {
+            std::cerr << "エラー: WPFアプリケーション(" << host << ":" << port << ")への接続がタイムアウトしました。" << std::endl;
         } else {
-            // EINPROGRESS以外の即時エラー
-            std::cerr << "エラー: WPFアプリケーション(" << host << ":" << port << ")に接続できませんでした。 " 
-                      << strerror(errno) << std::endl;
-            close(sock);
-            return;
+            std::cerr << "エラー: WPFアプリケーション(" << host << ":" << port << ")に接続できませんでした。 "
+                      << strerror(static_cast<int>(-connected)) << std::endl;
         }
+        done(false);
+        co_return;
     }
-    // ret == 0 の場合、即座に接続が完了した
 
     std::cout << "WPFアプリケーションに接続しました。設定を送信します...\n";
-    std::string config_str = serialize_config();
-    
-    ssize_t total_sent = 0;
-    const char* data_ptr = config_str.c_str();
-    size_t data_len = config_str.length();
-
-    while (total_sent < (ssize_t)data_len && !g_shutdown_flag.load()) {
-        ssize_t bytes_sent = send(sock, data_ptr + total_sent, data_len - total_sent, 0);
-        if (bytes_sent < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // 一時的な送信不可、少し待って再試行
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                continue;
-            }
-            std::cerr << "エラー: データ送信に失敗しました。 " << strerror(errno) << std::endl;
-            close(sock);
-            return;
-        }
-        total_sent += bytes_sent;
+    std::string config_str;
+    bool offloaded = co_await OffloadAwaitable(backend, [&config_str](std::function<void()> resume) {
+        return g_worker_pool->try_submit([&config_str, resume] {
+            config_str = serialize_config();
+            resume();
+        });
+    });
+    if (!offloaded) {
+        config_str = serialize_config(); // ワーカーが埋まっている場合はループ上で直列化する
     }
 
-    if (g_shutdown_flag.load()) {
+    ssize_t sent = co_await write_all(*backend, sock, config_str.data(), config_str.size(),
+                                      std::chrono::steady_clock::now() + g_socket_profile.send_timeout);
+    if (sent == -ECANCELED) {
         std::cout << "送信がキャンセルされました。\n";
+    } else if (sent < 0) {
+        std::cerr << "エラー: データ送信に失敗しました。 " << strerror(static_cast<int>(-sent)) << std::endl;
     } else {
-        std::cout << "設定を送信しました（" << total_sent << " バイト）\n";
+        std::cout << "設定を送信しました（" << sent << " バイト）\n";
     }
-    
-    close(sock);
     std::cout << "接続を閉じました。\n";
+    done(sent >= 0);
 }
 
 /**
- * @brief WPFからの設定更新を待ち受けるサーバーとして動作する (別スレッドで実行)
+ * @brief WPFアプリケーションに現在の設定を送信する
+ *
+ * 送信は受信スレッドのイベントループ上のコルーチンで行い、呼び出し元は
+ * 完了まで待つ。イベントループが動いていない場合は、一時的なループを
+ * 呼び出し元のスレッドで回して送信する。
  */
-void handle_client_connection(int client_sock); // プロトタイプ宣言
+void send_config_to_wpf() {
+    std::string host = get_config_value("CONFIG_SYNC", "WPF_HOST", "192.168.4.10");
+    std::string port_str = get_config_value("CONFIG_SYNC", "WPF_RECV_PORT", "12347");
 
-void receive_config_updates() {
-    std::string port_str = get_config_value("CONFIG_SYNC", "CPP_RECV_PORT", "12348");
-    
     int port;
     try {
         port = std::stoi(port_str);
         if (port <= 0 || port > 65535) {
             throw std::out_of_range("ポート番号が範囲外です");
         }
-    } catch (const std::exception& e) {
-        std::cerr << "エラー: 不正なポート番号: " << port_str << " (" << e.what() << ")" << std::endl;
-        return;
+    } catch (const std::exception& e) {
+        std::cerr << "エラー: 不正なポート番号: " << port_str << " (" << e.what() << ")" << std::endl;
+        return;
+    }
+
+    std::shared_ptr<std::promise<bool>> done(new std::promise<bool>());
+    std::future<bool> result = done->get_future();
+
+    std::shared_ptr<EventBackend> backend = std::atomic_load(&g_event_backend);
+    if (backend) {
+        backend->post([backend, host, port, done] {
+            push_config_to_wpf(backend, host, port, [done](bool ok) { done->set_value(ok); });
+        });
+        try {
+            result.get();
+        } catch (const std::future_error&) {
+            std::cout << "送信がキャンセルされました。\n"; // ループ終了で依頼が破棄された
+        }
+        return;
+    }
+
+    std::shared_ptr<EventBackend> local_loop =
+        create_event_backend(get_config_value("CONFIG_SYNC", "EVENT_BACKEND", "auto"));
+    if (!local_loop) {
+        return;
+    }
+    push_config_to_wpf(local_loop, host, port, [done](bool ok) { done->set_value(ok); });
+    while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        local_loop->run_once(100);
+    }
+    local_loop->shutdown();
+}
+
+/**
+ * @brief WPFへの送信要求をまとめ、送信先ごとに送信頻度を制限するスケジューラー
+ *
+ * 要求を受けてもすぐには送らず、まとめる時間（PUSH_COALESCE_MS）の間に届いた要求を
+ * 1回の送信にまとめる。送信先ごとに前回の送信開始から 1/PUSH_MAX_RATE 秒は次を送らず（0で制限なし）、
+ * 送信中に届いた要求は送信完了後の1回にまとめる。
+ * WPFは受信のたびに設定一覧を丸ごと置き換えるため、送るのは常にその時点の全設定
+ * （各キーの最終値）になる。
+ * request() 以外はイベントループのスレッドからのみ呼ばれる。
+ */
+class PushScheduler {
+public:
+    PushScheduler(std::chrono::milliseconds window, long max_rate)
+        : window_(window),
+          min_interval_(max_rate > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                           std::chrono::duration<double>(1.0 / static_cast<double>(max_rate)))
+                                     : std::chrono::steady_clock::duration::zero()),
+          requests_(0), pushes_(0), rate_limited_(0), changed_keys_(0) {}
+
+    /**
+     * @brief 送信を要求する（イベントループのスレッドで呼ぶ）
+     * @param changed_keys この要求のきっかけになった変更の項目数（統計用）
+     */
+    void request(const std::shared_ptr<EventBackend>& backend, const std::string& host, int port,
+                 size_t changed_keys) {
+        requests_++;
+        changed_keys_ += changed_keys;
+        Subscriber& subscriber = subscribers_[host + ":" + std::to_string(port)];
+        subscriber.host = host;
+        subscriber.port = port;
+        subscriber.pending = true;
+        if (!subscriber.timer_armed && !subscriber.in_flight) {
+            arm(backend, subscriber);
+        }
+    }
+
+    uint64_t requests() const { return requests_.load(); }
+    uint64_t pushes() const { return pushes_.load(); }
+    uint64_t rate_limited() const { return rate_limited_.load(); }
+    uint64_t changed_keys() const { return changed_keys_.load(); }
+
+private:
+    struct Subscriber {
+        std::string host;
+        int port = 0;
+        bool pending = false;      // 未送信の要求がある
+        bool timer_armed = false;  // 送信待ちのタイマーがある
+        bool in_flight = false;    // 送信中
+        std::chrono::steady_clock::time_point last_push;
+    };
+
+    // まとめる時間と送信頻度の上限を満たす時刻に送信を予約する
+    void arm(const std::shared_ptr<EventBackend>& backend, Subscriber& subscriber) {
+        std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + window_;
+        std::chrono::steady_clock::time_point allowed = subscriber.last_push + min_interval_;
+        if (allowed > due) {
+            due = allowed;
+            rate_limited_++;
+        }
+        subscriber.timer_armed = true;
+        std::weak_ptr<EventBackend> weak_backend = backend;
+        backend->add_timer(due, [this, weak_backend, &subscriber] {
+            std::shared_ptr<EventBackend> owner = weak_backend.lock();
+            subscriber.timer_armed = false;
+            if (owner) {
+                flush(owner, subscriber);
+            }
+        });
+    }
+
+    void flush(const std::shared_ptr<EventBackend>& backend, Subscriber& subscriber) {
+        subscriber.pending = false;
+        subscriber.in_flight = true;
+        subscriber.last_push = std::chrono::steady_clock::now();
+        pushes_++;
+        std::weak_ptr<EventBackend> weak_backend = backend;
+        push_config_to_wpf(backend, subscriber.host, subscriber.port, [this, weak_backend, &subscriber](bool) {
+            subscriber.in_flight = false;
+            std::shared_ptr<EventBackend> owner = weak_backend.lock();
+            if (subscriber.pending && owner && !g_shutdown_flag.load()) {
+                arm(owner, subscriber); // 送信中に届いた要求をまとめて送る
+            }
+        });
+    }
+
+    const std::chrono::milliseconds window_;
+    const std::chrono::steady_clock::duration min_interval_;
+    std::map<std::string, Subscriber> subscribers_; // "host:port" → 状態（要素の位置は変わらない）
+    std::atomic<uint64_t> requests_;
+    std::atomic<uint64_t> pushes_;
+    std::atomic<uint64_t> rate_limited_;
+    std::atomic<uint64_t> changed_keys_;
+};
+
+std::unique_ptr<PushScheduler> g_push_scheduler;
+
+/**
+ * @brief WPFへの送信を予約する（まとめる時間の後に送信される）
+ *
+ * どのスレッドから呼んでもよい。g_config_mutexを保持したまま呼んでもよい。
+ * @param changed_keys この要求のきっかけになった変更の項目数（統計用）
+ * @return イベントループが動いておらず予約できなかった場合はfalse
+ */
+bool schedule_config_push(size_t changed_keys) {
+    std::shared_ptr<EventBackend> backend = std::atomic_load(&g_event_backend);
+    if (!backend || !g_push_scheduler) {
+        return false;
+    }
+    // 送信先の取得はg_config_mutexを取るため、イベントループ側で行う
+    backend->post([backend, changed_keys] {
+        std::string host = get_config_value("CONFIG_SYNC", "WPF_HOST", "192.168.4.10");
+        int port = static_cast<int>(get_config_int("CONFIG_SYNC", "WPF_RECV_PORT", 12347, 1, 65535));
+        g_push_scheduler->request(backend, host, port, changed_keys);
+    });
+    return true;
+}
+
+/**
+ * @brief 受信スレッドの準備完了をメインスレッドに知らせる
+ *
+ * 待ち受けを始めたら ready() で成功を通知する。途中で失敗して抜けた場合は
+ * デストラクタが失敗を通知するので、メインスレッドが待ち続けることはない。
+ */
+class ReadySignal {
+public:
+    explicit ReadySignal(std::promise<bool>* promise) : promise_(promise) {}
+    ~ReadySignal() { notify(false); }
+
+    void ready() { notify(true); }
+
+    // 通知の責任を別の ReadySignal に引き渡す
+    std::promise<bool>* release() {
+        std::promise<bool>* promise = promise_;
+        promise_ = nullptr;
+        return promise;
+    }
+
+private:
+    void notify(bool ok) {
+        if (promise_ != nullptr) {
+            promise_->set_value(ok);
+            promise_ = nullptr;
+        }
     }
 
-    int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    std::promise<bool>* promise_;
+};
+
+/**
+ * @brief 受信用のリスニングソケットを作成する
+ * @param reuse_port trueなら SO_REUSEPORT を付け、同じポートに複数のソケットをバインドできるようにする
+ * @return ソケット。失敗時は-1
+ */
+int open_listen_socket(int port, bool reuse_port) {
+    int listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (listen_sock < 0) {
         std::cerr << "エラー: 受信用ソケットを作成できませんでした。 " << strerror(errno) << std::endl;
-        return;
+        return -1;
     }
 
     // ソケットオプション設定（アドレス再利用）
@@ -388,6 +7598,12 @@ void receive_config_updates() {
     if (setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         std::cerr << "エラー: SO_REUSEADDRの設定に失敗しました。 " << strerror(errno) << std::endl;
     }
+    // カーネルが新しい接続をシャードのソケットに振り分ける
+    if (reuse_port && setsockopt(listen_sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        std::cerr << "エラー: SO_REUSEPORTの設定に失敗しました。 " << strerror(errno) << std::endl;
+        close(listen_sock);
+        return -1;
+    }
 
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
@@ -398,189 +7614,239 @@ void receive_config_updates() {
     if (bind(listen_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         std::cerr << "エラー: ポート " << port << " にバインドできませんでした。 " << strerror(errno) << std::endl;
         close(listen_sock);
-        return;
+        return -1;
     }
 
-    if (listen(listen_sock, 5) < 0) {
+    // 受け付けた接続はバッファやTCP_NODELAYを引き継ぐが、念のため受け付け時にも設定する
+    apply_socket_profile(listen_sock, g_socket_profile, true);
+
+    if (listen(listen_sock, static_cast<int>(g_socket_profile.listen_backlog)) < 0) {
         std::cerr << "エラー: listenに失敗しました。 " << strerror(errno) << std::endl;
         close(listen_sock);
-        return;
+        return -1;
     }
+    return listen_sock;
+}
 
-    std::cout << "ポート " << port << " でWPFからの設定更新を待機しています...\n";
+/**
+ * @brief 受信シャードの構成（RECV_SHARDS / SHARD_CPU_AFFINITY）
+ */
+struct ShardPlan {
+    size_t index = 0;
+    size_t count = 1;
+    int port = 0;
+    int cpu = -1; // 固定するCPU（-1なら固定しない）
+    ConnectionLimits limits;
+    std::shared_ptr<PeerConnectionCounter> peers;
+};
 
-    while (!g_shutdown_flag.load()) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(listen_sock, &readfds);
-        
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        
-        int activity = select(listen_sock + 1, &readfds, nullptr, nullptr, &timeout);
-        
-        if (activity < 0) {
-            if (errno != EINTR) {
-                std::cerr << "エラー: selectに失敗しました。 " << strerror(errno) << std::endl;
-            }
-            break;
+/**
+ * @brief 受信シャード1つ分（自分のリスナーとイベントループ）を終了要求まで動かす
+ *
+ * 各シャードは自分のスレッドでバックエンドを作り、SO_REUSEPORT で振り分けられた接続だけを処理する。
+ * 設定の読み取りは直列化済みスナップショット（g_config_text）を使うのでシャード間でロックを取り合わない。
+ * @param listen_sock このシャードのリスニングソケット（終了時に閉じる）
+ * @param ready 待ち受けを開始できたかを通知する先
+ */
+void run_receive_shard(ShardPlan plan, int listen_sock, std::promise<bool>* ready) {
+    trace_spans::name_thread(plan.count > 1 ? "receiver " + std::to_string(plan.index + 1) : std::string("receiver"));
+    ReadySignal ready_signal(ready);
+    std::string shard_label = plan.count > 1 ? "シャード " + std::to_string(plan.index + 1) + "/" +
+                                                   std::to_string(plan.count) + "、"
+                                             : "";
+
+    if (plan.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(plan.cpu, &cpus);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (result != 0) {
+            std::cerr << "警告: " << shard_label << "CPU " << plan.cpu << " に固定できませんでした。 "
+                      << strerror(result) << std::endl;
+            plan.cpu = -1;
         }
-        
-        if (activity == 0) {
-            // タイムアウト、継続
-            continue;
+    }
+    make_thread_realtime(g_realtime.priority, plan.count > 1 ? "受信シャード " + std::to_string(plan.index + 1)
+                                                             : std::string("受信スレッド"));
+
+    std::shared_ptr<EventBackend> backend =
+        create_event_backend(get_config_value("CONFIG_SYNC", "EVENT_BACKEND", "auto"));
+    if (!backend) {
+        close(listen_sock);
+        return;
+    }
+
+    ConnectionLimits limits = plan.limits;
+    std::shared_ptr<PeerConnectionCounter> peers = plan.peers;
+
+    // バックエンド自身が保持するハンドラーなので、循環参照を避けてweak_ptrで持つ
+    std::weak_ptr<EventBackend> weak_backend = backend;
+    bool listening = backend->listen_on(listen_sock, [weak_backend, limits, peers](int client_sock) {
+        std::shared_ptr<EventBackend> owner = weak_backend.lock();
+        if (!owner) {
+            ::close(client_sock);
+            return;
         }
-        
-        if (FD_ISSET(listen_sock, &readfds)) {
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            int client_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &client_len);
-            
-            if (client_sock < 0) {
-                if (!g_shutdown_flag.load()) {
-                    std::cerr << "エラー: acceptに失敗しました。 " << strerror(errno) << std::endl;
-                }
-                continue;
-            }
 
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        std::string peer = "不明";
+        uint32_t peer_ip = 0;
+        if (getpeername(client_sock, (struct sockaddr*)&client_addr, &client_len) == 0) {
             char client_ip[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-            std::cout << "クライアント " << client_ip << ":" << ntohs(client_addr.sin_port) << " から接続を受信しました。\n";
+            peer = std::string(client_ip) + ":" + std::to_string(ntohs(client_addr.sin_port));
+            peer_ip = client_addr.sin_addr.s_addr;
+        }
 
-            // 接続処理を別関数に委譲
-            handle_client_connection(client_sock);
+        // 同じ送信元からの同時接続数を制限する
+        if (!peers->try_acquire(peer_ip)) {
+            g_eviction_stats.per_ip_limit++;
+            std::cerr << "エラー: 送信元ごとの同時接続数の上限（" << limits.max_connections_per_ip
+                      << "）に達したため " << peer << " からの接続を拒否しました。\n";
+            ::close(client_sock);
+            return;
+        }
+        std::cout << "クライアント " << peer << " から接続を受信しました。\n";
+        if (g_traffic_recorder) {
+            g_traffic_recorder->open(client_sock, traffic_capture::ACCEPTED, peer);
         }
+        apply_socket_profile(client_sock, g_socket_profile, false);
+        serve_connection(owner, client_sock, peer, limits, peers, peer_ip);
+    });
+    if (!listening) {
+        std::cerr << "エラー: リスナーを登録できませんでした。 " << strerror(errno) << std::endl;
+        close(listen_sock);
+        return;
+    }
+    if (plan.index == 0) {
+        std::atomic_store(&g_event_backend, backend);
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_shard_mutex);
+        g_shard_backends.push_back(backend);
     }
 
-    close(listen_sock);
-    std::cout << "設定更新受信スレッドを終了しました。\n";
-}
+    std::cout << "ポート " << plan.port << " でWPFからの設定更新を待機しています...（" << shard_label
+              << "バックエンド: " << backend->name();
+    if (plan.cpu >= 0) {
+        std::cout << "、CPU " << plan.cpu;
+    }
+    std::cout << "）\n";
+    ready_signal.ready();
 
-/**
- * @brief 既存のソケットを通じて現在の設定を送信する
- * @param sock 既に接続済みのクライアントソケット
- */
-void send_config_on_existing_socket(int sock) {
-    std::string config_str = serialize_config();
-    
-    ssize_t total_sent = 0;
-    const char* data_ptr = config_str.c_str();
-    size_t data_len = config_str.length();
-
-    // handle_client_connectionではノンブロッキングに設定していないため、sendはブロックするはず
-    while (total_sent < (ssize_t)data_len && !g_shutdown_flag.load()) {
-        ssize_t bytes_sent = send(sock, data_ptr + total_sent, data_len - total_sent, 0);
-        if (bytes_sent < 0) {
-            // EAGAIN/EWOULDBLOCKはブロッキングソケットでは通常発生しないが、念のため
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                continue;
-            }
-            std::cerr << "エラー: 設定の返信に失敗しました。 " << strerror(errno) << std::endl;
-            return;
-        }
-        total_sent += bytes_sent;
+    while (!g_shutdown_flag.load()) {
+        backend->run_once(1000);
     }
 
-    if (g_shutdown_flag.load()) {
-        std::cout << "設定の返信がキャンセルされました。\n";
-    } else {
-        std::cout << "設定を返信しました（" << total_sent << " バイト）\n";
+    // 処理中のセッションを取り消し、後始末が終わるまで（最大1秒）ループを回す
+    backend->cancel_all();
+    std::chrono::steady_clock::time_point drain_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (backend->active_socket_count() > 0 && std::chrono::steady_clock::now() < drain_deadline) {
+        backend->run_once(50);
     }
+    backend->shutdown();
+    close(listen_sock);
 }
 
 /**
- * @brief クライアントからの接続を処理し、完全なメッセージを受信する (改良版)
- * @param client_sock クライアントのソケットディスクリプタ
+ * @brief WPFからの設定更新を待ち受けるサーバーとして動作する (別スレッドで実行)
+ *
+ * 受け付けと送受信はイベントループ（epollまたはio_uring）上のコルーチンで行い、
+ * パース・適用・直列化はワーカープールで行う。
+ * RECV_SHARDS が2以上なら、シャードごとに SO_REUSEPORT のリスナーとイベントループを持つ
+ * スレッドを立て、カーネルに接続を振り分けさせる（最初のシャードはこのスレッドで動かす）。
+ * @param ready 待ち受けを開始できたか（イベントループに送信を依頼できるか）を通知する先
  */
-void handle_client_connection(int client_sock) {
-    // クライアントソケットにもタイムアウトを設定
-    struct timeval timeout;
-    timeout.tv_sec = 10;  // 受信用は少し長めに設定
-    timeout.tv_usec = 0;
-    setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+void receive_config_updates(std::promise<bool>* ready) {
+    ReadySignal ready_signal(ready);
+    std::string port_str = get_config_value("CONFIG_SYNC", "CPP_RECV_PORT", "12348");
 
+    int port;
     try {
-        // 1. ヘッダー（メッセージ長）を改行まで読み込む
-        std::string header;
-        char c;
-        int header_read_count = 0;
-        const int MAX_HEADER_LENGTH = 20; // ヘッダーの最大長を制限
-
-        while (recv(client_sock, &c, 1, 0) > 0 && !g_shutdown_flag.load()) {
-            if (c == '\n') {
-                break;
-            }
-            header += c;
-            header_read_count++;
-            
-            // 異常に長いヘッダーを防ぐ
-            if (header_read_count > MAX_HEADER_LENGTH) {
-                std::cerr << "エラー: ヘッダーが長すぎます。\n";
-                close(client_sock);
-                return;
-            }
+        port = std::stoi(port_str);
+        if (port <= 0 || port > 65535) {
+            throw std::out_of_range("ポート番号が範囲外です");
         }
+    } catch (const std::exception& e) {
+        std::cerr << "エラー: 不正なポート番号: " << port_str << " (" << e.what() << ")" << std::endl;
+        return;
+    }
 
-        if (header.empty() || g_shutdown_flag.load()) {
-            close(client_sock);
-            return;
-        }
+    // シャード数（0ならCPU数）
+    long cpu_count = std::max(1u, std::thread::hardware_concurrency());
+    long shard_count = get_config_int("CONFIG_SYNC", "RECV_SHARDS", 1, 0, 256);
+    if (shard_count == 0) {
+        shard_count = cpu_count;
+    }
+    bool pin_cpu = get_config_int("CONFIG_SYNC", "SHARD_CPU_AFFINITY", 0, 0, 1) != 0;
+    // リアルタイム動作で RT_CPU があれば、シャードnを RT_CPU + n に固定する
+    int first_cpu = 0;
+    if (g_realtime.enabled && g_realtime.cpu >= 0) {
+        pin_cpu = true;
+        first_cpu = g_realtime.cpu;
+    }
 
-        // 2. メッセージ長をパースし、その長さのデータを受信する
-        size_t expected_length = std::stoull(header);
-        
-        // 0バイトデータは「設定要求」として扱う
-        if (expected_length == 0) {
-            std::cout << "\nWPFから設定要求（0バイト）を受信しました。現在の設定を返信します。\n";
-            send_config_on_existing_socket(client_sock);
-            close(client_sock);
+    // 全シャードのソケットを先にバインドしておく（1つでも失敗したら起動しない）
+    std::vector<int> listen_socks;
+    for (long i = 0; i < shard_count; i++) {
+        int listen_sock = open_listen_socket(port, shard_count > 1);
+        if (listen_sock < 0) {
+            for (int opened : listen_socks) {
+                close(opened);
+            }
             return;
         }
+        listen_socks.push_back(listen_sock);
+    }
 
-        // 異常に大きなメッセージサイズを防ぐ
-        const size_t MAX_MESSAGE_SIZE = 1024 * 1024; // 1MB
-        if (expected_length > MAX_MESSAGE_SIZE) {
-            std::cerr << "エラー: メッセージサイズが大きすぎます: " << expected_length << " bytes\n";
-            close(client_sock);
-            return;
-        }
-        
-        std::string received_data;
-        received_data.reserve(expected_length);
-        
-        std::vector<char> buffer(4096);
-        size_t total_received = 0;
-
-        while (total_received < expected_length && !g_shutdown_flag.load()) {
-            size_t to_read = std::min(buffer.size(), expected_length - total_received);
-            ssize_t bytes_received = recv(client_sock, buffer.data(), to_read, 0);
-            
-            if (bytes_received <= 0) {
-                if (bytes_received == 0) {
-                    std::cerr << "エラー: クライアントが接続を閉じました。" << std::endl;
-                } else {
-                    std::cerr << "エラー: データ受信中にエラーが発生しました: " << strerror(errno) << std::endl;
-                }
-                close(client_sock);
-                return;
-            }
-            
-            received_data.append(buffer.data(), bytes_received);
-            total_received += bytes_received;
-        }
-        
-        if (!g_shutdown_flag.load()) {
-            std::cout << "\nWPFから設定データを受信しました（" << total_received << " バイト）\n";
-            update_config_from_string(received_data);
+    ShardPlan plan;
+    plan.count = static_cast<size_t>(shard_count);
+    plan.port = port;
+    plan.limits = load_connection_limits();
+    plan.peers.reset(new PeerConnectionCounter(plan.limits.max_connections_per_ip));
+
+    // 2つ目以降のシャードを起動し、待ち受けを始めるまで待つ
+    std::vector<std::thread> shard_threads;
+    std::vector<std::promise<bool>> shard_ready(static_cast<size_t>(shard_count));
+    for (size_t i = 1; i < plan.count; i++) {
+        ShardPlan shard = plan;
+        shard.index = i;
+        shard.cpu = pin_cpu ? static_cast<int>((first_cpu + i) % cpu_count) : -1;
+        shard_threads.push_back(std::thread(run_receive_shard, shard, listen_socks[i], &shard_ready[i]));
+    }
+    for (size_t i = 1; i < plan.count; i++) {
+        if (!shard_ready[i].get_future().get()) {
+            std::cerr << "警告: シャード " << i + 1 << " を起動できませんでした。残りのシャードで処理します。\n";
         }
-        
-    } catch (const std::exception& e) {
-        std::cerr << "エラー: クライアント接続処理中に例外が発生しました: " << e.what() << std::endl;
     }
-    
-    close(client_sock);
+
+    // 最初のシャードはこのスレッドで動かす（準備完了の通知もこのシャードが行う）
+    plan.cpu = pin_cpu ? first_cpu : -1;
+    run_receive_shard(plan, listen_socks[0], ready_signal.release());
+
+    for (std::thread& thread : shard_threads) {
+        thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_shard_mutex);
+        g_shard_backends.clear();
+    }
+    std::cout << "設定更新受信スレッドを終了しました。\n";
+}
+
+/**
+ * @brief 現在の設定でジャーナルのスナップショットを作り直す（g_config_mutexを保持した状態で呼ぶ）
+ *
+ * 設定ファイルと同期した時点（読み込み・保存）で呼び、ファイルの更新日時・サイズ・ハッシュを
+ * 記録しておく。次回起動時にファイルが変わっていなければ、テキストを解析せずに
+ * スナップショット（コンパイル済みの設定）から復元する。
+ * @param filename 同期した設定ファイル
+ */
+void compact_journal_locked(const std::string& filename) {
+    if (g_journal && filename + ".journal" == g_journal->journal_path()) {
+        g_journal->compact(g_config_data, g_config_version.load(), hash_file_stamp(filename));
+    }
 }
 
 /**
@@ -588,6 +7854,7 @@ void handle_client_connection(int client_sock) {
  * @param filename 保存先ファイル名
  */
 void save_config(const std::string& filename) {
+    trace_spans::Span span("save");
     std::lock_guard<std::mutex> lock(g_config_mutex);
     
     // バックアップファイルを作成
@@ -623,6 +7890,9 @@ void save_config(const std::string& filename) {
     
     file.close();
     std::cout << "設定を " << filename << " に保存しました。\n";
+
+    // 保存した内容を次回起動時の基準にする
+    compact_journal_locked(filename);
 }
 
 /**
@@ -655,9 +7925,123 @@ void print_current_config() {
         }
         std::cout << "\n";
     }
+    if (!g_derived_keys.empty()) {
+        std::cout << "[派生キー]\n";
+        g_derived_keys.print_locked();
+        std::cout << "\n";
+    }
     std::cout << "==================\n\n";
 }
 
+/**
+ * @brief ジャーナルの記録時刻を表示用の文字列にする
+ */
+std::string format_journal_time(int64_t time_ms) {
+    time_t seconds = static_cast<time_t>(time_ms / 1000);
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+    return buffer;
+}
+
+/**
+ * @brief 設定バージョン from から to までの変更を表示する（"diff N..M" コマンド）
+ */
+void print_config_diff(uint64_t from, uint64_t to) {
+    if (!g_journal) {
+        std::cerr << "エラー: ジャーナルが無効です。\n";
+        return;
+    }
+    std::vector<JournalRecord> records;
+    if (!g_journal->history_between(from, to, records)) {
+        std::cerr << "エラー: 設定バージョン " << from << " まで遡る履歴は残っていません（最古 "
+                  << g_journal->oldest_version() << "）。\n";
+        return;
+    }
+
+    std::cout << "\n=== 設定バージョン " << from << " → " << to << " の変更 ===\n";
+    // バージョンごとの概要（いつ、どこから、何項目）
+    for (size_t i = 0; i < records.size();) {
+        size_t j = i;
+        while (j < records.size() && records[j].version == records[i].version) {
+            j++;
+        }
+        std::cout << "  v" << records[i].version << "  " << format_journal_time(records[i].time_ms) << "  "
+                  << records[i].source << "  " << (j - i) << " 項目\n";
+        i = j;
+    }
+
+    // キーごとの差分（from時点の値 → to時点の値）
+    std::map<std::pair<std::string, std::string>, std::pair<const JournalRecord*, const JournalRecord*>> changes;
+    for (const JournalRecord& record : records) {
+        std::pair<const JournalRecord*, const JournalRecord*>& entry =
+            changes[std::make_pair(record.section, record.key)];
+        if (entry.first == nullptr) {
+            entry.first = &record;
+        }
+        entry.second = &record;
+    }
+    int changed = 0;
+    for (const auto& change : changes) {
+        const JournalRecord& first = *change.second.first;
+        const JournalRecord& last = *change.second.second;
+        if (first.had_old == last.has_new && first.old_value == last.new_value) {
+            continue; // 途中で変わったが元に戻っている
+        }
+        std::cout << "  [" << change.first.first << "] " << change.first.second << ": "
+                  << (first.had_old ? first.old_value : "(なし)") << " -> "
+                  << (last.has_new ? last.new_value : "(なし)") << "\n";
+        changed++;
+    }
+    if (changed == 0) {
+        std::cout << "  差分はありません。\n";
+    }
+    std::cout << "================\n\n";
+}
+
+/**
+ * @brief 設定を指定バージョンの状態に戻す（"rollback N" コマンド）
+ *
+ * 戻す操作自体も新しいバージョンとして適用し、ジャーナルに記録する。
+ * @return 設定が変わった場合はtrue
+ */
+bool rollback_config(uint64_t target) {
+    if (!g_journal) {
+        std::cerr << "エラー: ジャーナルが無効です。\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(g_config_mutex);
+    uint64_t current = g_config_version.load();
+    if (target >= current) {
+        std::cout << "設定バージョン " << target << " は現在のバージョン（" << current << "）より前ではありません。\n";
+        return false;
+    }
+    std::vector<JournalRecord> records;
+    if (!g_journal->history_between(target, current, records)) {
+        std::cerr << "エラー: 設定バージョン " << target << " まで遡る履歴は残っていません（最古 "
+                  << g_journal->oldest_version() << "）。\n";
+        return false;
+    }
+
+    // 各キーを、target時点の値（targetより後で最初に変更される直前の値）に戻す
+    std::vector<ConfigUpdate> changes;
+    std::set<std::pair<std::string, std::string>> seen;
+    for (const JournalRecord& record : records) {
+        if (!seen.insert(std::make_pair(record.section, record.key)).second) {
+            continue;
+        }
+        ConfigUpdate update;
+        update.section = record.section;
+        update.key = record.key;
+        update.value = record.old_value;
+        update.remove = !record.had_old;
+        changes.push_back(update);
+    }
+    std::cout << "設定をバージョン " << target << " の状態に戻します...\n";
+    return apply_config_updates_locked(changes, "rollback " + std::to_string(target), true) > 0;
+}
+
 /**
  * @brief 設定統計情報を表示する
  */
@@ -673,9 +8057,194 @@ void print_config_stats() {
     }
     
     std::cout << "総キー数: " << total_keys << "\n";
+    std::cout << "設定バージョン: " << g_config_version.load() << "\n";
+    if (g_shm_publisher) {
+        std::cout << "共有メモリへの公開: " << g_shm_publisher->publish_count() << " 回\n";
+    }
+    if (g_push_scheduler) {
+        uint64_t requests = g_push_scheduler->requests();
+        uint64_t pushes = g_push_scheduler->pushes();
+        std::cout << "WPFへの送信: 要求 " << requests << " 件 → 送信 " << pushes << " 回";
+        if (pushes > 0) {
+            std::cout << "（まとめ率 " << std::fixed << std::setprecision(2)
+                      << static_cast<double>(requests) / pushes << " 件/回）";
+            std::cout.unsetf(std::ios::fixed);
+        }
+        std::cout << " / 頻度制限で待機 " << g_push_scheduler->rate_limited() << " 回 / 変更項目 "
+                  << g_push_scheduler->changed_keys() << " 件\n";
+    }
+    if (g_journal) {
+        std::cout << "ジャーナル: 記録 " << g_journal->appended() << " 件 / fsync " << g_journal->fsyncs()
+                  << " 回 / コンパクション " << g_journal->compactions() << " 回 / 遡れる最古のバージョン "
+                  << g_journal->oldest_version() << "\n";
+    }
+    if (g_worker_pool) {
+        std::cout << "ワーカー: " << g_worker_pool->thread_count() << " スレッド"
+                  << " / 待機中 " << g_worker_pool->queued() << " (上限 " << g_worker_pool->max_queued() << ")"
+                  << " / 処理済み " << g_worker_pool->completed()
+                  << " / 拒否 " << g_worker_pool->rejected()
+                  << " / スチール " << g_worker_pool->stolen() << "\n";
+    }
+    std::cout << "制限による切断: アイドル " << g_eviction_stats.idle.load()
+              << " / フレーム期限 " << g_eviction_stats.frame_deadline.load()
+              << " / 低速 " << g_eviction_stats.slow_rate.load()
+              << " / 同一IP上限 " << g_eviction_stats.per_ip_limit.load() << "\n";
+    std::cout << "フレーム整合性（CRC32C: " << crc32c_implementation() << "）: 検証 "
+              << g_integrity_stats.crc_verified.load() << " / CRC不一致 " << g_integrity_stats.crc_failed.load()
+              << " / 重複 " << g_integrity_stats.duplicates.load() << " / 欠番 " << g_integrity_stats.gaps.load()
+              << "\n";
+    std::cout << "パイプライン接続: " << g_pipeline_stats.sessions.load() << " 本 / 要求 "
+              << g_pipeline_stats.requests.load() << " 件 / 過多で拒否 " << g_pipeline_stats.rejected.load()
+              << " 件 / 購読中 " << g_subscription_hub.size() << " / 変更通知 " << g_pipeline_stats.events.load()
+              << " 件\n";
+    if (!g_replicate_from.empty()) {
+        int64_t last_batch_ms = g_replica_state.last_batch_ms.load();
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "複製元 " << g_replicate_from << ": " << (g_replica_state.connected.load() ? "接続中" : "切断")
+                  << " / 複製済みの設定バージョン " << g_replica_state.version.load() << " / バッチ "
+                  << g_replica_state.batches.load() << " 件（設定全体 " << g_replica_state.snapshots.load()
+                  << "）/ 再接続 " << g_replica_state.reconnects.load() << " / 欠落 " << g_replica_state.gaps.load()
+                  << " / 直近の適用 " << g_replica_state.apply_us.load() / 1000.0 << " ms";
+        if (last_batch_ms > 0) {
+            std::cout << " / 最終受信 " << (now_ms - last_batch_ms) / 1000.0 << " 秒前";
+        }
+        std::cout << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+    int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch())
+                         .count();
+    for (const std::shared_ptr<ReplicaMetrics>& replica : g_replica_registry.list()) {
+        uint64_t acked = replica->acked_version.load();
+        uint64_t current = g_config_version.load();
+        int64_t oldest_ns = replica->oldest_unacked_ns.load();
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "複製先 " << replica->peer << ": 確認済みの設定バージョン " << acked << "（遅れ "
+                  << (current > acked ? current - acked : 0) << "）/ 確認待ち " << replica->unacked_bytes.load()
+                  << " バイト";
+        if (oldest_ns != 0) {
+            std::cout << "（最古 " << (now_ns - oldest_ns) / 1000000.0 << " ms 前）";
+        }
+        std::cout << " / 往復 " << replica->rtt_us.load() / 1000.0 << " ms / 送信 " << replica->batches.load()
+                  << " バッチ（設定全体 " << replica->snapshots.load() << "）/ 上限で待機 "
+                  << replica->window_full.load() << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+    if (g_traffic_recorder) {
+        std::cout << "送受信の記録: " << g_traffic_recorder->path() << " / 接続 " << g_traffic_recorder->connections()
+                  << " 本 / " << g_traffic_recorder->written() << " バイト / 上限で破棄 "
+                  << g_traffic_recorder->dropped() << " 件\n";
+    }
+    g_subsystem_stats.print();
+    if (g_realtime.enabled) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        std::cout << "リアルタイム動作: メモリ固定 " << (g_realtime_state.memory_locked.load() ? "あり" : "なし")
+                  << " / SCHED_FIFO のスレッド " << g_realtime_state.fifo_threads.load()
+                  << " / 起動後のページフォルト " << usage.ru_minflt - g_realtime_state.start_minor_faults
+                  << "（メジャー " << usage.ru_majflt - g_realtime_state.start_major_faults << "）\n";
+    }
+    if (!g_derived_keys.empty()) {
+        std::cout << "派生キー: " << g_derived_keys.size() << " 項目 / 計算 " << g_derived_keys.evaluations()
+                  << " 回 / キャッシュから " << g_derived_keys.hits() << " 回 / 無効化 " << g_derived_keys.invalidations()
+                  << " 回 / 計算できず " << g_derived_keys.failures() << " 回\n";
+    }
+    if (trace_spans::recording()) {
+        trace_spans::Summary trace = trace_spans::summarize();
+        std::cout << "処理区間: スレッド " << trace.threads << " / 記録 " << trace.recorded << " 件（リングの上書き "
+                  << trace.overwritten << " 件）\n";
+    }
+    if (g_presets) {
+        std::cout << "プリセット: " << g_presets->size() << " 個 / 切り替え " << g_preset_stats.switches.load()
+                  << " 回（変わった項目 " << g_preset_stats.changed_keys.load() << "、所要時間 直近 "
+                  << g_preset_stats.last_us.load() << " us / 最大 " << g_preset_stats.max_us.load() << " us）";
+        if (!g_active_preset.empty()) {
+            std::cout << " / 現在 " << g_active_preset << "（設定バージョン " << g_active_preset_version << " で切り替え）";
+        }
+        std::cout << "\n";
+    }
+    const FastPathChannel::Stats& fast_path = g_fast_path.stats();
+    if (fast_path.received.load() > 0 || fast_path.published.load() > 0 || fast_path.beacons.load() > 0) {
+        std::cout << "UDP高速経路: 受信 " << fast_path.received.load() << " 件（適用 " << fast_path.applied.load()
+                  << " 件・" << fast_path.applied_keys.load() << " 項目 / 古い・重複 " << fast_path.stale.load()
+                  << " / 誤り " << fast_path.corrupt.load() << " / 対象外の項目 " << fast_path.not_allowed.load()
+                  << " / base なし " << fast_path.no_base.load()
+                  << " / TCP優先で無視 " << fast_path.overridden.load() << "）/ 状態の送信 変更 " << fast_path.published.load()
+                  << " 件・ビーコン " << fast_path.beacons.load() << " 件（失敗 " << fast_path.send_errors.load() << "）\n";
+    }
+    if (g_cas_stats.requests.load() > 0) {
+        std::cout << "条件付き更新: " << g_cas_stats.requests.load() << " 件 / 衝突で適用しなかった要求 "
+                  << g_cas_stats.rejected.load() << " 件 / 衝突した項目 " << g_cas_stats.conflicted_keys.load() << "\n";
+    }
+    if (g_query_stats.queries.load() > 0) {
+        std::cout << "条件付きの読み出し: " << g_query_stats.queries.load() << " 件 / 返信 "
+                  << g_query_stats.reply_bytes.load() << " バイト（全体を返した場合 " << g_query_stats.full_bytes.load()
+                  << " バイト）\n";
+    }
+    std::string codecs = config_compression::supported_codecs();
+    if (!codecs.empty()) {
+        uint64_t frames = g_compression_stats.compressed_frames.load();
+        uint64_t raw_bytes = g_compression_stats.raw_bytes.load();
+        uint64_t wire_bytes = g_compression_stats.wire_bytes.load();
+        uint64_t decompressed = g_compression_stats.decompressed_frames.load();
+        std::cout << "圧縮（" << codecs << "）: 送信 " << frames << " フレーム " << raw_bytes << " → " << wire_bytes
+                  << " バイト";
+        std::cout << std::fixed << std::setprecision(1);
+        if (raw_bytes > 0) {
+            std::cout << "（" << 100.0 * wire_bytes / raw_bytes << "%、平均 "
+                      << g_compression_stats.compress_ns.load() / 1000.0 / frames << " us）";
+        }
+        std::cout << " / 展開 " << decompressed << " フレーム";
+        if (decompressed > 0) {
+            std::cout << "（平均 " << g_compression_stats.decompress_ns.load() / 1000.0 / decompressed << " us）";
+        }
+        std::cout.unsetf(std::ios::fixed);
+        std::cout << "\n";
+    }
+    std::vector<std::shared_ptr<EventBackend>> shards;
+    {
+        std::lock_guard<std::mutex> shard_lock(g_shard_mutex);
+        shards = g_shard_backends;
+    }
+    uint64_t requests = 0;
+    uint64_t syscalls = 0;
+    for (const std::shared_ptr<EventBackend>& backend : shards) {
+        requests += backend->requests();
+        syscalls += backend->syscalls();
+    }
+    if (!shards.empty()) {
+        std::cout << "受信バックエンド: " << shards.front()->name()
+                  << " / リクエスト " << requests
+                  << " / システムコール " << syscalls;
+        if (requests > 0) {
+            std::cout << " (" << std::fixed << std::setprecision(2)
+                      << static_cast<double>(syscalls) / requests << " 回/リクエスト)";
+            std::cout.unsetf(std::ios::fixed);
+        }
+        std::cout << "\n";
+    }
+    if (shards.size() > 1) {
+        std::cout << "シャード別リクエスト:";
+        for (size_t i = 0; i < shards.size(); i++) {
+            std::cout << (i == 0 ? " " : " / ") << shards[i]->requests();
+        }
+        std::cout << "\n";
+    }
     std::cout << "================\n\n";
 }
 
+/**
+ * @brief コンソールからの再送信要求。スケジューラーに予約し、使えなければその場で送信する
+ */
+void request_config_push() {
+    if (!schedule_config_push(0)) {
+        send_config_to_wpf();
+    }
+}
+
 int main(int argc, char* argv[]) {
     // シグナルハンドラーを設定
     signal(SIGINT, signal_handler);
@@ -692,20 +8261,232 @@ int main(int argc, char* argv[]) {
 
     std::cout << "設定ファイル: " << config_path << "\n\n";
 
-    // 初期設定をファイルから読み込む
-    if (!load_config(config_path)) {
-        return 1;
+    // 起動から最初の送信までの時間を測る
+    std::chrono::steady_clock::time_point startup_begin = std::chrono::steady_clock::now();
+
+    // 変更履歴のジャーナルを開き、前回のスナップショットとジャーナルから設定を復元する
+    g_journal.reset(new ConfigJournal(config_path));
+    ConfigMap recovered_data;
+    uint64_t recovered_version = 0;
+    FileStamp synced_stamp;
+    size_t replayed = 0;
+    bool recovered = g_journal->recover(recovered_data, recovered_version, synced_stamp, replayed);
+    if (recovered) {
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        g_config_data.swap(recovered_data);
+        g_config_version.store(recovered_version);
+        g_key_changes.clear();
+        g_key_change_horizon = recovered_version;
+        publish_config_snapshot_locked();
+        std::cout << "スナップショットとジャーナルから設定を復元しました（設定バージョン " << recovered_version
+                  << "、再生 " << replayed << " 件）\n";
+    }
+    bool journal_started = g_journal->start(recovered, [](ConfigMap& data, uint64_t& version) {
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        data = g_config_data;
+        version = g_config_version.load();
+    });
+    if (!journal_started) {
+        std::cerr << "警告: ジャーナル " << g_journal->journal_path() << " を開けません。変更履歴は記録されません。 "
+                  << strerror(errno) << std::endl;
+        g_journal.reset();
+    }
+
+    // 初期設定をファイルから読み込む（前回の同期からファイルが変わっていなければ不要）。
+    // 更新日時・サイズが違っても内容が同じなら解析せず、記録だけ更新する
+    bool file_changed = !recovered || synced_stamp != stat_file_stamp(config_path);
+    bool stamp_only = false;
+    if (file_changed && recovered && hash_file_stamp(config_path).content_crc == synced_stamp.content_crc) {
+        file_changed = false;
+        stamp_only = true;
+    }
+    if (file_changed) {
+        if (recovered) {
+            std::cout << "設定ファイルが前回の同期以降に変更されています。差分を読み込みます。\n";
+        }
+        if (!load_config(config_path) && !recovered) {
+            return 1;
+        }
+    }
+    if (g_journal) {
+        g_journal->configure(get_config_int("CONFIG_SYNC", "JOURNAL_COMPACT_RECORDS", 10000, 0, 100000000),
+                             get_config_int("CONFIG_SYNC", "JOURNAL_KEEP_VERSIONS", 1000, 0, 100000000));
+        if (file_changed || stamp_only) {
+            std::lock_guard<std::mutex> lock(g_config_mutex);
+            compact_journal_locked(config_path);
+        }
     }
+    std::chrono::steady_clock::time_point config_ready = std::chrono::steady_clock::now();
 
-    // 読み込んだ設定の統計を表示
-    print_config_stats();
+    // 他のキーから計算する派生キー（共有メモリへの最初の公開より前に読み込む）
+    std::string derived_keys_path = get_config_value("CONFIG_SYNC", "DERIVED_KEYS", "");
+    if (!derived_keys_path.empty()) {
+        std::lock_guard<std::mutex> lock(g_config_mutex);
+        std::string error;
+        if (g_derived_keys.load(derived_keys_path, g_config_data, error)) {
+            std::cout << "派生キー: " << derived_keys_path << "（" << g_derived_keys.size() << " 項目）\n";
+        } else {
+            std::cerr << "警告: 派生キー " << derived_keys_path << " を読み込めませんでした（" << error
+                      << "）。派生キーは使いません。\n";
+        }
+    }
+
+    // リアルタイム動作（ワーカー・受信スレッドを作る前にメモリを固定しておく）
+    g_realtime = load_realtime_settings();
+    if (g_realtime.enabled) {
+        enter_realtime_mode(g_realtime);
+    }
+
+    // 同じPi上の他プロセス向けに、設定を共有メモリへ公開する
+    std::string shm_name = get_config_value("CONFIG_SYNC", "SHM_NAME", config_shm::DEFAULT_NAME);
+    if (!shm_name.empty()) {
+        std::unique_ptr<ConfigShmPublisher> publisher(new ConfigShmPublisher());
+        if (publisher->open(shm_name)) {
+            std::lock_guard<std::mutex> lock(g_config_mutex);
+            g_shm_publisher = std::move(publisher);
+            publish_config_snapshot_locked();
+            std::cout << "設定を共有メモリ " << shm_name << " に公開しています。\n";
+        } else {
+            std::cerr << "警告: 共有メモリ " << shm_name << " を作成できませんでした。 " << strerror(errno) << std::endl;
+        }
+    }
+
+    // 接続処理用のワーカープールを作成
+    unsigned int default_workers = std::max(2u, std::thread::hardware_concurrency());
+    long worker_threads = get_config_int("CONFIG_SYNC", "WORKER_THREADS", default_workers, 1, 64);
+    long queue_depth = get_config_int("CONFIG_SYNC", "WORKER_QUEUE_DEPTH", 32, 1, 4096);
+    g_worker_pool.reset(new WorkerPool(worker_threads, queue_depth));
+    std::cout << "ワーカープール: " << worker_threads << " スレッド, キュー上限 " << queue_depth << "\n";
+
+    // 圧縮の設定（使える方式はビルドフラグで決まる）
+    g_compress_min_bytes.store(get_config_int("CONFIG_SYNC", "COMPRESS_MIN_BYTES", 4096, 0, 1L << 30));
+    g_compression_level.store(static_cast<int>(get_config_int("CONFIG_SYNC", "COMPRESSION_LEVEL", 3, 1, 19)));
+
+    // ソケットの調整項目（受信スレッド・送信の開始前に決めておく）
+    g_socket_profile = load_socket_profile();
+    std::cout << "ソケット設定: " << g_socket_profile.name << "（TCP_NODELAY " << g_socket_profile.no_delay
+              << " / TCP_QUICKACK " << g_socket_profile.quick_ack << " / SNDBUF " << g_socket_profile.send_buffer
+              << " / RCVBUF " << g_socket_profile.recv_buffer << " / USER_TIMEOUT "
+              << g_socket_profile.user_timeout_ms << " ms / keepalive " << g_socket_profile.keepalive << " / backlog "
+              << g_socket_profile.listen_backlog << "）\n";
+
+    // WPFへの送信をまとめるスケジューラーを作成
+    long coalesce_ms = get_config_int("CONFIG_SYNC", "PUSH_COALESCE_MS", 50, 0, 60000);
+    long max_push_rate = get_config_int("CONFIG_SYNC", "PUSH_MAX_RATE", 10, 0, 1000);
+    g_push_scheduler.reset(new PushScheduler(std::chrono::milliseconds(coalesce_ms), max_push_rate));
+    g_push_on_change.store(get_config_int("CONFIG_SYNC", "PUSH_ON_CHANGE", 0, 0, 1) != 0);
+    std::cout << "WPFへの送信: まとめる時間 " << coalesce_ms << " ms / 送信先ごとの上限 " << max_push_rate
+              << " 回/秒" << (g_push_on_change.load() ? " / 設定変更時に自動送信" : "") << "\n";
+
+    // 複製: 他のインスタンスは op=replicate でこのインスタンスの変更を受け取れる。
+    // REPLICATE_FROM があればこのインスタンスは複製先（読み取り専用）になる
+    char epoch[17];
+    snprintf(epoch, sizeof(epoch), "%08x%08x", std::random_device()(), std::random_device()());
+    g_replication_epoch = epoch;
+    g_replication_window.store(static_cast<size_t>(
+        get_config_int("CONFIG_SYNC", "REPLICATION_WINDOW_BYTES", 1024 * 1024, 4096, 1L << 30)));
+    g_replicate_from = get_config_value("CONFIG_SYNC", "REPLICATE_FROM", "");
+    std::cout << "複製: エポック " << g_replication_epoch << " / 確認待ちの上限 " << g_replication_window.load()
+              << " バイト" << (g_replicate_from.empty() ? "" : " / 複製元 " + g_replicate_from + "（読み取り専用）")
+              << "\n";
+
+    // 送受信の記録（SyncReplay で再生できる）
+    std::string capture_path = get_config_value("CONFIG_SYNC", "CAPTURE_FILE", "");
+    if (!capture_path.empty()) {
+        std::unique_ptr<TrafficRecorder> recorder(new TrafficRecorder());
+        long capture_max_mb = get_config_int("CONFIG_SYNC", "CAPTURE_MAX_MB", 256, 0, 1L << 20);
+        if (recorder->start(capture_path, static_cast<uint64_t>(capture_max_mb) * 1024 * 1024)) {
+            g_traffic_recorder = std::move(recorder);
+            std::cout << "送受信を " << capture_path << " に記録しています（上限 " << capture_max_mb << " MB）。\n";
+        } else {
+            std::cerr << "警告: 通信の記録 " << capture_path << " を作成できませんでした。 " << strerror(errno)
+                      << std::endl;
+        }
+    }
+
+    // 設定キーとサブシステムの対応（変更ごとに、設定し直す必要のあるサブシステムだけを知らせる）
+    std::string subsystem_map_path = get_config_value("CONFIG_SYNC", "SUBSYSTEM_MAP", "");
+    if (!subsystem_map_path.empty()) {
+        std::unique_ptr<SubsystemMap> subsystem_map(new SubsystemMap());
+        std::string error;
+        if (subsystem_map->load(subsystem_map_path, error)) {
+            std::cout << "サブシステムの対応: " << subsystem_map_path << "（" << subsystem_map->subsystem_count()
+                      << " サブシステム / " << subsystem_map->rule_count() << " 行）\n";
+            g_subsystem_map = std::move(subsystem_map);
+        } else {
+            std::cerr << "警告: サブシステムの対応 " << subsystem_map_path << " を読み込めませんでした（" << error
+                      << "）。影響するサブシステムは通知しません。\n";
+        }
+    }
+
+    // 名前付きの設定プリセット（"preset <名前>" コマンド・op=preset で切り替える）
+    std::string presets_path = get_config_value("CONFIG_SYNC", "PRESETS_FILE", "");
+    if (!presets_path.empty()) {
+        std::unique_ptr<PresetLibrary> presets(new PresetLibrary());
+        std::string error;
+        bool loaded;
+        {
+            std::lock_guard<std::mutex> lock(g_config_mutex);
+            loaded = presets->load(presets_path, g_config_data, error);
+        }
+        if (loaded) {
+            std::cout << "プリセット: " << presets_path << "（" << presets->describe() << "）\n";
+            g_presets = std::move(presets);
+        } else {
+            std::cerr << "警告: プリセット " << presets_path << " を読み込めませんでした（" << error
+                      << "）。プリセットは使えません。\n";
+        }
+    }
+
+    // UDPの高速経路（対象の調整用の項目だけをデータグラムで受け付け、現在値を配る）
+    FastPathSettings fast_path_settings = load_fast_path_settings();
+    if (!fast_path_settings.keys.empty()) {
+        std::string error;
+        if (g_fast_path.start(fast_path_settings, !g_replicate_from.empty(), error)) {
+            std::cout << "UDP高速経路: " << g_fast_path.describe() << "\n";
+        } else {
+            std::cerr << "警告: UDP高速経路を開始できませんでした（" << error << "）。対象の項目もTCPだけで受け付けます。\n";
+        }
+    }
+
+    // 処理区間の記録（"trace" コマンドで Chrome トレース形式に書き出す）
+    long trace_events = get_config_int("CONFIG_SYNC", "TRACE_RING_EVENTS", 8192, 0, 1L << 22);
+    std::string trace_path = get_config_value("CONFIG_SYNC", "TRACE_FILE", "config_sync_trace.json");
+    trace_spans::name_thread("main");
+    trace_spans::set_ring_capacity(static_cast<size_t>(trace_events));
+    std::cout << "処理区間の記録: "
+              << (trace_events > 0 ? "スレッドごとに直近 " + std::to_string(trace_events) + " 件" : std::string("なし"))
+              << " / USDT プローブ " << (trace_spans::have_usdt() ? "あり" : "なし（sys/sdt.h なしでビルド）") << "\n";
 
     // WPFからの設定更新を待ち受けるスレッドを開始
-    std::thread receiver_thread(receive_config_updates);
+    std::promise<bool> receiver_ready;
+    std::future<bool> receiver_started = receiver_ready.get_future();
+    std::thread receiver_thread(receive_config_updates, &receiver_ready);
 
-    // 少し待ってから、最初の設定をWPFに送信
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    // 受信スレッドのイベントループが動き出してから、最初の設定をWPFに送信する
+    // （待ち受けに失敗した場合は一時的なループで送信する）
+    receiver_started.get();
+    std::chrono::steady_clock::time_point receiver_ready_at = std::chrono::steady_clock::now();
+    if (!g_replicate_from.empty()) {
+        start_replica_follower(g_replicate_from);
+    }
+    if (g_realtime.enabled) {
+        mark_realtime_baseline();
+    }
     send_config_to_wpf();
+    std::chrono::steady_clock::time_point first_push_done = std::chrono::steady_clock::now();
+
+    typedef std::chrono::duration<double, std::milli> Millis;
+    std::cout << std::fixed << std::setprecision(1)
+              << "起動から最初の送信完了まで " << Millis(first_push_done - startup_begin).count() << " ms（設定の準備 "
+              << Millis(config_ready - startup_begin).count() << " ms"
+              << (file_changed ? "、テキスト解析" : "、スナップショット使用") << " / 受信スレッドの準備 "
+              << Millis(receiver_ready_at - config_ready).count() << " ms / 送信 "
+              << Millis(first_push_done - receiver_ready_at).count() << " ms）\n";
+    std::cout.unsetf(std::ios::fixed);
+
+    // 読み込んだ設定の統計を表示
+    print_config_stats();
 
     std::cout << "\nメインの処理を実行中...\n";
     std::cout << "コマンド:\n";
@@ -714,6 +8495,10 @@ int main(int argc, char* argv[]) {
     std::cout << "  t: 設定統計を表示\n";
     std::cout << "  w: 現在の設定を " << config_path << " に上書き保存\n";
     std::cout << "  r: 設定ファイルを再読み込み\n";
+    std::cout << "  rollback N: 設定をバージョンNの状態に戻す\n";
+    std::cout << "  diff N..M: バージョンNからMまでの変更を表示（Mを省略すると現在まで）\n";
+    std::cout << "  trace [ファイル]: 処理区間を Chrome トレース形式で書き出す（省略すると " << trace_path << "）\n";
+    std::cout << "  preset [名前]: 設定をプリセットに切り替える（省略すると一覧を表示）\n";
     std::cout << "  q: 終了\n\n";
 
     // メインスレッドでは、他の処理を実行できる
@@ -734,19 +8519,71 @@ int main(int argc, char* argv[]) {
             print_config_stats();
         } else if (line == "w") {
             save_config(config_path);
+        } else if ((line == "r" || line.compare(0, 9, "rollback ") == 0 || line.compare(0, 7, "preset ") == 0) &&
+                   !g_replicate_from.empty()) {
+            std::cout << "複製先（読み取り専用）のため設定は変更できません。複製元 " << g_replicate_from
+                      << " で変更してください。\n";
         } else if (line == "r") {
             std::cout << "設定ファイルを再読み込みしています...\n";
             if (load_config(config_path)) {
+                {
+                    std::lock_guard<std::mutex> lock(g_config_mutex);
+                    compact_journal_locked(config_path);
+                }
                 std::cout << "設定ファイルの再読み込みが完了しました。\n";
                 print_config_stats();
                 // 再読み込み後、WPFに更新された設定を送信
-                send_config_to_wpf();
+                request_config_push();
             } else {
                 std::cout << "設定ファイルの再読み込みに失敗しました。\n";
             }
+        } else if (line.compare(0, 9, "rollback ") == 0) {
+            uint64_t target;
+            try {
+                target = std::stoull(line.substr(9));
+            } catch (const std::exception& e) {
+                std::cout << "使い方: rollback <設定バージョン>\n";
+                continue;
+            }
+            if (rollback_config(target)) {
+                request_config_push();
+            }
+        } else if (line.compare(0, 5, "diff ") == 0) {
+            std::string range = line.substr(5);
+            std::string::size_type dots = range.find("..");
+            try {
+                uint64_t from = std::stoull(range.substr(0, dots));
+                uint64_t to = g_config_version.load();
+                if (dots != std::string::npos && dots + 2 < range.size()) {
+                    to = std::stoull(range.substr(dots + 2));
+                }
+                print_config_diff(from, to);
+            } catch (const std::exception& e) {
+                std::cout << "使い方: diff <バージョンN>..<バージョンM>\n";
+            }
+        } else if (line == "preset") {
+            if (g_presets) {
+                std::cout << "プリセット: " << g_presets->describe() << "\n";
+            } else {
+                std::cout << "プリセットはありません（PRESETS_FILE）。\n";
+            }
+        } else if (line.compare(0, 7, "preset ") == 0) {
+            if (switch_to_preset(line.substr(7), "console") > 0) {
+                request_config_push();
+            }
+        } else if (line == "trace" || line.compare(0, 6, "trace ") == 0) {
+            std::string path = line.size() > 6 ? line.substr(6) : trace_path;
+            std::string error;
+            long written = trace_spans::write_chrome_trace(path, error);
+            if (written < 0) {
+                std::cerr << "エラー: 処理区間を " << path << " に書き出せませんでした（" << error << "）。\n";
+            } else {
+                std::cout << "処理区間 " << written << " 件を " << path
+                          << " に書き出しました（chrome://tracing または Perfetto で開けます）。\n";
+            }
         } else {
             std::cout << "現在の設定をWPFに再送信します。\n";
-            send_config_to_wpf();
+            request_config_push();
         }
     }
 
@@ -759,6 +8596,23 @@ int main(int argc, char* argv[]) {
         receiver_thread.join();
     }
 
+    g_fast_path.stop();
+
+    if (g_traffic_recorder) {
+        g_traffic_recorder->stop();
+        std::cout << "送受信の記録を " << g_traffic_recorder->path() << " に保存しました（接続 "
+                  << g_traffic_recorder->connections() << " 本、" << g_traffic_recorder->written() << " バイト）。\n";
+    }
+
+    // 受け付け済みの接続を処理し終えてからワーカーを止める
+    std::cout << "ワーカースレッドの終了を待機中...\n";
+    g_worker_pool->stop();
+
+    // 残りの変更履歴を書き込む
+    if (g_journal) {
+        g_journal->stop();
+    }
+
     std::cout << "プログラムを終了します。\n";
     return 0;
 }
\ No newline at end of file
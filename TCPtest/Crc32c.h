@@ -0,0 +1,154 @@
+// Crc32c.h - CRC32C（Castagnoli）の計算（ヘッダーのみ）
+//
+// 目的:
+// ジャーナル・スナップショットの検証と、TCPフレームの整合性チェック（crcオプション）に使う。
+// ConfigSynchronizerと測定ツール（SyncBench）で同じ実装を共有する。
+//
+// 仕組み:
+// - x86: SSE4.2 の crc32 命令（8バイトずつ）
+// - AArch64: ARMv8 の crc32c 命令（8バイトずつ）
+// - どちらも使えないCPUではテーブル方式
+// 使える命令は最初の呼び出し時に実行中のCPUで判定する（ビルドオプションは不要）。
+//
+// 使い方:
+//   uint32_t crc = crc32c(data, length);
+//   // 分割して計算する場合は前回の値を渡す
+//   crc = crc32c(more, more_length, crc);
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#if defined(__clang__)
+#define CRC32C_ARM_TARGET __attribute__((target("crc")))
+#else
+#define CRC32C_ARM_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+namespace crc32c_detail {
+
+typedef uint32_t (*Function)(const void* data, size_t length, uint32_t crc);
+
+/**
+ * @brief テーブル方式（どのCPUでも動く）
+ */
+inline uint32_t compute_table(const void* data, size_t length, uint32_t crc) {
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) {
+                value = (value & 1) ? (value >> 1) ^ 0x82F63B78u : value >> 1;
+            }
+            table[i] = value;
+        }
+        return true;
+    }();
+    (void)initialized;
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief SSE4.2 の crc32 命令を使う版
+ */
+__attribute__((target("sse4.2"))) inline uint32_t compute_sse42(const void* data, size_t length, uint32_t crc) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t value = ~crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        value = __builtin_ia32_crc32di(value, word);
+        bytes += 8;
+        length -= 8;
+    }
+    uint32_t value32 = static_cast<uint32_t>(value);
+    while (length > 0) {
+        value32 = __builtin_ia32_crc32qi(value32, *bytes);
+        bytes++;
+        length--;
+    }
+    return ~value32;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+/**
+ * @brief ARMv8 の crc32c 命令を使う版
+ */
+CRC32C_ARM_TARGET inline uint32_t compute_armv8(const void* data, size_t length, uint32_t crc) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint32_t value = ~crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        value = __crc32cd(value, word);
+        bytes += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        value = __crc32cb(value, *bytes);
+        bytes++;
+        length--;
+    }
+    return ~value;
+}
+#endif
+
+struct Implementation {
+    Function function;
+    const char* name;
+};
+
+/**
+ * @brief 実行中のCPUで使える最速の実装を選ぶ（最初の1回だけ判定する）
+ */
+inline const Implementation& select() {
+    static const Implementation selected = [] {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("sse4.2")) {
+            return Implementation{compute_sse42, "sse4.2"};
+        }
+#endif
+#if defined(__aarch64__) && defined(__linux__)
+        if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+            return Implementation{compute_armv8, "armv8"};
+        }
+#endif
+        return Implementation{compute_table, "table"};
+    }();
+    return selected;
+}
+
+} // namespace crc32c_detail
+
+/**
+ * @brief CRC32C（Castagnoli）を計算する
+ * @param crc 前回までの値（連続したデータを分けて計算する場合）
+ */
+inline uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0) {
+    return crc32c_detail::select().function(data, length, crc);
+}
+
+/**
+ * @brief 使用中の実装名（"sse4.2" / "armv8" / "table"）
+ */
+inline const char* crc32c_implementation() {
+    return crc32c_detail::select().name;
+}
+
+#endif // CRC32C_H
@@ -0,0 +1,460 @@
+// FastPath.h - 調整用の項目を UDP（ユニキャスト / マルチキャスト）で送受信するデータグラム（ヘッダーのみ）
+//
+// 目的:
+// スラスター制御のゲインやジョイスティックのデッドゾーンのように、調整中に何度も変える少数の項目を、
+// 1回ごとのTCP接続・フレーム・切断なしに ConfigSynchronizer へ送り、複数の受け手へ一度に配る。
+//
+// 仕組み:
+// - データグラムは "CSFP1 sid=<送り手> seq=<番号> crc=<CRC32C>[ version=<版>][ base=<版>][ beacon]" の
+//   ヘッダー行と、"[SECTION]KEY=VALUE" の行（TCPの更新フレームの本体と同じ形式）からなる。
+// - 値は差分ではなく最新の値なので、同じデータグラムが重複して届いても結果は変わらない。
+//   送り手（sid）ごとに、受け取った seq 以下のものは捨てる（入れ替わって届いた古い値で戻さない）。
+//   送り手は起動のたびに違う sid を使う。
+// - ConfigSynchronizer が送る「状態」（version= 付き）は、対象の項目すべての現在値を持つ。
+//   変更のたびと一定間隔のビーコン（beacon）で送るので、途中が失われても次の状態で追いつける。
+// - TCP が正式な経路: 受け手は version= 付きの状態だけを使い、他の送り手の変更要求は使わない。
+//   変更要求には base=（送り手が最後に見た状態の版）が必要で、ConfigSynchronizer は base= より後に
+//   UDP 以外で変わった項目を UDP の値で上書きしない（base= のない変更要求は捨てる）。
+//
+// 使い方（受け手）:
+//   #include "FastPath.h"
+//   FastPathListener listener;
+//   if (listener.open(12350, "239.255.43.21")) {
+//       while (running) {
+//           if (listener.receive(100)) {      // 新しい状態を受け取ったらtrue
+//               std::string value;
+//               listener.get("THRUSTER_CONTROL", "KP_YAW", value);
+//           }
+//       }
+//   }
+// 使い方（送り手）:
+//   fast_path::Datagram datagram;
+//   datagram.sid = "wpf-1a2b";               // 起動ごとに変える
+//   datagram.seq = ++seq;
+//   datagram.has_base = true;
+//   datagram.base = listener.version();       // 最後に受け取った状態の版（まだなければ 0）
+//   datagram.values.push_back(fast_path::Value{"THRUSTER_CONTROL", "KP_YAW", "0.18"});
+//   std::string bytes = fast_path::encode(datagram);
+//   sendto(sock, bytes.data(), bytes.size(), 0, ...); // ConfigSynchronizer の FAST_PATH_PORT へ
+//
+// コンパイル方法（受け手側）:
+// g++ -std=c++11 your_program.cpp
+
+#ifndef FAST_PATH_H
+#define FAST_PATH_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "Crc32c.h"
+
+namespace fast_path {
+
+const char* const MAGIC = "CSFP1";
+
+// 1つのデータグラムの上限（IPv4 の UDP）と、分割されずに届く目安（イーサネット）
+const size_t MAX_DATAGRAM = 65507;
+const size_t UNFRAGMENTED_DATAGRAM = 1472;
+
+/**
+ * @brief 項目1つの値
+ */
+struct Value {
+    std::string section;
+    std::string key;
+    std::string value;
+};
+
+/**
+ * @brief データグラム1つ
+ */
+struct Datagram {
+    std::string sid;
+    uint64_t seq = 0;
+    bool has_version = false; // ConfigSynchronizer が送る状態
+    uint64_t version = 0;
+    bool has_base = false;    // 送り手が最後に見た状態の版
+    uint64_t base = 0;
+    bool beacon = false;      // 一定間隔で送る状態（変更によるものではない）
+    std::vector<Value> values;
+};
+
+inline std::string encode(const Datagram& datagram) {
+    std::string body;
+    for (const Value& value : datagram.values) {
+        body += "[" + value.section + "]" + value.key + "=" + value.value + "\n";
+    }
+    char crc[16];
+    snprintf(crc, sizeof(crc), "%08x", crc32c(body.data(), body.size()));
+    std::string header = std::string(MAGIC) + " sid=" + datagram.sid + " seq=" + std::to_string(datagram.seq) +
+                         " crc=" + crc;
+    if (datagram.has_version) {
+        header += " version=" + std::to_string(datagram.version);
+    }
+    if (datagram.has_base) {
+        header += " base=" + std::to_string(datagram.base);
+    }
+    if (datagram.beacon) {
+        header += " beacon";
+    }
+    return header + "\n" + body;
+}
+
+inline bool parse_number(const std::string& text, uint64_t& number) {
+    if (text.empty() || text.size() > 20) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (*end != '\0' || errno != 0 || text[0] == '-') {
+        return false;
+    }
+    number = value;
+    return true;
+}
+
+/**
+ * @brief データグラムを読む（CRC も確かめる）
+ * @return 形式が正しければtrue（違えば error に理由）
+ */
+inline bool decode(const char* data, size_t size, Datagram& datagram, std::string& error) {
+    const char* newline = static_cast<const char*>(memchr(data, '\n', size));
+    if (newline == nullptr) {
+        error = "ヘッダーがありません";
+        return false;
+    }
+    std::string header(data, static_cast<size_t>(newline - data));
+    const char* body = newline + 1;
+    size_t body_size = size - static_cast<size_t>(body - data);
+
+    datagram = Datagram();
+    bool has_crc = false;
+    uint32_t crc = 0;
+    size_t position = 0;
+    bool first = true;
+    while (position <= header.size()) {
+        size_t space = header.find(' ', position);
+        if (space == std::string::npos) {
+            space = header.size();
+        }
+        std::string token = header.substr(position, space - position);
+        position = space + 1;
+        if (first) {
+            if (token != MAGIC) {
+                error = "形式が違います";
+                return false;
+            }
+            first = false;
+            continue;
+        }
+        if (token.empty()) {
+            continue;
+        }
+        size_t equals = token.find('=');
+        std::string name = token.substr(0, equals);
+        std::string value = equals == std::string::npos ? std::string() : token.substr(equals + 1);
+        bool valid = false;
+        if (name == "sid") {
+            datagram.sid = value;
+            valid = !value.empty();
+        } else if (name == "seq") {
+            valid = parse_number(value, datagram.seq);
+        } else if (name == "version") {
+            valid = datagram.has_version = parse_number(value, datagram.version);
+        } else if (name == "base") {
+            valid = datagram.has_base = parse_number(value, datagram.base);
+        } else if (name == "beacon") {
+            valid = datagram.beacon = equals == std::string::npos;
+        } else if (name == "crc" && value.size() == 8) {
+            char* end = nullptr;
+            crc = static_cast<uint32_t>(strtoul(value.c_str(), &end, 16));
+            valid = has_crc = *end == '\0';
+        }
+        if (!valid) {
+            error = "不正なヘッダー項目: " + token;
+            return false;
+        }
+    }
+    if (datagram.sid.empty() || datagram.seq == 0 || !has_crc) {
+        error = "sid / seq / crc がありません";
+        return false;
+    }
+    if (crc32c(body, body_size) != crc) {
+        error = "CRCが一致しません";
+        return false;
+    }
+    size_t line_start = 0;
+    while (line_start < body_size) {
+        const char* line = body + line_start;
+        const char* end = static_cast<const char*>(memchr(line, '\n', body_size - line_start));
+        size_t length = end == nullptr ? body_size - line_start : static_cast<size_t>(end - line);
+        line_start += length + 1;
+        if (length == 0) {
+            continue;
+        }
+        std::string text(line, length);
+        size_t close = text.find(']');
+        size_t equals = close == std::string::npos ? std::string::npos : text.find('=', close);
+        if (text[0] != '[' || close == std::string::npos || close == 1 || equals == std::string::npos ||
+            equals == close + 1) {
+            error = "不正な行: " + text;
+            return false;
+        }
+        datagram.values.push_back(
+            Value{text.substr(1, close - 1), text.substr(close + 1, equals - close - 1), text.substr(equals + 1)});
+    }
+    return true;
+}
+
+/**
+ * @brief 送り手ごとの seq を覚え、古いもの・重複を見分ける
+ *
+ * sid はデータグラムから来るため、覚える送り手は MAX_SENDERS までとし、
+ * 超えたら最も長く使われていない送り手を忘れる（TCP の SequenceTracker と同じ上限）。
+ */
+class SequenceFilter {
+public:
+    static const size_t MAX_SENDERS = 1024;
+
+    /**
+     * @return 送り手から初めて、またはこれまでより新しい seq ならtrue（覚える）
+     */
+    bool accept(const std::string& sid, uint64_t seq) {
+        std::map<std::string, Entry>::iterator it = senders_.find(sid);
+        if (it != senders_.end() && seq <= it->second.last) {
+            return false;
+        }
+        Entry& entry = it != senders_.end() ? it->second : senders_[sid];
+        entry.last = seq;
+        entry.touched = ++clock_;
+        if (senders_.size() > MAX_SENDERS) {
+            std::map<std::string, Entry>::iterator oldest = senders_.begin();
+            for (std::map<std::string, Entry>::iterator candidate = senders_.begin(); candidate != senders_.end();
+                 ++candidate) {
+                if (candidate->second.touched < oldest->second.touched) {
+                    oldest = candidate;
+                }
+            }
+            senders_.erase(oldest);
+        }
+        return true;
+    }
+
+private:
+    struct Entry {
+        uint64_t last = 0;
+        uint64_t touched = 0;
+    };
+
+    std::map<std::string, Entry> senders_;
+    uint64_t clock_ = 0;
+};
+
+/**
+ * @brief 受信用のUDPソケットを開く（group が空でなければそのマルチキャストグループに参加する）
+ *
+ * 同じホストの複数の受け手が同じポートで受け取れるよう SO_REUSEADDR を付ける。
+ * @param interface_address マルチキャストに使うインターフェースのアドレス（空ならOSが選ぶ）
+ * @return ソケット、失敗時は-1
+ */
+inline int open_receiver(int port, const std::string& group, const std::string& interface_address) {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    if (!group.empty()) {
+        ip_mreq request;
+        memset(&request, 0, sizeof(request));
+        request.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (inet_pton(AF_INET, group.c_str(), &request.imr_multiaddr) <= 0 ||
+            (!interface_address.empty() && inet_pton(AF_INET, interface_address.c_str(), &request.imr_interface) <= 0) ||
+            setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0) {
+            int saved = errno;
+            close(sock);
+            errno = saved;
+            return -1;
+        }
+    }
+    return sock;
+}
+
+/**
+ * @brief 送信用のUDPソケットを開く（マルチキャストは TTL 1、同じホストの受け手にも届くようループバックあり）
+ * @return ソケット、失敗時は-1
+ */
+inline int open_sender(const std::string& interface_address) {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    unsigned char ttl = 1;
+    unsigned char loop = 1;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (!interface_address.empty()) {
+        in_addr address;
+        if (inet_pton(AF_INET, interface_address.c_str(), &address) <= 0 ||
+            setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &address, sizeof(address)) < 0) {
+            close(sock);
+            return -1;
+        }
+    }
+    return sock;
+}
+
+/**
+ * @brief "host:port" を読む
+ */
+inline bool parse_address(const std::string& text, sockaddr_in& addr) {
+    size_t colon = text.rfind(':');
+    uint64_t port = 0;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (colon == std::string::npos || !parse_number(text.substr(colon + 1), port) || port == 0 || port > 65535 ||
+        inet_pton(AF_INET, text.substr(0, colon).c_str(), &addr.sin_addr) <= 0) {
+        return false;
+    }
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    return true;
+}
+
+} // namespace fast_path
+
+/**
+ * @brief ConfigSynchronizer が送る状態を受け取り、対象の項目の最新値を持つ受け手
+ *
+ * 1つのスレッドから使う。複数のプロセスが同じグループ・ポートで同時に受け取れる。
+ */
+class FastPathListener {
+public:
+    // 受信の集計
+    struct Stats {
+        uint64_t received = 0;
+        uint64_t accepted = 0; // 値を取り込んだ状態
+        uint64_t stale = 0;    // 古い・重複した seq
+        uint64_t corrupt = 0;  // 形式・CRC の誤り
+        uint64_t ignored = 0;  // 状態でないもの（他の送り手の変更要求）
+    };
+
+    FastPathListener() : sock_(-1), version_(0) {}
+    ~FastPathListener() { close(); }
+    FastPathListener(const FastPathListener&) = delete;
+    FastPathListener& operator=(const FastPathListener&) = delete;
+
+    bool open(int port, const std::string& group = "", const std::string& interface_address = "") {
+        close();
+        sock_ = fast_path::open_receiver(port, group, interface_address);
+        return sock_ >= 0;
+    }
+
+    void close() {
+        if (sock_ >= 0) {
+            ::close(sock_);
+            sock_ = -1;
+        }
+    }
+
+    /**
+     * @brief 届いているデータグラムを読む（何も届いていなければ timeout_ms まで待つ）
+     * @return 新しい状態を取り込んだらtrue
+     */
+    bool receive(int timeout_ms) {
+        if (sock_ < 0) {
+            return false;
+        }
+        pollfd pfd{sock_, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return false;
+        }
+        bool updated = false;
+        char buffer[fast_path::MAX_DATAGRAM];
+        while (true) {
+            ssize_t n = recv(sock_, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                break;
+            }
+            updated = handle(buffer, static_cast<size_t>(n)) || updated;
+        }
+        return updated;
+    }
+
+    /**
+     * @brief 受け取ったバイト列を1つのデータグラムとして取り込む（受信を自分で行う場合）
+     * @return 新しい状態を取り込んだらtrue
+     */
+    bool handle(const char* data, size_t size) {
+        stats_.received++;
+        fast_path::Datagram datagram;
+        std::string error;
+        if (!fast_path::decode(data, size, datagram, error)) {
+            stats_.corrupt++;
+            return false;
+        }
+        if (!datagram.has_version) {
+            stats_.ignored++;
+            return false;
+        }
+        if (!filter_.accept(datagram.sid, datagram.seq)) {
+            stats_.stale++;
+            return false;
+        }
+        stats_.accepted++;
+        version_ = datagram.version;
+        for (fast_path::Value& value : datagram.values) {
+            values_[std::make_pair(value.section, value.key)] = std::move(value.value);
+        }
+        return true;
+    }
+
+    bool get(const std::string& section, const std::string& key, std::string& value) const {
+        std::map<std::pair<std::string, std::string>, std::string>::const_iterator it =
+            values_.find(std::make_pair(section, key));
+        if (it == values_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    // 最後に取り込んだ状態の設定バージョン
+    uint64_t version() const { return version_; }
+    const Stats& stats() const { return stats_; }
+    int fd() const { return sock_; }
+
+private:
+    int sock_;
+    uint64_t version_;
+    fast_path::SequenceFilter filter_;
+    std::map<std::pair<std::string, std::string>, std::string> values_;
+    Stats stats_;
+};
+
+#endif // FAST_PATH_H
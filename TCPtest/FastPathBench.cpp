@@ -0,0 +1,270 @@
+// FastPathBench.cpp - UDP高速経路とTCPの更新が、複数の受け手に届くまでの時間を比べる測定ツール
+//
+// 目的:
+// 調整用の項目（THRUSTER_CONTROL KP_YAW）を、UDP高速経路のデータグラムと、従来のTCPの更新（接続・フレーム・切断）
+// でそれぞれ変え、ConfigSynchronizer が配る状態（FAST_PATH_PUBLISH）で受け手全員に新しい値が届くまでの時間を測る。
+// 損失率を指定すると、送信と受け手の受信の両方でその割合のデータグラムを捨て、失われた場合の追いつき
+// （送り手の再送・ビーコン）にかかる時間も測れる。
+//
+// 使い方:
+// ./FastPathBench [host] [TCPポート] [UDPポート] [状態の受信 group:port] [回数] [受け手の数] [損失率(%)] [インターフェース]
+//   例（ループバックのマルチキャスト）:
+//   ./FastPathBench 127.0.0.1 12348 12349 239.255.43.21:12350 1000 3 0 127.0.0.1
+//
+// 測定の規則:
+// - 受け手はそれぞれ FastPathListener で同じグループ・ポートを受信する（別々のソケット）。
+// - UDP: 新しい値を1つのデータグラムで送り、RESEND_MS 待っても受け手全員に届かなければ、
+//   同じ値を新しい seq で送り直す（値は最新値なので、何度届いても結果は同じ）。
+// - TCP: 1回の更新を1本の接続で送り、ConfigSynchronizer が閉じるまで待つ。
+// - どちらも、送り始めてから受け手全員の状態に新しい値が見えるまでを1回とする（TIMEOUT で諦める）。
+//
+// コンパイル方法:
+// g++ -std=c++11 -O2 FastPathBench.cpp -o FastPathBench -lpthread
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+
+#include "FastPath.h"
+
+typedef std::chrono::steady_clock Clock;
+
+const char BENCH_SECTION[] = "THRUSTER_CONTROL";
+const char BENCH_KEY[] = "KP_YAW";
+const std::chrono::milliseconds RESEND_MS(50);
+const std::chrono::seconds TIMEOUT(5);
+
+/**
+ * @brief 受け手全員の状態に目的の値が見えたかを待ち合わせる
+ */
+class Arrivals {
+public:
+    explicit Arrivals(size_t listeners) : seen_(listeners, false), remaining_(0), version_(0) {}
+
+    void expect(const std::string& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        target_ = value;
+        std::fill(seen_.begin(), seen_.end(), false);
+        remaining_.store(seen_.size());
+    }
+
+    void report(size_t listener, const std::string& value, uint64_t version) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (version > version_.load()) {
+            version_.store(version);
+        }
+        if (value == target_ && !seen_[listener]) {
+            seen_[listener] = true;
+            remaining_--;
+        }
+    }
+
+    bool all_seen() const { return remaining_.load() == 0; }
+
+    // 受け手が受け取った状態の最新の版（変更要求の base= に使う）
+    uint64_t version() const { return version_.load(); }
+
+private:
+    std::mutex mutex_;
+    std::string target_;
+    std::vector<bool> seen_;
+    std::atomic<size_t> remaining_;
+    std::atomic<uint64_t> version_;
+};
+
+/**
+ * @brief 1回の更新（接続・送信・相手が閉じるまで）
+ */
+bool tcp_update(const sockaddr_in& addr, const std::string& body) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return false;
+    }
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    std::string frame = std::to_string(body.size()) + "\n" + body;
+    bool ok = connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+              send(sock, frame.data(), frame.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(frame.size());
+    char buffer[256];
+    while (ok) {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+    }
+    close(sock);
+    return ok;
+}
+
+void print_latencies(const char* label, std::vector<double>& latencies_us, size_t timeouts, uint64_t sends) {
+    std::cout << std::fixed << std::setprecision(1) << label << ": ";
+    if (latencies_us.empty()) {
+        std::cout << "届いた更新がありません（タイムアウト " << timeouts << "）\n";
+        return;
+    }
+    std::sort(latencies_us.begin(), latencies_us.end());
+    auto percentile = [&](double p) { return latencies_us[static_cast<size_t>(p * (latencies_us.size() - 1))]; };
+    std::cout << "p50 " << percentile(0.50) << " us / p90 " << percentile(0.90) << " us / p99 " << percentile(0.99)
+              << " us / 最大 " << latencies_us.back() << " us（" << latencies_us.size() << " 回、タイムアウト "
+              << timeouts << "、送信 " << sends << " 回）\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    int tcp_port = argc > 2 ? std::atoi(argv[2]) : 12348;
+    int udp_port = argc > 3 ? std::atoi(argv[3]) : 12349;
+    std::string state_address = argc > 4 ? argv[4] : "239.255.43.21:12350";
+    int count = argc > 5 ? std::atoi(argv[5]) : 1000;
+    int listener_count = argc > 6 ? std::atoi(argv[6]) : 3;
+    double loss = argc > 7 ? std::atof(argv[7]) / 100.0 : 0.0;
+    std::string interface_address = argc > 8 ? argv[8] : "";
+
+    sockaddr_in tcp_addr;
+    sockaddr_in udp_addr;
+    sockaddr_in state_addr;
+    if (!fast_path::parse_address(host + ":" + std::to_string(tcp_port), tcp_addr) ||
+        !fast_path::parse_address(host + ":" + std::to_string(udp_port), udp_addr) ||
+        !fast_path::parse_address(state_address, state_addr) || count <= 0 || listener_count <= 0 || loss < 0 ||
+        loss >= 1) {
+        std::cerr << "使い方: " << argv[0]
+                  << " [host] [TCPポート] [UDPポート] [状態の受信 group:port] [回数] [受け手の数] [損失率(%)] [インターフェース]\n";
+        return 1;
+    }
+    bool multicast = IN_MULTICAST(ntohl(state_addr.sin_addr.s_addr));
+    std::string group = multicast ? state_address.substr(0, state_address.rfind(':')) : std::string();
+
+    // 受け手（それぞれのスレッドで受信し、損失率の分だけ捨てる）
+    std::vector<std::unique_ptr<FastPathListener>> listeners;
+    for (int i = 0; i < listener_count; i++) {
+        listeners.emplace_back(new FastPathListener());
+        if (!listeners.back()->open(ntohs(state_addr.sin_port), group, interface_address)) {
+            std::cerr << "エラー: " << state_address << " を受信できません。 " << strerror(errno) << "\n";
+            return 1;
+        }
+    }
+    Arrivals arrivals(listeners.size());
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> dropped(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < listeners.size(); i++) {
+        threads.emplace_back([&, i] {
+            FastPathListener& listener = *listeners[i];
+            std::mt19937 random(static_cast<unsigned>(i + 1));
+            std::uniform_real_distribution<double> chance(0.0, 1.0);
+            char buffer[fast_path::MAX_DATAGRAM];
+            while (!stop.load()) {
+                pollfd pfd{listener.fd(), POLLIN, 0};
+                if (poll(&pfd, 1, 20) <= 0) {
+                    continue;
+                }
+                ssize_t n = recv(listener.fd(), buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (n <= 0) {
+                    continue;
+                }
+                if (loss > 0 && chance(random) < loss) {
+                    dropped++;
+                    continue;
+                }
+                std::string value;
+                if (listener.handle(buffer, static_cast<size_t>(n)) && listener.get(BENCH_SECTION, BENCH_KEY, value)) {
+                    arrivals.report(i, value, listener.version());
+                }
+            }
+        });
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    char sid[24];
+    snprintf(sid, sizeof(sid), "bench%08x", std::random_device()());
+    uint64_t seq = 0;
+    std::mt19937 random(12345);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    // mode 1: UDP / mode 2: TCP（値は "モード.回数" にして、前の値と重ならないようにする）
+    for (int mode = 1; mode <= 2; mode++) {
+        std::vector<double> latencies_us;
+        size_t timeouts = 0;
+        uint64_t sends = 0;
+        for (int i = 0; i < count; i++) {
+            char value[32];
+            snprintf(value, sizeof(value), "%d.%06d", mode, i);
+            arrivals.expect(value);
+            Clock::time_point begin = Clock::now();
+            Clock::time_point deadline = begin + TIMEOUT;
+            bool seen = false;
+            while (!seen && Clock::now() < deadline) {
+                sends++;
+                if (mode == 1) {
+                    fast_path::Datagram datagram;
+                    datagram.sid = sid;
+                    datagram.seq = ++seq;
+                    datagram.has_base = true;
+                    datagram.base = arrivals.version();
+                    datagram.values.push_back(fast_path::Value{BENCH_SECTION, BENCH_KEY, value});
+                    std::string bytes = fast_path::encode(datagram);
+                    if (loss == 0 || chance(random) >= loss) {
+                        sendto(sock, bytes.data(), bytes.size(), 0, (const struct sockaddr*)&udp_addr, sizeof(udp_addr));
+                    }
+                } else if (!tcp_update(tcp_addr, std::string("[") + BENCH_SECTION + "]" + BENCH_KEY + "=" + value + "\n")) {
+                    std::this_thread::sleep_for(RESEND_MS);
+                    continue;
+                }
+                // 受け手全員に届くか、送り直す時刻まで待つ
+                Clock::time_point resend = Clock::now() + RESEND_MS;
+                while (!(seen = arrivals.all_seen()) && Clock::now() < std::min(resend, deadline)) {
+                    std::this_thread::yield();
+                }
+                if (mode == 2 && !seen) {
+                    // TCP は適用済みなので送り直さず、ビーコンで届くのを待つ
+                    while (!(seen = arrivals.all_seen()) && Clock::now() < deadline) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            if (seen) {
+                latencies_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+            } else {
+                timeouts++;
+            }
+        }
+        print_latencies(mode == 1 ? "UDP高速経路" : "TCPの更新 ", latencies_us, timeouts, sends);
+    }
+    stop.store(true);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    close(sock);
+
+    uint64_t accepted = 0;
+    uint64_t stale = 0;
+    uint64_t corrupt = 0;
+    for (const std::unique_ptr<FastPathListener>& listener : listeners) {
+        accepted += listener->stats().accepted;
+        stale += listener->stats().stale;
+        corrupt += listener->stats().corrupt;
+    }
+    std::cout << "受け手 " << listeners.size() << " 個: 取り込んだ状態 " << accepted << " / 古い・重複 " << stale
+              << " / 誤り " << corrupt << " / 損失として捨てた " << dropped.load() << "\n";
+    return 0;
+}
@@ -0,0 +1,220 @@
+// ShmBench.cpp - 共有メモリ設定リーダーの測定ツール
+//
+// 目的:
+// 1. ConfigShmReader による1回の読み出しにかかる時間を測る（ハンドルあり／なし）
+// 2. ConfigSynchronizerへTCPで更新を送ってから、別プロセス（このツール）の
+//    共有メモリ上に値が見えるまでの時間を測る
+// 3. プリセット名を2つ指定した場合は、交互に切り替え（op=preset）を送り、
+//    切り替えが共有メモリで見えるまでの時間と、設定バージョンが1つずつ進むか（途中の状態がないか）を調べる
+//
+// 使い方:
+// ./ShmBench [host] [port] [読み出し回数] [更新回数] [共有メモリ名] [プリセットA プリセットB]
+// （ConfigSynchronizerを起動した状態で実行する）
+//
+// コンパイル方法:
+// g++ -std=c++11 -O2 ShmBench.cpp -o ShmBench -lrt
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <thread>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+
+#include "ConfigShm.h"
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t now_ns() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief 測定結果を並べ替えて代表値を表示する
+ */
+void print_percentiles(const char* label, std::vector<double>& samples, const char* unit) {
+    if (samples.empty()) {
+        std::cout << label << ": 測定値なし\n";
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) { return samples[static_cast<size_t>(p * (samples.size() - 1))]; };
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << label << "(" << unit << "): p50 " << percentile(0.50) << " / p90 " << percentile(0.90)
+              << " / p99 " << percentile(0.99) << " / p99.9 " << percentile(0.999) << " / 最大 " << samples.back()
+              << "\n";
+}
+
+/**
+ * @brief 設定更新フレームを1つ送り、サーバーが接続を閉じるまで待つ
+ */
+bool send_update(const sockaddr_in& addr, const std::string& body) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return false;
+    }
+    if (connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return false;
+    }
+    std::string frame = std::to_string(body.size()) + "\n" + body;
+    bool ok = send(sock, frame.data(), frame.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(frame.size());
+    char buffer[64];
+    while (ok && recv(sock, buffer, sizeof(buffer), 0) > 0) {
+    }
+    close(sock);
+    return ok;
+}
+
+/**
+ * @brief パイプライン接続で1行の返信ヘッダーを読む（本体のない返信だけを想定する）
+ */
+bool read_reply_line(int sock, std::string& line) {
+    line.clear();
+    char c;
+    while (recv(sock, &c, 1, 0) == 1) {
+        if (c == '\n') {
+            return true;
+        }
+        line += c;
+    }
+    return false;
+}
+
+/**
+ * @brief 2つのプリセットを交互に切り替え、共有メモリで見えるまでの時間を測る
+ */
+void measure_preset_switch(const sockaddr_in& addr, ConfigShmReader& reader, int switches, const std::string& first,
+                           const std::string& second) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "エラー: 接続できません。\n";
+        if (sock >= 0) {
+            close(sock);
+        }
+        return;
+    }
+    std::vector<double> switch_us;
+    int torn = 0; // 1回の切り替えで設定バージョンが2つ以上進んだ回数
+    for (int i = 0; i < switches; i++) {
+        const std::string& name = i % 2 == 0 ? first : second;
+        std::string request = "0 id=p" + std::to_string(i) + " op=preset name=" + name + "\n";
+        uint64_t before = reader.version();
+        uint64_t sent_at = now_ns();
+        if (send(sock, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+            break;
+        }
+        Clock::time_point give_up = Clock::now() + std::chrono::seconds(2);
+        while (reader.version() == before && Clock::now() < give_up) {
+            std::this_thread::yield();
+        }
+        uint64_t seen_at = now_ns();
+        uint64_t after = reader.version();
+        std::string reply;
+        if (!read_reply_line(sock, reply) || reply.find("status=ok") == std::string::npos) {
+            std::cerr << "エラー: プリセット " << name << " に切り替えられませんでした: " << reply << "\n";
+            break;
+        }
+        if (after == before) {
+            std::cerr << "警告: 切り替えが共有メモリに反映されませんでした（" << reply << "）。\n";
+            continue;
+        }
+        if (after != before + 1) {
+            torn++;
+        }
+        switch_us.push_back((seen_at - sent_at) / 1000.0);
+    }
+    close(sock);
+    print_percentiles("プリセット切り替え→共有メモリで観測", switch_us, "us");
+    std::cout << "1回の切り替えで設定バージョンが2つ以上進んだ回数: " << torn << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? std::atoi(argv[2]) : 12348;
+    long reads = argc > 3 ? std::atol(argv[3]) : 1000000;
+    int updates = argc > 4 ? std::atoi(argv[4]) : 200;
+    std::string shm_name = argc > 5 ? argv[5] : config_shm::DEFAULT_NAME;
+
+    ConfigShmReader reader;
+    if (!reader.open(shm_name.c_str())) {
+        std::cerr << "エラー: 共有メモリ " << shm_name << " を開けません。ConfigSynchronizerを起動してください。\n";
+        return 1;
+    }
+    std::cout << "共有メモリ " << shm_name << " (設定バージョン " << reader.version() << ")\n";
+
+    // 1. 読み出し時間（ハンドルあり／なし）。時計の呼び出しを薄めるため1000回ずつまとめて測る
+    const int BATCH = 1000;
+    ConfigShmReader::Handle handle = reader.lookup("CONFIG_SYNC", "CPP_RECV_PORT");
+    int64_t value = 0;
+    if (!reader.get_int(handle, value)) {
+        std::cerr << "エラー: [CONFIG_SYNC]CPP_RECV_PORT が共有メモリにありません。\n";
+        return 1;
+    }
+    std::vector<double> cached_ns;
+    std::vector<double> lookup_ns;
+    for (long i = 0; i < reads / BATCH; i++) {
+        Clock::time_point begin = Clock::now();
+        for (int j = 0; j < BATCH; j++) {
+            reader.get_int(handle, value);
+        }
+        Clock::time_point middle = Clock::now();
+        for (int j = 0; j < BATCH; j++) {
+            reader.get_int("CONFIG_SYNC", "CPP_RECV_PORT", value);
+        }
+        Clock::time_point end = Clock::now();
+        cached_ns.push_back(std::chrono::duration<double, std::nano>(middle - begin).count() / BATCH);
+        lookup_ns.push_back(std::chrono::duration<double, std::nano>(end - middle).count() / BATCH);
+    }
+    print_percentiles("読み出し（ハンドル）", cached_ns, "ns/回");
+    print_percentiles("読み出し（キー検索）", lookup_ns, "ns/回");
+
+    // 2. 更新が別プロセスから見えるまでの時間
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+        std::cerr << "エラー: 不正なIPアドレス: " << host << std::endl;
+        return 1;
+    }
+
+    std::vector<double> end_to_end_us;
+    std::vector<double> publish_to_read_us;
+    ConfigShmReader::Handle stamp = reader.lookup("SHM_BENCH", "STAMP");
+    for (int i = 0; i < updates; i++) {
+        uint64_t sent_at = now_ns();
+        std::thread sender([&addr, sent_at] { send_update(addr, "[SHM_BENCH]STAMP=" + std::to_string(sent_at) + "\n"); });
+
+        // 値が見えるまで読み続ける（1コアでも送信側が進めるよう合間に譲る）
+        int64_t seen = 0;
+        Clock::time_point give_up = Clock::now() + std::chrono::seconds(2);
+        while ((!reader.get_int(stamp, seen) || static_cast<uint64_t>(seen) != sent_at) && Clock::now() < give_up) {
+            std::this_thread::yield();
+        }
+        uint64_t seen_at = now_ns();
+        sender.join();
+        if (static_cast<uint64_t>(seen) != sent_at) {
+            std::cerr << "警告: 更新が共有メモリに反映されませんでした。\n";
+            continue;
+        }
+        end_to_end_us.push_back((seen_at - sent_at) / 1000.0);
+        publish_to_read_us.push_back((seen_at - reader.publish_time_ns()) / 1000.0);
+    }
+    print_percentiles("TCP更新→共有メモリで観測", end_to_end_us, "us");
+    print_percentiles("公開→別プロセスで観測", publish_to_read_us, "us");
+
+    // 3. プリセットの切り替えが見えるまでの時間
+    if (argc > 7) {
+        measure_preset_switch(addr, reader, updates, argv[6], argv[7]);
+    }
+    return 0;
+}
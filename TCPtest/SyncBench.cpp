@@ -0,0 +1,566 @@
+// SyncBench.cpp - ConfigSynchronizer 負荷測定ツール
+//
+// 目的:
+// ConfigSynchronizerの受信ポートに対して設定要求（0バイト）または設定更新を
+// 繰り返し送り、リクエストごとの往復レイテンシとスループットを表示する。
+//
+// 使い方:
+// ./SyncBench [host] [port] [リクエスト数] [並列数] [get|update|probe] [更新サイズ(バイト)] [オプション,...]
+// probe … host:port（複製元）に [BENCH_PROBE]T<スレッド>=<番号> を書き込み、follower= の複製先で
+//          同じ値が読めるようになるまでの時間（複製の遅れ）を測る
+// オプション（カンマ区切り）:
+//   crc      … CRC32Cトレーラーとシーケンス番号付きのフレームを送る
+//              （付けた場合と付けない場合を比べて整合性チェックのオーバーヘッドを測る）
+//   zstd/lz4 … get では返信をその方式で受け取り（accept=）、update では本体を圧縮して送る。
+//              圧縮率・圧縮/展開のCPU時間と、回線速度ごとの同期時間の見積もりを表示する
+//   split    … ヘッダーと本体を別々の send() で送る（Nagleと遅延ACKの影響を受けやすい送り方）
+//   nodelay  … クライアント側のソケットにも TCP_NODELAY を設定する
+//   pipeline[=W] … 並列数ぶんの接続をそれぞれ使い続け、id 付きの要求を W 件（既定16）ずつ
+//              まとめて送ってから返信を受信する（パイプライン接続。1接続1要求との比較用）
+//   section=<名前> / key=<名前> / match=<パターン> / since=<版>
+//            … get に読み出し条件を付ける（設定全体ではなく該当する項目だけを受け取る）
+//   follower=<host:port> … probe で値を読む複製先
+//
+// コンパイル方法:
+// g++ -std=c++11 -O2 SyncBench.cpp -o SyncBench -lpthread
+// （圧縮を使う場合は -DCONFIG_SYNC_WITH_ZSTD -lzstd / -DCONFIG_SYNC_WITH_LZ4 -llz4。make WITH_ZSTD=1 WITH_LZ4=1 bench）
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+
+#include "Crc32c.h"
+#include "ConfigCompression.h"
+
+/**
+ * @brief 接続する
+ * @return ソケット、失敗時は-1
+ */
+int connect_to(const sockaddr_in& addr, bool no_delay) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (no_delay) {
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    }
+    if (connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief 1リクエスト分（接続・送信・応答受信・切断）を実行する
+ * @param addr 接続先アドレス
+ * @param frame 送信するフレーム（ヘッダー込み）
+ * @param response 受信したデータ（使い回すバッファ）
+ * @param split trueならヘッダー（最初の改行まで）と残りを別々の send() で送る
+ * @param no_delay trueならクライアント側のソケットに TCP_NODELAY を設定する
+ * @return 成功時true
+ */
+bool run_request(const sockaddr_in& addr, const std::string& frame, std::string& response, bool split = false,
+                 bool no_delay = false) {
+    int sock = connect_to(addr, no_delay);
+    if (sock < 0) {
+        return false;
+    }
+
+    size_t header_end = split ? frame.find('\n') : std::string::npos;
+    size_t first_part = header_end == std::string::npos ? frame.size() : header_end + 1;
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        size_t limit = sent < first_part ? first_part : frame.size();
+        ssize_t n = send(sock, frame.data() + sent, limit - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(sock);
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    // サーバーが接続を閉じるまで（更新の適用完了、または設定の返信完了）を1リクエストとする
+    char buffer[16 * 1024];
+    response.clear();
+    while (true) {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        response.append(buffer, static_cast<size_t>(n));
+    }
+    close(sock);
+    return true;
+}
+
+/**
+ * @brief パイプライン接続に要求をまとめて送り、同じ件数の返信を受信する
+ * @param frames id 付きのフレーム
+ * @param pending 受信済みで使っていないデータ（次の呼び出しに持ち越す）
+ * @param latencies_us 返信ごとの、まとめて送り始めてからのレイテンシ（受信順に追加する）
+ * @param wire_bytes 返信本体の受信バイト数（加算する）
+ * @param raw_bytes 返信本体の展開後のバイト数（加算する）
+ * @return 受信できた status=ok 以外の返信の数、接続が切れた場合は-1
+ */
+int run_pipelined_batch(int sock, const std::vector<std::string>& frames, std::string& pending,
+                        std::vector<double>& latencies_us, uint64_t& wire_bytes, uint64_t& raw_bytes) {
+    std::string batch;
+    for (const std::string& frame : frames) {
+        batch += frame;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (sent < batch.size()) {
+        ssize_t n = send(sock, batch.data() + sent, batch.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    int rejected = 0;
+    char buffer[16 * 1024];
+    for (size_t replies = 0; replies < frames.size();) {
+        // 返信1つ分（ヘッダー・本体・CRCトレーラー）が揃っていれば取り出す
+        size_t newline = pending.find('\n');
+        if (newline != std::string::npos) {
+            std::istringstream header(pending.substr(0, newline));
+            size_t length = 0;
+            size_t raw_length = 0;
+            bool ok = false;
+            bool with_crc = false;
+            std::string token;
+            header >> length;
+            raw_length = length;
+            while (header >> token) {
+                if (token == "status=ok") {
+                    ok = true;
+                } else if (token == "crc") {
+                    with_crc = true;
+                } else if (token.compare(0, 4, "raw=") == 0) {
+                    raw_length = static_cast<size_t>(std::stoull(token.substr(4)));
+                }
+            }
+            size_t frame_size = newline + 1 + length + (with_crc ? 9 : 0);
+            if (pending.size() >= frame_size) {
+                pending.erase(0, frame_size);
+                latencies_us.push_back(
+                    std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+                wire_bytes += length;
+                raw_bytes += raw_length;
+                rejected += ok ? 0 : 1;
+                replies++;
+                continue;
+            }
+        }
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        pending.append(buffer, static_cast<size_t>(n));
+    }
+    return rejected;
+}
+
+/**
+ * @brief 更新フレームを作る（指定サイズ程度になるまで [BENCH]KEY_n=値 を並べる）
+ */
+std::string make_update_body(size_t size, unsigned seed) {
+    std::string body;
+    for (unsigned i = 0; body.size() < size; i++) {
+        body += "[BENCH]KEY_" + std::to_string(i) + "=" + std::to_string(seed + i) + "\n";
+    }
+    return body;
+}
+
+/**
+ * @brief フレームを作る
+ * @param options ヘッダーに付けるオプション（先頭は空白）
+ * @param with_crc trueならcrcオプションとシーケンス番号を付け、本体の後にCRCトレーラーを付ける
+ */
+std::string make_frame(const std::string& body, std::string options, bool with_crc, const std::string& session,
+                       uint64_t seq) {
+    if (!with_crc) {
+        return std::to_string(body.size()) + options + "\n" + body;
+    }
+    char trailer[16];
+    snprintf(trailer, sizeof(trailer), "%08x\n", crc32c(body.data(), body.size()));
+    return std::to_string(body.size()) + options + " crc sid=" + session + " seq=" + std::to_string(seq) + "\n" +
+           body + trailer;
+}
+
+/**
+ * @brief 設定要求への返信を検査し、圧縮されていれば展開する
+ * @param body 展開後の本体
+ * @param wire_bytes 本体の送信バイト数（圧縮後）
+ * @return 形式が正しく、展開できた場合true
+ */
+bool decode_reply(const std::string& response, std::string& body, size_t& wire_bytes) {
+    size_t newline = response.find('\n');
+    if (newline == std::string::npos) {
+        return false;
+    }
+    std::istringstream header(response.substr(0, newline));
+    size_t length = 0;
+    size_t raw_length = 0;
+    config_compression::Codec codec = config_compression::NONE;
+    std::string token;
+    header >> length;
+    while (header >> token) {
+        if (token.compare(0, 4, "enc=") == 0 && !config_compression::parse_codec(token.substr(4), codec)) {
+            return false;
+        }
+        if (token.compare(0, 4, "raw=") == 0) {
+            raw_length = static_cast<size_t>(std::stoull(token.substr(4)));
+        }
+    }
+    if (response.size() < newline + 1 + length) {
+        return false;
+    }
+    wire_bytes = length;
+    if (codec == config_compression::NONE) {
+        body.assign(response, newline + 1, length);
+        return true;
+    }
+    return config_compression::decompress(codec, response.data() + newline + 1, length, raw_length, body);
+}
+
+/**
+ * @brief 圧縮率とCPU時間を測り、回線速度ごとの1回の同期時間（送信＋圧縮＋展開）を見積もって表示する
+ */
+void report_compression(config_compression::Codec codec, const std::string& sample) {
+    const int rounds = 200;
+    std::string compressed;
+    std::string restored;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        config_compression::compress(codec, sample.data(), sample.size(), compressed);
+    }
+    double compress_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / rounds;
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        config_compression::decompress(codec, compressed.data(), compressed.size(), sample.size(), restored);
+    }
+    double decompress_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / rounds;
+    if (restored != sample) {
+        std::cerr << "エラー: 展開結果が元のデータと一致しません\n";
+        return;
+    }
+
+    std::cout << std::fixed << std::setprecision(1) << "圧縮(" << config_compression::codec_name(codec) << "): "
+              << sample.size() << " → " << compressed.size() << " バイト（" << 100.0 * compressed.size() / sample.size()
+              << "%）/ 圧縮 " << compress_us << " us / 展開 " << decompress_us << " us\n";
+    for (double mbps : {1.0, 10.0, 100.0}) {
+        double raw_ms = static_cast<double>(sample.size()) * 8 / (mbps * 1e6) * 1e3;
+        double compressed_ms =
+            static_cast<double>(compressed.size()) * 8 / (mbps * 1e6) * 1e3 + (compress_us + decompress_us) / 1e3;
+        std::cout << "  " << std::setw(5) << mbps << " Mbps: 非圧縮 " << std::setprecision(3) << raw_ms
+                  << " ms / 圧縮 " << compressed_ms << " ms" << std::setprecision(1) << "\n";
+    }
+}
+
+/**
+ * @brief CRC32Cの計算速度を測り、1フレームあたりの計算時間を表示する
+ */
+void report_crc_cost(size_t frame_size) {
+    std::vector<char> data(1024 * 1024, 'x');
+    const int rounds = 256;
+    uint32_t crc = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        crc = crc32c(data.data(), data.size(), crc);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double bytes_per_second = static_cast<double>(data.size()) * rounds / seconds;
+    // 100Mbpsのテザーで1フレームを送るのにかかる時間と比べる
+    double wire_ns = static_cast<double>(frame_size) * 8 / 100e6 * 1e9;
+    std::cout << std::fixed << std::setprecision(2) << "CRC32C(" << crc32c_implementation() << "): "
+              << bytes_per_second / 1e9 << " GB/s / 1フレーム(" << frame_size << "B)あたり "
+              << frame_size / bytes_per_second * 1e9 << " ns（100Mbpsでの送信時間 " << wire_ns << " ns）\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? std::atoi(argv[2]) : 12348;
+    int total = argc > 3 ? std::atoi(argv[3]) : 1000;
+    int concurrency = argc > 4 ? std::atoi(argv[4]) : 1;
+    std::string mode = argc > 5 ? argv[5] : "get";
+    size_t update_size = argc > 6 ? static_cast<size_t>(std::atol(argv[6])) : 64;
+    bool with_crc = false;
+    bool split = false;
+    bool no_delay = false;
+    int pipeline = 0; // パイプライン接続で1度に送る要求数（0なら1接続1要求）
+    std::string query; // get に付ける読み出し条件（先頭は空白）
+    std::string follower; // probe で値を読む複製先（host:port）
+    config_compression::Codec codec = config_compression::NONE;
+    bool options_ok = true;
+    if (argc > 7) {
+        std::istringstream options(argv[7]);
+        std::string option;
+        while (std::getline(options, option, ',')) {
+            config_compression::Codec parsed;
+            if (option == "crc") {
+                with_crc = true;
+            } else if (option == "split") {
+                split = true;
+            } else if (option == "nodelay") {
+                no_delay = true;
+            } else if (option.compare(0, 8, "section=") == 0 || option.compare(0, 4, "key=") == 0 ||
+                       option.compare(0, 6, "match=") == 0 || option.compare(0, 6, "since=") == 0) {
+                query += " " + option;
+            } else if (option.compare(0, 9, "follower=") == 0) {
+                follower = option.substr(9);
+            } else if (option == "pipeline") {
+                pipeline = 16;
+            } else if (option.compare(0, 9, "pipeline=") == 0) {
+                pipeline = std::atoi(option.c_str() + 9);
+                options_ok = options_ok && pipeline > 0;
+            } else if (config_compression::parse_codec(option, parsed) && parsed != config_compression::NONE) {
+                if (!config_compression::is_supported(parsed)) {
+                    std::cerr << "エラー: " << option << " を使うには WITH_" << (parsed == config_compression::ZSTD ? "ZSTD" : "LZ4")
+                              << "=1 でビルドしてください\n";
+                    return 1;
+                }
+                codec = parsed;
+            } else {
+                options_ok = false;
+            }
+        }
+    }
+
+    if (total <= 0 || concurrency <= 0 || (mode != "get" && mode != "update" && mode != "probe") ||
+        (mode == "probe") != !follower.empty() || !options_ok) {
+        std::cerr << "使い方: " << argv[0]
+                  << " [host] [port] [リクエスト数] [並列数] [get|update|probe] [更新サイズ] [crc,zstd,lz4,split,nodelay,pipeline[=W],section=,key=,match=,since=,follower=host:port]\n";
+        return 1;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+        std::cerr << "エラー: 不正なIPアドレス: " << host << std::endl;
+        return 1;
+    }
+    sockaddr_in follower_addr;
+    memset(&follower_addr, 0, sizeof(follower_addr));
+    if (!follower.empty()) {
+        size_t colon = follower.rfind(':');
+        follower_addr.sin_family = AF_INET;
+        follower_addr.sin_port = htons(colon == std::string::npos ? 0 : std::atoi(follower.c_str() + colon + 1));
+        if (colon == std::string::npos ||
+            inet_pton(AF_INET, follower.substr(0, colon).c_str(), &follower_addr.sin_addr) <= 0) {
+            std::cerr << "エラー: 不正な複製先: " << follower << std::endl;
+            return 1;
+        }
+    }
+
+    std::atomic<int> next{0};
+    std::atomic<int> failures{0};
+    std::mutex latencies_mutex;
+    std::vector<double> latencies_us;
+    latencies_us.reserve(total);
+    std::atomic<uint64_t> wire_total{0};
+    std::atomic<uint64_t> raw_total{0};
+    std::string sample; // 圧縮測定に使う本体（最初に受信・送信したもの）
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < concurrency; t++) {
+        threads.push_back(std::thread([&, t] {
+            std::vector<double> local;
+            std::string session = "bench-" + std::to_string(getpid()) + "-" + std::to_string(t);
+            uint64_t seq = 0;
+            int index;
+            std::string response;
+            std::string reply_body;
+            std::string compressed;
+            uint64_t local_wire = 0;
+            uint64_t local_raw = 0;
+            if (mode == "probe") {
+                // 複製元に書き込み、複製先の設定要求で同じ値が返るまで読み続ける（5秒で諦める）
+                std::string key = "T" + std::to_string(t);
+                std::string probe_get = make_frame("", " section=BENCH_PROBE key=" + key, false, session, 0);
+                while ((index = next.fetch_add(1)) < total) {
+                    std::string expected = "[BENCH_PROBE]" + key + "=" + std::to_string(index) + "\n";
+                    auto begin = std::chrono::steady_clock::now();
+                    if (!run_request(addr, make_frame(expected, "", false, session, 0), response)) {
+                        failures++;
+                        continue;
+                    }
+                    bool seen = false;
+                    while (!seen && std::chrono::steady_clock::now() - begin < std::chrono::seconds(5)) {
+                        size_t wire_bytes = 0;
+                        seen = run_request(follower_addr, probe_get, response) &&
+                               decode_reply(response, reply_body, wire_bytes) && reply_body == expected;
+                    }
+                    if (!seen) {
+                        failures++;
+                        continue;
+                    }
+                    local.push_back(
+                        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+                }
+                std::lock_guard<std::mutex> lock(latencies_mutex);
+                latencies_us.insert(latencies_us.end(), local.begin(), local.end());
+                return;
+            }
+            if (pipeline > 0) {
+                // 接続を使い続け、id 付きの要求を pipeline 件ずつまとめて送る
+                int sock = connect_to(addr, no_delay);
+                std::string pending;
+                std::vector<std::string> frames;
+                while (sock >= 0 && (index = next.fetch_add(1)) < total) {
+                    frames.clear();
+                    do {
+                        std::string id = " id=r" + std::to_string(index);
+                        if (mode == "get") {
+                            frames.push_back(make_frame("", id + query + (codec != config_compression::NONE
+                                                                      ? std::string(" accept=") +
+                                                                            config_compression::codec_name(codec)
+                                                                      : std::string()),
+                                                        false, session, 0));
+                        } else {
+                            std::string body = make_update_body(update_size, index);
+                            frames.push_back(make_frame(body, id, with_crc, session, ++seq));
+                            local_wire += body.size();
+                            local_raw += body.size();
+                        }
+                    } while (static_cast<int>(frames.size()) < pipeline && (index = next.fetch_add(1)) < total);
+                    uint64_t reply_wire = 0;
+                    uint64_t reply_raw = 0;
+                    int rejected = run_pipelined_batch(sock, frames, pending, local, reply_wire, reply_raw);
+                    if (rejected < 0) {
+                        failures += static_cast<int>(frames.size());
+                        close(sock);
+                        sock = connect_to(addr, no_delay);
+                        pending.clear();
+                        continue;
+                    }
+                    failures += rejected;
+                    if (mode == "get") {
+                        local_wire += reply_wire;
+                        local_raw += reply_raw;
+                    }
+                }
+                if (sock >= 0) {
+                    close(sock);
+                }
+                wire_total += local_wire;
+                raw_total += local_raw;
+                std::lock_guard<std::mutex> lock(latencies_mutex);
+                latencies_us.insert(latencies_us.end(), local.begin(), local.end());
+                return;
+            }
+            while ((index = next.fetch_add(1)) < total) {
+                std::string body = mode == "update" ? make_update_body(update_size, index) : "";
+                std::string frame;
+                auto begin = std::chrono::steady_clock::now();
+                if (mode == "get") {
+                    std::string options = query + (codec != config_compression::NONE
+                                                       ? std::string(" accept=") + config_compression::codec_name(codec)
+                                                       : std::string());
+                    frame = make_frame(body, options, false, session, 0);
+                } else if (codec != config_compression::NONE) {
+                    // 送信側の圧縮時間もレイテンシに含める
+                    config_compression::compress(codec, body.data(), body.size(), compressed);
+                    char dict[16];
+                    snprintf(dict, sizeof(dict), "%08x", config_compression::dictionary_id());
+                    frame = make_frame(compressed, std::string(" enc=") + config_compression::codec_name(codec) +
+                                                       " raw=" + std::to_string(body.size()) + " dict=" + dict,
+                                       with_crc, session, ++seq);
+                    local_wire += compressed.size();
+                    local_raw += body.size();
+                } else {
+                    frame = make_frame(body, "", with_crc, session, ++seq);
+                    local_wire += body.size();
+                    local_raw += body.size();
+                }
+                if (!run_request(addr, frame, response, split, no_delay)) {
+                    failures++;
+                    continue;
+                }
+                if (mode == "get") {
+                    size_t wire_bytes = 0;
+                    if (!decode_reply(response, reply_body, wire_bytes)) {
+                        failures++;
+                        continue;
+                    }
+                    local_wire += wire_bytes;
+                    local_raw += reply_body.size();
+                }
+                auto end = std::chrono::steady_clock::now();
+                local.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+                if (local.size() == 1 && t == 0) {
+                    std::lock_guard<std::mutex> lock(latencies_mutex);
+                    sample = mode == "get" ? reply_body : body;
+                }
+            }
+            wire_total += local_wire;
+            raw_total += local_raw;
+            std::lock_guard<std::mutex> lock(latencies_mutex);
+            latencies_us.insert(latencies_us.end(), local.begin(), local.end());
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    if (latencies_us.empty()) {
+        std::cerr << "エラー: 成功したリクエストがありません（失敗 " << failures.load() << " 件）\n";
+        return 1;
+    }
+    std::sort(latencies_us.begin(), latencies_us.end());
+    auto percentile = [&](double p) {
+        size_t index = static_cast<size_t>(p * (latencies_us.size() - 1));
+        return latencies_us[index];
+    };
+
+    if (with_crc) {
+        report_crc_cost(mode == "update" ? update_size : 0);
+    }
+    if (codec != config_compression::NONE && !sample.empty()) {
+        report_compression(codec, sample);
+    }
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "モード: " << mode << (with_crc ? "+crc" : "")
+              << (codec != config_compression::NONE ? std::string("+") + config_compression::codec_name(codec) : "")
+              << (split ? "+split" : "") << (no_delay ? "+nodelay" : "")
+              << (pipeline > 0 ? "+pipeline=" + std::to_string(pipeline) : "") << query
+              << (follower.empty() ? "" : " follower=" + follower)
+              << " / リクエスト " << latencies_us.size() << " 件 (失敗 " << failures.load() << ") / 並列 "
+              << concurrency << "\n";
+    if (raw_total.load() > 0) {
+        std::cout << "本体: " << raw_total.load() << " バイト → 送信 " << wire_total.load() << " バイト（"
+                  << 100.0 * wire_total.load() / raw_total.load() << "%）\n";
+    }
+    std::cout << "スループット: " << latencies_us.size() / elapsed << " req/s\n";
+    std::cout << "レイテンシ(us): p50 " << percentile(0.50) << " / p90 " << percentile(0.90)
+              << " / p99 " << percentile(0.99) << " / 最大 " << latencies_us.back() << "\n";
+    return failures.load() > 0 ? 2 : 0;
+}
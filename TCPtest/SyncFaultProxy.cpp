@@ -0,0 +1,907 @@
+// SyncFaultProxy.cpp - 回線の障害を入れながら中継する ConfigSynchronizer 用のローカルTCPプロキシ
+//
+// 目的:
+// テザーやWi-Fiの回線が悪いときに、接続・送信・受信の各タイムアウトと、再送・重複検出が
+// どう効くかを手元で再現し、設定が一致するまでの時間と障害からの復旧時間を測る。
+//
+// 使い方:
+// ./SyncFaultProxy proxy <待ち受けポート> <host> <port> [障害,...]
+//   待ち受けポートへの接続を host:port に中継しながら障害を入れる（Ctrl+C で終了）。
+//   WPF → ConfigSynchronizer の向きは WPF の送信先を、ConfigSynchronizer → WPF の向きは
+//   config.ini の WPF_HOST / WPF_RECV_PORT をこのプロキシに向ける。
+// ./SyncFaultProxy suite [host] [port] [回数] [クライアントのタイムアウト(ms)]
+//   障害の種類ごとにプロキシを内部で立て、模擬クライアントから [FAULT_SUITE] への更新を
+//   回数ぶん送って、一致までの時間と復旧時間を表にする。
+//   （設定を書き換えるので、試験用に起動したインスタンスに対して使うこと）
+//
+// 障害（カンマ区切り、どれも省略可）:
+//   delay=<ms>      … 片方向の遅延（両方向に入る）
+//   jitter=<ms>     … 遅延に加える 0〜ms のばらつき（バイトの順序は変えない）
+//   rate=<バイト/s> … 片方向あたりの帯域の上限
+//   chunk=<バイト>  … 1回の書き込みの上限（1 でバイト単位に分けて送る）
+//   gap=<ms>        … 分けた書き込みどうしの間隔
+//   partial=<ms>    … 受け取ったひとかたまりを途中で切り、残りを ms 後に送る（部分書き込み）
+//   stall=<ms>      … 上り（クライアント → 中継先）が after= バイトに達したら、両方向の転送を ms 止める
+//   after=<バイト>  … stall を始める上りのバイト数（既定 0）
+//   reset=<バイト>  … 上りがこのバイト数に達したら、両側の接続を RST で切る
+//   reset=reply     … 中継先から返信（または切断）が来たら、クライアント側だけを RST で切る
+//                     （適用は済んだのに確認が届かない場合）
+//   every=<N>       … stall / reset を N 本に1本の接続（1本目から）だけに入れる（既定 1）
+//
+// 模擬クライアントの規則（suite）:
+// - 1回の更新は1本の接続で、CRCトレーラーとシーケンス番号（sid= / seq=）付きのフレームを送り、
+//   ConfigSynchronizer が切断する（適用済み）か "DUP"（再送したものが適用済み）を待つ。
+// - 接続・返信がタイムアウトした、途中で切られた、BUSY / CRCERR が返った、切断されたのに
+//   値が見えない（受信途中で打ち切られた）場合は、同じシーケンス番号で送り直す。
+// - 一致 … プロキシを通さずに設定を読み、書いた値がすべて見えた時点
+//   一致までの時間 … 最初の送信から一致まで
+//   復旧時間 … その回で最初に障害（stall の開始 / reset）が入ってから一致まで
+//
+// コンパイル方法:
+// g++ -std=c++11 -O2 SyncFaultProxy.cpp -o SyncFaultProxy -lpthread
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <limits>
+#include <iomanip>
+#include <sstream>
+#include <csignal>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+
+#include "Crc32c.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// 片方向で読み込んだまま送れていないデータの上限（超えたら送り元からの読み込みを止める）
+const size_t MAX_QUEUED_BYTES = 1024 * 1024;
+// 帯域の上限があるとき、1回に書き込む量（上限の 1/50 秒ぶん）
+const uint64_t RATE_SLICES_PER_SECOND = 50;
+
+// suite の模擬クライアント
+const int DEFAULT_CLIENT_TIMEOUT_MS = 3000;
+const int ROUND_TIMEOUT_MS = 30000;
+const int RETRY_BACKOFF_MS = 100;
+const unsigned SUITE_KEYS = 16;
+const char SUITE_SECTION[] = "FAULT_SUITE";
+
+std::atomic<bool> g_stop(false);
+
+/**
+ * @brief 入れる障害の指定
+ */
+struct FaultSpec {
+    int delay_ms = 0;
+    int jitter_ms = 0;
+    uint64_t rate = 0;       // バイト/秒（0で無制限）
+    size_t chunk = 0;        // 1回の書き込みの上限（0で分けない）
+    int gap_ms = 0;
+    int partial_ms = 0;
+    int stall_ms = 0;
+    uint64_t after = 0;
+    uint64_t reset_bytes = 0;
+    bool reset_reply = false;
+    uint64_t every = 1;
+};
+
+/**
+ * @brief "delay=100,chunk=1" 形式の障害指定を読む
+ * @return 形式が正しければtrue（違えば error に理由）
+ */
+bool parse_faults(const std::string& text, FaultSpec& spec, std::string& error) {
+    std::istringstream tokens(text);
+    std::string token;
+    while (std::getline(tokens, token, ',')) {
+        if (token.empty()) {
+            continue;
+        }
+        size_t equals = token.find('=');
+        if (equals == std::string::npos) {
+            error = "値がありません: " + token;
+            return false;
+        }
+        std::string name = token.substr(0, equals);
+        std::string value = token.substr(equals + 1);
+        if (name == "reset" && value == "reply") {
+            spec.reset_reply = true;
+            continue;
+        }
+        char* end = nullptr;
+        errno = 0;
+        unsigned long long number = strtoull(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || errno != 0 || number > 1000000000ULL) {
+            error = "数値が不正です: " + token;
+            return false;
+        }
+        if (name == "delay") {
+            spec.delay_ms = static_cast<int>(number);
+        } else if (name == "jitter") {
+            spec.jitter_ms = static_cast<int>(number);
+        } else if (name == "rate") {
+            spec.rate = number;
+        } else if (name == "chunk") {
+            spec.chunk = static_cast<size_t>(number);
+        } else if (name == "gap") {
+            spec.gap_ms = static_cast<int>(number);
+        } else if (name == "partial") {
+            spec.partial_ms = static_cast<int>(number);
+        } else if (name == "stall") {
+            spec.stall_ms = static_cast<int>(number);
+        } else if (name == "after") {
+            spec.after = number;
+        } else if (name == "reset") {
+            spec.reset_bytes = number;
+        } else if (name == "every" && number > 0) {
+            spec.every = number;
+        } else {
+            error = "不明な障害です: " + token;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief プロキシの集計（suite のスレッドからも読む）
+ */
+class ProxyStats {
+public:
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> bytes_up{0};
+    std::atomic<uint64_t> bytes_down{0};
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> resets{0};
+
+    void record_fault(Clock::time_point when) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fault_times_.push_back(when);
+    }
+
+    /**
+     * @brief since 以降に最初に障害を入れた時刻
+     * @return 障害がなければfalse
+     */
+    bool first_fault_since(Clock::time_point since, Clock::time_point& when) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Clock::time_point& time : fault_times_) {
+            if (time >= since) {
+                when = time;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<Clock::time_point> fault_times_;
+};
+
+/**
+ * @brief 受け取ったデータのひとかたまり（due になったら送ってよい）
+ */
+struct Segment {
+    Clock::time_point due;
+    std::string data;
+    size_t offset = 0;
+};
+
+/**
+ * @brief 中継の片方向
+ */
+struct Direction {
+    std::deque<Segment> queue;
+    size_t queued = 0;
+    bool eof = false;  // 送り元が閉じた
+    bool shut = false; // 送り先に SHUT_WR を送った
+    Clock::time_point last_due;
+    Clock::time_point next_send; // 帯域の上限と gap= で、次に書き込んでよい時刻
+    uint64_t forwarded = 0;
+};
+
+/**
+ * @brief 中継している接続1組
+ */
+struct Link {
+    int client = -1;
+    int server = -1;
+    bool connecting = true; // 中継先への接続が終わっていない
+    bool faulted = false;   // stall / reset を入れる接続
+    bool stalled = false;   // stall を入れ終えた
+    bool closed = false;
+    Clock::time_point stall_until;
+    Direction up;   // クライアント → 中継先
+    Direction down; // 中継先 → クライアント
+};
+
+/**
+ * @brief 障害を入れるTCPプロキシ（1スレッドの poll ループ）
+ */
+class FaultProxy {
+public:
+    FaultProxy(const FaultSpec& spec, const sockaddr_in& target)
+        : spec_(spec), target_(target), listen_fd_(-1), port_(0), random_(12345) {}
+
+    ~FaultProxy() {
+        for (Link& link : links_) {
+            close_link(link);
+        }
+        if (listen_fd_ >= 0) {
+            close(listen_fd_);
+        }
+    }
+
+    FaultProxy(const FaultProxy&) = delete;
+    FaultProxy& operator=(const FaultProxy&) = delete;
+
+    /**
+     * @brief 127.0.0.1 の port で待ち受ける（0なら空いているポート）
+     */
+    bool listen_on(int port, std::string& error) {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd_ < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        int opt = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (bind(listen_fd_, (const struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 64) < 0 ||
+            getsockname(listen_fd_, (struct sockaddr*)&addr, &length) < 0) {
+            error = strerror(errno);
+            return false;
+        }
+        port_ = ntohs(addr.sin_port);
+        return true;
+    }
+
+    int port() const { return port_; }
+    ProxyStats& stats() { return stats_; }
+
+    /**
+     * @brief stop が立つまで中継する
+     */
+    void run(const std::atomic<bool>& stop) {
+        std::vector<pollfd> fds;
+        while (!stop.load()) {
+            Clock::time_point now = Clock::now();
+            int timeout_ms = 20;
+            fds.clear();
+            fds.push_back(pollfd{listen_fd_, POLLIN, 0});
+            for (Link& link : links_) {
+                short client_events = 0;
+                short server_events = 0;
+                if (!link.up.eof && link.up.queued < MAX_QUEUED_BYTES) {
+                    client_events |= POLLIN;
+                }
+                if (!link.connecting && !link.down.eof && link.down.queued < MAX_QUEUED_BYTES) {
+                    server_events |= POLLIN;
+                }
+                if (link.connecting || ready_to_write(link, link.up, now)) {
+                    server_events |= POLLOUT;
+                }
+                if (ready_to_write(link, link.down, now)) {
+                    client_events |= POLLOUT;
+                }
+                timeout_ms = std::min(timeout_ms, wait_ms(link, now));
+                // 待つものがない側は外す（閉じた相手の POLLHUP で回り続けないように）
+                fds.push_back(pollfd{client_events != 0 ? link.client : -1, client_events, 0});
+                fds.push_back(pollfd{server_events != 0 ? link.server : -1, server_events, 0});
+            }
+            if (poll(fds.data(), fds.size(), timeout_ms) < 0 && errno != EINTR) {
+                std::cerr << "エラー: poll に失敗しました。" << strerror(errno) << std::endl;
+                return;
+            }
+            if (fds[0].revents & POLLIN) {
+                accept_clients();
+            }
+            size_t index = 1;
+            for (std::list<Link>::iterator it = links_.begin(); it != links_.end() && index < fds.size(); ++it) {
+                Link& link = *it;
+                short client_revents = fds[index++].revents;
+                short server_revents = fds[index++].revents;
+                if (link.connecting && server_revents != 0) {
+                    finish_connect(link);
+                }
+                if (!link.closed && (client_revents & (POLLIN | POLLHUP | POLLERR))) {
+                    read_side(link, true);
+                }
+                if (!link.closed && !link.connecting && (server_revents & (POLLIN | POLLHUP | POLLERR))) {
+                    read_side(link, false);
+                }
+                if (!link.closed && !link.connecting) {
+                    write_side(link, link.up, link.server);
+                }
+                if (!link.closed) {
+                    write_side(link, link.down, link.client);
+                }
+                if (!link.closed && link.up.shut && link.down.shut) {
+                    close_link(link);
+                }
+            }
+            links_.remove_if([](const Link& link) { return link.closed; });
+        }
+    }
+
+private:
+    // 次に送れる時刻までの待ち時間（poll のタイムアウトに使う）
+    int wait_ms(const Link& link, Clock::time_point now) const {
+        Clock::time_point wake = Clock::time_point::max();
+        for (const Direction* direction : {&link.up, &link.down}) {
+            if (!direction->queue.empty()) {
+                Clock::time_point at = std::max(direction->queue.front().due, direction->next_send);
+                if (link.stall_until > at) {
+                    at = link.stall_until;
+                }
+                wake = std::min(wake, at);
+            }
+        }
+        if (wake == Clock::time_point::max()) {
+            return 20;
+        }
+        if (wake <= now) {
+            return 0;
+        }
+        return static_cast<int>(
+            std::min<int64_t>(20, std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1));
+    }
+
+    bool ready_to_write(const Link& link, const Direction& direction, Clock::time_point now) const {
+        return !direction.queue.empty() && direction.queue.front().due <= now && direction.next_send <= now &&
+               link.stall_until <= now;
+    }
+
+    void accept_clients() {
+        while (true) {
+            int client = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client < 0) {
+                return;
+            }
+            int server = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (server < 0) {
+                close(client);
+                continue;
+            }
+            // 分けた書き込みがそのまま別々のセグメントになるように、両側で Nagle を切る
+            int opt = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            if (connect(server, (const struct sockaddr*)&target_, sizeof(target_)) < 0 && errno != EINPROGRESS) {
+                close(server);
+                abort_socket(client);
+                continue;
+            }
+            uint64_t number = stats_.connections.fetch_add(1);
+            links_.push_back(Link());
+            Link& link = links_.back();
+            link.client = client;
+            link.server = server;
+            link.faulted = number % spec_.every == 0;
+        }
+    }
+
+    void finish_connect(Link& link) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(link.server, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            abort_link(link);
+            return;
+        }
+        link.connecting = false;
+    }
+
+    void read_side(Link& link, bool from_client) {
+        int fd = from_client ? link.client : link.server;
+        Direction& direction = from_client ? link.up : link.down;
+        char buffer[16 * 1024];
+        while (!direction.eof && direction.queued < MAX_QUEUED_BYTES) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n < 0) {
+                abort_link(link);
+                return;
+            }
+            if (!from_client && link.faulted && spec_.reset_reply) {
+                // 返信（または適用後の切断）が届いたところで、クライアント側だけを切る
+                Clock::time_point now = Clock::now();
+                stats_.resets++;
+                stats_.record_fault(now);
+                abort_socket(link.client);
+                link.client = -1;
+                close_link(link);
+                return;
+            }
+            if (n == 0) {
+                direction.eof = true;
+                return;
+            }
+            enqueue(direction, buffer, static_cast<size_t>(n));
+        }
+    }
+
+    void enqueue(Direction& direction, const char* data, size_t size) {
+        Clock::time_point due = Clock::now() + std::chrono::milliseconds(spec_.delay_ms);
+        if (spec_.jitter_ms > 0) {
+            due += std::chrono::milliseconds(std::uniform_int_distribution<int>(0, spec_.jitter_ms)(random_));
+        }
+        if (due < direction.last_due) {
+            due = direction.last_due; // 遅延が揺れてもバイトの順序は保つ
+        }
+        size_t cut = size;
+        if (spec_.partial_ms > 0 && size > 1) {
+            cut = std::uniform_int_distribution<size_t>(1, size - 1)(random_);
+        }
+        Segment first;
+        first.due = due;
+        first.data.assign(data, cut);
+        direction.queue.push_back(std::move(first));
+        if (cut < size) {
+            due += std::chrono::milliseconds(spec_.partial_ms);
+            Segment rest;
+            rest.due = due;
+            rest.data.assign(data + cut, size - cut);
+            direction.queue.push_back(std::move(rest));
+        }
+        direction.last_due = due;
+        direction.queued += size;
+    }
+
+    void write_side(Link& link, Direction& direction, int fd) {
+        bool upstream = &direction == &link.up;
+        while (true) {
+            Clock::time_point now = Clock::now();
+            if (!ready_to_write(link, direction, now)) {
+                break;
+            }
+            size_t limit = std::numeric_limits<size_t>::max();
+            if (upstream && link.faulted) {
+                if (spec_.stall_ms > 0 && !link.stalled) {
+                    if (direction.forwarded >= spec_.after) {
+                        link.stalled = true;
+                        link.stall_until = now + std::chrono::milliseconds(spec_.stall_ms);
+                        stats_.stalls++;
+                        stats_.record_fault(now);
+                        return;
+                    }
+                    limit = static_cast<size_t>(spec_.after - direction.forwarded);
+                }
+                if (spec_.reset_bytes > 0) {
+                    if (direction.forwarded >= spec_.reset_bytes) {
+                        stats_.resets++;
+                        stats_.record_fault(now);
+                        abort_link(link);
+                        return;
+                    }
+                    limit = std::min<size_t>(limit, static_cast<size_t>(spec_.reset_bytes - direction.forwarded));
+                }
+            }
+            Segment& segment = direction.queue.front();
+            size_t size = std::min(segment.data.size() - segment.offset, limit);
+            if (spec_.chunk > 0) {
+                size = std::min(size, spec_.chunk);
+            }
+            if (spec_.rate > 0) {
+                size = std::min<size_t>(size, static_cast<size_t>(std::max<uint64_t>(1, spec_.rate / RATE_SLICES_PER_SECOND)));
+            }
+            ssize_t n = send(fd, segment.data.data() + segment.offset, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n < 0) {
+                abort_link(link);
+                return;
+            }
+            size_t written = static_cast<size_t>(n);
+            segment.offset += written;
+            direction.queued -= written;
+            direction.forwarded += written;
+            (upstream ? stats_.bytes_up : stats_.bytes_down) += written;
+            if (segment.offset == segment.data.size()) {
+                direction.queue.pop_front();
+            }
+            if (spec_.rate > 0) {
+                direction.next_send = now + std::chrono::microseconds(written * 1000000 / spec_.rate);
+            }
+            if (spec_.chunk > 0 && spec_.gap_ms > 0) {
+                direction.next_send = std::max(direction.next_send, now + std::chrono::milliseconds(spec_.gap_ms));
+            }
+        }
+        if (direction.queue.empty() && direction.eof && !direction.shut) {
+            shutdown(fd, SHUT_WR);
+            direction.shut = true;
+        }
+    }
+
+    // SO_LINGER 0 で閉じて RST を送る
+    static void abort_socket(int fd) {
+        if (fd < 0) {
+            return;
+        }
+        linger option;
+        option.l_onoff = 1;
+        option.l_linger = 0;
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+        close(fd);
+    }
+
+    void abort_link(Link& link) {
+        abort_socket(link.client);
+        abort_socket(link.server);
+        link.client = -1;
+        link.server = -1;
+        link.closed = true;
+    }
+
+    void close_link(Link& link) {
+        if (link.client >= 0) {
+            close(link.client);
+        }
+        if (link.server >= 0) {
+            close(link.server);
+        }
+        link.client = -1;
+        link.server = -1;
+        link.closed = true;
+    }
+
+    FaultSpec spec_;
+    sockaddr_in target_;
+    int listen_fd_;
+    int port_;
+    std::mt19937 random_;
+    std::list<Link> links_;
+    ProxyStats stats_;
+};
+
+/**
+ * @brief 接続して request を送り、相手が閉じるまで（または timeout_ms まで）返信を読む
+ * @param error 失敗した理由
+ * @return 相手が閉じるまで読めた場合true
+ */
+bool exchange(const sockaddr_in& addr, const std::string& request, std::string& response, int timeout_ms,
+              std::string& error) {
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    auto remaining_ms = [&deadline]() {
+        int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return static_cast<int>(std::max<int64_t>(0, left));
+    };
+    response.clear();
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    auto fail = [&](const std::string& reason) {
+        // 打ち切った接続は RST で閉じ、相手に受信途中のフレームを残させない
+        linger option;
+        option.l_onoff = 1;
+        option.l_linger = 0;
+        setsockopt(sock, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+        close(sock);
+        error = reason;
+        return false;
+    };
+    if (connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        return fail(std::string("接続できません（") + strerror(errno) + "）");
+    }
+    pollfd pfd{sock, POLLOUT, 0};
+    if (poll(&pfd, 1, remaining_ms()) <= 0) {
+        return fail("接続タイムアウト");
+    }
+    int so_error = 0;
+    socklen_t length = sizeof(so_error);
+    getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &length);
+    if (so_error != 0) {
+        return fail(std::string("接続できません（") + strerror(so_error) + "）");
+    }
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t n = send(sock, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            pfd = pollfd{sock, POLLOUT, 0};
+            if (poll(&pfd, 1, remaining_ms()) <= 0) {
+                return fail("送信タイムアウト");
+            }
+            continue;
+        }
+        if (n <= 0) {
+            return fail(std::string("送信中に切断（") + strerror(errno) + "）");
+        }
+        sent += static_cast<size_t>(n);
+    }
+    char buffer[16 * 1024];
+    while (true) {
+        ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            response.append(buffer, static_cast<size_t>(n));
+            continue;
+        }
+        if (n == 0) {
+            close(sock);
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return fail(std::string("受信中に切断（") + strerror(errno) + "）");
+        }
+        pfd = pollfd{sock, POLLIN, 0};
+        if (poll(&pfd, 1, remaining_ms()) <= 0) {
+            return fail("返信タイムアウト");
+        }
+    }
+}
+
+/**
+ * @brief suite の障害の種類1つ
+ */
+struct Scenario {
+    const char* name;
+    const char* faults;
+};
+
+const Scenario SCENARIOS[] = {
+    {"baseline", ""},
+    {"latency", "delay=150,jitter=50"},
+    {"bandwidth", "rate=2000"},
+    {"fragment", "chunk=1"},
+    {"partial", "partial=200"},
+    {"stall", "stall=1500,after=40"},
+    {"stall_rate", "stall=2500,after=40,every=2"},
+    {"stall_long", "stall=6000,after=40,every=2"},
+    {"reset", "reset=40,every=2"},
+    {"reset_reply", "reset=reply,every=2"},
+};
+
+/**
+ * @brief 1種類分の結果
+ */
+struct ScenarioResult {
+    size_t rounds = 0;
+    size_t consistent = 0;
+    size_t attempts = 0;
+    size_t duplicates = 0;               // 再送が DUP（適用済み）で確認できた回数
+    std::vector<double> consistent_ms;   // 一致までの時間
+    std::vector<double> recovery_ms;     // 復旧時間（障害が入った回だけ）
+    std::vector<std::string> failures;   // 失敗した試行の理由（種類ごとに1回だけ）
+};
+
+std::string make_suite_frame(const std::string& body, const std::string& session, uint64_t seq) {
+    char trailer[16];
+    snprintf(trailer, sizeof(trailer), "%08x\n", crc32c(body.data(), body.size()));
+    return std::to_string(body.size()) + " crc sid=" + session + " seq=" + std::to_string(seq) + "\n" + body +
+           trailer;
+}
+
+/**
+ * @brief プロキシを通さずに設定を読み、body の行がすべて見えるか調べる
+ */
+bool config_matches(const sockaddr_in& direct, const std::string& body) {
+    std::string response;
+    std::string error;
+    std::string request = std::string("0 section=") + SUITE_SECTION + "\n";
+    if (!exchange(direct, request, response, 2000, error)) {
+        return false;
+    }
+    size_t newline = response.find('\n');
+    if (newline == std::string::npos) {
+        return false;
+    }
+    std::string config = response.substr(newline + 1);
+    std::istringstream lines(body);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (config.find(line + "\n") == std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string format_ms(std::vector<double> values) {
+    if (values.empty()) {
+        return "-";
+    }
+    std::sort(values.begin(), values.end());
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(0) << values[(values.size() - 1) / 2] << " / " << values.back();
+    return text.str();
+}
+
+int run_suite(const sockaddr_in& direct, int rounds, int client_timeout_ms) {
+    std::string session = "faultsuite" + std::to_string(getpid());
+    uint64_t seq = 0;
+    bool all_consistent = true;
+    std::cout << "模擬クライアント: 返信のタイムアウト " << client_timeout_ms << " ms / 再送の間隔 " << RETRY_BACKOFF_MS
+              << " ms / 1回の上限 " << ROUND_TIMEOUT_MS << " ms / 更新 " << SUITE_KEYS << " 項目（[" << SUITE_SECTION
+              << "]）\n\n";
+    // 見出しは全角文字の表示幅に合わせて空白で揃える（std::setw はバイト数で数えるため）
+    std::cout << "種類        障害                          一致    試行/回   DUP   一致まで p50/最大(ms) 復旧 p50/最大(ms)\n";
+    for (const Scenario& scenario : SCENARIOS) {
+        FaultSpec spec;
+        std::string error;
+        if (!parse_faults(scenario.faults, spec, error)) {
+            std::cerr << "エラー: " << scenario.name << ": " << error << "\n";
+            return 1;
+        }
+        FaultProxy proxy(spec, direct);
+        if (!proxy.listen_on(0, error)) {
+            std::cerr << "エラー: プロキシを待ち受けられません。" << error << "\n";
+            return 1;
+        }
+        sockaddr_in proxy_addr;
+        memset(&proxy_addr, 0, sizeof(proxy_addr));
+        proxy_addr.sin_family = AF_INET;
+        proxy_addr.sin_port = htons(static_cast<uint16_t>(proxy.port()));
+        proxy_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::atomic<bool> stop(false);
+        std::thread thread([&proxy, &stop] { proxy.run(stop); });
+
+        ScenarioResult result;
+        for (int round = 0; round < rounds && !g_stop.load(); round++) {
+            result.rounds++;
+            std::string stamp = std::string(scenario.name) + "_" + std::to_string(round);
+            std::string body;
+            for (unsigned i = 0; i < SUITE_KEYS; i++) {
+                char key[32];
+                snprintf(key, sizeof(key), "K%02u", i);
+                body += std::string("[") + SUITE_SECTION + "]" + key + "=" + stamp + "\n";
+            }
+            std::string frame = make_suite_frame(body, session, ++seq);
+            Clock::time_point begin = Clock::now();
+            Clock::time_point deadline = begin + std::chrono::milliseconds(ROUND_TIMEOUT_MS);
+            bool consistent = false;
+            while (!consistent && Clock::now() < deadline && !g_stop.load()) {
+                result.attempts++;
+                std::string response;
+                if (!exchange(proxy_addr, frame, response, client_timeout_ms, error)) {
+                    // 失敗した理由は種類ごとに1回だけ残す
+                } else if (response.compare(0, 3, "DUP") == 0) {
+                    result.duplicates++;
+                    consistent = config_matches(direct, body);
+                    error = "DUP なのに値が見えない";
+                } else if (response.empty()) {
+                    consistent = config_matches(direct, body);
+                    error = "切断されたが値が見えない（受信途中で打ち切り）";
+                } else {
+                    size_t newline = response.find('\n');
+                    error = "返信 " + response.substr(0, newline);
+                }
+                if (!consistent) {
+                    if (std::find(result.failures.begin(), result.failures.end(), error) == result.failures.end()) {
+                        result.failures.push_back(error);
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(RETRY_BACKOFF_MS));
+                }
+            }
+            if (!consistent) {
+                continue;
+            }
+            Clock::time_point end = Clock::now();
+            result.consistent++;
+            result.consistent_ms.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+            Clock::time_point fault;
+            if (proxy.stats().first_fault_since(begin, fault)) {
+                result.recovery_ms.push_back(std::chrono::duration<double, std::milli>(end - fault).count());
+            }
+        }
+        stop.store(true);
+        thread.join();
+
+        std::ostringstream ratio;
+        ratio << result.consistent << "/" << result.rounds;
+        std::ostringstream attempts;
+        attempts << std::fixed << std::setprecision(1)
+                 << (result.rounds > 0 ? static_cast<double>(result.attempts) / result.rounds : 0.0);
+        std::cout << std::left << std::setw(12) << scenario.name << std::setw(30)
+                  << (scenario.faults[0] != '\0' ? scenario.faults : "-") << std::setw(8) << ratio.str()
+                  << std::setw(10) << attempts.str() << std::setw(6) << result.duplicates << std::setw(22)
+                  << format_ms(result.consistent_ms) << format_ms(result.recovery_ms) << std::right << "\n";
+        for (const std::string& failure : result.failures) {
+            std::cout << "    失敗した試行: " << failure << "\n";
+        }
+        all_consistent = all_consistent && result.consistent == result.rounds;
+    }
+    return all_consistent ? 0 : 2;
+}
+
+void handle_signal(int) {
+    g_stop.store(true);
+}
+
+bool resolve(const std::string& host, int port, sockaddr_in& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    return port > 0 && port < 65536 && inet_pton(AF_INET, host.c_str(), &addr.sin_addr) > 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    if (mode == "proxy" && argc >= 5) {
+        FaultSpec spec;
+        std::string error;
+        sockaddr_in target;
+        if (!resolve(argv[3], std::atoi(argv[4]), target)) {
+            std::cerr << "エラー: 中継先が不正です: " << argv[3] << ":" << argv[4] << std::endl;
+            return 1;
+        }
+        if (!parse_faults(argc > 5 ? argv[5] : "", spec, error)) {
+            std::cerr << "エラー: " << error << std::endl;
+            return 1;
+        }
+        FaultProxy proxy(spec, target);
+        if (!proxy.listen_on(std::atoi(argv[2]), error)) {
+            std::cerr << "エラー: ポート " << argv[2] << " で待ち受けられません。" << error << std::endl;
+            return 1;
+        }
+        std::cout << "127.0.0.1:" << proxy.port() << " → " << argv[3] << ":" << argv[4] << " を中継します（障害: "
+                  << (argc > 5 && argv[5][0] != '\0' ? argv[5] : "なし") << "）\n";
+        proxy.run(g_stop);
+        ProxyStats& stats = proxy.stats();
+        std::cout << "\n接続 " << stats.connections.load() << " 本 / 上り " << stats.bytes_up.load()
+                  << " バイト / 下り " << stats.bytes_down.load() << " バイト / stall " << stats.stalls.load()
+                  << " 回 / reset " << stats.resets.load() << " 回\n";
+        return 0;
+    }
+    if (mode == "suite") {
+        sockaddr_in direct;
+        std::string host = argc > 2 ? argv[2] : "127.0.0.1";
+        int port = argc > 3 ? std::atoi(argv[3]) : 12348;
+        int rounds = argc > 4 ? std::atoi(argv[4]) : 5;
+        int client_timeout_ms = argc > 5 ? std::atoi(argv[5]) : DEFAULT_CLIENT_TIMEOUT_MS;
+        if (!resolve(host, port, direct) || rounds <= 0 || client_timeout_ms <= 0) {
+            std::cerr << "エラー: 引数が不正です。\n";
+            return 1;
+        }
+        std::string response;
+        std::string error;
+        if (!exchange(direct, std::string("0 section=") + SUITE_SECTION + "\n", response, 2000, error)) {
+            std::cerr << "エラー: " << host << ":" << port << " の ConfigSynchronizer に接続できません（" << error
+                      << "）。\n";
+            return 1;
+        }
+        return run_suite(direct, rounds, client_timeout_ms);
+    }
+    std::cerr << "使い方: " << argv[0] << " proxy <待ち受けポート> <host> <port> [障害,...]\n"
+              << "        " << argv[0] << " suite [host] [port] [回数] [クライアントのタイムアウト(ms)]\n"
+              << "障害: delay=<ms>,jitter=<ms>,rate=<バイト/s>,chunk=<バイト>,gap=<ms>,partial=<ms>,\n"
+              << "      stall=<ms>,after=<バイト>,reset=<バイト>|reply,every=<N>\n";
+    return 1;
+}
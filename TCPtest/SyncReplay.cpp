@@ -0,0 +1,380 @@
+// SyncReplay.cpp - 通信の記録（CAPTURE_FILE）を ConfigSynchronizer に送り直す再生ツール
+//
+// 目的:
+// 現場の調整作業で記録した送受信を、手元の ConfigSynchronizer に同じ順序で送り直し、
+// 問題の再現と、実際の作業に基づいたスループット・レイテンシの測定（性能の退行確認）に使う。
+//
+// 使い方:
+// ./SyncReplay <記録ファイル> [host] [port] [速度]
+//   速度: 1（既定）… 記録と同じ間隔で送る / 2 … 2倍速 / fast … 待たずに最速で送る
+// ./SyncReplay <記録ファイル> dump … レコードを一覧表示する
+//
+// 再生の規則:
+// - 受け付けた接続（WPFなどから届いた接続）だけを再生する。ConfigSynchronizer から
+//   張った接続（WPFへの送信・複製元への接続）は数えるだけで再生しない。
+// - 受信したバイト列は、記録と同じ区切り（recv 1回ずつ）で送る。
+// - 記録で接続を閉じた時点に来たら送信側を閉じ（SHUT_WR）、相手が閉じるまで返信を読む。
+// - 記録で先に閉じていた接続があれば、それが再生でも閉じるまで次の接続を始めない
+//   （最速でも、順番に依存する更新・要求の順序が記録と同じになる）。
+//
+// コンパイル方法:
+// g++ -std=c++11 -O2 SyncReplay.cpp -o SyncReplay
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <ctime>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+
+#include "TrafficCapture.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// 記録で閉じた後、相手が閉じるのを待つ最大時間
+const std::chrono::seconds FINISH_TIMEOUT(10);
+
+/**
+ * @brief 受け付けた接続1本分（記録の内容と再生の状態）
+ */
+struct Connection {
+    std::string peer;
+    uint64_t opened_ns = 0;
+    uint64_t closed_ns = std::numeric_limits<uint64_t>::max(); // 記録の終わりまで閉じなかった場合は最大値
+    std::string expected_reply; // 記録で ConfigSynchronizer が送った内容
+    size_t prerequisite = 0;    // この接続を始める前に閉じている必要がある接続の数（閉じた順）
+
+    int sock = -1;
+    bool started = false;
+    bool completed = false;
+    std::string reply;
+    Clock::time_point last_sent;
+    Clock::time_point finish_deadline = Clock::time_point::max();
+};
+
+/**
+ * @brief 再生の1ステップ（記録の時刻順）
+ */
+struct Step {
+    enum Kind { OPEN, SEND, FINISH };
+    uint64_t time_ns;
+    size_t connection;
+    Kind kind;
+    std::string data;
+};
+
+/**
+ * @brief 表示用に、制御文字をエスケープした先頭部分
+ */
+std::string preview(const std::string& data, size_t limit) {
+    std::string text;
+    for (size_t i = 0; i < data.size() && i < limit; i++) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c == '\n') {
+            text += "\\n";
+        } else if (c < 0x20 || c == 0x7f) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            text += escaped;
+        } else {
+            text += static_cast<char>(c);
+        }
+    }
+    if (data.size() > limit) {
+        text += "...";
+    }
+    return text;
+}
+
+/**
+ * @brief レコードを一覧表示する
+ */
+int dump_capture(traffic_capture::Reader& reader) {
+    traffic_capture::Record record;
+    size_t count = 0;
+    std::cout << std::fixed << std::setprecision(3);
+    while (reader.next(record)) {
+        std::cout << std::setw(12) << record.time_ns / 1e6 << " ms  #" << record.connection << "  "
+                  << std::left << std::setw(9) << traffic_capture::type_name(record.type) << std::right << " "
+                  << std::setw(6) << record.data.size() << "  " << preview(record.data, 80) << "\n";
+        count++;
+    }
+    std::cout << count << " 件" << (reader.truncated() ? "（最後のレコードが途中で切れています）" : "") << "\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "使い方: " << argv[0] << " <記録ファイル> [host] [port] [速度(1, 2, ... / fast)]\n"
+                  << "        " << argv[0] << " <記録ファイル> dump\n";
+        return 1;
+    }
+    traffic_capture::Reader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << "エラー: " << argv[1] << " は通信の記録ファイルではないか、開けません。\n";
+        return 1;
+    }
+    if (argc > 2 && std::string(argv[2]) == "dump") {
+        return dump_capture(reader);
+    }
+    std::string host = argc > 2 ? argv[2] : "127.0.0.1";
+    int port = argc > 3 ? std::atoi(argv[3]) : 12348;
+    std::string speed_arg = argc > 4 ? argv[4] : "1";
+    bool fast = speed_arg == "fast";
+    double speed = fast ? 0 : std::atof(speed_arg.c_str());
+    if (!fast && speed <= 0) {
+        std::cerr << "エラー: 速度が不正です: " << speed_arg << "\n";
+        return 1;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+        std::cerr << "エラー: 不正なIPアドレス: " << host << std::endl;
+        return 1;
+    }
+
+    // 記録を読み込み、受け付けた接続ごとのステップに分ける
+    std::vector<Connection> connections;
+    std::vector<Step> steps;
+    std::map<uint32_t, size_t> inbound;  // 記録の接続番号 → connections の位置
+    std::map<uint32_t, bool> outbound;   // こちらから張った接続
+    uint64_t capture_end_ns = 0;
+    traffic_capture::Record record;
+    while (reader.next(record)) {
+        capture_end_ns = record.time_ns;
+        if (record.type == traffic_capture::CONNECTED) {
+            outbound[record.connection] = true;
+            continue;
+        }
+        if (record.type == traffic_capture::ACCEPTED) {
+            inbound[record.connection] = connections.size();
+            connections.push_back(Connection());
+            connections.back().peer = record.data;
+            connections.back().opened_ns = record.time_ns;
+            steps.push_back(Step{record.time_ns, connections.size() - 1, Step::OPEN, std::string()});
+            continue;
+        }
+        std::map<uint32_t, size_t>::const_iterator it = inbound.find(record.connection);
+        if (it == inbound.end()) {
+            continue;
+        }
+        Connection& connection = connections[it->second];
+        if (record.type == traffic_capture::RECEIVED) {
+            steps.push_back(Step{record.time_ns, it->second, Step::SEND, std::move(record.data)});
+        } else if (record.type == traffic_capture::SENT) {
+            connection.expected_reply += record.data;
+        } else if (record.type == traffic_capture::CLOSED) {
+            connection.closed_ns = record.time_ns;
+            steps.push_back(Step{record.time_ns, it->second, Step::FINISH, std::string()});
+        }
+    }
+    if (reader.truncated()) {
+        std::cerr << "警告: 記録の最後のレコードが途中で切れています（それより前までを再生します）。\n";
+    }
+    if (connections.empty()) {
+        std::cerr << "エラー: 再生できる接続がありません。\n";
+        return 1;
+    }
+
+    // 記録で閉じた順の一覧と、各接続の前に閉じている接続の数
+    std::vector<size_t> close_order(connections.size());
+    for (size_t i = 0; i < connections.size(); i++) {
+        close_order[i] = i;
+    }
+    std::stable_sort(close_order.begin(), close_order.end(), [&connections](size_t a, size_t b) {
+        return connections[a].closed_ns < connections[b].closed_ns;
+    });
+    std::vector<uint64_t> close_times;
+    for (size_t index : close_order) {
+        close_times.push_back(connections[index].closed_ns);
+    }
+    for (Connection& connection : connections) {
+        connection.prerequisite = static_cast<size_t>(
+            std::lower_bound(close_times.begin(), close_times.end(), connection.opened_ns) - close_times.begin());
+    }
+
+    size_t done_prefix = 0; // close_order の先頭から、再生でも閉じ終えた数
+    size_t open_count = 0;
+    size_t failures = 0;
+    size_t timeouts = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t reply_bytes = 0;
+    std::vector<double> latencies_us;
+
+    auto complete = [&](Connection& connection) {
+        if (connection.sock >= 0) {
+            close(connection.sock);
+            connection.sock = -1;
+            open_count--;
+        }
+        connection.completed = true;
+        while (done_prefix < close_order.size() && connections[close_order[done_prefix]].completed) {
+            done_prefix++;
+        }
+    };
+
+    // 開いている接続の返信を読み、閉じられた接続を片付ける
+    auto pump = [&](int timeout_ms) {
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (connections[i].sock >= 0) {
+                fds.push_back(pollfd{connections[i].sock, POLLIN, 0});
+                owners.push_back(i);
+            }
+        }
+        if (fds.empty()) {
+            if (timeout_ms > 0) {
+                usleep(static_cast<useconds_t>(timeout_ms) * 1000);
+            }
+            return;
+        }
+        poll(fds.data(), fds.size(), timeout_ms);
+        Clock::time_point now = Clock::now();
+        char buffer[64 * 1024];
+        for (size_t i = 0; i < fds.size(); i++) {
+            Connection& connection = connections[owners[i]];
+            if (fds[i].revents != 0) {
+                while (true) {
+                    ssize_t n = recv(connection.sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+                    if (n > 0) {
+                        reply_bytes += static_cast<uint64_t>(n);
+                        if (connection.reply.size() <= connection.expected_reply.size()) {
+                            connection.reply.append(buffer, static_cast<size_t>(n));
+                        }
+                        continue;
+                    }
+                    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                        break;
+                    }
+                    // 相手が閉じた（または接続が切れた）
+                    latencies_us.push_back(std::chrono::duration<double, std::micro>(now - connection.last_sent).count());
+                    complete(connection);
+                    break;
+                }
+            }
+            if (!connection.completed && now >= connection.finish_deadline) {
+                timeouts++;
+                complete(connection);
+            }
+        }
+    };
+
+    Clock::time_point started = Clock::now();
+    for (const Step& step : steps) {
+        Connection& connection = connections[step.connection];
+        Clock::time_point due = fast ? started
+                                     : started + std::chrono::duration_cast<Clock::duration>(
+                                                     std::chrono::duration<double, std::nano>(step.time_ns / speed));
+        while (true) {
+            Clock::time_point now = Clock::now();
+            bool waiting_prerequisite = step.kind == Step::OPEN && done_prefix < connection.prerequisite;
+            if (now >= due && !waiting_prerequisite) {
+                break;
+            }
+            int wait_ms = 50;
+            if (now < due) {
+                wait_ms = static_cast<int>(std::min<int64_t>(
+                    50, std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count()));
+            }
+            pump(wait_ms);
+        }
+
+        if (step.kind == Step::OPEN) {
+            connection.started = true;
+            connection.last_sent = Clock::now();
+            int sock = socket(AF_INET, SOCK_STREAM, 0);
+            int opt = 1;
+            if (sock >= 0) {
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            }
+            if (sock < 0 || connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+                if (sock >= 0) {
+                    close(sock);
+                }
+                failures++;
+                complete(connection);
+                continue;
+            }
+            connection.sock = sock;
+            open_count++;
+        } else if (connection.sock < 0) {
+            continue; // 接続できなかった、または相手が先に閉じた
+        } else if (step.kind == Step::SEND) {
+            size_t sent = 0;
+            while (sent < step.data.size()) {
+                ssize_t n = send(connection.sock, step.data.data() + sent, step.data.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    break;
+                }
+                sent += static_cast<size_t>(n);
+            }
+            sent_bytes += sent;
+            connection.last_sent = Clock::now();
+        } else {
+            shutdown(connection.sock, SHUT_WR);
+            connection.finish_deadline = Clock::now() + FINISH_TIMEOUT;
+        }
+        pump(0);
+    }
+
+    // 記録の終わりまで閉じなかった接続も送信側を閉じ、すべての接続が閉じるまで待つ
+    for (Connection& connection : connections) {
+        if (connection.sock >= 0 && connection.finish_deadline == Clock::time_point::max()) {
+            shutdown(connection.sock, SHUT_WR);
+            connection.finish_deadline = Clock::now() + FINISH_TIMEOUT;
+        }
+    }
+    while (open_count > 0) {
+        pump(50);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+    size_t matched = 0;
+    for (const Connection& connection : connections) {
+        if (connection.started && connection.reply == connection.expected_reply) {
+            matched++;
+        }
+    }
+
+    time_t capture_start = static_cast<time_t>(reader.start_unix_ns() / 1000000000ULL);
+    char start_text[32];
+    strftime(start_text, sizeof(start_text), "%Y-%m-%d %H:%M:%S", localtime(&capture_start));
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "記録: " << argv[1] << "（開始 " << start_text << "、長さ " << capture_end_ns / 1e9 << " 秒）/ 受け付けた接続 "
+              << connections.size() << " 本 / こちらからの接続 " << outbound.size() << " 本（再生しない）\n";
+    std::cout << "再生: 速度 " << (fast ? std::string("fast") : speed_arg) << " / 経過 " << elapsed << " 秒";
+    if (elapsed > 0) {
+        std::cout << "（記録の " << capture_end_ns / 1e9 / elapsed << " 倍速）";
+    }
+    std::cout << " / 接続 " << connections.size() << " 本（失敗 " << failures << "、タイムアウト " << timeouts
+              << "）/ 送信 " << sent_bytes << " バイト / 返信 " << reply_bytes << " バイト\n";
+    std::cout << "スループット: " << connections.size() / elapsed << " 接続/s / " << sent_bytes / elapsed / 1024
+              << " KB/s\n";
+    if (!latencies_us.empty()) {
+        std::sort(latencies_us.begin(), latencies_us.end());
+        auto percentile = [&](double p) { return latencies_us[static_cast<size_t>(p * (latencies_us.size() - 1))]; };
+        std::cout << "レイテンシ(us)（最後の送信から相手が閉じるまで）: p50 " << percentile(0.50) << " / p90 "
+                  << percentile(0.90) << " / p99 " << percentile(0.99) << " / 最大 " << latencies_us.back() << "\n";
+    }
+    std::cout << "返信が記録と一致: " << matched << " / " << connections.size() << " 本\n";
+    return failures + timeouts > 0 ? 2 : 0;
+}
@@ -0,0 +1,318 @@
+// TraceSpans.h - 処理区間（スパン）の計測とChromeトレース形式への書き出し（ヘッダーのみ）
+//
+// 目的:
+// 「300 ms の遅れは接続・ヘッダー受信・パース・適用のどこで起きたか」を、標準出力の
+// メッセージからではなく、区間ごとの開始時刻と所要時間から答えられるようにする。
+//
+// 仕組み:
+// - 区間（Span）は終わった時点で、そのスレッドのリングバッファに1件として書き込む。
+//   リングはスレッドごとなので書き込みにロックは要らない（いっぱいになれば古いものから上書き）。
+// - 書き出し（write_chrome_trace）は全スレッドのリングを読み、chrome://tracing や
+//   Perfetto で開ける JSON にする。読み出し中に上書きされた分はシーケンスロックと
+//   同じ考え方（予約番号を読み直す）で捨てる。
+// - 接続ごとの区間（connection >= 0）は、1つのスレッドで多くの接続がコルーチンとして
+//   並行するため、入れ子にならない非同期の区間（接続ごとの行）として書き出す。
+// - sys/sdt.h があれば USDT プローブ config_sync:span_start / config_sync:span_end を置く。
+//   プローブは使われていなければ nop 1つで、リングを無効（容量0）にしていても動く。
+//   引数は span_start(名前, 接続), span_end(名前, 接続, 所要時間ns。リング無効時は0)。
+//     bpftrace -e 'usdt:./ConfigSynchronizer:config_sync:span_end { @[str(arg0)] = hist(arg2); }'
+//
+// 使い方:
+//   trace_spans::set_ring_capacity(8192);      // スレッドごとの件数（0で記録しない）
+//   trace_spans::name_thread("worker 1");      // 書き出し時のスレッド名
+//   {
+//       trace_spans::Span span("apply");       // 名前は文字列リテラル（ポインタだけを残す）
+//       ...
+//   }
+//   std::string error;
+//   trace_spans::write_chrome_trace("trace.json", error);
+
+#ifndef TRACE_SPANS_H
+#define TRACE_SPANS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if !defined(CONFIG_SYNC_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_SPANS_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef TRACE_SPANS_HAVE_USDT
+#define TRACE_SPANS_PROBE_START(name, connection) DTRACE_PROBE2(config_sync, span_start, name, connection)
+#define TRACE_SPANS_PROBE_END(name, connection, duration) \
+    DTRACE_PROBE3(config_sync, span_end, name, connection, duration)
+#else
+#define TRACE_SPANS_PROBE_START(name, connection) ((void)0)
+#define TRACE_SPANS_PROBE_END(name, connection, duration) ((void)0)
+#endif
+
+namespace trace_spans {
+
+// USDT プローブ付きでビルドされたか
+inline bool have_usdt() {
+#ifdef TRACE_SPANS_HAVE_USDT
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+/**
+ * @brief 記録された区間1件
+ */
+struct Event {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int64_t connection; // 接続ごとの区間なら接続（ソケット）、それ以外は -1
+};
+
+/**
+ * @brief 1スレッド分のリングバッファ（書き込むのは持ち主のスレッドだけ）
+ */
+class ThreadRing {
+public:
+    ThreadRing(size_t capacity, uint32_t tid, std::string name)
+        : slots_(new Slot[capacity]), capacity_(capacity), tid_(tid), name_(std::move(name)), reserved_(0),
+          committed_(0) {}
+
+    void push(const char* name, uint64_t start_ns, uint64_t duration_ns, int64_t connection) {
+        uint64_t index = reserved_.load(std::memory_order_relaxed);
+        reserved_.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Slot& slot = slots_[index % capacity_];
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.start_ns.store(start_ns, std::memory_order_relaxed);
+        slot.duration_ns.store(duration_ns, std::memory_order_relaxed);
+        slot.connection.store(connection, std::memory_order_relaxed);
+        committed_.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 残っている区間を out に追加する（読んでいる間に上書きされたものは除く）
+     */
+    void collect(std::vector<Event>& out) const {
+        uint64_t end = committed_.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+        std::vector<Event> copied;
+        copied.reserve(static_cast<size_t>(end - begin));
+        for (uint64_t i = begin; i < end; i++) {
+            const Slot& slot = slots_[i % capacity_];
+            copied.push_back(Event{slot.name.load(std::memory_order_relaxed),
+                                   slot.start_ns.load(std::memory_order_relaxed),
+                                   slot.duration_ns.load(std::memory_order_relaxed),
+                                   slot.connection.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t reserved = reserved_.load(std::memory_order_relaxed);
+        uint64_t valid_from = reserved > capacity_ ? reserved - capacity_ : 0;
+        for (uint64_t i = begin; i < end; i++) {
+            if (i >= valid_from) {
+                out.push_back(copied[static_cast<size_t>(i - begin)]);
+            }
+        }
+    }
+
+    uint32_t tid() const { return tid_; }
+    const std::string& name() const { return name_; }
+    uint64_t recorded() const { return committed_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<uint64_t> start_ns{0};
+        std::atomic<uint64_t> duration_ns{0};
+        std::atomic<int64_t> connection{-1};
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t capacity_;
+    uint32_t tid_;
+    std::string name_;
+    std::atomic<uint64_t> reserved_;
+    std::atomic<uint64_t> committed_;
+};
+
+/**
+ * @brief 全スレッドのリング（スレッドが終わっても書き出せるよう、ここで持ち続ける）
+ */
+class Registry {
+public:
+    static Registry& instance() {
+        static Registry registry;
+        return registry;
+    }
+
+    std::atomic<size_t>& capacity() { return capacity_; }
+
+    std::shared_ptr<ThreadRing> add_ring(const std::string& thread_name) {
+        std::shared_ptr<ThreadRing> ring(new ThreadRing(std::max<size_t>(capacity_.load(), 1),
+                                                        static_cast<uint32_t>(syscall(SYS_gettid)), thread_name));
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    std::vector<std::shared_ptr<ThreadRing>> rings() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rings_;
+    }
+
+private:
+    Registry() : capacity_(0) {}
+
+    std::atomic<size_t> capacity_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<ThreadRing>> rings_;
+};
+
+inline std::string& thread_name() {
+    static thread_local std::string name;
+    return name;
+}
+
+inline ThreadRing* current_ring() {
+    static thread_local std::shared_ptr<ThreadRing> ring;
+    if (!ring) {
+        ring = Registry::instance().add_ring(thread_name());
+    }
+    return ring.get();
+}
+
+/**
+ * @brief スレッドごとのリングの件数（0で記録しない）。スレッドが最初の区間を記録する前に決めておく
+ */
+inline void set_ring_capacity(size_t capacity) {
+    Registry::instance().capacity().store(capacity);
+}
+
+inline bool recording() {
+    return Registry::instance().capacity().load(std::memory_order_relaxed) > 0;
+}
+
+/**
+ * @brief 書き出し時に表示するスレッド名（そのスレッドが最初の区間を記録する前に呼ぶ）
+ */
+inline void name_thread(const std::string& name) {
+    thread_name() = name;
+}
+
+/**
+ * @brief 生存期間を1つの区間として記録する
+ */
+class Span {
+public:
+    explicit Span(const char* name, int64_t connection = -1)
+        : name_(name), connection_(connection), start_ns_(recording() ? now_ns() : 0) {
+        TRACE_SPANS_PROBE_START(name_, connection_);
+    }
+
+    ~Span() {
+        uint64_t duration_ns = 0;
+        if (start_ns_ != 0) {
+            duration_ns = now_ns() - start_ns_;
+            current_ring()->push(name_, start_ns_, duration_ns, connection_);
+        }
+        TRACE_SPANS_PROBE_END(name_, connection_, duration_ns);
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name_;
+    int64_t connection_;
+    uint64_t start_ns_;
+};
+
+/**
+ * @brief 記録の件数
+ */
+struct Summary {
+    size_t threads = 0;
+    uint64_t recorded = 0;    // これまでに記録した件数
+    uint64_t overwritten = 0; // リングが一周して上書きされた件数
+};
+
+inline Summary summarize() {
+    Summary summary;
+    size_t capacity = Registry::instance().capacity().load();
+    for (const std::shared_ptr<ThreadRing>& ring : Registry::instance().rings()) {
+        summary.threads++;
+        summary.recorded += ring->recorded();
+        summary.overwritten += ring->recorded() > capacity ? ring->recorded() - capacity : 0;
+    }
+    return summary;
+}
+
+/**
+ * @brief 全スレッドの区間を Chrome トレース形式（JSON）で書き出す
+ * @return 書き出した区間の件数（ファイルを書けなければ -1 で、error に理由）
+ */
+inline long write_chrome_trace(const std::string& path, std::string& error) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        error = "開けません";
+        return -1;
+    }
+    long pid = static_cast<long>(getpid());
+    long count = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const std::shared_ptr<ThreadRing>& ring : Registry::instance().rings()) {
+        std::vector<Event> events;
+        ring->collect(events);
+        std::string name = ring->name().empty() ? "thread " + std::to_string(ring->tid()) : ring->name();
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", pid, ring->tid(), name.c_str());
+        first = false;
+        for (const Event& event : events) {
+            double ts = static_cast<double>(event.start_ns) / 1000.0;
+            double dur = static_cast<double>(event.duration_ns) / 1000.0;
+            if (event.connection < 0) {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, pid, ring->tid(), ts, dur);
+            } else {
+                // 接続ごとの行（id は接続）に、開始と終了の組として書く
+                fprintf(file,
+                        ",\n{\"name\":\"%s\",\"cat\":\"connection\",\"ph\":\"b\",\"id\":%lld,\"pid\":%ld,"
+                        "\"tid\":%u,\"ts\":%.3f,\"args\":{\"connection\":%lld}}"
+                        ",\n{\"name\":\"%s\",\"cat\":\"connection\",\"ph\":\"e\",\"id\":%lld,\"pid\":%ld,"
+                        "\"tid\":%u,\"ts\":%.3f}",
+                        event.name, static_cast<long long>(event.connection), pid, ring->tid(), ts,
+                        static_cast<long long>(event.connection), event.name,
+                        static_cast<long long>(event.connection), pid, ring->tid(), ts + dur);
+            }
+            count++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        error = "書き込みに失敗しました";
+        return -1;
+    }
+    return count;
+}
+
+} // namespace trace_spans
+
+#endif // TRACE_SPANS_H
@@ -0,0 +1,176 @@
+// TrafficCapture.h - 同期プロトコルの通信記録ファイルの形式（ヘッダーのみ）
+//
+// 目的:
+// 現場での調整作業で起きた問題を後から再現できるよう、ConfigSynchronizerが送受信した
+// バイト列を時刻付きで記録し（CAPTURE_FILE）、再生ツール（SyncReplay）で手元の
+// ConfigSynchronizerに同じ順序・同じ間隔（または最速）で送り直す。
+//
+// 仕組み:
+// - 記録はフレーム単位ではなく、接続ごとの受信・送信の1回ずつ（recv/send の単位）で残す。
+//   ヘッダーと本体が別々に届いた・少しずつ届いたといった送り方もそのまま再現できる。
+// - ファイルは先頭のヘッダー（24バイト）と、レコードの並び。数値はすべてリトルエンディアン。
+//     ヘッダー: "CSYNCCAP"(8) | 形式のバージョン u32 | 予約 u32 | 記録開始のUNIX時刻(ns) u64
+//     レコード: 記録開始からの時間(ns) u64 | 接続番号 u32 | 種類 u8 | 長さ u32 | データ
+// - 接続の開始（ACCEPTED / CONNECTED）のデータは相手のアドレス、CLOSED はデータなし。
+//
+// 使い方（読み出し側）:
+//   traffic_capture::Reader reader;
+//   if (reader.open("capture.bin")) {
+//       traffic_capture::Record record;
+//       while (reader.next(record)) {
+//           // record.time_ns, record.connection, record.type, record.data
+//       }
+//   }
+
+#ifndef TRAFFIC_CAPTURE_H
+#define TRAFFIC_CAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace traffic_capture {
+
+const char MAGIC[8] = {'C', 'S', 'Y', 'N', 'C', 'C', 'A', 'P'};
+const uint32_t FORMAT_VERSION = 1;
+const size_t FILE_HEADER_SIZE = 24;
+const size_t RECORD_HEADER_SIZE = 17;
+
+// レコードの種類
+enum RecordType : uint8_t {
+    ACCEPTED = 1,  // WPFなどからの接続を受け付けた（データは相手のアドレス）
+    CONNECTED = 2, // こちらから接続した（WPFへの送信・複製元への接続。データは相手のアドレス）
+    RECEIVED = 3,  // 受信したバイト列
+    SENT = 4,      // 送信したバイト列
+    CLOSED = 5,    // こちらが接続を閉じた
+};
+
+struct Record {
+    uint64_t time_ns = 0;
+    uint32_t connection = 0;
+    RecordType type = CLOSED;
+    std::string data;
+};
+
+inline const char* type_name(RecordType type) {
+    switch (type) {
+        case ACCEPTED:
+            return "accepted";
+        case CONNECTED:
+            return "connected";
+        case RECEIVED:
+            return "received";
+        case SENT:
+            return "sent";
+        case CLOSED:
+            return "closed";
+    }
+    return "unknown";
+}
+
+inline void put_le(std::string& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+inline uint64_t get_le(const unsigned char* data, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief ファイルの先頭に書くヘッダー
+ */
+inline std::string file_header(uint64_t start_unix_ns) {
+    std::string header(MAGIC, sizeof(MAGIC));
+    put_le(header, FORMAT_VERSION, 4);
+    put_le(header, 0, 4);
+    put_le(header, start_unix_ns, 8);
+    return header;
+}
+
+/**
+ * @brief レコード1件を out に追加する
+ */
+inline void append_record(std::string& out, uint64_t time_ns, uint32_t connection, RecordType type,
+                          const char* data, size_t length) {
+    put_le(out, time_ns, 8);
+    put_le(out, connection, 4);
+    out += static_cast<char>(type);
+    put_le(out, length, 4);
+    out.append(data, length);
+}
+
+/**
+ * @brief 記録ファイルを先頭から順に読む
+ */
+class Reader {
+public:
+    Reader() : file_(nullptr), start_unix_ns_(0), truncated_(false) {}
+    ~Reader() {
+        if (file_ != nullptr) {
+            fclose(file_);
+        }
+    }
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /**
+     * @return 記録ファイルとして開けた場合true
+     */
+    bool open(const std::string& path) {
+        file_ = fopen(path.c_str(), "rb");
+        if (file_ == nullptr) {
+            return false;
+        }
+        unsigned char header[FILE_HEADER_SIZE];
+        if (fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+            memcmp(header, MAGIC, sizeof(MAGIC)) != 0 || get_le(header + 8, 4) != FORMAT_VERSION) {
+            fclose(file_);
+            file_ = nullptr;
+            return false;
+        }
+        start_unix_ns_ = get_le(header + 16, 8);
+        return true;
+    }
+
+    /**
+     * @brief 次のレコードを読む
+     * @return 読めた場合true（終わり、または途中で切れていればfalse。後者は truncated() がtrue）
+     */
+    bool next(Record& record) {
+        unsigned char header[RECORD_HEADER_SIZE];
+        size_t got = fread(header, 1, sizeof(header), file_);
+        if (got != sizeof(header)) {
+            truncated_ = got != 0;
+            return false;
+        }
+        record.time_ns = get_le(header, 8);
+        record.connection = static_cast<uint32_t>(get_le(header + 8, 4));
+        record.type = static_cast<RecordType>(header[12]);
+        size_t length = static_cast<size_t>(get_le(header + 13, 4));
+        record.data.resize(length);
+        if (length > 0 && fread(&record.data[0], 1, length, file_) != length) {
+            truncated_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t start_unix_ns() const { return start_unix_ns_; }
+    bool truncated() const { return truncated_; }
+
+private:
+    FILE* file_;
+    uint64_t start_unix_ns_;
+    bool truncated_;
+};
+
+} // namespace traffic_capture
+
+#endif // TRAFFIC_CAPTURE_H
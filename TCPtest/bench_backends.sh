@@ -0,0 +1,38 @@
+#!/bin/bash
+# bench_backends.sh - 受信バックエンド（epoll / io_uring）ごとのレイテンシとシステムコール数を比較する
+#
+# 使い方: ./bench_backends.sh [リクエスト数] [並列数]
+# ConfigSynchronizer と SyncBench をビルドした状態で実行すること（make all bench）
+
+set -e
+
+REQUESTS=${1:-2000}
+CONCURRENCY=${2:-4}
+PORT=${BENCH_PORT:-22348}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+for backend in epoll io_uring; do
+    # ベンチ用の設定ファイル（WPFへの送信先は存在しないアドレスのまま）
+    sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "/^EVENT_BACKEND=/d" config.ini > "$WORK_DIR/config.ini"
+    echo "EVENT_BACKEND=$backend" >> "$WORK_DIR/config.ini"
+
+    mkfifo "$WORK_DIR/stdin"
+    ./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+    server_pid=$!
+    exec 3> "$WORK_DIR/stdin"
+    sleep 2
+
+    echo "=== $backend ==="
+    ./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" "$CONCURRENCY" get
+    ./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" "$CONCURRENCY" update 256
+
+    echo "t" >&3
+    sleep 1
+    echo "q" >&3
+    exec 3>&-
+    wait "$server_pid" || true
+    grep "受信バックエンド" "$WORK_DIR/server.log" | tail -1
+    rm -f "$WORK_DIR/stdin"
+    echo
+done
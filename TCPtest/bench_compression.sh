@@ -0,0 +1,69 @@
+#!/bin/bash
+# bench_compression.sh - 圧縮方式（なし / lz4 / zstd）ごとの圧縮率・CPU時間・同期時間を比較する
+#
+# 使い方: ./bench_compression.sh [リクエスト数] [更新サイズ(バイト)]
+# 圧縮付きでビルドした状態で実行すること（make WITH_ZSTD=1 WITH_LZ4=1 all bench）
+# root権限があり tc の netem が使える場合は、ループバックの帯域を 1 / 10 / 100 Mbps に
+# 絞って実測する。使えない場合は SyncBench が表示する見積もり（送信時間＋圧縮・展開時間）だけを使う。
+
+set -e
+
+REQUESTS=${1:-200}
+UPDATE_SIZE=${2:-16384}
+PORT=${BENCH_PORT:-22349}
+WORK_DIR=$(mktemp -d)
+NETEM=0
+cleanup() {
+    if [ "$NETEM" = 1 ]; then
+        tc qdisc del dev lo root 2>/dev/null || true
+    fi
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+# ベンチ用の設定ファイル（返信は小さくても圧縮する。WPFへの送信先は存在しないアドレスのまま）
+sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s/^COMPRESS_MIN_BYTES=.*/COMPRESS_MIN_BYTES=0/" \
+    config.ini > "$WORK_DIR/config.ini"
+
+mkfifo "$WORK_DIR/stdin"
+./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+server_pid=$!
+exec 3> "$WORK_DIR/stdin"
+sleep 2
+
+CODECS="none lz4 zstd"
+run_all() {
+    for codec in $CODECS; do
+        option=$codec
+        [ "$codec" = none ] && option=""
+        echo "--- $codec: 設定要求 ---"
+        ./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 1 get 0 $option
+        echo "--- $codec: 設定更新 ${UPDATE_SIZE}B ---"
+        ./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 1 update "$UPDATE_SIZE" $option
+    done
+}
+
+echo "=== 制限なし（ループバック） ==="
+run_all
+
+if tc qdisc replace dev lo root netem rate 100mbit 2>/dev/null; then
+    NETEM=1
+    for rate in 100mbit 10mbit 1mbit; do
+        tc qdisc replace dev lo root netem rate "$rate"
+        echo
+        echo "=== netem rate $rate ==="
+        REQUESTS=$((REQUESTS / 10 > 0 ? REQUESTS / 10 : 1)) run_all
+    done
+    tc qdisc del dev lo root
+    NETEM=0
+else
+    echo
+    echo "情報: tc netem が使えないため、回線速度ごとの同期時間は上の見積もりを参照してください。"
+fi
+
+echo "t" >&3
+sleep 1
+echo "q" >&3
+exec 3>&-
+wait "$server_pid" || true
+grep -E "^圧縮" "$WORK_DIR/server.log" | tail -1
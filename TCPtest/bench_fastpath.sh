@@ -0,0 +1,50 @@
+#!/bin/bash
+# bench_fastpath.sh - UDP高速経路とTCPの更新が、複数の受け手に届くまでの時間を比べる
+#
+# 使い方: ./bench_fastpath.sh [回数] [受け手の数] [損失率(%)]
+# ConfigSynchronizer と FastPathBench をビルドした状態で実行すること（make all fastpath-bench）
+# 試験用のインスタンスを FAST_PATH_KEYS=THRUSTER_CONTROL:* で起動し、状態をループバックの
+# マルチキャスト（FAST_PATH_PUBLISH）で配る。FastPathBench が KP_YAW を UDP / TCP で変え、
+# 受け手全員に届くまでの時間を、損失なしと指定の損失率で測る。
+# 最後に ConfigSynchronizer 側で数えた UDP高速経路の集計を表示する。
+
+set -e
+
+COUNT=${1:-500}
+LISTENERS=${2:-3}
+LOSS=${3:-20}
+PORT=${BENCH_PORT:-22369}
+FAST_PORT=$((PORT + 1))
+STATE_PORT=$((PORT + 2))
+GROUP=${BENCH_GROUP:-239.255.43.21}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s/^SHM_NAME=.*/SHM_NAME=/" \
+    -e "s/^FAST_PATH_KEYS=.*/FAST_PATH_KEYS=THRUSTER_CONTROL:*/" \
+    -e "s/^FAST_PATH_PORT=.*/FAST_PATH_PORT=$FAST_PORT/" \
+    -e "s/^FAST_PATH_PUBLISH=.*/FAST_PATH_PUBLISH=$GROUP:$STATE_PORT/" \
+    -e "s/^FAST_PATH_INTERFACE=.*/FAST_PATH_INTERFACE=127.0.0.1/" \
+    -e "s/^FAST_PATH_BEACON_MS=.*/FAST_PATH_BEACON_MS=100/" config.ini > "$WORK_DIR/config.ini"
+
+mkfifo "$WORK_DIR/stdin"
+./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+server_pid=$!
+exec 3> "$WORK_DIR/stdin"
+sleep 2
+
+status=0
+echo "=== 損失なし ==="
+./FastPathBench 127.0.0.1 "$PORT" "$FAST_PORT" "$GROUP:$STATE_PORT" "$COUNT" "$LISTENERS" 0 127.0.0.1 || status=$?
+echo
+echo "=== 損失 ${LOSS}% ==="
+./FastPathBench 127.0.0.1 "$PORT" "$FAST_PORT" "$GROUP:$STATE_PORT" "$COUNT" "$LISTENERS" "$LOSS" 127.0.0.1 || status=$?
+
+echo "t" >&3
+sleep 1
+echo "q" >&3
+exec 3>&-
+wait "$server_pid" || true
+echo
+grep "^UDP高速経路" "$WORK_DIR/server.log" | tail -2
+exit $status
@@ -0,0 +1,38 @@
+#!/bin/bash
+# bench_faults.sh - 回線の障害の種類ごとに、設定が一致するまでの時間と復旧時間を測る
+#
+# 使い方: ./bench_faults.sh [回数] [クライアントのタイムアウト(ms)]
+# ConfigSynchronizer と SyncFaultProxy をビルドした状態で実行すること（make all fault-proxy）
+# 試験用のインスタンスを起動し、SyncFaultProxy suite が障害（遅延・帯域・バイト単位の分割・
+# 部分書き込み・停止・切断）ごとにプロキシを挟んで [FAULT_SUITE] への更新を送り、
+# 一致までの時間・復旧時間・再送の回数を表にする。
+# 最後に ConfigSynchronizer 側で数えた、制限による切断と重複（再送）の件数を表示する。
+
+set -e
+
+ROUNDS=${1:-5}
+CLIENT_TIMEOUT_MS=${2:-3000}
+PORT=${BENCH_PORT:-22359}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s/^SHM_NAME=.*/SHM_NAME=/" config.ini > "$WORK_DIR/config.ini"
+
+mkfifo "$WORK_DIR/stdin"
+./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+server_pid=$!
+exec 3> "$WORK_DIR/stdin"
+sleep 2
+
+status=0
+./SyncFaultProxy suite 127.0.0.1 "$PORT" "$ROUNDS" "$CLIENT_TIMEOUT_MS" || status=$?
+
+echo "t" >&3
+sleep 1
+echo "q" >&3
+exec 3>&-
+wait "$server_pid" || true
+echo
+grep "^制限による切断: " "$WORK_DIR/server.log" | tail -1
+grep "^フレーム整合性" "$WORK_DIR/server.log" | tail -1
+exit $status
@@ -0,0 +1,45 @@
+#!/bin/bash
+# bench_pipeline.sh - 1接続1要求とパイプライン接続（id 付きの要求をまとめて送る）のスループットを比較する
+#
+# 使い方: ./bench_pipeline.sh [リクエスト数] [更新サイズ(バイト)]
+# ConfigSynchronizer と SyncBench をビルドした状態で実行すること（make all bench）
+# 設定要求と設定更新について、1接続1要求 / パイプライン（まとめて送る数 1・8・32）を
+# 並列数 1 と 4 で測り、p50・p99・req/s を表にする。
+# ワーカーキュー（WORKER_QUEUE_DEPTH）を超えて同時に送った要求は status=busy で拒否され、「失敗」に数える。
+
+set -e
+
+REQUESTS=${1:-5000}
+UPDATE_SIZE=${2:-256}
+PORT=${BENCH_PORT:-22352}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# ベンチ用の設定ファイル（WPFへの送信先は存在しないアドレスのまま）
+sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" config.ini > "$WORK_DIR/config.ini"
+
+mkfifo "$WORK_DIR/stdin"
+./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+server_pid=$!
+exec 3> "$WORK_DIR/stdin"
+sleep 2
+
+printf "%-8s %-14s %-6s %-10s %-10s %-10s %s\n" "モード" "接続" "並列" "p50(us)" "p99(us)" "req/s" "失敗"
+for mode in get update; do
+    for concurrency in 1 4; do
+        for variant in "1接続1要求:" "pipeline=1:pipeline=1" "pipeline=8:pipeline=8" "pipeline=32:pipeline=32"; do
+            label=${variant%%:*}
+            options=${variant#*:}
+            result=$(./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" "$concurrency" "$mode" "$UPDATE_SIZE" $options || true)
+            p50=$(echo "$result" | sed -n 's/.*p50 \([0-9.]*\).*/\1/p')
+            p99=$(echo "$result" | sed -n 's/.*p99 \([0-9.]*\).*/\1/p')
+            rate=$(echo "$result" | sed -n 's/^スループット: \([0-9.]*\).*/\1/p')
+            failed=$(echo "$result" | sed -n 's/.*(失敗 \([0-9]*\)).*/\1/p')
+            printf "%-8s %-14s %-6s %-10s %-10s %-10s %s\n" "$mode" "$label" "$concurrency" "$p50" "$p99" "$rate" "$failed"
+        done
+    done
+done
+
+echo "q" >&3
+exec 3>&-
+wait "$server_pid" || true
@@ -0,0 +1,38 @@
+#!/bin/bash
+# bench_presets.sh - プリセットの切り替え（op=preset）が共有メモリで見えるまでの時間を測る
+#
+# 使い方: ./bench_presets.sh [切り替え回数] [プリセットA] [プリセットB]
+# ConfigSynchronizer と ShmBench をビルドした状態で実行すること（make all shm-bench）
+# presets.conf の2つのプリセット（既定は current と calm_water）を交互に切り替え、
+# 切り替えを送ってから別プロセスの共有メモリで見えるまでの時間と、1回の切り替えで
+# 設定バージョンが1つだけ進むこと（途中の状態が見えないこと）を確かめる。
+# 比較のため、1項目の更新が見えるまでの時間も同じ回数だけ測る。
+
+set -e
+
+SWITCHES=${1:-1000}
+PRESET_A=${2:-current}
+PRESET_B=${3:-calm_water}
+PORT=${BENCH_PORT:-22358}
+SHM=/config_sync_bench_presets
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s|^SHM_NAME=.*|SHM_NAME=$SHM|" \
+    -e "s|^PRESETS_FILE=.*|PRESETS_FILE=$PWD/presets.conf|" config.ini > "$WORK_DIR/config.ini"
+
+mkfifo "$WORK_DIR/stdin"
+./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+server_pid=$!
+exec 3> "$WORK_DIR/stdin"
+sleep 2
+
+# 1項目の更新（比較用）とプリセットの切り替えを、それぞれ同じ回数ずつ測る
+./ShmBench 127.0.0.1 "$PORT" 1000 "$SWITCHES" "$SHM" "$PRESET_A" "$PRESET_B" | grep -E "TCP更新|プリセット|バージョン"
+
+echo "t" >&3
+sleep 1
+echo "q" >&3
+exec 3>&-
+wait "$server_pid" || true
+grep "^プリセット: .* 個" "$WORK_DIR/server.log" | tail -1
@@ -0,0 +1,48 @@
+#!/bin/bash
+# bench_queries.sh - 設定全体の要求と条件付きの読み出し（section / key / match / since）を比較する
+#
+# 使い方: ./bench_queries.sh [リクエスト数] [追加する設定の大きさ(バイト)]
+# ConfigSynchronizer と SyncBench をビルドした状態で実行すること（make all bench）
+# 設定の大きさの影響を見るため、最初に [BENCH] セクションの項目を指定した大きさぶん追加してから、
+# それぞれの読み出し方の p50・p99・req/s と1回あたりの返信の大きさを表にする（並列数1）。
+
+set -e
+
+REQUESTS=${1:-3000}
+EXTRA_SIZE=${2:-200000}
+PORT=${BENCH_PORT:-22353}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# ベンチ用の設定ファイル（WPFへの送信先は存在しないアドレスのまま）
+sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" config.ini > "$WORK_DIR/config.ini"
+
+mkfifo "$WORK_DIR/stdin"
+./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+server_pid=$!
+exec 3> "$WORK_DIR/stdin"
+sleep 2
+
+# 設定を大きくする（この更新の後の版を since= の基準にする）
+./SyncBench 127.0.0.1 "$PORT" 1 1 update "$EXTRA_SIZE" > /dev/null
+exec 4<> "/dev/tcp/127.0.0.1/$PORT"
+printf '0 since=0 section=NONE\n' >&4
+read -r header <&4
+exec 4>&-
+version=$(echo "$header" | sed -n 's/.*version=\([0-9]*\).*/\1/p')
+
+printf "%-34s %-10s %-10s %-10s %s\n" "読み出し" "p50(us)" "p99(us)" "req/s" "返信(バイト/回)"
+for options in "" "section=NETWORK" "section=NETWORK,key=RECV_PORT" "match=GSTREAMER_CAMERA_*:PORT" \
+               "match=*:*_PORT" "since=$version"; do
+    result=$(./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 1 get 0 $options || true)
+    p50=$(echo "$result" | sed -n 's/.*p50 \([0-9.]*\).*/\1/p')
+    p99=$(echo "$result" | sed -n 's/.*p99 \([0-9.]*\).*/\1/p')
+    rate=$(echo "$result" | sed -n 's/^スループット: \([0-9.]*\).*/\1/p')
+    count=$(echo "$result" | sed -n 's/.*リクエスト \([0-9]*\) 件.*/\1/p')
+    bytes=$(echo "$result" | sed -n 's/^本体: \([0-9]*\) バイト.*/\1/p')
+    printf "%-34s %-10s %-10s %-10s %s\n" "${options:-（全体）}" "$p50" "$p99" "$rate" "$(( ${bytes:-0} / ${count:-1} ))"
+done
+
+echo "q" >&3
+exec 3>&-
+wait "$server_pid" || true
@@ -0,0 +1,57 @@
+#!/bin/bash
+# bench_replay.sh - 通信を記録（CAPTURE_FILE）し、新しく起動した ConfigSynchronizer で再生したときのスループットを測る
+#
+# 使い方: ./bench_replay.sh [リクエスト数] [更新サイズ(バイト)]
+# ConfigSynchronizer・SyncBench・SyncReplay をビルドした状態で実行すること（make all bench replay）
+# 記録用のインスタンスに SyncBench で 設定要求 / 設定更新 / パイプライン接続の更新 を送って記録し、
+# 同じ設定で起動し直したインスタンスに SyncReplay で 記録と同じ間隔（速度 1）/ 最速（fast）で再生して、
+# 経過時間・接続/s・レイテンシ・返信が記録と一致した接続の数を表にする。
+# 再生するインスタンスも同じ設定（CAPTURE_FILE を含む）で起動するので、返信の設定全体は記録と一致する。
+
+set -e
+
+REQUESTS=${1:-2000}
+UPDATE_SIZE=${2:-256}
+PORT=${BENCH_PORT:-22356}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# インスタンスごとの作業ディレクトリ（記録ファイルは作業ディレクトリの capture.bin）
+start_instance() {
+    local name=$1
+    mkdir -p "$WORK_DIR/$name"
+    sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s/^CAPTURE_FILE=.*/CAPTURE_FILE=capture.bin/" \
+        config.ini > "$WORK_DIR/$name/config.ini"
+    mkfifo "$WORK_DIR/$name/stdin"
+    (cd "$WORK_DIR/$name" && exec "$OLDPWD/ConfigSynchronizer" config.ini < stdin > server.log 2>&1) &
+    server_pid=$!
+    exec 3> "$WORK_DIR/$name/stdin"
+    sleep 1
+}
+
+stop_instance() {
+    echo "q" >&3
+    exec 3>&-
+    wait "$server_pid" || true
+}
+
+start_instance capture
+./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 4 get > /dev/null
+./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 4 update "$UPDATE_SIZE" > /dev/null
+./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 2 update "$UPDATE_SIZE" pipeline=8 > /dev/null
+stop_instance
+echo "記録: $(stat -c %s "$WORK_DIR/capture/capture.bin") バイト"
+
+printf "%-8s %-10s %-12s %-10s %-10s %-10s %s\n" "速度" "経過(s)" "接続/s" "KB/s" "p50(us)" "p99(us)" "一致"
+for speed in 1 fast; do
+    start_instance "replay-$speed"
+    result=$(./SyncReplay "$WORK_DIR/capture/capture.bin" 127.0.0.1 "$PORT" "$speed" || true)
+    stop_instance
+    elapsed=$(echo "$result" | sed -n 's/.*経過 \([0-9.]*\) 秒.*/\1/p')
+    rate=$(echo "$result" | sed -n 's/^スループット: \([0-9.]*\) 接続\/s.*/\1/p')
+    kbps=$(echo "$result" | sed -n 's/^スループット: .* \/ \([0-9.]*\) KB\/s.*/\1/p')
+    p50=$(echo "$result" | sed -n 's/.*p50 \([0-9.]*\).*/\1/p')
+    p99=$(echo "$result" | sed -n 's/.*p99 \([0-9.]*\).*/\1/p')
+    matched=$(echo "$result" | sed -n 's/^返信が記録と一致: \(.*\) 本/\1/p')
+    printf "%-8s %-10s %-12s %-10s %-10s %-10s %s\n" "$speed" "$elapsed" "$rate" "$kbps" "$p50" "$p99" "$matched"
+done
@@ -0,0 +1,95 @@
+#!/bin/bash
+# bench_replication.sh - 複製元1つ・複製先2つ（REPLICATE_FROM）を起動し、複製の遅れとスループットを測る
+#
+# 使い方: ./bench_replication.sh [更新数] [プローブ数] [更新サイズ(バイト)]
+# ConfigSynchronizer と SyncBench をビルドした状態で実行すること（make all bench）
+# 複製元に書き込んでから複製先で同じ値が読めるまでの時間（SyncBench probe）を、
+# 更新なし / 複製元へパイプライン接続で更新を送り続けている間 のそれぞれで測って表にする。
+# 最後に複製元・複製先の設定全体（CONFIG_SYNC を除く）が一致しているかを確かめる。
+
+set -e
+
+UPDATES=${1:-20000}
+PROBES=${2:-300}
+UPDATE_SIZE=${3:-256}
+PORT=${BENCH_PORT:-22354}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# インスタンスごとの作業ディレクトリ（複製元は PORT、複製先は PORT+1, PORT+2 で待ち受ける）
+start_instance() {
+    local name=$1 port=$2 leader=$3
+    mkdir -p "$WORK_DIR/$name"
+    sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$port/" -e "s/^REPLICATE_FROM=.*/REPLICATE_FROM=$leader/" \
+        config.ini > "$WORK_DIR/$name/config.ini"
+    if [ -n "$leader" ]; then
+        # 共有メモリは複製元だけが公開する
+        sed -i -e "s/^SHM_NAME=.*/SHM_NAME=/" "$WORK_DIR/$name/config.ini"
+    fi
+    mkfifo "$WORK_DIR/$name/stdin"
+    ./ConfigSynchronizer "$WORK_DIR/$name/config.ini" < "$WORK_DIR/$name/stdin" > "$WORK_DIR/$name/server.log" 2>&1 &
+    pids+=($!)
+}
+
+# 設定全体を取得する（CONFIG_SYNC はインスタンスごとなので比べない）
+fetch_config() {
+    exec 4<> "/dev/tcp/127.0.0.1/$1"
+    printf '0\n' >&4
+    read -r header <&4
+    head -c "$header" <&4 | grep -v '^\[CONFIG_SYNC\]'
+    exec 4>&-
+}
+
+pids=()
+start_instance leader "$PORT" ""
+exec 3> "$WORK_DIR/leader/stdin"
+sleep 1
+start_instance follower1 $((PORT + 1)) "127.0.0.1:$PORT"
+exec 5> "$WORK_DIR/follower1/stdin"
+start_instance follower2 $((PORT + 2)) "127.0.0.1:$PORT"
+exec 6> "$WORK_DIR/follower2/stdin"
+sleep 2
+
+printf "%-28s %-12s %-12s %-12s %s\n" "負荷" "遅れp50(us)" "遅れp99(us)" "遅れ最大(us)" "更新(req/s)"
+for load in idle sustained; do
+    load_pid=""
+    if [ "$load" = sustained ]; then
+        ./SyncBench 127.0.0.1 "$PORT" "$UPDATES" 2 update "$UPDATE_SIZE" pipeline=8 > "$WORK_DIR/load.txt" 2>&1 &
+        load_pid=$!
+        sleep 0.5
+    fi
+    result=$(./SyncBench 127.0.0.1 "$PORT" "$PROBES" 1 probe 0 "follower=127.0.0.1:$((PORT + 1))" || true)
+    rate="-"
+    if [ -n "$load_pid" ]; then
+        wait "$load_pid" || true
+        rate=$(sed -n 's/^スループット: \([0-9.]*\).*/\1/p' "$WORK_DIR/load.txt")
+    fi
+    p50=$(echo "$result" | sed -n 's/.*p50 \([0-9.]*\).*/\1/p')
+    p99=$(echo "$result" | sed -n 's/.*p99 \([0-9.]*\).*/\1/p')
+    max=$(echo "$result" | sed -n 's/.*最大 \([0-9.]*\).*/\1/p')
+    label="$load"
+    [ "$load" = sustained ] && label="sustained（${UPDATES}件 x ${UPDATE_SIZE}B）"
+    printf "%-28s %-12s %-12s %-12s %s\n" "$label" "$p50" "$p99" "$max" "$rate"
+done
+
+# 複製が追いついたら、3つの設定全体が一致するはず
+sleep 1
+leader_config=$(fetch_config "$PORT")
+for i in 1 2; do
+    if [ "$leader_config" = "$(fetch_config $((PORT + i)))" ]; then
+        echo "複製先 $i: 複製元と一致"
+    else
+        echo "複製先 $i: 複製元と一致しません"
+    fi
+done
+
+# 複製元から見た各複製先の遅れ
+echo "t" >&3
+sleep 0.5
+grep '^複製先 ' "$WORK_DIR/leader/server.log" | tail -2
+
+for fd in 3 5 6; do
+    echo "q" >&$fd
+    eval "exec $fd>&-"
+done
+wait "${pids[@]}" || true
@@ -0,0 +1,76 @@
+#!/bin/bash
+# bench_rt.sh - リアルタイム動作（RT_MODE）の有無で、更新が共有メモリで見えるまでの遅れのばらつきを比べる
+#
+# 使い方: ./bench_rt.sh [更新数] [受信スレッドのCPU]
+# ConfigSynchronizer と ShmBench をビルドした状態で実行すること（make all shm-bench）
+# SCHED_FIFO とメモリ固定の権限が必要（root で実行するか、RLIMIT_RTPRIO / RLIMIT_MEMLOCK を上げておく）。
+# 通常動作 / リアルタイム動作 のそれぞれを、負荷なし / CPUとメモリに負荷をかけた状態 で測る。
+# 負荷には stress-ng があればそれを使い、なければCPU数分のビジーループと sort によるメモリの確保・解放を使う。
+
+set -e
+
+UPDATES=${1:-2000}
+RT_CPU=${2:-$(($(nproc) - 1))}
+PORT=${BENCH_PORT:-22356}
+SHM=/config_sync_bench_rt
+WORK_DIR=$(mktemp -d)
+stress_pids=()
+trap 'stop_stress; rm -rf "$WORK_DIR"' EXIT
+
+start_stress() {
+    if command -v stress-ng > /dev/null; then
+        stress-ng --cpu "$(nproc)" --vm 2 --vm-bytes 25% --page-in --quiet > /dev/null 2>&1 &
+        stress_pids+=($!)
+        return
+    fi
+    for _ in $(seq "$(nproc)"); do
+        (while :; do :; done) &
+        stress_pids+=($!)
+    done
+    for _ in 1 2; do
+        (while :; do head -c 64M /dev/urandom | sort > /dev/null; done) > /dev/null 2>&1 &
+        stress_pids+=($!)
+    done
+}
+
+stop_stress() {
+    if [ ${#stress_pids[@]} -gt 0 ]; then
+        kill "${stress_pids[@]}" 2> /dev/null || true
+        wait "${stress_pids[@]}" 2> /dev/null || true
+        stress_pids=()
+    fi
+}
+
+printf "%-22s %-16s %s\n" "動作" "負荷" "TCP更新→共有メモリで観測(us)"
+for rt in 0 1; do
+    for stress in 0 1; do
+        sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s|^SHM_NAME=.*|SHM_NAME=$SHM|" \
+            -e "s/^RT_MODE=.*/RT_MODE=$rt/" -e "s/^RT_CPU=.*/RT_CPU=$RT_CPU/" -e "s/^TRACE_RING_EVENTS=.*/TRACE_RING_EVENTS=0/" \
+            -e "/^MAX_CONNECTIONS_PER_IP=/d" config.ini > "$WORK_DIR/config.ini"
+        echo "MAX_CONNECTIONS_PER_IP=0" >> "$WORK_DIR/config.ini"
+        rm -f "$WORK_DIR"/config.ini.journal "$WORK_DIR"/config.ini.snapshot
+
+        mkfifo "$WORK_DIR/stdin"
+        ./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+        server_pid=$!
+        exec 3> "$WORK_DIR/stdin"
+        sleep 2
+        if [ "$stress" = 1 ]; then
+            start_stress
+            sleep 1
+        fi
+
+        result=$(./ShmBench 127.0.0.1 "$PORT" 1000 "$UPDATES" "$SHM" | grep "TCP更新→共有メモリで観測" | sed 's/^[^:]*: //')
+        stop_stress
+        printf "%-22s %-16s %s\n" "$([ "$rt" = 1 ] && echo "リアルタイム(CPU $RT_CPU)" || echo "通常")" \
+            "$([ "$stress" = 1 ] && echo "CPU+メモリ" || echo "なし")" "$result"
+
+        echo "t" >&3
+        sleep 1
+        echo "q" >&3
+        exec 3>&-
+        wait "$server_pid" || true
+        grep -E "^(警告: .*(SCHED_FIFO|固定)|リアルタイム動作: メモリ固定 .* / SCHED_FIFO)" "$WORK_DIR/server.log" | tail -1 || true
+        rm -f "$WORK_DIR/stdin"
+    done
+done
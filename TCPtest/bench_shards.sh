@@ -0,0 +1,59 @@
+#!/bin/bash
+# bench_shards.sh - 受信シャード数（RECV_SHARDS）ごとのスループットを比較する
+#
+# 使い方: ./bench_shards.sh [リクエスト数] [並列数] [シャード数...]
+# ConfigSynchronizer と SyncBench をビルドした状態で実行すること（make all bench）
+# シャード数を省略した場合は 1 2 4 … CPU数 で測定する。
+
+set -e
+
+REQUESTS=${1:-20000}
+CONCURRENCY=${2:-16}
+shift 2 2>/dev/null || shift $#
+PORT=${BENCH_PORT:-22350}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+SHARDS="$*"
+if [ -z "$SHARDS" ]; then
+    cpus=$(nproc)
+    n=1
+    while [ "$n" -lt "$cpus" ]; do
+        SHARDS="$SHARDS $n"
+        n=$((n * 2))
+    done
+    SHARDS="$SHARDS $cpus"
+fi
+
+printf "%-8s %-14s %-14s %s\n" "シャード" "get req/s" "update req/s" "p99(us) get/update"
+for shards in $SHARDS; do
+    # ベンチ用の設定ファイル（WPFへの送信先は存在しないアドレスのまま。ワーカーも同じ数にする）
+    sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "/^RECV_SHARDS=/d" -e "/^SHARD_CPU_AFFINITY=/d" \
+        -e "/^MAX_CONNECTIONS_PER_IP=/d" config.ini > "$WORK_DIR/config.ini"
+    {
+        echo "RECV_SHARDS=$shards"
+        echo "SHARD_CPU_AFFINITY=1"
+        echo "MAX_CONNECTIONS_PER_IP=0"
+    } >> "$WORK_DIR/config.ini"
+    rm -f "$WORK_DIR"/config.ini.journal "$WORK_DIR"/config.ini.snapshot
+
+    mkfifo "$WORK_DIR/stdin"
+    ./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+    server_pid=$!
+    exec 3> "$WORK_DIR/stdin"
+    sleep 2
+
+    get=$(./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" "$CONCURRENCY" get)
+    update=$(./SyncBench 127.0.0.1 "$PORT" "$((REQUESTS / 4))" "$CONCURRENCY" update 256)
+    rate() { echo "$1" | sed -n 's/^スループット: \([0-9.]*\).*/\1/p'; }
+    p99() { echo "$1" | sed -n 's/.*p99 \([0-9.]*\).*/\1/p'; }
+    printf "%-8s %-14s %-14s %s / %s\n" "$shards" "$(rate "$get")" "$(rate "$update")" "$(p99 "$get")" "$(p99 "$update")"
+
+    echo "t" >&3
+    sleep 1
+    echo "q" >&3
+    exec 3>&-
+    wait "$server_pid" || true
+    grep "シャード別リクエスト" "$WORK_DIR/server.log" | tail -1
+    rm -f "$WORK_DIR/stdin"
+done
@@ -0,0 +1,47 @@
+#!/bin/bash
+# bench_socket_profiles.sh - ソケット設定のプロファイル（SOCKET_PROFILE）ごとの要求/応答レイテンシを比較する
+#
+# 使い方: ./bench_socket_profiles.sh [リクエスト数] [更新サイズ(バイト)]
+# ConfigSynchronizer と SyncBench をビルドした状態で実行すること（make all bench）
+# 各プロファイルについて、設定要求と設定更新を
+#   一括送信 / ヘッダーと本体を分けて送信（split）/ 分けて送信＋クライアントもTCP_NODELAY
+# の組み合わせで測り、p50・p99 を表にする（並列数1）。
+
+set -e
+
+REQUESTS=${1:-2000}
+UPDATE_SIZE=${2:-256}
+PORT=${BENCH_PORT:-22351}
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+printf "%-12s %-8s %-16s %-10s %-10s %s\n" "プロファイル" "モード" "送り方" "p50(us)" "p99(us)" "req/s"
+for profile in default low_latency throughput; do
+    # ベンチ用の設定ファイル（WPFへの送信先は存在しないアドレスのまま）
+    sed -e "s/^CPP_RECV_PORT=.*/CPP_RECV_PORT=$PORT/" -e "s/^SOCKET_PROFILE=.*/SOCKET_PROFILE=$profile/" \
+        -e "/^TCP_/d" -e "/^SOCKET_SNDBUF=/d" -e "/^SOCKET_RCVBUF=/d" config.ini > "$WORK_DIR/config.ini"
+    rm -f "$WORK_DIR"/config.ini.journal "$WORK_DIR"/config.ini.snapshot
+
+    mkfifo "$WORK_DIR/stdin"
+    ./ConfigSynchronizer "$WORK_DIR/config.ini" < "$WORK_DIR/stdin" > "$WORK_DIR/server.log" 2>&1 &
+    server_pid=$!
+    exec 3> "$WORK_DIR/stdin"
+    sleep 2
+
+    for mode in get update; do
+        for variant in "一括:" "split:split" "split+nodelay:split,nodelay"; do
+            label=${variant%%:*}
+            options=${variant#*:}
+            result=$(./SyncBench 127.0.0.1 "$PORT" "$REQUESTS" 1 "$mode" "$UPDATE_SIZE" $options)
+            p50=$(echo "$result" | sed -n 's/.*p50 \([0-9.]*\).*/\1/p')
+            p99=$(echo "$result" | sed -n 's/.*p99 \([0-9.]*\).*/\1/p')
+            rate=$(echo "$result" | sed -n 's/^スループット: \([0-9.]*\).*/\1/p')
+            printf "%-12s %-8s %-16s %-10s %-10s %s\n" "$profile" "$mode" "$label" "$p50" "$p99" "$rate"
+        done
+    done
+
+    echo "q" >&3
+    exec 3>&-
+    wait "$server_pid" || true
+    rm -f "$WORK_DIR/stdin"
+done
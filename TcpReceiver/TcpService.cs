@@ -16,6 +16,14 @@ namespace TcpReceiver
         private readonly LoggingService loggingService;
         private TcpListener tcpListener;
         private CancellationTokenSource cancellationTokenSource;
+        private readonly string sessionId = Guid.NewGuid().ToString("N").Substring(0, 16);
+        private long sequenceNumber;
+
+        /// <summary>
+        /// trueなら送信する設定にCRC32Cトレーラーとシーケンス番号を付ける
+        /// （C++側で破損・重複・欠番を検出できるようにする）
+        /// </summary>
+        public bool UseFrameIntegrity { get; set; }
 
         /// <summary>
         /// 設定データを受信したときに発生するイベント
@@ -191,14 +199,38 @@ namespace TcpReceiver
                     using (var stream = client.GetStream())
                     {
                         byte[] configBytes = Encoding.UTF8.GetBytes(configString);
-                        string header = configBytes.Length.ToString() + "\n";
-                        byte[] headerBytes = Encoding.UTF8.GetBytes(header);
+                        string header = configBytes.Length.ToString();
+                        byte[] trailerBytes = Array.Empty<byte>();
+                        if (UseFrameIntegrity)
+                        {
+                            // ヘッダー "<長さ> crc sid=<セッション> seq=<番号>" と本体のCRC32Cトレーラー
+                            // （設定要求の0バイトフレームには付けない）
+                            if (configBytes.Length > 0)
+                            {
+                                long seq = Interlocked.Increment(ref sequenceNumber);
+                                header += $" crc sid={sessionId} seq={seq}";
+                                trailerBytes = Encoding.ASCII.GetBytes(Crc32C.Compute(configBytes).ToString("x8") + "\n");
+                            }
+                        }
+                        byte[] headerBytes = Encoding.UTF8.GetBytes(header + "\n");
 
                         await stream.WriteAsync(headerBytes, 0, headerBytes.Length);
                         await stream.WriteAsync(configBytes, 0, configBytes.Length);
+                        await stream.WriteAsync(trailerBytes, 0, trailerBytes.Length);
                         await stream.FlushAsync();
 
                         loggingService.AddEntry($"データ送信完了: ヘッダー({headerBytes.Length}B) + データ({configBytes.Length}B)");
+
+                        if (UseFrameIntegrity && configBytes.Length > 0)
+                        {
+                            // 破損（CRCERR）や重複（DUP）で拒否された場合はC++側が1行返してから切断する
+                            client.Client.Shutdown(SocketShutdown.Send);
+                            string reply = await ReadLineAsync(stream, CancellationToken.None);
+                            if (!string.IsNullOrEmpty(reply))
+                            {
+                                loggingService.AddEntry($"C++アプリが設定を拒否しました: {reply}");
+                            }
+                        }
                     }
                 }
             }
@@ -217,4 +249,37 @@ namespace TcpReceiver
             await SendConfigAsync(host, port, ""); // 0バイトのデータを送信
         }
     }
+
+    /// <summary>
+    /// CRC32C（Castagnoli）の計算（C++側の Crc32c.h と同じ値になる）
+    /// </summary>
+    internal static class Crc32C
+    {
+        private static readonly uint[] Table = CreateTable();
+
+        private static uint[] CreateTable()
+        {
+            var table = new uint[256];
+            for (uint i = 0; i < 256; i++)
+            {
+                uint value = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    value = (value & 1) != 0 ? (value >> 1) ^ 0x82F63B78u : value >> 1;
+                }
+                table[i] = value;
+            }
+            return table;
+        }
+
+        public static uint Compute(byte[] data)
+        {
+            uint crc = 0xFFFFFFFFu;
+            foreach (byte b in data)
+            {
+                crc = Table[(crc ^ b) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+    }
 }
\ No newline at end of file